@@ -309,13 +309,6 @@ void setPerspective()
 	);
 }
 
-void setGLMatrix(GLfloat* glm, Matrix4& m) {
-	glm[0] = m[0];  glm[4] = m[1];   glm[8] = m[2];    glm[12] = m[3];
-	glm[1] = m[4];  glm[5] = m[5];   glm[9] = m[6];    glm[13] = m[7];
-	glm[2] = m[8];  glm[6] = m[9];   glm[10] = m[10];   glm[14] = m[11];
-	glm[3] = m[12];  glm[7] = m[13];  glm[11] = m[14];   glm[15] = m[15];
-}
-
 
 // Vertex buffers
 GLuint VAO, VBO;
@@ -345,17 +338,14 @@ void ChangeSize(GLFWwindow* window, int width, int height)
 void drawPlane()
 {
 	Matrix4 MVP;
-	GLfloat mvp[16];
 	GLint currPolygonMode;
 
 	glGetIntegerv(GL_POLYGON_MODE, &currPolygonMode);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); // plane always GL_FILL
 
 	MVP = project_matrix * view_matrix;
-	// [TODO] row-major ---> column-major
-	setGLMatrix(mvp, MVP);
-
-	glUniformMatrix4fv(iLocMVP, 1, GL_FALSE, mvp);
+	// Matrix4 is row-major, GL_TRUE lets the driver transpose it on upload
+	glUniformMatrix4fv(iLocMVP, 1, GL_TRUE, MVP.get());
 
 	GLfloat vertices[18]{ 1.0, -0.9, -1.0,
 		1.0, -0.9,  1.0,
@@ -406,16 +396,12 @@ void RenderScene(void) {
 	S = scaling(models[cur_idx].scale);
 
 	Matrix4 MVP;
-	GLfloat mvp[16];
 
 	// [TODO] multiply all the 
 	MVP = project_matrix * view_matrix * T * R * S;
 
-	// [TODO] row-major ---> column-major
-	setGLMatrix(mvp, MVP);
-
-	// use uniform to send mvp to vertex shader
-	glUniformMatrix4fv(iLocMVP, 1, GL_FALSE, mvp);
+	// use uniform to send mvp to vertex shader, transposed from row-major by GL
+	glUniformMatrix4fv(iLocMVP, 1, GL_TRUE, MVP.get());
 	glBindVertexArray(m_shape_list[cur_idx].vao);
 	glDrawArrays(GL_TRIANGLES, 0, m_shape_list[cur_idx].vertex_count);
 	drawPlane();
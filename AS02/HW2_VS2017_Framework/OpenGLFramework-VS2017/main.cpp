@@ -381,13 +381,6 @@ void setPerspective()
 	);
 }
 
-void setGLMatrix(GLfloat* glm, Matrix4& m) {
-	glm[0] = m[0];  glm[4] = m[1];   glm[8] = m[2];    glm[12] = m[3];
-	glm[1] = m[4];  glm[5] = m[5];   glm[9] = m[6];    glm[13] = m[7];
-	glm[2] = m[8];  glm[6] = m[9];   glm[10] = m[10];   glm[14] = m[11];
-	glm[3] = m[12];  glm[7] = m[13];  glm[11] = m[14];   glm[15] = m[15];
-}
-
 // Vertex buffers
 GLuint VAO, VBO;
 
@@ -420,24 +413,19 @@ void RenderScene(void) {
 	S = scaling(models[cur_idx].scale);
 
 	Matrix4 M, V, P;
-	GLfloat m[16], v[16], p[16];
 
 	// [TODO] multiply all the matrix
 	M = T * R * S;
 	V = view_matrix;
 	P = project_matrix;
 
-	// row-major ---> column-major
-	setGLMatrix(m, M);
-	setGLMatrix(v, V);
-	setGLMatrix(p, P);
-
 	// use uniform to send mvp to vertex shader
 	glUniform1i(uniform.iLocLightSource, lightSource);
 
-	glUniformMatrix4fv(uniform.iLocModelMatrix, 1, GL_FALSE, m);
-	glUniformMatrix4fv(uniform.iLocViewMatrix, 1, GL_FALSE, v);
-	glUniformMatrix4fv(uniform.iLocProjectionMatrix, 1, GL_FALSE, p);
+	// row-major, GL_TRUE transposes on upload instead of a copy per matrix
+	glUniformMatrix4fv(uniform.iLocModelMatrix, 1, GL_TRUE, M.get());
+	glUniformMatrix4fv(uniform.iLocViewMatrix, 1, GL_TRUE, V.get());
+	glUniformMatrix4fv(uniform.iLocProjectionMatrix, 1, GL_TRUE, P.get());
 
 	glUniform3f(uniform.iLocDirectionalPosition, directional_light.position.x, directional_light.position.y, directional_light.position.z);
 	glUniform3f(uniform.iLocDirectionalDirection, directional_light.direction.x, directional_light.direction.y, directional_light.direction.z);
@@ -0,0 +1,216 @@
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark.cpp
+// =============
+// Scenario parsing, camera spline and JSON results of the benchmark mode.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "Benchmark.h"
+
+using namespace std;
+
+static bool ParseSwitch(const string& value, bool& out)
+{
+	if (value == "on" || value == "true" || value == "1")
+		out = true;
+	else if (value == "off" || value == "false" || value == "0")
+		out = false;
+	else
+		return false;
+	return true;
+}
+
+bool LoadBenchmarkScenario(const string& path, BenchmarkScenario& scenario)
+{
+	ifstream file(path);
+	if (!file) {
+		printf("Benchmark: cannot open %s\n", path.c_str());
+		return false;
+	}
+
+	scenario = BenchmarkScenario();
+	size_t slash = path.find_last_of("/\\");
+	scenario.name = slash == string::npos ? path : path.substr(slash + 1);
+
+	string line;
+	int line_number = 0;
+	while (getline(file, line))
+	{
+		line_number++;
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.erase(comment);
+		istringstream in(line);
+		string key, value;
+		if (!(in >> key))
+			continue;
+
+		bool ok = true;
+		if (key == "camera") {
+			CameraPose pose;
+			ok = (bool)(in >> pose.eye.x >> pose.eye.y >> pose.eye.z >> pose.center.x >> pose.center.y >> pose.center.z);
+			if (ok)
+				scenario.camera.push_back(pose);
+		}
+		else if (!(in >> value))
+			ok = false;
+		else if (key == "name")
+			scenario.name = value;
+		else if (key == "model")
+			scenario.models.push_back(value);
+		else if (key == "projection" && (value == "perspective" || value == "orthogonal"))
+			scenario.perspective = value == "perspective";
+		else if (key == "light" && (value == "directional" || value == "point" || value == "spot"))
+			scenario.light_source = value == "directional" ? 0 : value == "point" ? 1 : 2;
+		else if (key == "mag_filter" && (value == "nearest" || value == "linear"))
+			scenario.mag_filter = value == "linear" ? 1 : 0;
+		else if (key == "min_filter" && (value == "nearest" || value == "linear_mipmap_linear"))
+			scenario.min_filter = value == "linear_mipmap_linear" ? 1 : 0;
+		else if (key == "lighting" && (value == "per-pixel" || value == "per-vertex"))
+			scenario.per_pixel = value == "per-pixel";
+		else if (key == "frames")
+			ok = (scenario.frames = atoi(value.c_str())) > 0;
+		else if (key == "warmup")
+			ok = (scenario.warmup = atoi(value.c_str())) >= 0;
+		else if (key == "lights")
+			ok = (scenario.light_field = atoi(value.c_str())) >= 0;
+		else if (key == "shadows")
+			ok = ParseSwitch(value, scenario.shadows);
+		else if (key == "prepass")
+			ok = ParseSwitch(value, scenario.prepass);
+		else if (key == "show_all")
+			ok = ParseSwitch(value, scenario.show_all);
+		else
+			ok = false;
+
+		if (!ok) {
+			printf("Benchmark: %s:%d: cannot parse \"%s\"\n", path.c_str(), line_number, line.c_str());
+			return false;
+		}
+	}
+
+	if (scenario.camera.empty()) {
+		printf("Benchmark: %s has no camera keys\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+static Vector3 CatmullRom(const Vector3& p0, const Vector3& p1, const Vector3& p2, const Vector3& p3, float t)
+{
+	float t2 = t * t, t3 = t2 * t;
+	return (p1 * 2.0f + (p2 - p0) * t + (p0 * 2.0f - p1 * 5.0f + p2 * 4.0f - p3) * t2 + (p1 * 3.0f - p0 - p2 * 3.0f + p3) * t3) * 0.5f;
+}
+
+CameraPose CameraSplinePose(const vector<CameraPose>& keys, float t)
+{
+	int segments = (int)keys.size() - 1;
+	if (segments <= 0)
+		return keys[0];
+
+	t = min(max(t, 0.0f), 1.0f) * segments;
+	int s = min((int)t, segments - 1);
+	float u = t - s;
+	// the end keys are repeated so the curve still passes through them
+	const CameraPose& k0 = keys[max(s - 1, 0)];
+	const CameraPose& k1 = keys[s];
+	const CameraPose& k2 = keys[s + 1];
+	const CameraPose& k3 = keys[min(s + 2, segments)];
+
+	CameraPose pose;
+	pose.eye = CatmullRom(k0.eye, k1.eye, k2.eye, k3.eye, u);
+	pose.center = CatmullRom(k0.center, k1.center, k2.center, k3.center, u);
+	return pose;
+}
+
+struct Distribution
+{
+	double min, mean, p50, p95, p99, max;
+};
+
+static Distribution Summarize(vector<double> values)
+{
+	Distribution d = { 0, 0, 0, 0, 0, 0 };
+	if (values.empty())
+		return d;
+	sort(values.begin(), values.end());
+	double sum = 0.0;
+	for (double v : values)
+		sum += v;
+	auto percentile = [&](double p) { return values[min((size_t)(p * values.size()), values.size() - 1)]; };
+	d.min = values.front();
+	d.mean = sum / values.size();
+	d.p50 = percentile(0.50);
+	d.p95 = percentile(0.95);
+	d.p99 = percentile(0.99);
+	d.max = values.back();
+	return d;
+}
+
+static void WriteDistribution(FILE* file, const char* key, const vector<double>& values, bool last = false)
+{
+	Distribution d = Summarize(values);
+	fprintf(file, "  \"%s\": {\"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+		key, d.min, d.mean, d.p50, d.p95, d.p99, d.max, last ? "" : ",");
+}
+
+static string JsonEscape(const string& text)
+{
+	string out;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		if ((unsigned char)c >= 0x20)
+			out += c;
+	}
+	return out;
+}
+
+bool WriteBenchmarkResults(const string& path, const BenchmarkScenario& scenario, const string& renderer,
+						   int width, int height, double total_seconds, const vector<BenchmarkFrame>& frames)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+
+	vector<double> frame_ms, gpu_ms, draw_calls, triangles;
+	for (const BenchmarkFrame& f : frames)
+	{
+		frame_ms.push_back(f.frame_ms);
+		gpu_ms.push_back(f.gpu_ms);
+		draw_calls.push_back(f.draw_calls);
+		triangles.push_back(f.triangles);
+	}
+	const char* lights[3] = { "directional", "point", "spot" };
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"scenario\": \"%s\",\n", JsonEscape(scenario.name).c_str());
+	fprintf(file, "  \"renderer\": \"%s\",\n", JsonEscape(renderer).c_str());
+	fprintf(file, "  \"width\": %d,\n  \"height\": %d,\n", width, height);
+	fprintf(file, "  \"settings\": {\"projection\": \"%s\", \"light\": \"%s\", \"mag_filter\": \"%s\", \"min_filter\": \"%s\", "
+		"\"lighting\": \"%s\", \"lights\": %d, \"shadows\": %s, \"prepass\": %s, \"show_all\": %s},\n",
+		scenario.perspective ? "perspective" : "orthogonal", lights[scenario.light_source],
+		scenario.mag_filter ? "linear" : "nearest", scenario.min_filter ? "linear_mipmap_linear" : "nearest",
+		scenario.per_pixel ? "per-pixel" : "per-vertex", scenario.light_field,
+		scenario.shadows ? "true" : "false", scenario.prepass ? "true" : "false", scenario.show_all ? "true" : "false");
+	fprintf(file, "  \"frames\": %d,\n  \"warmup\": %d,\n", (int)frames.size(), scenario.warmup);
+	fprintf(file, "  \"total_seconds\": %.4f,\n", total_seconds);
+	fprintf(file, "  \"fps\": %.3f,\n", frames.size() / max(total_seconds, 1e-9));
+	WriteDistribution(file, "frame_ms", frame_ms);
+	WriteDistribution(file, "gpu_ms", gpu_ms);
+	WriteDistribution(file, "draw_calls", draw_calls);
+	WriteDistribution(file, "triangles", triangles);
+	fprintf(file, "  \"frame_ms_per_frame\": [");
+	for (size_t i = 0; i < frames.size(); i++)
+		fprintf(file, "%s%.4f", i == 0 ? "" : ", ", frames[i].frame_ms);
+	fprintf(file, "]\n}\n");
+
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
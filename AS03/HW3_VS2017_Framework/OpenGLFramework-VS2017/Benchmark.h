@@ -0,0 +1,75 @@
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark.h
+// ===========
+// Deterministic rendering benchmarks. A scenario file fixes the models, render
+// settings, a camera spline and the frame count; every frame places the camera
+// by frame number instead of time, so two runs draw exactly the same frames.
+// Results are written as JSON to compare builds.
+//
+// Scenario file, one setting per line, # starts a comment:
+//   name orbit_mew
+//   model ../TextureModels/Mew.obj        (repeatable, the first one is shown)
+//   projection perspective | orthogonal
+//   light directional | point | spot
+//   mag_filter nearest | linear
+//   min_filter nearest | linear_mipmap_linear
+//   lighting per-pixel | per-vertex        (headless only, the window draws both)
+//   frames 600
+//   warmup 30
+//   lights 128                             (clustered light field, default 0)
+//   shadows on | off
+//   prepass on | off
+//   show_all on | off                      (every model in a grid instead of the first)
+//   camera eye_x eye_y eye_z center_x center_y center_z   (spline key, repeatable)
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef BENCHMARK_H_DEF
+#define BENCHMARK_H_DEF
+
+#include <string>
+#include <vector>
+#include "Vectors.h"
+
+struct CameraPose
+{
+	Vector3 eye;
+	Vector3 center;
+};
+
+struct BenchmarkScenario
+{
+	std::string name;
+	std::vector<std::string> models;
+	bool perspective = true;
+	int light_source = 0;		// DIRECTIONALLIGHT, POINTLIGHT or SPOTLIGHT
+	int mag_filter = 1;			// 0 nearest, 1 linear
+	int min_filter = 1;			// 0 nearest, 1 linear_mipmap_linear
+	bool per_pixel = true;
+	int frames = 300;
+	int warmup = 30;
+	int light_field = 0;
+	bool shadows = false;
+	bool prepass = false;
+	bool show_all = false;
+	std::vector<CameraPose> camera;
+};
+
+struct BenchmarkFrame
+{
+	double frame_ms;		// wall time to submit the frame, GPU work of earlier frames overlaps it
+	double gpu_ms;			// GL_TIME_ELAPSED of the frame, read back PROFILER_FRAME_LATENCY frames later
+	int draw_calls;
+	int triangles;
+};
+
+// reports the offending line and returns false on a malformed file
+bool		LoadBenchmarkScenario(const std::string& path, BenchmarkScenario& scenario);
+
+// Catmull-Rom through the camera keys, t in [0, 1] runs from the first key to the last
+CameraPose	CameraSplinePose(const std::vector<CameraPose>& keys, float t);
+
+// min/mean/percentiles of every per-frame value, plus the raw frame times
+bool		WriteBenchmarkResults(const std::string& path, const BenchmarkScenario& scenario, const std::string& renderer,
+								  int width, int height, double total_seconds, const std::vector<BenchmarkFrame>& frames);
+
+#endif
@@ -0,0 +1,324 @@
+///////////////////////////////////////////////////////////////////////////////
+// FrameCapture.cpp
+// ================
+// PBO ring readback and the Y4M / PNG writer thread.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include "ImageWriter.h"
+#include "Logger.h"
+#include "FrameCapture.h"
+
+using namespace std;
+
+const int CAPTURE_ROW_BAND = 16;		// rows per Y4M conversion job, even so chroma rows never straddle two
+
+static double ElapsedMs(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static bool EndsWith(const string& s, const string& suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+FrameCapture::FrameCapture()
+	: capturing(false), y4m(false), frame_width(0), frame_height(0), stream(NULL), oldest(0), pending(0), next_frame(0),
+	  frames_in_use(0), quit(false)
+{
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		slots[i].pbo = 0;
+		slots[i].fence = 0;
+		slots[i].frame = 0;
+	}
+	memset(&capture_stats, 0, sizeof(capture_stats));
+}
+
+FrameCapture::~FrameCapture()
+{
+	// the PBOs went with the context, only the writer is left to stop
+	if (writer.joinable()) {
+		{
+			lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		queued_cv.notify_all();
+		writer.join();
+	}
+	for (size_t i = 0; i < free_frames.size(); i++)
+		delete free_frames[i];
+	if (stream)
+		fclose(stream);
+}
+
+bool FrameCapture::start(const string& path, int width, int height, int fps)
+{
+	if (capturing)
+		stop();
+	if (width <= 0 || height <= 0)
+		return false;
+	output_path = path;
+	y4m = EndsWith(path, ".y4m");
+	frame_width = width;
+	frame_height = height;
+	if (y4m) {
+		stream = fopen(path.c_str(), "wb");
+		if (!stream) {
+			LOG_ERROR("Capture: cannot open %s", path);
+			return false;
+		}
+		fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, max(fps, 1));
+	}
+
+	size_t bytes = (size_t)width * height * 4;
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		glGenBuffers(1, &slots[i].pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		slots[i].fence = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	oldest = 0;
+	pending = 0;
+	next_frame = 0;
+	memset(&capture_stats, 0, sizeof(capture_stats));
+
+	// the writer's pool leaves the render thread and the writer a core each
+	int cores = (int)max(thread::hardware_concurrency(), 1u);
+	encode_pool.reset(new ThreadPool(max(cores - 2, 0)));
+	quit = false;
+	frames_in_use = 0;
+	writer = thread(&FrameCapture::writerLoop, this);
+	capturing = true;
+	LOG_INFO("Capture: recording %dx%d to %s", width, height, y4m ? path : path + "_*.png");
+	return true;
+}
+
+void FrameCapture::capture(GLuint fbo, int x, int y, int width, int height)
+{
+	if (!capturing)
+		return;
+	if (width != frame_width || height != frame_height) {
+		capture_stats.skipped++;
+		return;
+	}
+	auto start = chrono::steady_clock::now();
+
+	// hand over every readback that has landed, oldest first
+	collect(false);
+	if (pending == CAPTURE_PBO_COUNT) {
+		// the whole ring is in flight, this is the stall the ring is sized to avoid
+		auto wait_start = chrono::steady_clock::now();
+		glClientWaitSync(slots[oldest].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		capture_stats.readback_waits++;
+		capture_stats.readback_wait_ms += ElapsedMs(wait_start);
+		collect(false);
+	}
+
+	GLint read_fbo = 0, read_buffer = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glGetIntegerv(GL_READ_BUFFER, &read_buffer);
+	glReadBuffer(fbo == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+
+	Slot& slot = slots[(oldest + pending) % CAPTURE_PBO_COUNT];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.frame = next_frame++;
+	pending++;
+	capture_stats.captured++;
+
+	glReadBuffer(read_buffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	capture_stats.capture_ms += ElapsedMs(start);
+}
+
+void FrameCapture::collect(bool wait)
+{
+	while (pending > 0)
+	{
+		Slot& slot = slots[oldest];
+		GLuint64 timeout = wait ? GL_TIMEOUT_IGNORED : 0;
+		GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+		if (status == GL_TIMEOUT_EXPIRED)
+			return;
+		retire(slot);
+		oldest = (oldest + 1) % CAPTURE_PBO_COUNT;
+		pending--;
+	}
+}
+
+void FrameCapture::retire(Slot& slot)
+{
+	glDeleteSync(slot.fence);
+	slot.fence = 0;
+
+	Frame* frame = NULL;
+	{
+		unique_lock<std::mutex> lock(mutex);
+		if (frames_in_use >= CAPTURE_MAX_QUEUED) {
+			// the writer fell behind, keep every frame and let the render thread wait instead
+			auto wait_start = chrono::steady_clock::now();
+			space_cv.wait(lock, [this]() { return frames_in_use < CAPTURE_MAX_QUEUED; });
+			capture_stats.queue_waits++;
+			capture_stats.queue_wait_ms += ElapsedMs(wait_start);
+		}
+		if (!free_frames.empty()) {
+			frame = free_frames.back();
+			free_frames.pop_back();
+		}
+		frames_in_use++;
+	}
+	if (!frame)
+		frame = new Frame;
+
+	size_t bytes = (size_t)frame_width * frame_height * 4;
+	frame->index = slot.frame;
+	frame->pixels.resize(bytes);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (data) {
+		memcpy(&frame->pixels[0], data, bytes);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	{
+		lock_guard<std::mutex> lock(mutex);
+		queue.push_back(frame);
+		capture_stats.queue_peak = max(capture_stats.queue_peak, (int)queue.size());
+	}
+	queued_cv.notify_one();
+}
+
+void FrameCapture::stop()
+{
+	if (!capturing)
+		return;
+	collect(true);
+	{
+		lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	queued_cv.notify_all();
+	writer.join();
+	encode_pool.reset();
+	if (stream) {
+		fclose(stream);
+		stream = NULL;
+	}
+	for (int i = 0; i < CAPTURE_PBO_COUNT; i++)
+	{
+		glDeleteBuffers(1, &slots[i].pbo);
+		slots[i].pbo = 0;
+	}
+	capturing = false;
+
+	const FrameCaptureStats& s = capture_stats;
+	int frames = max(s.captured, 1);
+	LOG_INFO("Capture: %d frames written to %s (%.1f MB), %d skipped, writer %.2f ms per frame",
+			 s.written, output_path, s.bytes / 1048576.0, s.skipped, s.encode_ms / frames);
+	LOG_INFO("Capture: %.3f ms per frame on the render thread, %d readback waits (%.2f ms), %d writer waits (%.2f ms), queue peak %d",
+			 s.capture_ms / frames, s.readback_waits, s.readback_wait_ms, s.queue_waits, s.queue_wait_ms, s.queue_peak);
+}
+
+void FrameCapture::writerLoop()
+{
+	vector<Frame*> batch;
+	while (true)
+	{
+		{
+			unique_lock<std::mutex> lock(mutex);
+			queued_cv.wait(lock, [this]() { return quit || !queue.empty(); });
+			if (queue.empty())
+				return;
+			batch.assign(queue.begin(), queue.end());
+			queue.clear();
+		}
+
+		auto start = chrono::steady_clock::now();
+		if (y4m) {
+			// one stream, so the frames go in order and each conversion is split instead
+			for (size_t i = 0; i < batch.size(); i++)
+				writeY4M(*batch[i]);
+		}
+		else {
+			encode_pool->parallelFor((int)batch.size(), [&](int i) { writePNG(*batch[i]); });
+		}
+		capture_stats.encode_ms += ElapsedMs(start);
+
+		{
+			lock_guard<std::mutex> lock(mutex);
+			free_frames.insert(free_frames.end(), batch.begin(), batch.end());
+			frames_in_use -= (int)batch.size();
+		}
+		space_cv.notify_all();
+	}
+}
+
+void FrameCapture::writeY4M(const Frame& frame)
+{
+	int w = frame_width, h = frame_height;
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	yuv.resize((size_t)w * h + (size_t)cw * ch * 2);
+	unsigned char* Y = &yuv[0];
+	unsigned char* U = Y + (size_t)w * h;
+	unsigned char* V = U + (size_t)cw * ch;
+	const unsigned char* rgba = &frame.pixels[0];
+
+	int bands = (h + CAPTURE_ROW_BAND - 1) / CAPTURE_ROW_BAND;
+	encode_pool->parallelFor(bands, [&](int band) {
+		int y_end = min(h, (band + 1) * CAPTURE_ROW_BAND);
+		for (int y = band * CAPTURE_ROW_BAND; y < y_end; y++)
+		{
+			// Y4M is top row first, glReadPixels bottom row first
+			const unsigned char* row = rgba + (size_t)(h - 1 - y) * w * 4;
+			for (int x = 0; x < w; x++)
+			{
+				const unsigned char* p = row + x * 4;
+				Y[(size_t)y * w + x] = (unsigned char)min(255.0f, 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+			}
+			if (y % 2)
+				continue;
+			// chroma of the 2x2 block, the last row and column repeat on odd sizes
+			const unsigned char* next = rgba + (size_t)(h - 1 - min(y + 1, h - 1)) * w * 4;
+			for (int cx = 0; cx < cw; cx++)
+			{
+				int x0 = cx * 2, x1 = min(cx * 2 + 1, w - 1);
+				float r = (row[x0 * 4] + row[x1 * 4] + next[x0 * 4] + next[x1 * 4]) * 0.25f;
+				float g = (row[x0 * 4 + 1] + row[x1 * 4 + 1] + next[x0 * 4 + 1] + next[x1 * 4 + 1]) * 0.25f;
+				float b = (row[x0 * 4 + 2] + row[x1 * 4 + 2] + next[x0 * 4 + 2] + next[x1 * 4 + 2]) * 0.25f;
+				float u = 128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b;
+				float v = 128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b;
+				U[(size_t)(y / 2) * cw + cx] = (unsigned char)max(0.0f, min(255.0f, u + 0.5f));
+				V[(size_t)(y / 2) * cw + cx] = (unsigned char)max(0.0f, min(255.0f, v + 0.5f));
+			}
+		}
+	});
+
+	fputs("FRAME\n", stream);
+	if (fwrite(&yuv[0], 1, yuv.size(), stream) == yuv.size()) {
+		capture_stats.written++;
+		capture_stats.bytes += 6 + yuv.size();
+	}
+}
+
+// called from the pool, only the counters are shared
+void FrameCapture::writePNG(const Frame& frame)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "_%05d.png", frame.index);
+	string path = output_path + name;
+	if (WritePNG(path.c_str(), frame_width, frame_height, 4, &frame.pixels[0], true)) {
+		lock_guard<std::mutex> lock(mutex);
+		capture_stats.written++;
+		capture_stats.bytes += (long long)frame_width * frame_height * 4;
+	}
+}
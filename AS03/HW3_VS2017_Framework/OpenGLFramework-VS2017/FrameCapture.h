@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+// FrameCapture.h
+// ==============
+// Records rendered frames without stalling the GPU. Each captured frame is
+// read into the next pixel pack buffer of a small ring (glReadPixels into a
+// PBO returns at once) and fenced; the PBO is only mapped a few frames later,
+// once its fence has signaled, and the pixels are handed to a writer thread.
+// Only when every PBO of the ring is still in flight does capture() wait.
+//
+// The writer encodes either a Y4M stream (4:2:0, full range BT.601, the RGB
+// to YUV conversion split into row bands on its own thread pool) or a PNG
+// sequence (the frames waiting in the queue are encoded in parallel).
+// A path ending in .y4m selects Y4M; any other path is a prefix for
+// <prefix>_00000.png, <prefix>_00001.png, ...
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_CAPTURE_H_DEF
+#define FRAME_CAPTURE_H_DEF
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <glad/glad.h>
+#include "ThreadPool.h"
+
+const int CAPTURE_PBO_COUNT = 3;		// frames a readback may stay in flight
+const int CAPTURE_MAX_QUEUED = 16;		// frames waiting for the writer before capture() blocks
+const int CAPTURE_DEFAULT_FPS = 60;		// Y4M frame rate, frames are written as captured
+
+struct FrameCaptureStats
+{
+	int captured;			// readbacks issued
+	int written;
+	int skipped;			// frames whose size differed from the stream
+	int readback_waits;		// captures that found the oldest PBO still in flight
+	double readback_wait_ms;
+	int queue_waits;		// captures that waited for the writer
+	double queue_wait_ms;
+	int queue_peak;
+	double capture_ms;		// render thread time in capture(), waits included
+	double encode_ms;		// writer time spent converting and writing
+	long long bytes;
+};
+
+class FrameCapture
+{
+public:
+	FrameCapture();
+	~FrameCapture();
+
+	// needs the GL context current; width x height is the size of every captured frame
+	bool		start(const std::string& path, int width, int height, int fps = CAPTURE_DEFAULT_FPS);
+	// reads the color buffer of fbo (0 for the window's back buffer) at (x, y), GL context thread only
+	void		capture(GLuint fbo, int x, int y, int width, int height);
+	// waits for the readbacks in flight and the writer, then prints the stats
+	void		stop();
+	bool		active() const { return capturing; }
+	const std::string& path() const { return output_path; }
+	const FrameCaptureStats& stats() const { return capture_stats; }
+
+private:
+	struct Frame
+	{
+		int index;
+		std::vector<unsigned char> pixels;	// RGBA8, bottom row first
+	};
+	struct Slot
+	{
+		GLuint pbo;
+		GLsync fence;
+		int frame;
+	};
+
+	void		collect(bool wait);
+	void		retire(Slot& slot);
+	void		writerLoop();
+	void		writeY4M(const Frame& frame);
+	void		writePNG(const Frame& frame);
+
+	bool		capturing;
+	std::string	output_path;
+	bool		y4m;
+	int			frame_width, frame_height;
+	FILE*		stream;
+	Slot		slots[CAPTURE_PBO_COUNT];
+	int			oldest, pending;		// ring position of the oldest readback in flight, and how many are
+	int			next_frame;
+
+	std::thread	writer;
+	std::unique_ptr<ThreadPool> encode_pool;
+	std::mutex	mutex;
+	std::condition_variable queued_cv, space_cv;
+	std::deque<Frame*> queue;			// in capture order
+	std::vector<Frame*> free_frames;	// recycled pixel buffers
+	int			frames_in_use;			// queued or being written
+	bool		quit;
+	std::vector<unsigned char> yuv;		// writer thread only
+
+	FrameCaptureStats capture_stats;
+};
+
+#endif
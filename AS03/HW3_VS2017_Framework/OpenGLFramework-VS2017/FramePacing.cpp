@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+// FramePacing.cpp
+// ===============
+// On-demand frame scheduling and the CPU usage report of the render loop.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "FramePacing.h"
+
+using namespace std;
+
+static const char* MODE_NAMES[2] = { "continuous", "on-demand" };
+
+double ProcessCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0.0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;		// 100 ns units
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+static double WallSeconds()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FramePacer::FramePacer()
+	: loop_mode(ContinuousRendering), dirty(true), is_animating(false)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		last_cpu_percent[i] = -1.0;
+		last_fps[i] = -1.0;
+	}
+	startWindow(WallSeconds());
+}
+
+void FramePacer::startWindow(double now)
+{
+	window_start = now;
+	window_cpu_start = ProcessCpuSeconds();
+	window_frames = 0;
+	window_wakeups = 0;
+}
+
+void FramePacer::setMode(RenderLoopMode mode)
+{
+	if (mode == loop_mode)
+		return;
+	// a partial window would mix both modes
+	loop_mode = mode;
+	dirty = true;
+	startWindow(WallSeconds());
+}
+
+void FramePacer::requestRedraw()
+{
+	dirty.store(true);
+	// under the lock, so a waiter between its check and its wait is not missed
+	std::lock_guard<std::mutex> lock(wait_mutex);
+	wake.notify_one();
+}
+
+void FramePacer::waitForRedraw(double seconds)
+{
+	std::unique_lock<std::mutex> lock(wait_mutex);
+	wake.wait_for(lock, chrono::duration<double>(seconds), [this]() { return dirty.load(); });
+}
+
+bool FramePacer::beginFrame()
+{
+	bool requested = dirty.exchange(false);
+	return loop_mode == ContinuousRendering || is_animating || requested;
+}
+
+void FramePacer::frameRendered()
+{
+	window_frames++;
+}
+
+void FramePacer::update()
+{
+	window_wakeups++;
+	double now = WallSeconds();
+	double elapsed = now - window_start;
+	if (elapsed < RENDER_LOOP_REPORT_SECONDS)
+		return;
+
+	int m = (int)loop_mode;
+	last_cpu_percent[m] = 100.0 * (ProcessCpuSeconds() - window_cpu_start) / elapsed;
+	last_fps[m] = window_frames / elapsed;
+	// continuous mode is measured quietly until there is an on-demand figure to compare with
+	if (loop_mode == ContinuousRendering && last_cpu_percent[OnDemandRendering] < 0.0)
+	{
+		startWindow(now);
+		return;
+	}
+	printf("Render loop (%s): %.1f frames/s, %.1f wakeups/s, CPU %.1f%%", MODE_NAMES[m],
+		   last_fps[m], window_wakeups / elapsed, last_cpu_percent[m]);
+	int other = 1 - m;
+	if (last_cpu_percent[other] >= 0.0)
+		printf(" | %s: %.1f frames/s, CPU %.1f%%", MODE_NAMES[other], last_fps[other], last_cpu_percent[other]);
+	printf("\n");
+	startWindow(now);
+}
+
+FramePacer& GetFramePacer()
+{
+	static FramePacer pacer;
+	return pacer;
+}
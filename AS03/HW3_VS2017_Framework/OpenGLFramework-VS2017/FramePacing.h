@@ -0,0 +1,75 @@
+///////////////////////////////////////////////////////////////////////////////
+// FramePacing.h
+// =============
+// Decides when the render thread draws. In continuous mode every loop
+// iteration renders; in on-demand mode a frame is only drawn after something
+// marked the view dirty (a new frame snapshot or command), or while a consumer
+// that needs every frame (the profiler) is running. The render thread sleeps
+// in waitForRedraw in between. requestRedraw may be called from any thread,
+// everything else belongs to the render thread.
+//
+// Also measures the process CPU time of each mode, so the idle cost of the
+// two can be compared from the periodic report.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_PACING_H_DEF
+#define FRAME_PACING_H_DEF
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+enum RenderLoopMode { ContinuousRendering, OnDemandRendering };
+
+const double ON_DEMAND_WAIT_SECONDS = 0.5;		// longest sleep between two checks of the loop
+const double RENDER_LOOP_REPORT_SECONDS = 5.0;	// period of the usage report
+
+// CPU time (user + system) the process has used so far
+double ProcessCpuSeconds();
+
+class FramePacer
+{
+public:
+	FramePacer();
+
+	void			setMode(RenderLoopMode mode);
+	RenderLoopMode	mode() const { return loop_mode; }
+
+	// the next frame has to be drawn, wakes waitForRedraw
+	void			requestRedraw();
+	// sleeps until a redraw is requested or the timeout passes
+	void			waitForRedraw(double seconds);
+	// draw every frame while set, regardless of dirty
+	void			setAnimating(bool animating) { is_animating = animating; }
+
+	// whether to draw now; takes the pending redraw request, so requests made
+	// while the frame is drawn cause another one
+	bool			beginFrame();
+	void			frameRendered();
+
+	// once per loop iteration, prints the usage of the current mode next to the
+	// last one of the other every RENDER_LOOP_REPORT_SECONDS, once on-demand mode was used
+	void			update();
+
+private:
+	void			startWindow(double now);
+
+	RenderLoopMode	loop_mode;
+	std::atomic<bool> dirty;
+	bool			is_animating;
+	std::mutex		wait_mutex;
+	std::condition_variable wake;
+
+	double			window_start;			// wall clock start of the current report window
+	double			window_cpu_start;
+	int				window_frames;
+	int				window_wakeups;
+
+	// the last full report of each mode, -1 until there is one
+	double			last_cpu_percent[2];
+	double			last_fps[2];
+};
+
+FramePacer& GetFramePacer();
+
+#endif
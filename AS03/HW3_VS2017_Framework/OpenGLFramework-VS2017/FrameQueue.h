@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// FrameQueue.h
+// ============
+// Lock-free hand-off between the GLFW event thread and the render thread.
+//
+// TripleBuffer: the producer fills one buffer and publishes it, the consumer
+// takes the newest published one. Neither side ever waits for the other and
+// snapshots the consumer was too slow to see are skipped.
+//
+// SpscQueue: bounded single-producer single-consumer ring for the commands
+// that must not be skipped (one-off actions that need the GL context).
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_QUEUE_H_DEF
+#define FRAME_QUEUE_H_DEF
+
+#include <atomic>
+#include <cstddef>
+
+template <class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : middle(1), write_index(0), read_index(2) {}
+
+	// producer side: fill writeBuffer() completely, then publish it
+	T&			writeBuffer() { return buffers[write_index]; }
+	void		publish()
+	{
+		// the previous middle buffer is free again, unless the consumer took it
+		int old = middle.exchange(write_index | FRESH, std::memory_order_acq_rel);
+		write_index = old & INDEX_MASK;
+	}
+
+	// consumer side: returns true and switches readBuffer() when something new was published
+	bool		update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+			return false;
+		int old = middle.exchange(read_index, std::memory_order_acq_rel);
+		read_index = old & INDEX_MASK;
+		return true;
+	}
+	const T&	readBuffer() const { return buffers[read_index]; }
+
+private:
+	static const int INDEX_MASK = 3;
+	static const int FRESH = 4;		// the middle buffer holds a snapshot the consumer has not taken
+
+	T					buffers[3];
+	std::atomic<int>	middle;
+	int					write_index;	// producer only
+	int					read_index;		// consumer only
+};
+
+template <class T, size_t N>
+class SpscQueue
+{
+	static_assert((N & (N - 1)) == 0, "the queue size is a power of two");
+
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	// producer side, false when the queue is full
+	bool		push(const T& item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N)
+			return false;
+		items[t & (N - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, false when the queue is empty
+	bool		pop(T& item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = items[h & (N - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T					items[N];
+	std::atomic<size_t>	head;		// next item to pop
+	std::atomic<size_t>	tail;		// next free slot
+};
+
+#endif
@@ -0,0 +1,161 @@
+///////////////////////////////////////////////////////////////////////////////
+// HeadlessContext.cpp
+// ===================
+// EGL surfaceless / OSMesa context creation.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include "HeadlessContext.h"
+
+#if defined(HEADLESS_OSMESA)
+
+#include <GL/osmesa.h>
+
+static OSMesaContext context = NULL;
+static unsigned char dummy_buffer[16 * 16 * 4];	// OSMesa needs a color buffer, frames go to FBOs
+
+bool CreateHeadlessContext(int major, int minor)
+{
+	const int attribs[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 24,
+		OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, major,
+		OSMESA_CONTEXT_MINOR_VERSION, minor,
+		0
+	};
+	context = OSMesaCreateContextAttribs(attribs, NULL);
+	if (context == NULL)
+	{
+		printf("Headless: OSMesaCreateContextAttribs failed\n");
+		return false;
+	}
+	if (!OSMesaMakeCurrent(context, dummy_buffer, 0x1401 /* GL_UNSIGNED_BYTE */, 16, 16))
+	{
+		printf("Headless: OSMesaMakeCurrent failed\n");
+		return false;
+	}
+	return true;
+}
+
+void DestroyHeadlessContext()
+{
+	if (context != NULL)
+		OSMesaDestroyContext(context);
+	context = NULL;
+}
+
+void* HeadlessGetProcAddress(const char* name)
+{
+	return (void*)OSMesaGetProcAddress(name);
+}
+
+const char* HeadlessBackendName()
+{
+	return "OSMesa";
+}
+
+#elif defined(HEADLESS_EGL)
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+bool CreateHeadlessContext(int major, int minor)
+{
+	// prefer the surfaceless platform, it needs neither a display server nor a device
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") && get_platform_display != NULL)
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint egl_major, egl_minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &egl_major, &egl_minor))
+	{
+		printf("Headless: cannot initialize an EGL display\n");
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API))
+	{
+		printf("Headless: EGL has no desktop OpenGL\n");
+		return false;
+	}
+
+	const EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = NULL;
+	EGLint config_count = 0;
+	eglChooseConfig(display, config_attribs, &config, 1, &config_count);
+
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, major,
+		EGL_CONTEXT_MINOR_VERSION, minor,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	// no config is fine with EGL_KHR_no_config_context, there is no surface anyway
+	context = eglCreateContext(display, config_count > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT)
+	{
+		printf("Headless: eglCreateContext failed (0x%x)\n", eglGetError());
+		return false;
+	}
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		printf("Headless: eglMakeCurrent without a surface failed (0x%x)\n", eglGetError());
+		return false;
+	}
+	return true;
+}
+
+void DestroyHeadlessContext()
+{
+	if (display != EGL_NO_DISPLAY)
+	{
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT)
+			eglDestroyContext(display, context);
+		eglTerminate(display);
+	}
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+}
+
+void* HeadlessGetProcAddress(const char* name)
+{
+	return (void*)eglGetProcAddress(name);
+}
+
+const char* HeadlessBackendName()
+{
+	return "EGL surfaceless";
+}
+
+#else
+
+bool CreateHeadlessContext(int /*major*/, int /*minor*/)
+{
+	printf("Headless: built without a backend, define HEADLESS_EGL or HEADLESS_OSMESA\n");
+	return false;
+}
+
+void DestroyHeadlessContext()
+{
+}
+
+void* HeadlessGetProcAddress(const char* /*name*/)
+{
+	return NULL;
+}
+
+const char* HeadlessBackendName()
+{
+	return "none";
+}
+
+#endif
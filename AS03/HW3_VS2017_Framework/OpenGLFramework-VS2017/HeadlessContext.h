@@ -0,0 +1,20 @@
+///////////////////////////////////////////////////////////////////////////////
+// HeadlessContext.h
+// =================
+// Window-less OpenGL core context for batch rendering on machines without a
+// display or GPU. Build with HEADLESS_EGL (EGL surfaceless, e.g. Mesa
+// llvmpipe, link EGL) or HEADLESS_OSMESA (link OSMesa); without either the
+// functions below only report that no backend is available.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef HEADLESS_CONTEXT_H_DEF
+#define HEADLESS_CONTEXT_H_DEF
+
+// creates the context and makes it current on the calling thread, rendering goes to FBOs
+bool		CreateHeadlessContext(int major, int minor);
+void		DestroyHeadlessContext();
+// for gladLoadGLLoader
+void*		HeadlessGetProcAddress(const char* name);
+const char*	HeadlessBackendName();
+
+#endif
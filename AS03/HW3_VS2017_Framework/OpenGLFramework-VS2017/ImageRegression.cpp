@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////////
+// ImageRegression.cpp
+// ===================
+// Settings matrix, image comparison and report of the regression mode.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <STB/stb_image.h>
+#include "ImageWriter.h"
+#include "ImageRegression.h"
+
+using namespace std;
+
+const int REGRESSION_DIFF_GAIN = 8;		// error scale of the diff images, small errors stay visible
+
+vector<RegressionCase> RegressionMatrix()
+{
+	vector<RegressionCase> cases;
+	for (int projection = 0; projection < 2; projection++)
+		for (int light = 0; light < 3; light++)
+			for (int lighting = 0; lighting < 2; lighting++)
+				for (int filter = 0; filter < 4; filter++)
+				{
+					RegressionCase c;
+					c.perspective = projection == 1;
+					c.light_source = light;
+					c.per_pixel = lighting == 1;
+					c.mag_filter = filter & 1;
+					c.min_filter = filter >> 1;
+					cases.push_back(c);
+				}
+	return cases;
+}
+
+string RegressionCaseName(const RegressionCase& c)
+{
+	const char* lights[3] = { "dir", "point", "spot" };
+	string name = c.perspective ? "persp" : "ortho";
+	name += string("_") + lights[c.light_source];
+	name += c.per_pixel ? "_pixel" : "_vertex";
+	name += c.mag_filter ? "_linear" : "_nearest";
+	name += c.min_filter ? "_mipmap" : "_nearest";
+	return name;
+}
+
+bool ReadPNG(const char* path, int& width, int& height, vector<unsigned char>& rgba)
+{
+	int channels;
+	unsigned char* data = stbi_load(path, &width, &height, &channels, 4);
+	if (!data)
+		return false;
+	rgba.assign(data, data + (size_t)width * height * 4);
+	stbi_image_free(data);
+	return true;
+}
+
+ImageDiff CompareImages(const unsigned char* a, const unsigned char* b, int width, int height, unsigned char* diff)
+{
+	ImageDiff result;
+	result.max_error = 0;
+	result.changed_pixels = 0;
+	double squared = 0.0;
+	size_t count = (size_t)width * height;
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char* pa = a + i * 4;
+		const unsigned char* pb = b + i * 4;
+		int pixel_error = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			int d = abs((int)pa[c] - (int)pb[c]);
+			squared += d * d;
+			pixel_error = max(pixel_error, d);
+		}
+		if (pixel_error > 0)
+			result.changed_pixels++;
+		result.max_error = max(result.max_error, pixel_error);
+		if (diff) {
+			int gray = (pb[0] + pb[1] + pb[2]) / 12;
+			unsigned char* pd = diff + i * 4;
+			pd[0] = (unsigned char)min(255, gray + pixel_error * REGRESSION_DIFF_GAIN);
+			pd[1] = (unsigned char)gray;
+			pd[2] = (unsigned char)gray;
+			pd[3] = 255;
+		}
+	}
+	double mse = count ? squared / (count * 3.0) : 0.0;
+	result.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : numeric_limits<double>::infinity();
+	return result;
+}
+
+vector<RegressionResult> CompareWithGoldens(const vector<string>& images, const string& output_dir,
+											const string& golden_dir, double psnr_threshold, ThreadPool& pool)
+{
+	// stbi reads its flip flag while decoding, clear it before the workers start
+	stbi_set_flip_vertically_on_load(false);
+	vector<RegressionResult> results(images.size());
+	pool.parallelFor((int)images.size(), [&](int i) {
+		RegressionResult& r = results[i];
+		r.image = images[i];
+		r.passed = false;
+		r.compared = false;
+		r.diff.psnr = 0.0;
+		r.diff.max_error = 0;
+		r.diff.changed_pixels = 0;
+
+		string render_path = output_dir + "/" + images[i];
+		string golden_path = golden_dir + "/" + images[i];
+		int width, height, golden_width, golden_height;
+		vector<unsigned char> render, golden;
+		if (!ReadPNG(render_path.c_str(), width, height, render)) {
+			r.error = "cannot read the render";
+			return;
+		}
+		if (!ReadPNG(golden_path.c_str(), golden_width, golden_height, golden)) {
+			r.error = "no golden image";
+			return;
+		}
+		if (width != golden_width || height != golden_height) {
+			r.error = "golden image is " + to_string(golden_width) + "x" + to_string(golden_height);
+			return;
+		}
+
+		vector<unsigned char> diff(render.size());
+		r.diff = CompareImages(&render[0], &golden[0], width, height, &diff[0]);
+		r.compared = true;
+		r.passed = r.diff.psnr >= psnr_threshold;
+		if (!r.passed) {
+			string name = images[i].substr(0, images[i].size() - 4);
+			string diff_path = output_dir + "/" + name + "_diff.png";
+			if (!WritePNG(diff_path.c_str(), width, height, 4, &diff[0], false))
+				r.error = "cannot write " + diff_path;
+		}
+	});
+	return results;
+}
+
+int PrintRegressionReport(const vector<RegressionResult>& results, double psnr_threshold)
+{
+	int failed = 0, missing = 0, identical = 0;
+	double worst = numeric_limits<double>::infinity();
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const RegressionResult& r = results[i];
+		if (r.passed) {
+			if (isinf(r.diff.psnr))
+				identical++;
+			worst = min(worst, r.diff.psnr);
+			continue;
+		}
+		failed++;
+		if (!r.compared) {
+			missing++;
+			printf("FAIL %s: %s\n", r.image.c_str(), r.error.c_str());
+		}
+		else {
+			printf("FAIL %s: %.2f dB, %d pixels changed, max error %d%s%s\n", r.image.c_str(), r.diff.psnr,
+				   r.diff.changed_pixels, r.diff.max_error, r.error.empty() ? "" : ", ", r.error.c_str());
+		}
+	}
+	printf("Regression: %d images, %d passed (%d identical), %d failed (%d without a comparison), threshold %.1f dB",
+		   (int)results.size(), (int)results.size() - failed, identical, failed, missing, psnr_threshold);
+	if (!isinf(worst))
+		printf(", lowest passing %.2f dB", worst);
+	printf("\n");
+	return failed;
+}
@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+// ImageRegression.h
+// =================
+// Golden image regression of the headless renderer. Every model is rendered
+// under the whole settings matrix: orthogonal/perspective projection, the
+// three light sources, per-vertex/per-pixel lighting and the four mag/min
+// filter pairs. Each image is compared with the golden image of the same name,
+// and fails when its PSNR (RGB, 8 bits) drops below a threshold. Failures get
+// a diff image next to the render: the golden image darkened, with the error
+// amplified into the red channel.
+//
+// Image names: <list index>_<model>_<projection>_<light>_<lighting>_<mag>_<min>_<pose>.png,
+// e.g. 00_Mew_persp_spot_pixel_linear_mipmap_000.png
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGE_REGRESSION_H_DEF
+#define IMAGE_REGRESSION_H_DEF
+
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+const double REGRESSION_DEFAULT_PSNR = 40.0;	// dB, well above driver rounding, well below a visible change
+
+// one combination of the matrix, same encodings as BenchmarkScenario
+struct RegressionCase
+{
+	bool perspective;
+	int light_source;		// DIRECTIONALLIGHT, POINTLIGHT or SPOTLIGHT
+	bool per_pixel;
+	int mag_filter;			// 0 nearest, 1 linear
+	int min_filter;			// 0 nearest, 1 linear_mipmap_linear
+};
+
+// 2 projections x 3 lights x 2 lighting modes x 4 filter pairs
+std::vector<RegressionCase> RegressionMatrix();
+// e.g. "persp_spot_pixel_linear_mipmap"
+std::string RegressionCaseName(const RegressionCase& c);
+
+struct ImageDiff
+{
+	double psnr;			// dB, infinite for identical images
+	int max_error;			// largest channel difference
+	int changed_pixels;		// pixels with any channel difference
+};
+
+// RGBA8, top row first as long as stbi's global flip flag is off, LoadTextureImage turns it on
+bool ReadPNG(const char* path, int& width, int& height, std::vector<unsigned char>& rgba);
+// diff, if given, receives the RGBA diff image
+ImageDiff CompareImages(const unsigned char* a, const unsigned char* b, int width, int height, unsigned char* diff);
+
+struct RegressionResult
+{
+	std::string image;
+	bool passed;
+	bool compared;			// false when the images could not be compared, error tells why
+	ImageDiff diff;
+	std::string error;		// e.g. a missing golden image
+};
+
+// compare output_dir/<image> with golden_dir/<image> for every name on the pool,
+// failures write output_dir/<image without .png>_diff.png
+std::vector<RegressionResult> CompareWithGoldens(const std::vector<std::string>& images, const std::string& output_dir,
+												 const std::string& golden_dir, double psnr_threshold, ThreadPool& pool);
+// prints the failures and a summary, returns the number of failed images
+int PrintRegressionReport(const std::vector<RegressionResult>& results, double psnr_threshold);
+
+#endif
@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////
+// ImageWriter.cpp
+// ===============
+// Minimal PNG writer for frame captures.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <vector>
+#include "ImageWriter.h"
+
+using namespace std;
+
+static unsigned int Crc32(const unsigned char* data, size_t size, unsigned int crc = 0)
+{
+	static unsigned int table[256];
+	static bool ready = false;
+	if (!ready)
+	{
+		for (unsigned int n = 0; n < 256; n++)
+		{
+			unsigned int c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		ready = true;
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static void PutBigEndian(vector<unsigned char>& out, unsigned int value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+static void WriteChunk(FILE* fp, const char* type, const vector<unsigned char>& data)
+{
+	vector<unsigned char> chunk;
+	PutBigEndian(chunk, (unsigned int)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	PutBigEndian(chunk, Crc32(&chunk[4], chunk.size() - 4));
+	fwrite(&chunk[0], 1, chunk.size(), fp);
+}
+
+bool WritePNG(const char* path, int width, int height, int channels, const unsigned char* pixels, bool flip_y)
+{
+	static const unsigned char color_types[5] = { 0, 0, 0, 2, 6 };
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4 || channels == 2)
+		return false;
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+	{
+		printf("WritePNG: Cannot open %s\n", path);
+		return false;
+	}
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, 8, fp);
+
+	vector<unsigned char> header;
+	PutBigEndian(header, (unsigned int)width);
+	PutBigEndian(header, (unsigned int)height);
+	header.push_back(8);	// bit depth
+	header.push_back(color_types[channels]);
+	header.push_back(0);	// deflate
+	header.push_back(0);	// adaptive filtering
+	header.push_back(0);	// no interlace
+	WriteChunk(fp, "IHDR", header);
+
+	// every row starts with filter type 0
+	size_t row_size = (size_t)width * channels;
+	vector<unsigned char> raw;
+	raw.reserve((row_size + 1) * height);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* row = pixels + row_size * (flip_y ? height - 1 - y : y);
+		raw.push_back(0);
+		raw.insert(raw.end(), row, row + row_size);
+	}
+
+	// zlib stream of stored deflate blocks
+	vector<unsigned char> data;
+	data.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	data.push_back(0x78);
+	data.push_back(0x01);
+	size_t pos = 0;
+	do
+	{
+		size_t block = raw.size() - pos < 65535 ? raw.size() - pos : 65535;
+		data.push_back(pos + block == raw.size() ? 1 : 0);
+		data.push_back((unsigned char)(block & 0xFF));
+		data.push_back((unsigned char)(block >> 8));
+		data.push_back((unsigned char)(~block & 0xFF));
+		data.push_back((unsigned char)((~block >> 8) & 0xFF));
+		data.insert(data.end(), raw.begin() + pos, raw.begin() + pos + block);
+		pos += block;
+	} while (pos < raw.size());
+
+	unsigned int a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); i++)
+	{
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	PutBigEndian(data, (b << 16) | a);
+	WriteChunk(fp, "IDAT", data);
+	WriteChunk(fp, "IEND", vector<unsigned char>());
+
+	bool ok = ferror(fp) == 0;
+	fclose(fp);
+	return ok;
+}
@@ -0,0 +1,14 @@
+///////////////////////////////////////////////////////////////////////////////
+// ImageWriter.h
+// =============
+// Minimal PNG writer for frame captures. Pixel rows are stored in zlib
+// "stored" blocks, so no compression library is needed.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IMAGE_WRITER_H_DEF
+#define IMAGE_WRITER_H_DEF
+
+// channels is 1 (gray), 3 (RGB) or 4 (RGBA); flip_y writes the last row first, as glReadPixels returns them
+bool WritePNG(const char* path, int width, int height, int channels, const unsigned char* pixels, bool flip_y);
+
+#endif
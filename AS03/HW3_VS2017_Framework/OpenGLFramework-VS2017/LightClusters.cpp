@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+// LightClusters.cpp
+// =================
+// Clustered forward lighting, CPU light-to-cluster assignment.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "LightClusters.h"
+
+using namespace std;
+
+float LightRange(const Vector3& intensity, float constant, float linear, float quadratic, float max_range)
+{
+	float peak = max(max(intensity.x, intensity.y), intensity.z);
+	if (peak <= 0.0f)
+		return 0.0f;
+	// solve quadratic * d^2 + linear * d + constant = peak / cutoff
+	float k = peak / LIGHT_ATTENUATION_CUTOFF - constant;
+	if (k <= 0.0f)
+		return max_range;	// never falls off enough, e.g. constant is tiny and the rest is zero
+	float range;
+	if (quadratic > 0.0f)
+		range = (-linear + sqrtf(linear * linear + 4.0f * quadratic * k)) / (2.0f * quadratic);
+	else if (linear > 0.0f)
+		range = k / linear;
+	else
+		range = max_range;
+	return min(range, max_range);
+}
+
+LightSphere SpotLightBounds(const Vector3& position, const Vector3& direction, float range, float cutoff)
+{
+	const float deg_to_rad = 3.14159265f / 180.0f;
+	Vector3 dir = direction;
+	dir.normalize();
+	float cos_cutoff = cosf(cutoff * deg_to_rad);
+	LightSphere sphere;
+	if (cutoff > 45.0f) {
+		// the cap circle bounds the cone
+		sphere.center = position + dir * (cos_cutoff * range);
+		sphere.radius = sinf(cutoff * deg_to_rad) * range;
+	}
+	else {
+		// circumscribed sphere through the apex and the cap rim
+		float radius = range / (2.0f * cos_cutoff);
+		sphere.center = position + dir * radius;
+		sphere.radius = radius;
+	}
+	return sphere;
+}
+
+float LightClusterGrid::sliceDepth(int slice) const
+{
+	float cluster_near = log_depth ? max(cur_near, CLUSTER_MIN_NEAR) : cur_near;
+	if (slice <= 0)
+		return cur_near;
+	if (log_depth)
+		return cluster_near * powf(cur_far / cluster_near, (float)slice / CLUSTER_SLICES);
+	return cluster_near + (cur_far - cluster_near) * slice / CLUSTER_SLICES;
+}
+
+void LightClusterGrid::setProjection(const Matrix4& projection, float near_clip, float far_clip, bool perspective)
+{
+	if (!cluster_bounds.empty() && projection == cur_projection && near_clip == cur_near && far_clip == cur_far
+		&& perspective == log_depth)
+		return;
+
+	cur_projection = projection;
+	cur_near = near_clip;
+	cur_far = far_clip;
+	log_depth = perspective;
+
+	if (log_depth) {
+		float cluster_near = max(cur_near, CLUSTER_MIN_NEAR);
+		depth_scale = CLUSTER_SLICES / logf(cur_far / cluster_near);
+		depth_bias = -logf(cluster_near) * depth_scale;
+	}
+	else {
+		depth_scale = CLUSTER_SLICES / (cur_far - cur_near);
+		depth_bias = -cur_near * depth_scale;
+	}
+
+	// every tile corner is a line through the frustum, found by unprojecting it at both clip planes
+	Matrix4 inv_projection = projection;
+	inv_projection.invert();
+	vector<Vector3> line_near((CLUSTER_TILES_X + 1) * (CLUSTER_TILES_Y + 1));
+	vector<Vector3> line_far(line_near.size());
+	for (int y = 0; y <= CLUSTER_TILES_Y; y++)
+	{
+		for (int x = 0; x <= CLUSTER_TILES_X; x++)
+		{
+			float ndc_x = -1.0f + 2.0f * x / CLUSTER_TILES_X;
+			float ndc_y = -1.0f + 2.0f * y / CLUSTER_TILES_Y;
+			Vector4 a = inv_projection * Vector4(ndc_x, ndc_y, -1.0f, 1.0f);
+			Vector4 b = inv_projection * Vector4(ndc_x, ndc_y, 1.0f, 1.0f);
+			line_near[y * (CLUSTER_TILES_X + 1) + x] = Vector3(a.x, a.y, a.z) / a.w;
+			line_far[y * (CLUSTER_TILES_X + 1) + x] = Vector3(b.x, b.y, b.z) / b.w;
+		}
+	}
+
+	cluster_bounds.assign(CLUSTER_COUNT, AABB());
+	for (int s = 0; s < CLUSTER_SLICES; s++)
+	{
+		// the view looks down -z
+		float z[2] = { -sliceDepth(s), -sliceDepth(s + 1) };
+		for (int y = 0; y < CLUSTER_TILES_Y; y++)
+		{
+			for (int x = 0; x < CLUSTER_TILES_X; x++)
+			{
+				AABB& box = cluster_bounds[(s * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x];
+				for (int c = 0; c < 4; c++)
+				{
+					int corner = (y + (c >> 1)) * (CLUSTER_TILES_X + 1) + x + (c & 1);
+					const Vector3& a = line_near[corner];
+					Vector3 d = line_far[corner] - a;
+					for (int p = 0; p < 2; p++)
+						box.expand(a + d * ((z[p] - a.z) / d.z));
+				}
+			}
+		}
+	}
+}
+
+void LightClusterGrid::assign(const vector<LightSphere>& lights, ThreadPool& pool)
+{
+	auto start = chrono::steady_clock::now();
+
+	cluster_grid.assign(CLUSTER_COUNT * 2, 0);
+	slice_indices.resize(CLUSTER_SLICES);
+
+	// one job per depth slice, lights outside the slice depth range are skipped up front
+	pool.parallelFor(CLUSTER_SLICES, [&](int s) {
+		vector<unsigned int>& out = slice_indices[s];
+		out.clear();
+		float slice_near = sliceDepth(s), slice_far = sliceDepth(s + 1);
+
+		vector<unsigned int> candidates;
+		for (int i = 0; i < (int)lights.size(); i++)
+		{
+			float depth = -lights[i].center.z;
+			if (depth + lights[i].radius >= slice_near && depth - lights[i].radius <= slice_far)
+				candidates.push_back(i);
+		}
+
+		for (int tile = 0; tile < CLUSTER_TILES_X * CLUSTER_TILES_Y; tile++)
+		{
+			int cluster = s * CLUSTER_TILES_X * CLUSTER_TILES_Y + tile;
+			const AABB& box = cluster_bounds[cluster];
+			unsigned int offset = (unsigned int)out.size();
+			for (int c = 0; c < (int)candidates.size(); c++)
+			{
+				const LightSphere& light = lights[candidates[c]];
+				if (box.distanceSquared(light.center) <= light.radius * light.radius)
+					out.push_back(candidates[c]);
+			}
+			cluster_grid[cluster * 2 + 0] = offset;	// relative to the slice until merged below
+			cluster_grid[cluster * 2 + 1] = (unsigned int)out.size() - offset;
+		}
+	});
+
+	light_indices.clear();
+	frame_stats = ClusterStats();
+	frame_stats.lights = (int)lights.size();
+	for (int s = 0; s < CLUSTER_SLICES; s++)
+	{
+		unsigned int base = (unsigned int)light_indices.size();
+		for (int tile = 0; tile < CLUSTER_TILES_X * CLUSTER_TILES_Y; tile++)
+		{
+			int cluster = s * CLUSTER_TILES_X * CLUSTER_TILES_Y + tile;
+			cluster_grid[cluster * 2 + 0] += base;
+			int count = (int)cluster_grid[cluster * 2 + 1];
+			if (count > 0)
+				frame_stats.occupied_clusters++;
+			frame_stats.max_lights_per_cluster = max(frame_stats.max_lights_per_cluster, count);
+		}
+		light_indices.insert(light_indices.end(), slice_indices[s].begin(), slice_indices[s].end());
+	}
+	frame_stats.index_count = (int)light_indices.size();
+	frame_stats.assign_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////////////////////////////////
+// LightClusters.h
+// ===============
+// Clustered forward lighting: the view frustum is split into screen tiles and
+// depth slices, and every cluster gets the list of lights whose range reaches
+// it. Assignment runs on the CPU thread pool, the fragment shader only loops
+// over the lights of its own cluster.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIGHT_CLUSTERS_H_DEF
+#define LIGHT_CLUSTERS_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "SceneBVH.h"
+#include "ThreadPool.h"
+
+const int CLUSTER_TILES_X = 16;
+const int CLUSTER_TILES_Y = 9;
+const int CLUSTER_SLICES = 24;
+const int CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+const float CLUSTER_MIN_NEAR = 0.1f;				// everything nearer falls into the first slice
+const float LIGHT_ATTENUATION_CUTOFF = 1.0f / 128.0f;	// light is ignored once it drops below this
+
+// view-space bounding sphere of a light
+struct LightSphere
+{
+	Vector3 center;
+	float radius;
+};
+
+struct ClusterStats
+{
+	int lights = 0;
+	int occupied_clusters = 0;
+	int max_lights_per_cluster = 0;
+	int index_count = 0;
+	double assign_ms = 0.0;
+};
+
+// distance at which the brightest channel of intensity, attenuated by
+// 1 / (constant + linear * d + quadratic * d^2), falls below LIGHT_ATTENUATION_CUTOFF
+float LightRange(const Vector3& intensity, float constant, float linear, float quadratic, float max_range);
+// tight sphere around a spot light cone, cutoff is the half angle in degrees
+LightSphere SpotLightBounds(const Vector3& position, const Vector3& direction, float range, float cutoff);
+
+class LightClusterGrid
+{
+public:
+	// rebuilds the cluster bounds when the projection changed
+	void		setProjection(const Matrix4& projection, float near_clip, float far_clip, bool perspective);
+	void		assign(const std::vector<LightSphere>& lights, ThreadPool& pool);
+
+	// slice = log(depth) * scale + bias for perspective, depth * scale + bias otherwise
+	float		depthScale() const { return depth_scale; }
+	float		depthBias() const { return depth_bias; }
+	bool		logDepth() const { return log_depth; }
+
+	// (offset, count) into indices() for every cluster, x fastest then y then slice
+	const std::vector<unsigned int>& grid() const { return cluster_grid; }
+	const std::vector<unsigned int>& indices() const { return light_indices; }
+	const ClusterStats& stats() const { return frame_stats; }
+
+private:
+	float		sliceDepth(int slice) const;
+
+	Matrix4		cur_projection;
+	float		cur_near = 0.0f, cur_far = 0.0f;
+	bool		log_depth = true;
+	float		depth_scale = 0.0f, depth_bias = 0.0f;
+	std::vector<AABB>	cluster_bounds;		// view space
+	std::vector<unsigned int>	cluster_grid;
+	std::vector<unsigned int>	light_indices;
+	std::vector<std::vector<unsigned int> > slice_indices;	// per slice scratch of the parallel pass
+	ClusterStats	frame_stats;
+};
+
+#endif
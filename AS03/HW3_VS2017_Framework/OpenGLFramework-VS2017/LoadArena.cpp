@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////////////////////////
+// LoadArena.cpp
+// =============
+// Linear arena for the temporaries of one model load, and the heap counters.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <algorithm>
+#include "LoadArena.h"
+
+using namespace std;
+
+LoadArena::LoadArena() : current(0), used(0), peak(0), allocations(0)
+{
+}
+
+LoadArena::~LoadArena()
+{
+	release();
+}
+
+void* LoadArena::allocate(size_t bytes, size_t alignment)
+{
+	allocations++;
+	for (;;)
+	{
+		if (current < blocks.size())
+		{
+			Block& b = blocks[current];
+			size_t start = (b.offset + alignment - 1) & ~(alignment - 1);
+			if (start + bytes <= b.size)
+			{
+				used += start + bytes - b.offset;
+				peak = max(peak, used);
+				b.offset = start + bytes;
+				return b.data + start;
+			}
+			// the rest of this block is lost until a rewind
+			used += b.size - b.offset;
+			b.offset = b.size;
+			if (current + 1 < blocks.size() && blocks[current + 1].size >= bytes + alignment)
+			{
+				blocks[++current].offset = 0;
+				continue;
+			}
+		}
+		// the blocks after the current one are too small for this request, drop them
+		while (blocks.size() > current + 1)
+		{
+			free(blocks.back().data);
+			blocks.pop_back();
+		}
+		size_t size = blocks.empty() ? LOAD_ARENA_BLOCK_SIZE : blocks.back().size * 2;
+		Block block = { (char*)malloc(max(size, bytes + alignment)), max(size, bytes + alignment), 0 };
+		if (!block.data)
+			throw bad_alloc();
+		blocks.push_back(block);
+		current = blocks.size() - 1;
+	}
+}
+
+LoadArena::Mark LoadArena::mark() const
+{
+	Mark m = { current, current < blocks.size() ? blocks[current].offset : 0 };
+	return m;
+}
+
+void LoadArena::rewind(const Mark& m)
+{
+	if (m.block >= blocks.size())
+		return;
+	current = m.block;
+	blocks[current].offset = m.offset;
+	used = m.offset;
+	for (size_t i = 0; i < current; i++)
+		used += blocks[i].size;
+}
+
+void LoadArena::release()
+{
+	for (size_t i = 0; i < blocks.size(); i++)
+		free(blocks[i].data);
+	blocks.clear();
+	current = 0;
+	used = 0;
+}
+
+size_t LoadArena::reservedBytes() const
+{
+	size_t total = 0;
+	for (size_t i = 0; i < blocks.size(); i++)
+		total += blocks[i].size;
+	return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// heap counters, only with LOAD_ARENA_COUNT_HEAP
+// every allocation carries its size in a header sized to keep the default
+// new alignment, so delete knows how much goes away
+///////////////////////////////////////////////////////////////////////////////
+#ifdef LOAD_ARENA_COUNT_HEAP
+
+static const size_t HEAP_HEADER = 16;
+
+static atomic<size_t> heap_allocations(0);
+static atomic<size_t> heap_live(0);
+static atomic<size_t> heap_peak(0);
+
+HeapStats GetHeapStats()
+{
+	HeapStats s = { heap_allocations.load(), heap_live.load(), heap_peak.load() };
+	return s;
+}
+
+void ResetHeapPeak()
+{
+	heap_peak = heap_live.load();
+}
+
+static void* CountedAlloc(size_t size)
+{
+	char* p = (char*)malloc(size + HEAP_HEADER);
+	if (!p)
+		return NULL;
+	*(size_t*)p = size;
+	heap_allocations.fetch_add(1, memory_order_relaxed);
+	size_t live = heap_live.fetch_add(size, memory_order_relaxed) + size;
+	size_t peak = heap_peak.load(memory_order_relaxed);
+	while (live > peak && !heap_peak.compare_exchange_weak(peak, live, memory_order_relaxed))
+		;
+	return p + HEAP_HEADER;
+}
+
+static void CountedFree(void* ptr)
+{
+	if (!ptr)
+		return;
+	char* p = (char*)ptr - HEAP_HEADER;
+	heap_live.fetch_sub(*(size_t*)p, memory_order_relaxed);
+	free(p);
+}
+
+void* operator new(size_t size)
+{
+	void* p = CountedAlloc(size);
+	if (!p)
+		throw bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	return CountedAlloc(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+	return CountedAlloc(size);
+}
+
+void operator delete(void* p) noexcept { CountedFree(p); }
+void operator delete[](void* p) noexcept { CountedFree(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { CountedFree(p); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p); }
+
+#else
+
+HeapStats GetHeapStats()
+{
+	HeapStats s = { 0, 0, 0 };
+	return s;
+}
+
+void ResetHeapPeak()
+{
+}
+
+#endif
@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// LoadArena.h
+// ===========
+// Linear arena for the temporaries of one model load. Allocations bump an
+// offset inside large blocks, freeing single buffers is a no-op, and the arena
+// is rewound to a mark or released as a whole. ArenaVector is a std::vector on
+// top of it, meant to be reserved to its exact size before it is filled.
+//
+// Built with LOAD_ARENA_COUNT_HEAP defined, process-wide heap counters replace
+// the global operator new/delete, so a load can report how many heap
+// allocations it made and its peak heap use. Without it the counters stay zero
+// and the allocator is left alone.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LOAD_ARENA_H_DEF
+#define LOAD_ARENA_H_DEF
+
+#include <cstddef>
+#include <vector>
+
+const size_t LOAD_ARENA_BLOCK_SIZE = 1 << 20;	// bytes of the first block, each new one doubles
+
+class LoadArena
+{
+public:
+	struct Mark
+	{
+		size_t block;
+		size_t offset;
+	};
+
+	// rewinds to where the arena was when it was made, declare it before the
+	// containers it should outlive
+	class Scope
+	{
+	public:
+		explicit Scope(LoadArena& arena) : arena(arena), start(arena.mark()) {}
+		~Scope() { arena.rewind(start); }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		LoadArena&	arena;
+		Mark		start;
+	};
+
+	LoadArena();
+	~LoadArena();
+	LoadArena(const LoadArena&) = delete;
+	LoadArena& operator=(const LoadArena&) = delete;
+
+	void*		allocate(size_t bytes, size_t alignment);
+	// everything allocated after the mark is dropped, the blocks are kept for reuse
+	Mark		mark() const;
+	void		rewind(const Mark& mark);
+	// frees every block
+	void		release();
+
+	size_t		allocationCount() const { return allocations; }
+	size_t		usedBytes() const { return used; }
+	size_t		peakBytes() const { return peak; }
+	size_t		reservedBytes() const;
+	size_t		blockCount() const { return blocks.size(); }
+
+private:
+	struct Block
+	{
+		char*	data;
+		size_t	size;
+		size_t	offset;
+	};
+
+	std::vector<Block>	blocks;
+	size_t				current;		// block allocations are carved from
+	size_t				used;			// bytes up to the current offset, padding included
+	size_t				peak;
+	size_t				allocations;
+};
+
+// std allocator handing out arena memory, deallocate does nothing
+template <class T>
+struct ArenaAllocator
+{
+	typedef T value_type;
+
+	LoadArena* arena;
+
+	explicit ArenaAllocator(LoadArena& arena) : arena(&arena) {}
+	template <class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T*			allocate(size_t n) { return (T*)arena->allocate(n * sizeof(T), alignof(T)); }
+	void		deallocate(T*, size_t) {}
+
+	template <class U> bool operator==(const ArenaAllocator<U>& rhs) const { return arena == rhs.arena; }
+	template <class U> bool operator!=(const ArenaAllocator<U>& rhs) const { return arena != rhs.arena; }
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+struct HeapStats
+{
+	size_t	allocations;	// operator new calls since start up
+	size_t	live_bytes;
+	size_t	peak_bytes;		// highest live_bytes since the last ResetHeapPeak
+};
+
+#ifdef LOAD_ARENA_COUNT_HEAP
+const bool HEAP_STATS_COUNTED = true;
+#else
+const bool HEAP_STATS_COUNTED = false;
+#endif
+
+// all zeros unless HEAP_STATS_COUNTED
+HeapStats	GetHeapStats();
+void		ResetHeapPeak();
+
+#endif
@@ -0,0 +1,364 @@
+///////////////////////////////////////////////////////////////////////////////
+// Logger.cpp
+// ==========
+// Bounded MPSC ring (per-slot sequence numbers after Vyukov) and the
+// background thread that formats and writes the messages.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+#include "Logger.h"
+
+using namespace std;
+
+static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE is a power of two");
+
+const int LOG_IDLE_WAIT_MS = 50;		// the writer wakes at least this often while idle
+
+atomic<int> log_min_level(LOG_LEVEL_INFO);
+
+struct LogSlot
+{
+	// pos: free for the producer claiming position pos, pos + 1: filled, for the writer
+	atomic<size_t>	sequence;
+	LogRecord		record;
+};
+
+class Logger
+{
+public:
+	Logger();
+	~Logger();
+
+	LogRecord*		begin();
+	void			commit(LogRecord* record);
+	void			flush();
+	void			restartAfterFork();
+
+private:
+	void			start();
+	void			writerLoop();
+	bool			writeNext();
+
+	LogSlot					slots[LOG_QUEUE_SIZE];
+	atomic<size_t>			enqueue_pos;
+	size_t					dequeue_pos;		// writer thread only
+	atomic<size_t>			written;			// slots the writer is done with
+	atomic<size_t>			dropped;
+	size_t					dropped_reported;
+
+	thread*					writer;
+	mutex					writer_mutex;
+	condition_variable		wake;
+	condition_variable		drained;
+	atomic<bool>			writer_sleeping;
+	bool					quit;
+	string					line;
+};
+
+static Logger& GetLogger();
+
+#ifndef _WIN32
+static void RestartLoggerInChild()
+{
+	GetLogger().restartAfterFork();
+}
+#endif
+
+Logger::Logger()
+	: enqueue_pos(0), dequeue_pos(0), written(0), dropped(0), dropped_reported(0),
+	  writer(NULL), writer_sleeping(false), quit(false)
+{
+	for (size_t i = 0; i < LOG_QUEUE_SIZE; i++)
+		slots[i].sequence.store(i, memory_order_relaxed);
+#ifndef _WIN32
+	// the writer thread does not survive fork(), the child starts its own
+	pthread_atfork(NULL, NULL, RestartLoggerInChild);
+#endif
+	start();
+}
+
+Logger::~Logger()
+{
+	{
+		lock_guard<mutex> lock(writer_mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	if (writer) {
+		writer->join();
+		delete writer;
+	}
+}
+
+void Logger::start()
+{
+	writer = new thread(&Logger::writerLoop, this);
+}
+
+void Logger::restartAfterFork()
+{
+	// only the forking thread exists in the child; the old writer's thread
+	// object cannot be joined or destroyed, and its locks may be held
+	writer = NULL;
+	new (&writer_mutex) mutex();
+	new (&wake) condition_variable();
+	new (&drained) condition_variable();
+	writer_sleeping = false;
+	start();
+}
+
+LogRecord* Logger::begin()
+{
+	size_t pos = enqueue_pos.load(memory_order_relaxed);
+	for (;;)
+	{
+		LogSlot& slot = slots[pos & (LOG_QUEUE_SIZE - 1)];
+		intptr_t diff = (intptr_t)slot.sequence.load(memory_order_acquire) - (intptr_t)pos;
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+				return &slot.record;
+		}
+		else if (diff < 0) {
+			// the writer has not freed this slot yet, the ring is full
+			dropped.fetch_add(1, memory_order_relaxed);
+			return NULL;
+		}
+		else
+			pos = enqueue_pos.load(memory_order_relaxed);
+	}
+}
+
+void Logger::commit(LogRecord* record)
+{
+	LogSlot* slot = (LogSlot*)((char*)record - offsetof(LogSlot, record));
+	// seq_cst pairs with the writer announcing that it sleeps, so one of the two sees the other
+	slot->sequence.store(slot->sequence.load(memory_order_relaxed) + 1, memory_order_seq_cst);
+	if (writer_sleeping.load(memory_order_seq_cst)) {
+		lock_guard<mutex> lock(writer_mutex);
+		wake.notify_one();
+	}
+}
+
+void Logger::flush()
+{
+	size_t target = enqueue_pos.load();
+	unique_lock<mutex> lock(writer_mutex);
+	wake.notify_one();
+	while (written.load() < target && writer)
+		drained.wait_for(lock, chrono::milliseconds(LOG_IDLE_WAIT_MS));
+}
+
+// one printf conversion of a captured argument
+static void FormatArg(string& out, const char* spec, size_t spec_length, char conversion, const LogRecord& r, const LogArg& a)
+{
+	// the spec without its length modifiers, the argument decides those
+	char f[32];
+	size_t n = 0;
+	for (size_t i = 0; i < spec_length && n + 4 < sizeof(f); i++)
+	{
+		if (!strchr("hljztL", spec[i]))
+			f[n++] = spec[i];
+	}
+	char buffer[512];
+	int length = 0;
+	switch (conversion)
+	{
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+	{
+		unsigned long long u = a.type == LogArg::Float ? (unsigned long long)(long long)a.d : a.u;
+		if (a.size < 8 && a.type != LogArg::Float)
+			u &= (1ULL << (a.size * 8)) - 1;
+		f[n++] = 'l';
+		f[n++] = 'l';
+		f[n++] = conversion == 'c' ? 'd' : conversion;
+		f[n] = '\0';
+		if (conversion == 'c')
+			length = snprintf(buffer, sizeof(buffer), "%c", (int)u);
+		else if (conversion == 'd' || conversion == 'i')
+			length = snprintf(buffer, sizeof(buffer), f, a.type == LogArg::Float ? (long long)a.d : a.i);
+		else
+			length = snprintf(buffer, sizeof(buffer), f, u);
+		break;
+	}
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		f[n++] = conversion;
+		f[n] = '\0';
+		length = snprintf(buffer, sizeof(buffer), f, a.type == LogArg::Float ? a.d : a.type == LogArg::Signed ? (double)a.i : (double)a.u);
+		break;
+	case 's':
+		f[n++] = 's';
+		f[n] = '\0';
+		length = snprintf(buffer, sizeof(buffer), f, a.type == LogArg::Text ? r.text + a.text_offset : "(not a string)");
+		break;
+	case 'p':
+		length = snprintf(buffer, sizeof(buffer), "%p", a.p);
+		break;
+	default:
+		break;
+	}
+	out.append(buffer, min(max(length, 0), (int)sizeof(buffer) - 1));
+}
+
+static void FormatRecord(string& out, const LogRecord& r)
+{
+	out.clear();
+	int arg = 0;
+	for (const char* p = r.format; *p; p++)
+	{
+		if (*p != '%') {
+			out += *p;
+			continue;
+		}
+		if (p[1] == '%') {
+			out += '%';
+			p++;
+			continue;
+		}
+		// %[flags][width][.precision][length]conversion
+		const char* spec = p;
+		const char* c = p + 1;
+		while (*c && !strchr("diuxXocfFeEgGaAsp", *c))
+			c++;
+		if (!*c)
+			break;
+		if (arg < r.arg_count)
+			FormatArg(out, spec, c - spec, *c, r, r.args[arg++]);
+		p = c;
+	}
+	if (r.skipped > 0) {
+		char buffer[48];
+		snprintf(buffer, sizeof(buffer), " (%u similar skipped)", r.skipped);
+		out += buffer;
+	}
+	out += '\n';
+}
+
+bool Logger::writeNext()
+{
+	LogSlot& slot = slots[dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+	if (slot.sequence.load(memory_order_acquire) != dequeue_pos + 1)
+		return false;
+	FormatRecord(line, slot.record);
+	fwrite(line.data(), 1, line.size(), slot.record.level >= LOG_LEVEL_WARN ? stderr : stdout);
+	slot.sequence.store(dequeue_pos + LOG_QUEUE_SIZE, memory_order_release);
+	dequeue_pos++;
+	written.fetch_add(1);
+	return true;
+}
+
+void Logger::writerLoop()
+{
+	for (;;)
+	{
+		bool any = false;
+		while (writeNext())
+			any = true;
+		size_t drops = dropped.load(memory_order_relaxed);
+		if (drops != dropped_reported) {
+			fprintf(stderr, "Logger: %d messages dropped, the queue was full\n", (int)(drops - dropped_reported));
+			dropped_reported = drops;
+		}
+		if (any) {
+			fflush(stdout);
+			lock_guard<mutex> lock(writer_mutex);
+			drained.notify_all();
+		}
+
+		unique_lock<mutex> lock(writer_mutex);
+		writer_sleeping.store(true, memory_order_seq_cst);
+		// a commit that missed the flag is visible here
+		LogSlot& next = slots[dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+		bool ready = next.sequence.load(memory_order_seq_cst) == dequeue_pos + 1;
+		if (!ready) {
+			if (quit)
+				break;
+			wake.wait_for(lock, chrono::milliseconds(LOG_IDLE_WAIT_MS));
+		}
+		writer_sleeping.store(false, memory_order_relaxed);
+	}
+	fflush(stdout);
+	drained.notify_all();
+}
+
+static Logger& GetLogger()
+{
+	static Logger logger;
+	return logger;
+}
+
+void SetLogLevel(LogLevel level)
+{
+	log_min_level.store(level);
+}
+
+bool ParseLogLevel(const char* name, LogLevel& level)
+{
+	static const char* NAMES[4] = { "debug", "info", "warn", "error" };
+	for (int i = 0; i < 4; i++)
+	{
+		if (strcmp(name, NAMES[i]) == 0) {
+			level = (LogLevel)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+LogRecord* LogBegin(LogLevel level, const char* format)
+{
+	LogRecord* r = GetLogger().begin();
+	if (r) {
+		r->format = format;
+		r->level = (unsigned char)level;
+		r->text_used = 0;
+	}
+	return r;
+}
+
+void LogCommit(LogRecord* record)
+{
+	GetLogger().commit(record);
+}
+
+void LogFlush()
+{
+	GetLogger().flush();
+}
+
+void LogCaptureText(LogRecord& r, LogArg& a, const char* s, size_t length)
+{
+	a.type = LogArg::Text;
+	size_t room = LOG_TEXT_BYTES - r.text_used;
+	if (room == 0) {
+		// out of text space, point at the terminator of the previous string
+		a.text_offset = LOG_TEXT_BYTES - 1;
+		return;
+	}
+	length = min(length, room - 1);
+	memcpy(r.text + r.text_used, s, length);
+	r.text[r.text_used + length] = '\0';
+	a.text_offset = r.text_used;
+	r.text_used = (unsigned short)(r.text_used + length + 1);
+}
+
+bool LogRateLimit::allow(unsigned int& skipped_since)
+{
+	long long now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+	long long next = next_ns.load(memory_order_relaxed);
+	if (now < next || !next_ns.compare_exchange_strong(next, now + interval_ns, memory_order_relaxed)) {
+		skipped.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+	skipped_since = skipped.exchange(0, memory_order_relaxed);
+	return true;
+}
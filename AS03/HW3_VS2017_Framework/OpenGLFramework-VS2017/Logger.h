@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////
+// Logger.h
+// ========
+// Asynchronous logging for the input callbacks and setup paths. A LOG_* call
+// only copies the format string pointer and its arguments into a slot of a
+// lock-free multi-producer ring; a background thread formats the message
+// printf-style and writes it, INFO and DEBUG to stdout, WARN and ERROR to
+// stderr. When the ring is full messages are dropped and counted rather than
+// blocking the caller.
+//
+// The format must be a string literal. String arguments (const char*,
+// std::string) are copied, up to LOG_TEXT_BYTES per message in total. Lines
+// end without "\n", the logger adds it.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LOGGER_H_DEF
+#define LOGGER_H_DEF
+
+#include <string>
+#include <atomic>
+#include <type_traits>
+
+enum LogLevel { LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR };
+
+const int LOG_MAX_ARGS = 8;
+const int LOG_TEXT_BYTES = 192;
+const int LOG_QUEUE_SIZE = 1024;		// slots, a power of two
+
+struct LogArg
+{
+	enum Type : unsigned char { Signed, Unsigned, Float, Pointer, Text };
+	Type			type;
+	unsigned char	size;			// bytes of the integer passed, for %x and %u of negative values
+	unsigned short	text_offset;	// Text: start in LogRecord::text
+	union
+	{
+		long long			i;
+		unsigned long long	u;
+		double				d;
+		const void*			p;
+	};
+};
+
+struct LogRecord
+{
+	const char*		format;
+	unsigned char	level;
+	unsigned char	arg_count;
+	unsigned short	text_used;
+	unsigned int	skipped;		// rate limited messages of the same call site since this one's last
+	LogArg			args[LOG_MAX_ARGS];
+	char			text[LOG_TEXT_BYTES];
+};
+
+extern std::atomic<int> log_min_level;
+
+inline bool		LogEnabled(LogLevel level) { return level >= log_min_level.load(std::memory_order_relaxed); }
+void			SetLogLevel(LogLevel level);
+// parses debug, info, warn or error
+bool			ParseLogLevel(const char* name, LogLevel& level);
+
+// a slot of the ring to fill in, NULL when the ring is full; every slot taken has to be committed
+LogRecord*		LogBegin(LogLevel level, const char* format);
+void			LogCommit(LogRecord* record);
+// returns once everything logged so far is written
+void			LogFlush();
+
+// argument capture, integers and enums keep their signedness and size
+template <class T>
+inline void LogCapture(LogRecord& /*r*/, LogArg& a, const T& v, std::true_type /*arithmetic*/)
+{
+	if (std::is_floating_point<T>::value) {
+		a.type = LogArg::Float;
+		a.d = (double)v;
+	}
+	else if (std::is_signed<T>::value) {
+		a.type = LogArg::Signed;
+		a.i = (long long)v;
+	}
+	else {
+		a.type = LogArg::Unsigned;
+		a.u = (unsigned long long)v;
+	}
+	a.size = (unsigned char)sizeof(T);
+}
+
+template <class T>
+inline void LogCapture(LogRecord& r, LogArg& a, const T& v, std::false_type)
+{
+	static_assert(std::is_pointer<T>::value || std::is_enum<T>::value, "log arguments are numbers, pointers or strings");
+	LogCapture(r, a, v, std::integral_constant<bool, std::is_enum<T>::value>());
+}
+
+template <class T>
+inline void LogCapture(LogRecord& /*r*/, LogArg& a, T* const& v, std::false_type)
+{
+	a.type = LogArg::Pointer;
+	a.p = v;
+}
+
+void			LogCaptureText(LogRecord& r, LogArg& a, const char* s, size_t length);
+
+template <class T>
+inline void LogCapture(LogRecord& r, LogArg& a, const T& v)
+{
+	LogCapture(r, a, v, std::integral_constant<bool, std::is_arithmetic<T>::value>());
+}
+inline void LogCapture(LogRecord& r, LogArg& a, const char* s) { LogCaptureText(r, a, s, s ? std::char_traits<char>::length(s) : 0); }
+inline void LogCapture(LogRecord& r, LogArg& a, char* s) { LogCapture(r, a, (const char*)s); }
+inline void LogCapture(LogRecord& r, LogArg& a, const std::string& s) { LogCaptureText(r, a, s.c_str(), s.size()); }
+template <size_t N>
+inline void LogCapture(LogRecord& r, LogArg& a, const char (&s)[N]) { LogCapture(r, a, (const char*)s); }
+
+template <class... Args>
+inline void LogMessageSkipped(LogLevel level, unsigned int skipped, const char* format, const Args&... args)
+{
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+	if (!LogEnabled(level))
+		return;
+	LogRecord* r = LogBegin(level, format);
+	if (!r)
+		return;
+	r->skipped = skipped;
+	r->arg_count = (unsigned char)sizeof...(Args);
+	int i = 0;
+	int expand[] = { 0, (LogCapture(*r, r->args[i++], args), 0)... };
+	(void)expand;
+	LogCommit(r);
+}
+
+template <class... Args>
+inline void LogMessage(LogLevel level, const char* format, const Args&... args)
+{
+	LogMessageSkipped(level, 0, format, args...);
+}
+
+// lets one message per interval through, counting the rest
+class LogRateLimit
+{
+public:
+	explicit LogRateLimit(int interval_ms) : interval_ns(interval_ms * 1000000LL), next_ns(0), skipped(0) {}
+	bool			allow(unsigned int& skipped_since);
+
+private:
+	long long				interval_ns;
+	std::atomic<long long>	next_ns;
+	std::atomic<unsigned int> skipped;
+};
+
+#define LOG_DEBUG(...)	LogMessage(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)	LogMessage(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)	LogMessage(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...)	LogMessage(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// at most one message every interval_ms from this call site, e.g. for mouse move events;
+// the next one that gets through says how many were skipped
+#define LOG_EVERY(level, interval_ms, ...) \
+	do { \
+		static LogRateLimit log_rate_limit(interval_ms); \
+		unsigned int log_skipped; \
+		if (LogEnabled(level) && log_rate_limit.allow(log_skipped)) \
+			LogMessageSkipped(level, log_skipped, __VA_ARGS__); \
+	} while (0)
+
+#endif
@@ -0,0 +1,705 @@
+///////////////////////////////////////////////////////////////////////////////
+// MathBenchmark.cpp
+// =================
+// Timing loops and double-precision reference checks for Matrices/Vectors.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "MathCore.h"
+#include "Quaternion.h"
+#include "MathBenchmark.h"
+
+using namespace std;
+
+const int MATH_BENCH_REPEATS = 5;				// best of, against scheduling noise
+const long long MATH_BENCH_OPS = 1 << 22;		// operations per timing, split over the array size
+const long long MATH_BENCH_QUICK_OPS = 1 << 18;
+const int MATH_BENCH_CHECK_SAMPLES = 1000;
+
+// keeps the optimizer from dropping the loops
+static volatile float bench_sink;
+
+struct MathBenchResult
+{
+	string name;
+	int size;				// 1 for the single value chain
+	double ns_per_op;
+	double gflops;			// < 0 for operations without a fixed flop count
+};
+
+struct MathCheckResult
+{
+	string name;
+	double max_error;		// relative to max(1, |reference|)
+	double tolerance;
+};
+
+// small deterministic generator, the same inputs on every run
+struct BenchRandom
+{
+	unsigned int seed = 2024;
+	float next(float lo, float hi)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return lo + (hi - lo) * ((seed >> 8) / 16777216.0f);
+	}
+	Vector3 axis()
+	{
+		Vector3 v(next(-1, 1), next(-1, 1), next(0.2f, 1));
+		return v.normalize();
+	}
+	// orthonormal, chains of products stay bounded
+	Matrix4 rotation()
+	{
+		Matrix4 m;
+		return m.rotate(next(-180, 180), axis());
+	}
+	// translate * rotate * scale, well conditioned
+	Matrix4 affine()
+	{
+		Matrix4 m;
+		m.scale(next(0.5f, 2.0f), next(0.5f, 2.0f), next(0.5f, 2.0f));
+		m.rotate(next(-180, 180), axis());
+		m.translate(next(-5, 5), next(-5, 5), next(-5, 5));
+		return m;
+	}
+	// affine with a small projective row, inverted through invertGeneral
+	Matrix4 general()
+	{
+		Matrix4 m = affine();
+		m[12] = next(-0.2f, 0.2f);
+		m[13] = next(-0.2f, 0.2f);
+		m[14] = next(-0.2f, 0.2f);
+		return m;
+	}
+	void fill(vector<Vector3>& v) { for (Vector3& e : v) e = Vector3(next(-2, 2), next(-2, 2), next(-2, 2)); }
+	void fill(vector<Vector4>& v) { for (Vector4& e : v) e = Vector4(next(-2, 2), next(-2, 2), next(-2, 2), 1.0f); }
+	void fill(vector<Matrix4>& v) { for (Matrix4& e : v) e = affine(); }
+};
+
+// time body(reps) and return the best ns per operation
+template <class Body>
+static double TimeBest(Body body, long long ops)
+{
+	double best = 1e30;
+	for (int r = 0; r < MATH_BENCH_REPEATS; r++)
+	{
+		auto start = chrono::steady_clock::now();
+		body();
+		double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+		best = min(best, ns / ops);
+	}
+	return best;
+}
+
+static void Report(vector<MathBenchResult>& results, const string& name, int size, double ns_per_op, double flops_per_op)
+{
+	MathBenchResult r = { name, size, ns_per_op, flops_per_op > 0 ? flops_per_op / ns_per_op : -1.0 };
+	results.push_back(r);
+	if (r.gflops >= 0)
+		printf("  %-26s %8d %10.2f %10.3f\n", name.c_str(), size, ns_per_op, r.gflops);
+	else
+		printf("  %-26s %8d %10.2f %10s\n", name.c_str(), size, ns_per_op, "-");
+}
+
+// a matrix operation out = op(a, b) on arrays, and as a chain where every result feeds the next call
+template <class Op>
+static void BenchMatrixOp(vector<MathBenchResult>& results, const string& name, double flops, const vector<int>& sizes,
+						  long long total_ops, Op op)
+{
+	BenchRandom random;
+	const int operand_count = 64;		// second operands are cycled, they stay in cache
+	vector<Matrix4> operands(operand_count);
+	for (int i = 0; i < operand_count; i++)
+		operands[i] = random.rotation();
+
+	// single value: a dependent chain measures latency
+	{
+		Matrix4 value = random.affine();
+		long long ops = total_ops / 4;
+		double ns = TimeBest([&]() {
+			for (long long i = 0; i < ops; i++)
+				value = op(value, operands[i & (operand_count - 1)]);
+			bench_sink = value[0];
+		}, ops);
+		Report(results, name, 1, ns, flops);
+	}
+
+	for (int size : sizes)
+	{
+		vector<Matrix4> in(size), out(size);
+		for (int i = 0; i < size; i++)
+			in[i] = random.affine();
+		int passes = (int)max(1LL, total_ops / size);
+		double ns = TimeBest([&]() {
+			for (int p = 0; p < passes; p++)
+			{
+				for (int i = 0; i < size; i++)
+					out[i] = op(in[i], operands[i & (operand_count - 1)]);
+				bench_sink = out[p % size][0];
+			}
+		}, (long long)passes * size);
+		Report(results, name, size, ns, flops);
+	}
+}
+
+// one matrix applied to a chain of vectors and to arrays of them, the usual per-vertex pattern
+template <class Vec, class Op>
+static void BenchTransformOp(vector<MathBenchResult>& results, const string& name, double flops, const vector<int>& sizes,
+							 long long total_ops, Op op)
+{
+	BenchRandom random;
+	Matrix4 matrix = random.rotation();
+	{
+		Vec value = Vec(random.axis().x, random.axis().y, random.axis().z, 1.0f);
+		long long ops = total_ops;
+		double ns = TimeBest([&]() {
+			for (long long i = 0; i < ops; i++)
+				value = op(matrix, value);
+			bench_sink = value.x;
+		}, ops);
+		Report(results, name, 1, ns, flops);
+	}
+
+	for (int size : sizes)
+	{
+		vector<Vec> in(size), out(size);
+		for (int i = 0; i < size; i++)
+			in[i] = Vec(random.next(-2, 2), random.next(-2, 2), random.next(-2, 2), 1.0f);
+		int passes = (int)max(1LL, total_ops / size);
+		double ns = TimeBest([&]() {
+			for (int p = 0; p < passes; p++)
+			{
+				for (int i = 0; i < size; i++)
+					out[i] = op(matrix, in[i]);
+				bench_sink = out[p % size].x;
+			}
+		}, (long long)passes * size);
+		Report(results, name, size, ns, flops);
+	}
+}
+
+// same for Vector3 operations returning Vector3 or float
+template <class Op>
+static void BenchVectorOp(vector<MathBenchResult>& results, const string& name, double flops, const vector<int>& sizes,
+						  long long total_ops, Op op)
+{
+	BenchRandom random;
+	{
+		Vector3 value = random.axis(), other = random.axis();
+		long long ops = total_ops;
+		double ns = TimeBest([&]() {
+			for (long long i = 0; i < ops; i++)
+				value = op(value, other);
+			bench_sink = value.x;
+		}, ops);
+		Report(results, name, 1, ns, flops);
+	}
+
+	for (int size : sizes)
+	{
+		vector<Vector3> a(size), b(size), out(size);
+		for (int i = 0; i < size; i++)
+		{
+			a[i] = random.axis() * random.next(0.5f, 2.0f);
+			b[i] = random.axis() * random.next(0.5f, 2.0f);
+		}
+		int passes = (int)max(1LL, total_ops / size);
+		double ns = TimeBest([&]() {
+			for (int p = 0; p < passes; p++)
+			{
+				for (int i = 0; i < size; i++)
+					out[i] = op(a[i], b[i]);
+				bench_sink = out[p % size].x;
+			}
+		}, (long long)passes * size);
+		Report(results, name, size, ns, flops);
+	}
+}
+
+// a batch call over whole arrays, op(matrix, in, out, size), for the SIMD kernels in Matrices.h
+template <class In, class Out, class Op>
+static void BenchBatchOp(vector<MathBenchResult>& results, const string& name, double flops, const vector<int>& sizes,
+						 long long total_ops, Op op)
+{
+	BenchRandom random;
+	Matrix4 matrix = random.rotation();
+	for (int size : sizes)
+	{
+		vector<In> in(size);
+		vector<Out> out(size);
+		random.fill(in);
+		int passes = (int)max(1LL, total_ops / size);
+		double ns = TimeBest([&]() {
+			for (int p = 0; p < passes; p++)
+			{
+				op(matrix, &in[0], &out[0], size);
+				bench_sink = *(const float*)&out[p % size];
+			}
+		}, (long long)passes * size);
+		Report(results, name, size, ns, flops);
+	}
+}
+
+// normalizeVectors over three separate coordinate arrays, renormalized in place every pass
+static void BenchNormalizeSoA(vector<MathBenchResult>& results, const string& name, double flops, const vector<int>& sizes,
+							  long long total_ops)
+{
+	BenchRandom random;
+	for (int size : sizes)
+	{
+		vector<float> x(size), y(size), z(size);
+		for (int i = 0; i < size; i++)
+		{
+			x[i] = random.next(-2, 2);
+			y[i] = random.next(-2, 2);
+			z[i] = random.next(-2, 2);
+		}
+		int passes = (int)max(1LL, total_ops / size);
+		double ns = TimeBest([&]() {
+			for (int p = 0; p < passes; p++)
+			{
+				normalizeVectors(&x[0], &y[0], &z[0], size);
+				bench_sink = x[p % size];
+			}
+		}, (long long)passes * size);
+		Report(results, name, size, ns, flops);
+	}
+}
+
+// a vector over many orders of magnitude, with the occasional zero
+static Vector3 WideRangeVector(BenchRandom& random)
+{
+	if (random.next(0, 1) < 0.02f)
+		return Vector3(0, 0, 0);
+	float magnitude = powf(10.0f, random.next(-8, 8));
+	return Vector3(random.next(-1, 1), random.next(-1, 1), random.next(-1, 1)) * magnitude;
+}
+
+// largest component error of a batch normalized vector against the double precision unit vector
+static double NormalizeError(double x, double y, double z, const float* result)
+{
+	double length = sqrt(x * x + y * y + z * z);
+	double ref[3] = { x, y, z };
+	double e = 0.0;
+	for (int i = 0; i < 3; i++)
+		e = max(e, length * length < 1e-20 ? fabs(result[i] - ref[i]) : fabs(result[i] - ref[i] / length));
+	return e;
+}
+
+// the double precision references come from the MathCore templates, and
+// its constexpr paths are checked here at compile time
+constexpr Matrix4d CHECK_TRANSFORM = MakeTranslation(1.0, -2.0, 4.0) * MakeScaling(2.0, 4.0, 0.5);
+static_assert(Inverse(CHECK_TRANSFORM) * CHECK_TRANSFORM == Matrix4d::Identity(), "constexpr inverse");
+static_assert(Determinant(CHECK_TRANSFORM) == 4.0, "constexpr determinant");
+static_assert((CHECK_TRANSFORM * Vector4d(1.0, 1.0, 1.0, 1.0)) == Vector4d(3.0, 2.0, 4.5, 1.0), "constexpr transform");
+
+static Matrix4d Rotation(double angle, double x, double y, double z)
+{
+	double rad = angle / 180.0 * 3.14159265358979323846;
+	return MakeRotation(cos(rad), sin(rad), x, y, z);
+}
+
+// infinity-norm condition number, inverse errors grow with it
+static double ConditionNumber(const Matrix4d& a, const Matrix4d& inverse)
+{
+	double norm = 0.0, inverse_norm = 0.0;
+	for (int r = 0; r < 4; r++)
+	{
+		double row = 0.0, inverse_row = 0.0;
+		for (int c = 0; c < 4; c++)
+		{
+			row += fabs(a.m[r * 4 + c]);
+			inverse_row += fabs(inverse.m[r * 4 + c]);
+		}
+		norm = max(norm, row);
+		inverse_norm = max(inverse_norm, inverse_row);
+	}
+	return norm * inverse_norm;
+}
+
+static double RelativeError(double value, double reference)
+{
+	return fabs(value - reference) / max(1.0, fabs(reference));
+}
+
+static double MatrixError(const Matrix4& value, const Matrix4d& reference)
+{
+	double e = 0.0;
+	for (int i = 0; i < 16; i++)
+		e = max(e, RelativeError(value[i], reference.m[i]));
+	return e;
+}
+
+// every finite half converts to float and back unchanged
+static double HalfRoundTripErrors()
+{
+	int errors = 0;
+	for (int bits = 0; bits < 0x10000; bits++)
+	{
+		if ((bits & 0x7c00) == 0x7c00 && (bits & 0x3ff))
+			continue;
+		Half h;
+		h.bits = (uint16_t)bits;
+		errors += Half((float)h).bits != bits ? 1 : 0;
+	}
+	return errors;
+}
+
+static vector<MathCheckResult> RunCrossChecks()
+{
+	vector<MathCheckResult> checks;
+	auto add = [&](const char* name, double error, double tolerance) {
+		checks.push_back({ name, error, tolerance });
+	};
+
+	BenchRandom random;
+	double mul = 0, mul_v4 = 0, mul_v3 = 0, inv_affine = 0, inv_general = 0, inv_auto = 0, transpose = 0, rotate = 0;
+	double v_add = 0, v_dot = 0, v_cross = 0, v_norm = 0, v_len = 0;
+	double batch_mul = 0, batch_v4 = 0, batch_p4 = 0, batch_p3 = 0;
+	double gl_mul = 0, gl_transform = 0, core_mul = 0, core_inv = 0, half_mul = 0;
+	double q_euler = 0, q_mul = 0, q_rotate = 0, q_trs = 0, q_slerp = 0, q_arcball = 0;
+	for (int s = 0; s < MATH_BENCH_CHECK_SAMPLES; s++)
+	{
+		Matrix4 a = random.general(), b = random.general(), affine = random.affine();
+		Matrix4d da = FromMatrix4<double>(a), db = FromMatrix4<double>(b), daffine = FromMatrix4<double>(affine);
+
+		mul = max(mul, MatrixError(a * b, da * db));
+
+		Vector4 v4(random.next(-2, 2), random.next(-2, 2), random.next(-2, 2), 1.0f);
+		Vector4 r4 = a * v4;
+		for (int r = 0; r < 4; r++)
+		{
+			double ref = da.m[r * 4] * v4.x + da.m[r * 4 + 1] * v4.y + da.m[r * 4 + 2] * v4.z + da.m[r * 4 + 3] * v4.w;
+			mul_v4 = max(mul_v4, RelativeError(r4[r], ref));
+		}
+		Vector3 v3(v4.x, v4.y, v4.z);
+		Vector3 r3 = a * v3;
+		for (int r = 0; r < 3; r++)
+		{
+			double ref = da.m[r * 4] * v3.x + da.m[r * 4 + 1] * v3.y + da.m[r * 4 + 2] * v3.z;
+			mul_v3 = max(mul_v3, RelativeError(r3[r], ref));
+		}
+
+		// inverse errors are divided by the condition number, what is left is the method's own error
+		Matrix4d inv_a = Inverse(da), inv_affine_ref = Inverse(daffine);
+		double cond_a = ConditionNumber(da, inv_a), cond_affine = ConditionNumber(daffine, inv_affine_ref);
+		Matrix4 m = affine;
+		inv_affine = max(inv_affine, MatrixError(m.invertAffine(), inv_affine_ref) / cond_affine);
+		m = a;
+		inv_general = max(inv_general, MatrixError(m.invertGeneral(), inv_a) / cond_a);
+		m = (s & 1) ? a : affine;
+		inv_auto = max(inv_auto, MatrixError(m.invert(), (s & 1) ? inv_a : inv_affine_ref) / ((s & 1) ? cond_a : cond_affine));
+
+		const float* t = a.getTranspose();
+		for (int r = 0; r < 4; r++)
+			for (int c = 0; c < 4; c++)
+				transpose = max(transpose, RelativeError(t[c * 4 + r], da.m[r * 4 + c]));
+
+		float angle = random.next(-180, 180);
+		Vector3 axis = random.axis();
+		m = b;
+		m.rotate(angle, axis);
+		rotate = max(rotate, MatrixError(m, Rotation(angle, axis.x, axis.y, axis.z) * db));
+
+		Vector3 p = random.axis() * random.next(0.5f, 4.0f), q = random.axis() * random.next(0.5f, 4.0f);
+		Vector3 sum = p + q, cross = p.cross(q), unit = p;
+		unit.normalize();
+		double dot = (double)p.x * q.x + (double)p.y * q.y + (double)p.z * q.z;
+		double len = sqrt((double)p.x * p.x + (double)p.y * p.y + (double)p.z * p.z);
+		for (int i = 0; i < 3; i++)
+		{
+			v_add = max(v_add, RelativeError(sum[i], (double)p[i] + q[i]));
+			int j = (i + 1) % 3, k = (i + 2) % 3;
+			v_cross = max(v_cross, RelativeError(cross[i], (double)p[j] * q[k] - (double)p[k] * q[j]));
+			v_norm = max(v_norm, RelativeError(unit[i], p[i] / len));
+		}
+		v_dot = max(v_dot, RelativeError(p.dot(q), dot));
+		v_len = max(v_len, RelativeError(p.length(), len));
+
+		// the column-major type has to agree with Matrix4 element for element
+		GLMatrix4 gl = GLMatrix4(a) * GLMatrix4(b);
+		Matrix4d ab = da * db;
+		for (int r = 0; r < 4; r++)
+			for (int c = 0; c < 4; c++)
+				gl_mul = max(gl_mul, RelativeError(gl.at(r, c), ab.m[r * 4 + c]));
+		Matrix4 composed = affine;
+		GLMatrix4 gl_composed(affine);
+		composed.translate(p).rotate(angle, axis).scale(q.x, q.y, q.z);
+		gl_composed.translate(p).rotate(angle, axis).scale(q.x, q.y, q.z);
+		gl_transform = max(gl_transform, MatrixError(gl_composed.toMatrix4(), FromMatrix4<double>(composed)));
+
+		// the templates in float and in half storage, half keeps 11 significant bits
+		Matrix4f fa = FromMatrix4(a), fb = FromMatrix4(b);
+		core_mul = max(core_mul, MatrixError(ToMatrix4(fa * fb), ab));
+		core_inv = max(core_inv, MatrixError(ToMatrix4(Inverse(fa)), inv_a) / cond_a);
+		Matrix4h ha = Matrix4h(fa), hb = Matrix4h(fb);
+		half_mul = max(half_mul, MatrixError(ToMatrix4(ha * hb), Matrix4d(ha) * Matrix4d(hb)));
+
+		// quaternions against the matrices they stand for
+		const double rad = 180.0 / 3.14159265358979323846;
+		Vector3 euler(random.next(-3, 3), random.next(-3, 3), random.next(-3, 3));
+		Quaternion qe = Quaternion::FromEuler(euler);
+		Matrix4d euler_ref = Rotation(euler.x * rad, 1, 0, 0) * Rotation(euler.y * rad, 0, 1, 0) * Rotation(euler.z * rad, 0, 0, 1);
+		q_euler = max(q_euler, MatrixError(qe.toMatrix(), euler_ref));
+		Quaternion qa = Quaternion::FromAxisAngle(axis, angle / (float)rad);
+		q_mul = max(q_mul, MatrixError((qa * qe).toMatrix(), Rotation(angle, axis.x, axis.y, axis.z) * euler_ref));
+		Vector3 turned = qe.rotate(p);
+		for (int i = 0; i < 3; i++)
+		{
+			double ref = euler_ref.m[i * 4] * p.x + euler_ref.m[i * 4 + 1] * p.y + euler_ref.m[i * 4 + 2] * p.z;
+			q_rotate = max(q_rotate, RelativeError(turned[i], ref));
+		}
+		Matrix4 trs_ref_f;
+		trs_ref_f.scale(q.x, q.y, q.z);
+		Matrix4d trs_ref = FromMatrix4<double>(trs_ref_f);
+		trs_ref = MakeTranslation<double>(p.x, p.y, p.z) * euler_ref * trs_ref;
+		q_trs = max(q_trs, MatrixError(ComposeTRS(p, qe, q), trs_ref));
+		// the slerp midpoint is half way in angle to both ends
+		Quaternion mid = Slerp(qa, qe, 0.5f);
+		q_slerp = max(q_slerp, fabs((double)acosf(min(1.0f, fabsf(mid.dot(qa)))) - acosf(min(1.0f, fabsf(mid.dot(qe))))));
+		// the arcball rotation takes its first point onto the second
+		Vector3 from = ArcballPoint(random.next(0, 100), random.next(0, 100), 0, 0, 100, 100);
+		Vector3 to = ArcballPoint(random.next(0, 100), random.next(0, 100), 0, 0, 100, 100);
+		Vector3 moved = ArcballRotation(from, to).rotate(from);
+		for (int i = 0; i < 3; i++)
+			q_arcball = max(q_arcball, RelativeError(moved[i], to[i]));
+	}
+
+	// the batch kernels over odd lengths so the scalar tails are covered too
+	for (int s = 0; s < MATH_BENCH_CHECK_SAMPLES / 100; s++)
+	{
+		int count = 1 + s * 7;
+		Matrix4 a = random.general();
+		Matrix4d da = FromMatrix4<double>(a);
+		vector<Matrix4> mats(count), mats_out(count);
+		vector<Vector4> v4(count), v4_out(count), p4_out(count);
+		vector<Vector3> v3(count), p3_out(count);
+		random.fill(mats);
+		random.fill(v4);
+		random.fill(v3);
+		multiplyMatrices(a, &mats[0], &mats_out[0], count);
+		transformVectors(a, &v4[0], &v4_out[0], count);
+		transformPoints(a, &v3[0], &p4_out[0], count);
+		transformPoints(a, &v3[0], &p3_out[0], count);
+		for (int i = 0; i < count; i++)
+		{
+			batch_mul = max(batch_mul, MatrixError(mats_out[i], da * FromMatrix4<double>(mats[i])));
+			for (int r = 0; r < 4; r++)
+			{
+				double ref4 = da.m[r * 4] * v4[i].x + da.m[r * 4 + 1] * v4[i].y + da.m[r * 4 + 2] * v4[i].z + da.m[r * 4 + 3] * v4[i].w;
+				double ref3 = da.m[r * 4] * v3[i].x + da.m[r * 4 + 1] * v3[i].y + da.m[r * 4 + 2] * v3[i].z + da.m[r * 4 + 3];
+				batch_v4 = max(batch_v4, RelativeError(v4_out[i][r], ref4));
+				batch_p4 = max(batch_p4, RelativeError(p4_out[i][r], ref3));
+				if (r < 3)
+					batch_p3 = max(batch_p3, RelativeError(p3_out[i][r], ref3));
+			}
+		}
+	}
+
+	// batch normalization, left unchanged below the length cut off
+	double batch_norm = 0, batch_norm_soa = 0, batch_planes = 0;
+	for (int s = 0; s < MATH_BENCH_CHECK_SAMPLES / 100; s++)
+	{
+		int count = 1 + s * 7;
+		vector<Vector3> v(count), normalized(count);
+		vector<float> x(count), y(count), z(count);
+		vector<Vector4> planes(count), planes_out(count);
+		for (int i = 0; i < count; i++)
+		{
+			v[i] = WideRangeVector(random);
+			x[i] = v[i].x;
+			y[i] = v[i].y;
+			z[i] = v[i].z;
+			planes[i] = Vector4(v[i].x, v[i].y, v[i].z, random.next(-4, 4) * (v[i].length() + 1e-3f));
+		}
+		normalized = v;
+		planes_out = planes;
+		normalizeVectors(&normalized[0], count);
+		normalizeVectors(&x[0], &y[0], &z[0], count);
+		normalizePlanes(&planes_out[0], count);
+		for (int i = 0; i < count; i++)
+		{
+			float soa[3] = { x[i], y[i], z[i] };
+			batch_norm = max(batch_norm, NormalizeError(v[i].x, v[i].y, v[i].z, &normalized[i].x));
+			batch_norm_soa = max(batch_norm_soa, NormalizeError(v[i].x, v[i].y, v[i].z, soa));
+			batch_planes = max(batch_planes, NormalizeError(v[i].x, v[i].y, v[i].z, &planes_out[i].x));
+			// the distance scales with the normal
+			double length = v[i].length() < 1e-10f ? 1.0 : sqrt((double)v[i].x * v[i].x + (double)v[i].y * v[i].y + (double)v[i].z * v[i].z);
+			batch_planes = max(batch_planes, RelativeError(planes_out[i].w, planes[i].w / length));
+		}
+	}
+
+	// float rounding of a few dozen operations
+	add("Matrix4 * Matrix4", mul, 1e-5);
+	add("Matrix4 * Vector4", mul_v4, 1e-5);
+	add("Matrix4 * Vector3", mul_v3, 1e-5);
+	add("multiplyMatrices", batch_mul, 1e-5);
+	add("transformVectors", batch_v4, 1e-5);
+	add("transformPoints -> Vector4", batch_p4, 1e-5);
+	add("transformPoints -> Vector3", batch_p3, 1e-5);
+	add("GLMatrix4 * GLMatrix4", gl_mul, 1e-5);
+	add("GLMatrix4 transforms", gl_transform, 1e-5);
+	add("Matrix4f * Matrix4f", core_mul, 1e-5);
+	add("Inverse(Matrix4f)", core_inv, 1e-6);
+	add("Matrix4h * Matrix4h", half_mul, 1e-3);
+	add("Half round trip", HalfRoundTripErrors(), 0.0);
+	add("Quaternion::FromEuler", q_euler, 1e-5);
+	add("Quaternion * Quaternion", q_mul, 1e-5);
+	add("Quaternion::rotate", q_rotate, 1e-5);
+	add("ComposeTRS", q_trs, 1e-5);
+	add("Slerp midpoint", q_slerp, 1e-3);
+	add("ArcballRotation", q_arcball, 1e-3);
+	add("Matrix4::invertAffine", inv_affine, 1e-6);
+	add("Matrix4::invertGeneral", inv_general, 1e-6);
+	add("Matrix4::invert", inv_auto, 1e-6);
+	add("Matrix4::getTranspose", transpose, 0.0);
+	add("Matrix4::rotate", rotate, 1e-5);
+	add("Vector3 + Vector3", v_add, 1e-6);
+	add("Vector3::dot", v_dot, 1e-5);
+	add("Vector3::cross", v_cross, 1e-5);
+	add("Vector3::normalize", v_norm, 1e-6);
+	add("normalizeVectors", batch_norm, BATCH_NORMALIZE_MAX_ERROR);
+	add("normalizeVectors SoA", batch_norm_soa, BATCH_NORMALIZE_MAX_ERROR);
+	add("normalizePlanes", batch_planes, BATCH_NORMALIZE_MAX_ERROR);
+	add("Vector3::length", v_len, 1e-6);
+	return checks;
+}
+
+static bool WriteMathResults(const char* path, const vector<MathBenchResult>& results, const vector<MathCheckResult>& checks)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+	fprintf(file, "{\n  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const MathBenchResult& r = results[i];
+		fprintf(file, "    {\"name\": \"%s\", \"size\": %d, \"ns_per_op\": %.4f, \"gflops\": ", r.name.c_str(), r.size, r.ns_per_op);
+		if (r.gflops >= 0)
+			fprintf(file, "%.4f}", r.gflops);
+		else
+			fprintf(file, "null}");
+		fprintf(file, "%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n  \"checks\": [\n");
+	for (size_t i = 0; i < checks.size(); i++)
+	{
+		const MathCheckResult& c = checks[i];
+		fprintf(file, "    {\"name\": \"%s\", \"max_error\": %.3e, \"tolerance\": %.3e, \"pass\": %s}%s\n", c.name.c_str(),
+			c.max_error, c.tolerance, c.max_error <= c.tolerance ? "true" : "false", i + 1 < checks.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+int RunMathBenchmark(int argc, char** argv)
+{
+	bool quick = false;
+	const char* results_file = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--quick") == 0)
+			quick = true;
+		else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc)
+			results_file = argv[++i];
+	}
+	long long total_ops = quick ? MATH_BENCH_QUICK_OPS : MATH_BENCH_OPS;
+	vector<int> sizes = quick ? vector<int>{ 1 << 10, 1 << 14 } : vector<int>{ 1 << 10, 1 << 14, 1 << 18, 1 << 20 };
+
+	printf("Math benchmark: %s kernels, sizeof(Matrix4) = %d, sizeof(Vector3) = %d, best of %d\n",
+		MATRICES_SIMD_NAME, (int)sizeof(Matrix4), (int)sizeof(Vector3), MATH_BENCH_REPEATS);
+	printf("  %-26s %8s %10s %10s\n", "operation", "size", "ns/op", "GFLOP/s");
+
+	// flops per call: multiplies and adds, sqrt and division count as one
+	vector<MathBenchResult> results;
+	BenchMatrixOp(results, "Matrix4 * Matrix4", 112, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4& b) { return a * b; });
+	BenchTransformOp<Vector4>(results, "Matrix4 * Vector4", 28, sizes, total_ops,
+		[](const Matrix4& m, const Vector4& v) { return m * v; });
+	BenchTransformOp<Vector4>(results, "Matrix4 * Vector3", 15, sizes, total_ops,
+		[](const Matrix4& m, const Vector4& v) { Vector3 r = m * Vector3(v.x, v.y, v.z); return Vector4(r.x, r.y, r.z, v.w); });
+	BenchBatchOp<Matrix4, Matrix4>(results, "multiplyMatrices", 112, sizes, total_ops,
+		[](const Matrix4& m, const Matrix4* in, Matrix4* out, int n) { multiplyMatrices(m, in, out, n); });
+	BenchBatchOp<Vector4, Vector4>(results, "transformVectors", 28, sizes, total_ops,
+		[](const Matrix4& m, const Vector4* in, Vector4* out, int n) { transformVectors(m, in, out, n); });
+	BenchBatchOp<Vector3, Vector4>(results, "transformPoints -> Vector4", 24, sizes, total_ops,
+		[](const Matrix4& m, const Vector3* in, Vector4* out, int n) { transformPoints(m, in, out, n); });
+	BenchBatchOp<Vector3, Vector3>(results, "transformPoints -> Vector3", 18, sizes, total_ops,
+		[](const Matrix4& m, const Vector3* in, Vector3* out, int n) { transformPoints(m, in, out, n); });
+	// the model matrix: the old Euler chain rebuilt every frame against the fused build from a stored quaternion
+	BenchMatrixOp(results, "Euler T * Rx * Ry * Rz * S", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4& b) {
+			Matrix4 r, t, s;
+			t.translate(a[3], a[7], a[11]);
+			s.scale(a[0], a[5], a[10]);
+			r.rotateZ(b[0] * 90.0f).rotateY(b[1] * 90.0f).rotateX(b[2] * 90.0f);
+			return t * r * s;
+		});
+	BenchMatrixOp(results, "ComposeTRS", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4& b) {
+			return ComposeTRS(Vector3(a[3], a[7], a[11]), Quaternion(b[1], b[2], b[4], b[0]), Vector3(a[0], a[5], a[10]));
+		});
+	BenchMatrixOp(results, "Quaternion * Quaternion", 28, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4& b) {
+			Quaternion q = Quaternion(a[0], a[1], a[2], a[3]) * Quaternion(b[0], b[1], b[2], b[3]);
+			Matrix4 r = a;
+			r[0] = q.x; r[1] = q.y; r[2] = q.z; r[3] = q.w;
+			return r;
+		});
+	BenchMatrixOp(results, "Matrix4::invert", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4&) { Matrix4 r = a; return r.invert(); });
+	BenchMatrixOp(results, "Matrix4::invertAffine", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4&) { Matrix4 r = a; return r.invertAffine(); });
+	BenchMatrixOp(results, "Matrix4::invertGeneral", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4&) { Matrix4 r = a; return r.invertGeneral(); });
+	BenchMatrixOp(results, "Matrix4::getTranspose", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4&) { Matrix4 r = a; return Matrix4(r.getTranspose()); });
+	BenchMatrixOp(results, "Matrix4::rotate", -1, sizes, total_ops,
+		[](const Matrix4& a, const Matrix4& b) { Matrix4 r = a; return r.rotate(b[0] * 90.0f, Vector3(0.48f, 0.6f, 0.64f)); });
+
+	BenchVectorOp(results, "Vector3 + Vector3", 3, sizes, total_ops,
+		[](const Vector3& a, const Vector3& b) { return a + b * 0.5f; });
+	BenchVectorOp(results, "Vector3::dot", 5, sizes, total_ops,
+		[](const Vector3& a, const Vector3& b) { return Vector3(a.dot(b), a.y, a.z); });
+	BenchVectorOp(results, "Vector3::cross", 9, sizes, total_ops,
+		[](const Vector3& a, const Vector3& b) { return a.cross(b); });
+	BenchVectorOp(results, "Vector3::normalize", 10, sizes, total_ops,
+		[](const Vector3& a, const Vector3& b) { Vector3 r = a + b; return r.normalize(); });
+	BenchVectorOp(results, "Vector3::length", 6, sizes, total_ops,
+		[](const Vector3& a, const Vector3& b) { return Vector3(a.length(), b.y, a.z); });
+	// normalizing a copy of the input, one Vector3::normalize per element against the batch kernels
+	BenchBatchOp<Vector3, Vector3>(results, "Vector3::normalize loop", 10, sizes, total_ops,
+		[](const Matrix4&, const Vector3* in, Vector3* out, int n) { for (int i = 0; i < n; i++) { out[i] = in[i]; out[i].normalize(); } });
+	BenchBatchOp<Vector3, Vector3>(results, "normalizeVectors", 10, sizes, total_ops,
+		[](const Matrix4&, const Vector3* in, Vector3* out, int n) { copy(in, in + n, out); normalizeVectors(out, n); });
+	BenchNormalizeSoA(results, "normalizeVectors SoA", 10, sizes, total_ops);
+
+	printf("Cross-checks against double precision (%d samples, inverse errors per unit of condition number):\n", MATH_BENCH_CHECK_SAMPLES);
+	vector<MathCheckResult> checks = RunCrossChecks();
+	int failed = 0;
+	for (const MathCheckResult& c : checks)
+	{
+		bool pass = c.max_error <= c.tolerance;
+		failed += pass ? 0 : 1;
+		printf("  %-26s max error %.3e (tolerance %.0e) %s\n", c.name.c_str(), c.max_error, c.tolerance, pass ? "ok" : "FAILED");
+	}
+
+	if (results_file) {
+		if (WriteMathResults(results_file, results, checks))
+			printf("Math benchmark results written to %s\n", results_file);
+		else
+			printf("Math benchmark: cannot write %s\n", results_file);
+	}
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+///////////////////////////////////////////////////////////////////////////////
+// MathBenchmark.h
+// ===============
+// Microbenchmarks of the per-frame Matrix4 and Vector3 operations: multiply,
+// transforms, the inverses, getTranspose, rotate and the vector products, each
+// on a single value (a dependent chain, i.e. latency) and on arrays of 1K to
+// 1M elements (throughput). Reports ns/op and GFLOP/s and cross-checks every
+// operation against a double-precision reference.
+//
+// Run with --math-benchmark [--quick] [--results FILE].
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MATH_BENCHMARK_H_DEF
+#define MATH_BENCHMARK_H_DEF
+
+// returns 0 when every cross-check is within its tolerance
+int RunMathBenchmark(int argc, char** argv);
+
+#endif
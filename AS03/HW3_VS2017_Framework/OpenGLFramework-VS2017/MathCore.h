@@ -0,0 +1,399 @@
+///////////////////////////////////////////////////////////////////////////////
+// MathCore.h
+// ==========
+// Templated Vector<N, T> and Matrix<N, T> for any dimension and scalar type.
+// Construction, products, transpose, determinant and inverse are constexpr
+// (C++14), so transforms built from constants fold at compile time. Matrices
+// are row-major like Matrix4; FromMatrix4/ToMatrix4 convert at the boundary.
+//
+// T is float, double, or Half for storage only: a Half matrix or vector
+// converts to float for every operation and rounds back when stored.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MATH_CORE_H_DEF
+#define MATH_CORE_H_DEF
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "Vectors.h"
+#include "Matrices.h"
+
+// IEEE 754 binary16, converted with round to nearest even
+struct Half
+{
+	uint16_t bits = 0;
+
+	constexpr Half() {}
+	Half(float value) : bits(FromFloat(value)) {}
+	operator float() const { return ToFloat(bits); }
+
+	static uint16_t FromFloat(float value)
+	{
+		uint32_t f;
+		memcpy(&f, &value, sizeof(f));
+		uint32_t sign = (f >> 16) & 0x8000u;
+		uint32_t magnitude = f & 0x7fffffffu;
+		if (magnitude >= 0x7f800000u)		// inf and nan, nan keeps a payload bit
+			return (uint16_t)(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+		if (magnitude >= 0x477ff000u)		// rounds above 65504
+			return (uint16_t)(sign | 0x7c00u);
+		if (magnitude < 0x38800000u) {		// half denormal or zero
+			if (magnitude < 0x33000000u)
+				return (uint16_t)sign;
+			uint32_t mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+			int shift = 126 - (int)(magnitude >> 23);	// 14..24, the value in units of 2^-24
+			uint32_t half = mantissa >> shift;
+			uint32_t rest = mantissa & ((1u << shift) - 1);
+			uint32_t midpoint = 1u << (shift - 1);
+			if (rest > midpoint || (rest == midpoint && (half & 1)))
+				half++;
+			return (uint16_t)(sign | half);
+		}
+		uint32_t half = (magnitude - 0x38000000u) >> 13;
+		uint32_t rest = magnitude & 0x1fffu;
+		if (rest > 0x1000u || (rest == 0x1000u && (half & 1)))
+			half++;
+		return (uint16_t)(sign | half);
+	}
+
+	static float ToFloat(uint16_t h)
+	{
+		uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+		uint32_t exponent = (h >> 10) & 0x1fu;
+		uint32_t mantissa = h & 0x3ffu;
+		uint32_t f;
+		if (exponent == 0x1fu)
+			f = sign | 0x7f800000u | (mantissa << 13);
+		else if (exponent != 0)
+			f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else if (mantissa == 0)
+			f = sign;
+		else {
+			// renormalize the denormal
+			exponent = 113;
+			while (!(mantissa & 0x400u)) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			f = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+		}
+		float value;
+		memcpy(&value, &f, sizeof(value));
+		return value;
+	}
+};
+
+// arithmetic type of a storage type
+template <class T> struct MathCompute { typedef T Type; };
+template <> struct MathCompute<Half> { typedef float Type; };
+
+template <int N, class T>
+struct Vector
+{
+	static_assert(N >= 2, "Vector needs at least two components");
+	typedef typename MathCompute<T>::Type C;
+
+	T v[N] = {};
+
+	constexpr Vector() {}
+	template <class... A>
+	constexpr explicit Vector(C a0, A... rest) : v{ T(a0), T(C(rest))... }
+	{
+		static_assert(sizeof...(A) + 1 == N, "Vector needs one value per component");
+	}
+	template <class U>
+	constexpr explicit Vector(const Vector<N, U>& other)
+	{
+		for (int i = 0; i < N; i++)
+			v[i] = T(typename MathCompute<U>::Type(other[i]));
+	}
+
+	constexpr const T& operator[](int i) const { return v[i]; }
+	constexpr T& operator[](int i) { return v[i]; }
+
+	constexpr Vector operator+(const Vector& rhs) const { Vector r; for (int i = 0; i < N; i++) r[i] = T(C(v[i]) + C(rhs[i])); return r; }
+	constexpr Vector operator-(const Vector& rhs) const { Vector r; for (int i = 0; i < N; i++) r[i] = T(C(v[i]) - C(rhs[i])); return r; }
+	constexpr Vector operator-() const { Vector r; for (int i = 0; i < N; i++) r[i] = T(-C(v[i])); return r; }
+	constexpr Vector operator*(C s) const { Vector r; for (int i = 0; i < N; i++) r[i] = T(C(v[i]) * s); return r; }
+	constexpr bool operator==(const Vector& rhs) const { for (int i = 0; i < N; i++) if (C(v[i]) != C(rhs[i])) return false; return true; }
+	constexpr bool operator!=(const Vector& rhs) const { return !(*this == rhs); }
+
+	constexpr C dot(const Vector& rhs) const { C sum = C(v[0]) * C(rhs[0]); for (int i = 1; i < N; i++) sum += C(v[i]) * C(rhs[i]); return sum; }
+	C length() const { return std::sqrt(dot(*this)); }
+	Vector normalized() const { C len = length(); return len > C(0) ? *this * (C(1) / len) : *this; }
+};
+
+template <class T>
+constexpr Vector<3, T> Cross(const Vector<3, T>& a, const Vector<3, T>& b)
+{
+	typedef typename MathCompute<T>::Type C;
+	return Vector<3, T>(C(a[1]) * C(b[2]) - C(a[2]) * C(b[1]),
+						C(a[2]) * C(b[0]) - C(a[0]) * C(b[2]),
+						C(a[0]) * C(b[1]) - C(a[1]) * C(b[0]));
+}
+
+// row-major, m[row * N + col]
+template <int N, class T>
+struct Matrix
+{
+	static_assert(N >= 2, "Matrix needs at least two rows");
+	typedef typename MathCompute<T>::Type C;
+
+	T m[N * N] = {};
+
+	constexpr Matrix() {}
+	template <class... A>
+	constexpr explicit Matrix(C a0, A... rest) : m{ T(a0), T(C(rest))... }
+	{
+		static_assert(sizeof...(A) + 1 == N * N, "Matrix needs one value per element, row by row");
+	}
+	template <class U>
+	constexpr explicit Matrix(const Matrix<N, U>& other)
+	{
+		for (int i = 0; i < N * N; i++)
+			m[i] = T(typename MathCompute<U>::Type(other[i]));
+	}
+
+	static constexpr Matrix Identity()
+	{
+		Matrix r;
+		for (int i = 0; i < N; i++)
+			r.m[i * N + i] = T(C(1));
+		return r;
+	}
+
+	constexpr const T& operator[](int i) const { return m[i]; }
+	constexpr T& operator[](int i) { return m[i]; }
+	constexpr const T& operator()(int row, int col) const { return m[row * N + col]; }
+	constexpr T& operator()(int row, int col) { return m[row * N + col]; }
+
+	constexpr Matrix operator*(const Matrix& rhs) const
+	{
+		Matrix r;
+		for (int i = 0; i < N; i++)
+			for (int j = 0; j < N; j++)
+			{
+				C sum = C(m[i * N]) * C(rhs.m[j]);
+				for (int k = 1; k < N; k++)
+					sum += C(m[i * N + k]) * C(rhs.m[k * N + j]);
+				r.m[i * N + j] = T(sum);
+			}
+		return r;
+	}
+
+	constexpr Vector<N, T> operator*(const Vector<N, T>& rhs) const
+	{
+		Vector<N, T> r;
+		for (int i = 0; i < N; i++)
+		{
+			C sum = C(m[i * N]) * C(rhs[0]);
+			for (int k = 1; k < N; k++)
+				sum += C(m[i * N + k]) * C(rhs[k]);
+			r[i] = T(sum);
+		}
+		return r;
+	}
+
+	constexpr bool operator==(const Matrix& rhs) const { for (int i = 0; i < N * N; i++) if (C(m[i]) != C(rhs.m[i])) return false; return true; }
+	constexpr bool operator!=(const Matrix& rhs) const { return !(*this == rhs); }
+
+	constexpr Matrix transposed() const
+	{
+		Matrix r;
+		for (int i = 0; i < N; i++)
+			for (int j = 0; j < N; j++)
+				r.m[j * N + i] = m[i * N + j];
+		return r;
+	}
+};
+
+template <class T>
+constexpr T MathAbs(T x)
+{
+	return x < T(0) ? -x : x;
+}
+
+// Gaussian elimination with partial pivoting
+template <int N, class T>
+constexpr typename MathCompute<T>::Type Determinant(const Matrix<N, T>& src)
+{
+	typedef typename MathCompute<T>::Type C;
+	C a[N * N] = {};
+	for (int i = 0; i < N * N; i++)
+		a[i] = C(src[i]);
+	C det = C(1);
+	for (int c = 0; c < N; c++)
+	{
+		int pivot = c;
+		for (int r = c + 1; r < N; r++)
+			if (MathAbs(a[r * N + c]) > MathAbs(a[pivot * N + c]))
+				pivot = r;
+		if (a[pivot * N + c] == C(0))
+			return C(0);
+		if (pivot != c) {
+			for (int k = 0; k < N; k++)
+			{
+				C t = a[c * N + k];
+				a[c * N + k] = a[pivot * N + k];
+				a[pivot * N + k] = t;
+			}
+			det = -det;
+		}
+		det *= a[c * N + c];
+		for (int r = c + 1; r < N; r++)
+		{
+			C f = a[r * N + c] / a[c * N + c];
+			for (int k = c; k < N; k++)
+				a[r * N + k] -= f * a[c * N + k];
+		}
+	}
+	return det;
+}
+
+// Gauss-Jordan with partial pivoting, identity for a singular matrix like Matrix4::invert
+template <int N, class T>
+constexpr Matrix<N, T> Inverse(const Matrix<N, T>& src)
+{
+	typedef typename MathCompute<T>::Type C;
+	C a[N * N] = {}, inv[N * N] = {};
+	for (int i = 0; i < N * N; i++)
+		a[i] = C(src[i]);
+	for (int i = 0; i < N; i++)
+		inv[i * N + i] = C(1);
+	for (int c = 0; c < N; c++)
+	{
+		int pivot = c;
+		for (int r = c + 1; r < N; r++)
+			if (MathAbs(a[r * N + c]) > MathAbs(a[pivot * N + c]))
+				pivot = r;
+		if (a[pivot * N + c] == C(0))
+			return Matrix<N, T>::Identity();
+		for (int k = 0; k < N; k++)
+		{
+			C t = a[c * N + k]; a[c * N + k] = a[pivot * N + k]; a[pivot * N + k] = t;
+			t = inv[c * N + k]; inv[c * N + k] = inv[pivot * N + k]; inv[pivot * N + k] = t;
+		}
+		C scale = C(1) / a[c * N + c];
+		for (int k = 0; k < N; k++)
+		{
+			a[c * N + k] *= scale;
+			inv[c * N + k] *= scale;
+		}
+		for (int r = 0; r < N; r++)
+		{
+			if (r == c)
+				continue;
+			C f = a[r * N + c];
+			for (int k = 0; k < N; k++)
+			{
+				a[r * N + k] -= f * a[c * N + k];
+				inv[r * N + k] -= f * inv[c * N + k];
+			}
+		}
+	}
+	Matrix<N, T> r;
+	for (int i = 0; i < N * N; i++)
+		r[i] = T(inv[i]);
+	return r;
+}
+
+typedef Vector<2, float> Vector2f;
+typedef Vector<3, float> Vector3f;
+typedef Vector<4, float> Vector4f;
+typedef Vector<3, double> Vector3d;
+typedef Vector<4, double> Vector4d;
+typedef Vector<3, Half> Vector3h;
+typedef Vector<4, Half> Vector4h;
+typedef Matrix<3, float> Matrix3f;
+typedef Matrix<4, float> Matrix4f;
+typedef Matrix<3, double> Matrix3d;
+typedef Matrix<4, double> Matrix4d;
+typedef Matrix<4, Half> Matrix4h;
+
+///////////////////////////////////////////////////////////////////////////////
+// 4x4 transforms, same conventions as the Matrix4 helpers. The trigonometry
+// is left to the caller (std::sin/cos/tan are not constexpr), so everything
+// built from constant arguments is a compile-time constant.
+///////////////////////////////////////////////////////////////////////////////
+template <class T = float>
+constexpr Matrix<4, T> MakeTranslation(T x, T y, T z)
+{
+	return Matrix<4, T>(1, 0, 0, x,
+						0, 1, 0, y,
+						0, 0, 1, z,
+						0, 0, 0, 1);
+}
+
+template <class T = float>
+constexpr Matrix<4, T> MakeScaling(T x, T y, T z)
+{
+	return Matrix<4, T>(x, 0, 0, 0,
+						0, y, 0, 0,
+						0, 0, z, 0,
+						0, 0, 0, 1);
+}
+
+// about a unit axis, from the cosine and sine of the angle
+template <class T = float>
+constexpr Matrix<4, T> MakeRotation(T c, T s, T x, T y, T z)
+{
+	return Matrix<4, T>(x * x * (1 - c) + c,     x * y * (1 - c) - z * s, x * z * (1 - c) + y * s, 0,
+						x * y * (1 - c) + z * s, y * y * (1 - c) + c,     y * z * (1 - c) - x * s, 0,
+						x * z * (1 - c) - y * s, y * z * (1 - c) + x * s, z * z * (1 - c) + c,     0,
+						0, 0, 0, 1);
+}
+
+template <class T = float>
+constexpr Matrix<4, T> MakeOrthographic(T left, T right, T bottom, T top, T near_clip, T far_clip)
+{
+	return Matrix<4, T>(2 / (right - left), 0, 0, -(right + left) / (right - left),
+						0, 2 / (top - bottom), 0, -(top + bottom) / (top - bottom),
+						0, 0, -2 / (far_clip - near_clip), -(far_clip + near_clip) / (far_clip - near_clip),
+						0, 0, 0, 1);
+}
+
+// x_scale and y_scale are the reciprocal tangents of the half field of view
+template <class T = float>
+constexpr Matrix<4, T> MakePerspective(T x_scale, T y_scale, T near_clip, T far_clip)
+{
+	return Matrix<4, T>(x_scale, 0, 0, 0,
+						0, y_scale, 0, 0,
+						0, 0, -(far_clip + near_clip) / (far_clip - near_clip), -(2 * far_clip * near_clip) / (far_clip - near_clip),
+						0, 0, -1, 0);
+}
+
+// boundary with the float classes of Vectors.h/Matrices.h
+template <class T = float>
+inline Matrix<4, T> FromMatrix4(const Matrix4& src)
+{
+	Matrix<4, T> r;
+	for (int i = 0; i < 16; i++)
+		r[i] = T(src[i]);
+	return r;
+}
+
+template <class T>
+inline Matrix4 ToMatrix4(const Matrix<4, T>& src)
+{
+	typedef typename MathCompute<T>::Type C;
+	Matrix4 r;
+	for (int i = 0; i < 16; i++)
+		r[i] = (float)C(src[i]);
+	return r;
+}
+
+template <class T = float>
+inline Vector<3, T> FromVector3(const Vector3& v)
+{
+	return Vector<3, T>(v.x, v.y, v.z);
+}
+
+template <class T>
+inline Vector3 ToVector3(const Vector<3, T>& v)
+{
+	typedef typename MathCompute<T>::Type C;
+	return Vector3((float)C(v[0]), (float)C(v[1]), (float)C(v[2]));
+}
+
+#endif
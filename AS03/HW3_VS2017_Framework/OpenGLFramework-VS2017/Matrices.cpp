@@ -544,3 +544,399 @@ Matrix4& Matrix4::rotateZ(float angle)
 
     return *this;
 }
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// batch transforms
+// Vector4 arrays are multiplied by the columns of the matrix, one broadcast
+// vector component each. Vector3 arrays are processed four at a time,
+// deinterleaved into x/y/z registers and interleaved again on the way out.
+///////////////////////////////////////////////////////////////////////////////
+#if defined(MATRICES_SSE)
+// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3  ->  xxxx yyyy zzzz
+static inline void loadVector3x4(const Vector3* in, __m128& x, __m128& y, __m128& z)
+{
+    const float* p = &in->x;
+    __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+    x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1,1,2,2)), _MM_SHUFFLE(2,0,3,0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0,0,1,1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2,2,3,3)), _MM_SHUFFLE(2,0,2,0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1,1,2,2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3,3,0,0)), _MM_SHUFFLE(2,0,2,0));
+}
+
+static inline void storeVector3x4(Vector3* out, __m128 x, __m128 y, __m128 z)
+{
+    float* p = &out->x;
+    _mm_storeu_ps(p,     _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0,0,0,0)), _mm_shuffle_ps(z, x, _MM_SHUFFLE(1,1,0,0)), _MM_SHUFFLE(2,0,2,0)));
+    _mm_storeu_ps(p + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1,1,1,1)), _mm_shuffle_ps(x, y, _MM_SHUFFLE(2,2,2,2)), _MM_SHUFFLE(2,0,2,0)));
+    _mm_storeu_ps(p + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3,3,2,2)), _mm_shuffle_ps(y, z, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(2,0,2,0)));
+}
+
+// one row of the matrix applied to four points
+static inline __m128 transformRow(const __m128* row, __m128 x, __m128 y, __m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0], x), _mm_mul_ps(row[1], y)), _mm_add_ps(_mm_mul_ps(row[2], z), row[3]));
+}
+#endif
+
+static_assert(sizeof(Vector3) == 3 * sizeof(float) && sizeof(Vector4) == 4 * sizeof(float), "vectors must be packed floats");
+
+void transformVectors(const Matrix4& m, const Vector4* in, Vector4* out, int count)
+{
+    const float* e = m.get();
+    int i = 0;
+#if defined(MATRICES_SSE)
+    __m128 c0 = _mm_loadu_ps(e), c1 = _mm_loadu_ps(e + 4), c2 = _mm_loadu_ps(e + 8), c3 = _mm_loadu_ps(e + 12);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+#if defined(MATRICES_AVX)
+    // two vectors per iteration, the columns repeated in both lanes
+    __m256 d0 = _mm256_insertf128_ps(_mm256_castps128_ps256(c0), c0, 1);
+    __m256 d1 = _mm256_insertf128_ps(_mm256_castps128_ps256(c1), c1, 1);
+    __m256 d2 = _mm256_insertf128_ps(_mm256_castps128_ps256(c2), c2, 1);
+    __m256 d3 = _mm256_insertf128_ps(_mm256_castps128_ps256(c3), c3, 1);
+    for(; i + 2 <= count; i += 2)
+    {
+        __m256 v = _mm256_loadu_ps(&in[i].x);
+        _mm256_storeu_ps(&out[i].x, multiplyRowPair(v, d0, d1, d2, d3));
+    }
+#endif
+    for(; i < count; ++i)
+        _mm_storeu_ps(&out[i].x, multiplyRow(_mm_loadu_ps(&in[i].x), c0, c1, c2, c3));
+#elif defined(MATRICES_NEON)
+    float32x4x4_t c = vld4q_f32(e);     // deinterleaving the rows gives the columns
+    for(; i < count; ++i)
+    {
+        float32x4_t v = vld1q_f32(&in[i].x);
+        float32x4_t r = vmulq_laneq_f32(c.val[0], v, 0);
+        r = vfmaq_laneq_f32(r, c.val[1], v, 1);
+        r = vfmaq_laneq_f32(r, c.val[2], v, 2);
+        r = vfmaq_laneq_f32(r, c.val[3], v, 3);
+        vst1q_f32(&out[i].x, r);
+    }
+#endif
+    for(; i < count; ++i)
+        out[i] = m * in[i];
+}
+
+void transformPoints(const Matrix4& m, const Vector3* in, Vector4* out, int count)
+{
+    const float* e = m.get();
+    int i = 0;
+#if defined(MATRICES_SSE)
+    __m128 rows[4][4];
+    for(int r = 0; r < 4; ++r)
+        for(int k = 0; k < 4; ++k)
+            rows[r][k] = _mm_set1_ps(e[r * 4 + k]);
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z;
+        loadVector3x4(in + i, x, y, z);
+        __m128 rx = transformRow(rows[0], x, y, z);
+        __m128 ry = transformRow(rows[1], x, y, z);
+        __m128 rz = transformRow(rows[2], x, y, z);
+        __m128 rw = transformRow(rows[3], x, y, z);
+        _MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+        _mm_storeu_ps(&out[i].x, rx);
+        _mm_storeu_ps(&out[i + 1].x, ry);
+        _mm_storeu_ps(&out[i + 2].x, rz);
+        _mm_storeu_ps(&out[i + 3].x, rw);
+    }
+#elif defined(MATRICES_NEON)
+    for(; i + 4 <= count; i += 4)
+    {
+        float32x4x3_t v = vld3q_f32(&in[i].x);
+        float32x4x4_t r;
+        for(int k = 0; k < 4; ++k)
+        {
+            float32x4_t t = vfmaq_n_f32(vdupq_n_f32(e[k * 4 + 3]), v.val[0], e[k * 4]);
+            t = vfmaq_n_f32(t, v.val[1], e[k * 4 + 1]);
+            r.val[k] = vfmaq_n_f32(t, v.val[2], e[k * 4 + 2]);
+        }
+        vst4q_f32(&out[i].x, r);
+    }
+#endif
+    for(; i < count; ++i)
+        out[i] = m * Vector4(in[i].x, in[i].y, in[i].z, 1.0f);
+}
+
+void transformPoints(const Matrix4& m, const Vector3* in, Vector3* out, int count)
+{
+    const float* e = m.get();
+    int i = 0;
+#if defined(MATRICES_SSE)
+    __m128 rows[3][4];
+    for(int r = 0; r < 3; ++r)
+        for(int k = 0; k < 4; ++k)
+            rows[r][k] = _mm_set1_ps(e[r * 4 + k]);
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z;
+        loadVector3x4(in + i, x, y, z);
+        storeVector3x4(out + i, transformRow(rows[0], x, y, z), transformRow(rows[1], x, y, z), transformRow(rows[2], x, y, z));
+    }
+#elif defined(MATRICES_NEON)
+    for(; i + 4 <= count; i += 4)
+    {
+        float32x4x3_t v = vld3q_f32(&in[i].x);
+        float32x4x3_t r;
+        for(int k = 0; k < 3; ++k)
+        {
+            float32x4_t t = vfmaq_n_f32(vdupq_n_f32(e[k * 4 + 3]), v.val[0], e[k * 4]);
+            t = vfmaq_n_f32(t, v.val[1], e[k * 4 + 1]);
+            r.val[k] = vfmaq_n_f32(t, v.val[2], e[k * 4 + 2]);
+        }
+        vst3q_f32(&out[i].x, r);
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        Vector4 r = m * Vector4(in[i].x, in[i].y, in[i].z, 1.0f);
+        out[i] = Vector3(r.x, r.y, r.z);
+    }
+}
+
+// lhs is the same for every product, so its elements are broadcast once and
+// each product is only loads, multiplies and adds, no shuffles
+void multiplyMatrices(const Matrix4& lhs, const Matrix4* in, Matrix4* out, int count)
+{
+    const float* a = lhs.get();
+#if defined(MATRICES_AVX)
+    // rows 0/1 and 2/3 of the result share a register, one row per lane
+    __m256 s01[4], s23[4];
+    for(int k = 0; k < 4; ++k)
+    {
+        s01[k] = _mm256_setr_ps(a[k], a[k], a[k], a[k], a[4+k], a[4+k], a[4+k], a[4+k]);
+        s23[k] = _mm256_setr_ps(a[8+k], a[8+k], a[8+k], a[8+k], a[12+k], a[12+k], a[12+k], a[12+k]);
+    }
+    for(int i = 0; i < count; ++i)
+    {
+        const float* b = in[i].get();
+        __m256 b0 = _mm256_broadcast_ps((const __m128*)(b));
+        __m256 b1 = _mm256_broadcast_ps((const __m128*)(b + 4));
+        __m256 b2 = _mm256_broadcast_ps((const __m128*)(b + 8));
+        __m256 b3 = _mm256_broadcast_ps((const __m128*)(b + 12));
+        __m256 r01 = _mm256_add_ps(multiplyAdd(s01[1], b1, _mm256_mul_ps(s01[0], b0)), multiplyAdd(s01[3], b3, _mm256_mul_ps(s01[2], b2)));
+        __m256 r23 = _mm256_add_ps(multiplyAdd(s23[1], b1, _mm256_mul_ps(s23[0], b0)), multiplyAdd(s23[3], b3, _mm256_mul_ps(s23[2], b2)));
+        _mm256_storeu_ps(&out[i][0], r01);
+        _mm256_storeu_ps(&out[i][8], r23);
+    }
+#elif defined(MATRICES_SSE)
+    __m128 s[16];
+    for(int k = 0; k < 16; ++k)
+        s[k] = _mm_set1_ps(a[k]);
+    for(int i = 0; i < count; ++i)
+    {
+        const float* b = in[i].get();
+        __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4), b2 = _mm_loadu_ps(b + 8), b3 = _mm_loadu_ps(b + 12);
+        float* r = &out[i][0];
+        for(int row = 0; row < 4; ++row)
+        {
+            const __m128* e = s + row * 4;
+            _mm_storeu_ps(r + row * 4, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e[0], b0), _mm_mul_ps(e[1], b1)),
+                                                  _mm_add_ps(_mm_mul_ps(e[2], b2), _mm_mul_ps(e[3], b3))));
+        }
+    }
+#else
+    for(int i = 0; i < count; ++i)
+        multiplyMatrix4(a, in[i].get(), &out[i][0]);
+#endif
+}
+
+
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// batch normalization
+// rsqrt estimates 1/sqrt(x) to 1.5 * 2^-12 relative, one Newton step
+// y' = y * (1.5 - 0.5 * x * y * y) squares that to ~2e-7 before rounding.
+// NEON's estimate is only 8 bits and takes two steps.
+///////////////////////////////////////////////////////////////////////////////
+const float NORMALIZE_MIN_LENGTH2 = 1e-20f;
+
+#if defined(MATRICES_SSE)
+// 1/sqrt(len2), or 1 where len2 is too small to normalize
+static inline __m128 invLength4(__m128 len2)
+{
+    __m128 y = _mm_rsqrt_ps(len2);
+    __m128 half = _mm_mul_ps(_mm_set1_ps(0.5f), len2);
+    y = _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(half, _mm_mul_ps(y, y))));
+    __m128 valid = _mm_cmpge_ps(len2, _mm_set1_ps(NORMALIZE_MIN_LENGTH2));
+    return _mm_or_ps(_mm_and_ps(valid, y), _mm_andnot_ps(valid, _mm_set1_ps(1.0f)));
+}
+#endif
+
+#if defined(MATRICES_AVX)
+static inline __m256 invLength8(__m256 len2)
+{
+    __m256 y = _mm256_rsqrt_ps(len2);
+    __m256 half = _mm256_mul_ps(_mm256_set1_ps(0.5f), len2);
+    y = _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(half, _mm256_mul_ps(y, y))));
+    __m256 valid = _mm256_cmp_ps(len2, _mm256_set1_ps(NORMALIZE_MIN_LENGTH2), _CMP_GE_OQ);
+    return _mm256_blendv_ps(_mm256_set1_ps(1.0f), y, valid);
+}
+#endif
+
+#if defined(MATRICES_NEON)
+static inline float32x4_t invLength4(float32x4_t len2)
+{
+    float32x4_t y = vrsqrteq_f32(len2);
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(len2, y), y));
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(len2, y), y));
+    uint32x4_t valid = vcgeq_f32(len2, vdupq_n_f32(NORMALIZE_MIN_LENGTH2));
+    return vbslq_f32(valid, y, vdupq_n_f32(1.0f));
+}
+#endif
+
+static inline float invLength(float len2)
+{
+    return len2 < NORMALIZE_MIN_LENGTH2 ? 1.0f : 1.0f / sqrtf(len2);
+}
+
+void normalizeVectors(Vector3* v, int count)
+{
+    int i = 0;
+#if defined(MATRICES_SSE)
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z;
+        loadVector3x4(v + i, x, y, z);
+        __m128 s = invLength4(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        storeVector3x4(v + i, _mm_mul_ps(x, s), _mm_mul_ps(y, s), _mm_mul_ps(z, s));
+    }
+#elif defined(MATRICES_NEON)
+    for(; i + 4 <= count; i += 4)
+    {
+        float32x4x3_t p = vld3q_f32(&v[i].x);
+        float32x4_t s = invLength4(vfmaq_f32(vfmaq_f32(vmulq_f32(p.val[0], p.val[0]), p.val[1], p.val[1]), p.val[2], p.val[2]));
+        p.val[0] = vmulq_f32(p.val[0], s);
+        p.val[1] = vmulq_f32(p.val[1], s);
+        p.val[2] = vmulq_f32(p.val[2], s);
+        vst3q_f32(&v[i].x, p);
+    }
+#endif
+    for(; i < count; ++i)
+        v[i] *= invLength(v[i].x * v[i].x + v[i].y * v[i].y + v[i].z * v[i].z);
+}
+
+void normalizeVectors(float* x, float* y, float* z, int count)
+{
+    int i = 0;
+#if defined(MATRICES_AVX)
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+        __m256 s = invLength8(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz)));
+        _mm256_storeu_ps(x + i, _mm256_mul_ps(vx, s));
+        _mm256_storeu_ps(y + i, _mm256_mul_ps(vy, s));
+        _mm256_storeu_ps(z + i, _mm256_mul_ps(vz, s));
+    }
+#endif
+#if defined(MATRICES_SSE)
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+        __m128 s = invLength4(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+        _mm_storeu_ps(x + i, _mm_mul_ps(vx, s));
+        _mm_storeu_ps(y + i, _mm_mul_ps(vy, s));
+        _mm_storeu_ps(z + i, _mm_mul_ps(vz, s));
+    }
+#elif defined(MATRICES_NEON)
+    for(; i + 4 <= count; i += 4)
+    {
+        float32x4_t vx = vld1q_f32(x + i), vy = vld1q_f32(y + i), vz = vld1q_f32(z + i);
+        float32x4_t s = invLength4(vfmaq_f32(vfmaq_f32(vmulq_f32(vx, vx), vy, vy), vz, vz));
+        vst1q_f32(x + i, vmulq_f32(vx, s));
+        vst1q_f32(y + i, vmulq_f32(vy, s));
+        vst1q_f32(z + i, vmulq_f32(vz, s));
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        float s = invLength(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        x[i] *= s;
+        y[i] *= s;
+        z[i] *= s;
+    }
+}
+
+void normalizePlanes(Vector4* planes, int count)
+{
+    int i = 0;
+#if defined(MATRICES_SSE)
+    // four planes are a 4x4 block, transposed its rows are all a, b, c and d
+    for(; i + 4 <= count; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(&planes[i].x), b = _mm_loadu_ps(&planes[i + 1].x);
+        __m128 c = _mm_loadu_ps(&planes[i + 2].x), d = _mm_loadu_ps(&planes[i + 3].x);
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        __m128 s = invLength4(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), _mm_mul_ps(c, c)));
+        a = _mm_mul_ps(a, s); b = _mm_mul_ps(b, s); c = _mm_mul_ps(c, s); d = _mm_mul_ps(d, s);
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(&planes[i].x, a);
+        _mm_storeu_ps(&planes[i + 1].x, b);
+        _mm_storeu_ps(&planes[i + 2].x, c);
+        _mm_storeu_ps(&planes[i + 3].x, d);
+    }
+#endif
+    for(; i < count; ++i)
+        planes[i] *= invLength(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// GLMatrix4 transforms, the same as Matrix4 with the indices transposed
+///////////////////////////////////////////////////////////////////////////////
+GLMatrix4& GLMatrix4::translate(const Vector3& v)
+{
+    return translate(v.x, v.y, v.z);
+}
+
+GLMatrix4& GLMatrix4::translate(float x, float y, float z)
+{
+    m[0] += m[3]*x;   m[4] += m[7]*x;   m[8] += m[11]*x;  m[12]+= m[15]*x;
+    m[1] += m[3]*y;   m[5] += m[7]*y;   m[9] += m[11]*y;  m[13]+= m[15]*y;
+    m[2] += m[3]*z;   m[6] += m[7]*z;   m[10]+= m[11]*z;  m[14]+= m[15]*z;
+    return *this;
+}
+
+GLMatrix4& GLMatrix4::scale(float s)
+{
+    return scale(s, s, s);
+}
+
+GLMatrix4& GLMatrix4::scale(float x, float y, float z)
+{
+    m[0] *= x;   m[4] *= x;   m[8] *= x;   m[12]*= x;
+    m[1] *= y;   m[5] *= y;   m[9] *= y;   m[13]*= y;
+    m[2] *= z;   m[6] *= z;   m[10]*= z;   m[14]*= z;
+    return *this;
+}
+
+GLMatrix4& GLMatrix4::rotate(float angle, const Vector3& axis)
+{
+    return rotate(angle, axis.x, axis.y, axis.z);
+}
+
+GLMatrix4& GLMatrix4::rotate(float angle, float x, float y, float z)
+{
+    Matrix4 r;
+    r.rotate(angle, x, y, z);
+    *this = GLMatrix4(r) * *this;
+    return *this;
+}
+
+GLMatrix4& GLMatrix4::rotateX(float angle)
+{
+    return rotate(angle, 1, 0, 0);
+}
+
+GLMatrix4& GLMatrix4::rotateY(float angle)
+{
+    return rotate(angle, 0, 1, 0);
+}
+
+GLMatrix4& GLMatrix4::rotateZ(float angle)
+{
+    return rotate(angle, 0, 0, 1);
+}
@@ -4,6 +4,7 @@
 // NxN Matrix Math classes
 //
 // All matrices are row major. (OpenGL uses column-major matrix)
+// GLMatrix4 is the exception, it keeps a 4x4 matrix column-major for upload.
 // | 0 1 |    | 0 1 2 |    |  0  1  2  3 |
 // | 2 3 |    | 3 4 5 |    |  4  5  6  7 |
 //            | 6 7 8 |    |  8  9 10 11 |
@@ -21,6 +22,41 @@
 
 #include "Vectors.h"
 
+///////////////////////////////////////////////////////////////////////////
+// SIMD paths of the 4x4 products and the batch transforms: AVX (with FMA
+// when available) if the compiler targets it, SSE on x86/x64, NEON on
+// AArch64, plain C++ otherwise. Define MATRICES_NO_SIMD for scalar only.
+// The VS project builds with /arch:AVX2, which takes the AVX+FMA path.
+///////////////////////////////////////////////////////////////////////////
+#if !defined(MATRICES_NO_SIMD)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATRICES_SSE
+#include <xmmintrin.h>
+#if defined(__AVX__)
+#define MATRICES_AVX
+#include <immintrin.h>
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define MATRICES_FMA
+#endif
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define MATRICES_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined(MATRICES_FMA)
+#define MATRICES_SIMD_NAME "AVX+FMA"
+#elif defined(MATRICES_AVX)
+#define MATRICES_SIMD_NAME "AVX"
+#elif defined(MATRICES_SSE)
+#define MATRICES_SIMD_NAME "SSE"
+#elif defined(MATRICES_NEON)
+#define MATRICES_SIMD_NAME "NEON"
+#else
+#define MATRICES_SIMD_NAME "scalar"
+#endif
+
 ///////////////////////////////////////////////////////////////////////////
 // 2x2 matrix
 ///////////////////////////////////////////////////////////////////////////
@@ -205,8 +241,84 @@ private:
                             float m3, float m4, float m5,
                             float m6, float m7, float m8);
 
-    float m[16];
-    float tm[16];                                       // transpose m
+    struct NoInit {};
+    explicit Matrix4(NoInit) {}                         // for results that are overwritten anyway
+
+    alignas(16) float m[16];
+    alignas(16) float tm[16];                           // transpose m
+
+};
+
+// batch transforms over arrays, out may be the same array as in
+void transformVectors(const Matrix4& m, const Vector4* in, Vector4* out, int count);  // out = m * in
+void transformPoints(const Matrix4& m, const Vector3* in, Vector4* out, int count);   // out = m * (in, 1)
+void transformPoints(const Matrix4& m, const Vector3* in, Vector3* out, int count);   // out = (m * (in, 1)).xyz
+void multiplyMatrices(const Matrix4& lhs, const Matrix4* in, Matrix4* out, int count); // out = lhs * in
+
+// batch normalization with a SIMD reciprocal square root estimate refined by
+// Newton steps, within BATCH_NORMALIZE_MAX_ERROR relative of the exact unit
+// vector (Vector3::normalize is ~1 ulp). Vectors with a squared length under
+// 1e-20 are left as they are instead of turning into NaN.
+const float BATCH_NORMALIZE_MAX_ERROR = 1e-6f;
+void normalizeVectors(Vector3* v, int count);                           // AoS, in place
+void normalizeVectors(float* x, float* y, float* z, int count);         // SoA, in place
+void normalizePlanes(Vector4* planes, int count);                       // (a,b,c,d) / |(a,b,c)|
+
+
+
+///////////////////////////////////////////////////////////////////////////
+// 4x4 matrix stored column-major, the layout glUniformMatrix4fv expects
+// with transpose GL_FALSE, so get() is uploaded without a copy.
+// Constructor arguments and the transform functions follow Matrix4, only
+// the storage differs:
+// |  0  4  8 12 |
+// |  1  5  9 13 |
+// |  2  6 10 14 |
+// |  3  7 11 15 |
+///////////////////////////////////////////////////////////////////////////
+class GLMatrix4
+{
+public:
+    // constructors
+    GLMatrix4();  // init with identity
+    explicit GLMatrix4(const Matrix4& rowMajor);        // transposed once here
+    GLMatrix4(float xx, float xy, float xz, float xw,   // row by row, as Matrix4
+              float yx, float yy, float yz, float yw,
+              float zx, float zy, float zz, float zw,
+              float wx, float wy, float wz, float ww);
+
+    void        set(const Matrix4& rowMajor);
+    const float* get() const;                           // column-major, upload with GL_FALSE
+    Matrix4     toMatrix4() const;
+    float       at(int row, int col) const;
+
+    GLMatrix4&  identity();
+
+    // transform matrix, applied after the current transform like Matrix4
+    GLMatrix4&  translate(float x, float y, float z);
+    GLMatrix4&  translate(const Vector3& v);
+    GLMatrix4&  rotate(float angle, const Vector3& axis); // angle in degree
+    GLMatrix4&  rotate(float angle, float x, float y, float z);
+    GLMatrix4&  rotateX(float angle);
+    GLMatrix4&  rotateY(float angle);
+    GLMatrix4&  rotateZ(float angle);
+    GLMatrix4&  scale(float scale);
+    GLMatrix4&  scale(float sx, float sy, float sz);
+
+    // operators
+    Vector4     operator*(const Vector4& rhs) const;    // multiplication: v' = M * v
+    Vector3     operator*(const Vector3& rhs) const;    // multiplication: v' = M * v
+    GLMatrix4   operator*(const GLMatrix4& rhs) const;  // multiplication: M3 = M1 * M2
+    GLMatrix4&  operator*=(const GLMatrix4& rhs);       // multiplication: M1' = M1 * M2
+    bool        operator==(const GLMatrix4& rhs) const; // exact compare, no epsilon
+    bool        operator!=(const GLMatrix4& rhs) const; // exact compare, no epsilon
+    float       operator[](int index) const;            // storage order, m[col*4+row]
+    float&      operator[](int index);
+
+    friend std::ostream& operator<<(std::ostream& os, const GLMatrix4& m);
+
+private:
+    alignas(16) float m[16];
 
 };
 
@@ -628,6 +740,94 @@ inline std::ostream& operator<<(std::ostream& os, const Matrix3& m)
 
 
 
+///////////////////////////////////////////////////////////////////////////
+// SIMD kernels for row-major 4x4 arrays, used by Matrix4 and the batch
+// transforms. Every input is loaded before the output is stored, so out may
+// alias a, b or v. Loads are unaligned, heap arrays on 32-bit builds are
+// only 8-byte aligned.
+///////////////////////////////////////////////////////////////////////////
+#if defined(MATRICES_AVX)
+inline __m256 multiplyAdd(__m256 a, __m256 b, __m256 c)
+{
+#if defined(MATRICES_FMA)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// two rows of a (one per 128-bit lane) times b, whose rows are repeated in both lanes
+inline __m256 multiplyRowPair(__m256 a, __m256 b0, __m256 b1, __m256 b2, __m256 b3)
+{
+    __m256 r01 = multiplyAdd(_mm256_shuffle_ps(a, a, 0x55), b1, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x00), b0));
+    __m256 r23 = multiplyAdd(_mm256_shuffle_ps(a, a, 0xFF), b3, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xAA), b2));
+    return _mm256_add_ps(r01, r23);
+}
+#endif
+
+#if defined(MATRICES_SSE)
+// one row of a times the rows of b
+inline __m128 multiplyRow(__m128 a, __m128 b0, __m128 b1, __m128 b2, __m128 b3)
+{
+    __m128 r01 = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, 0x00), b0), _mm_mul_ps(_mm_shuffle_ps(a, a, 0x55), b1));
+    __m128 r23 = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, 0xAA), b2), _mm_mul_ps(_mm_shuffle_ps(a, a, 0xFF), b3));
+    return _mm_add_ps(r01, r23);
+}
+#endif
+
+// out = a * b
+inline void multiplyMatrix4(const float* a, const float* b, float* out)
+{
+#if defined(MATRICES_AVX)
+    __m256 b0 = _mm256_broadcast_ps((const __m128*)(b));
+    __m256 b1 = _mm256_broadcast_ps((const __m128*)(b + 4));
+    __m256 b2 = _mm256_broadcast_ps((const __m128*)(b + 8));
+    __m256 b3 = _mm256_broadcast_ps((const __m128*)(b + 12));
+    __m256 a01 = _mm256_loadu_ps(a);
+    __m256 a23 = _mm256_loadu_ps(a + 8);
+    _mm256_storeu_ps(out, multiplyRowPair(a01, b0, b1, b2, b3));
+    _mm256_storeu_ps(out + 8, multiplyRowPair(a23, b0, b1, b2, b3));
+#elif defined(MATRICES_SSE)
+    __m128 b0 = _mm_loadu_ps(b);
+    __m128 b1 = _mm_loadu_ps(b + 4);
+    __m128 b2 = _mm_loadu_ps(b + 8);
+    __m128 b3 = _mm_loadu_ps(b + 12);
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+    _mm_storeu_ps(out, multiplyRow(a0, b0, b1, b2, b3));
+    _mm_storeu_ps(out + 4, multiplyRow(a1, b0, b1, b2, b3));
+    _mm_storeu_ps(out + 8, multiplyRow(a2, b0, b1, b2, b3));
+    _mm_storeu_ps(out + 12, multiplyRow(a3, b0, b1, b2, b3));
+#elif defined(MATRICES_NEON)
+    float32x4_t b0 = vld1q_f32(b);
+    float32x4_t b1 = vld1q_f32(b + 4);
+    float32x4_t b2 = vld1q_f32(b + 8);
+    float32x4_t b3 = vld1q_f32(b + 12);
+    float32x4_t a_rows[4] = { vld1q_f32(a), vld1q_f32(a + 4), vld1q_f32(a + 8), vld1q_f32(a + 12) };
+    for(int i = 0; i < 4; ++i)
+    {
+        float32x4_t r = vmulq_laneq_f32(b0, a_rows[i], 0);
+        r = vfmaq_laneq_f32(r, b1, a_rows[i], 1);
+        r = vfmaq_laneq_f32(r, b2, a_rows[i], 2);
+        r = vfmaq_laneq_f32(r, b3, a_rows[i], 3);
+        vst1q_f32(out + i * 4, r);
+    }
+#else
+    float r[16];
+    for(int i = 0; i < 4; ++i)
+    {
+        for(int j = 0; j < 4; ++j)
+            r[i*4+j] = a[i*4]*b[j] + a[i*4+1]*b[4+j] + a[i*4+2]*b[8+j] + a[i*4+3]*b[12+j];
+    }
+    for(int i = 0; i < 16; ++i)
+        out[i] = r[i];
+#endif
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////
 // inline functions for Matrix4
 ///////////////////////////////////////////////////////////////////////////
@@ -790,6 +990,9 @@ inline Matrix4& Matrix4::operator-=(const Matrix4& rhs)
 
 
 
+// stays scalar: a transposed-row or broadcast-column SSE kernel measured 1.5x
+// slower than this inlined expression, which the compiler already interleaves
+// across a loop; use transformVectors for arrays
 inline Vector4 Matrix4::operator*(const Vector4& rhs) const
 {
     return Vector4(m[0]*rhs.x  + m[1]*rhs.y  + m[2]*rhs.z  + m[3]*rhs.w,
@@ -811,10 +1014,16 @@ inline Vector3 Matrix4::operator*(const Vector3& rhs) const
 
 inline Matrix4 Matrix4::operator*(const Matrix4& n) const
 {
+#if defined(MATRICES_SSE) || defined(MATRICES_NEON)
+    Matrix4 r((NoInit()));
+    multiplyMatrix4(m, n.m, r.m);
+    return r;
+#else
     return Matrix4(m[0]*n[0]  + m[1]*n[4]  + m[2]*n[8]  + m[3]*n[12],   m[0]*n[1]  + m[1]*n[5]  + m[2]*n[9]  + m[3]*n[13],   m[0]*n[2]  + m[1]*n[6]  + m[2]*n[10]  + m[3]*n[14],   m[0]*n[3]  + m[1]*n[7]  + m[2]*n[11]  + m[3]*n[15],
                    m[4]*n[0]  + m[5]*n[4]  + m[6]*n[8]  + m[7]*n[12],   m[4]*n[1]  + m[5]*n[5]  + m[6]*n[9]  + m[7]*n[13],   m[4]*n[2]  + m[5]*n[6]  + m[6]*n[10]  + m[7]*n[14],   m[4]*n[3]  + m[5]*n[7]  + m[6]*n[11]  + m[7]*n[15],
                    m[8]*n[0]  + m[9]*n[4]  + m[10]*n[8] + m[11]*n[12],  m[8]*n[1]  + m[9]*n[5]  + m[10]*n[9] + m[11]*n[13],  m[8]*n[2]  + m[9]*n[6]  + m[10]*n[10] + m[11]*n[14],  m[8]*n[3]  + m[9]*n[7]  + m[10]*n[11] + m[11]*n[15],
                    m[12]*n[0] + m[13]*n[4] + m[14]*n[8] + m[15]*n[12],  m[12]*n[1] + m[13]*n[5] + m[14]*n[9] + m[15]*n[13],  m[12]*n[2] + m[13]*n[6] + m[14]*n[10] + m[15]*n[14],  m[12]*n[3] + m[13]*n[7] + m[14]*n[11] + m[15]*n[15]);
+#endif
 }
 
 
@@ -898,4 +1107,159 @@ inline std::ostream& operator<<(std::ostream& os, const Matrix4& m)
     return os;
 }
 // END OF MATRIX4 INLINE //////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////
+// inline functions for GLMatrix4
+///////////////////////////////////////////////////////////////////////////
+inline GLMatrix4::GLMatrix4()
+{
+    identity();
+}
+
+
+
+inline GLMatrix4::GLMatrix4(const Matrix4& rowMajor)
+{
+    set(rowMajor);
+}
+
+
+
+inline GLMatrix4::GLMatrix4(float xx, float xy, float xz, float xw,
+                            float yx, float yy, float yz, float yw,
+                            float zx, float zy, float zz, float zw,
+                            float wx, float wy, float wz, float ww)
+{
+    m[0] = xx;  m[4] = xy;  m[8]  = xz;  m[12] = xw;
+    m[1] = yx;  m[5] = yy;  m[9]  = yz;  m[13] = yw;
+    m[2] = zx;  m[6] = zy;  m[10] = zz;  m[14] = zw;
+    m[3] = wx;  m[7] = wy;  m[11] = wz;  m[15] = ww;
+}
+
+
+
+inline void GLMatrix4::set(const Matrix4& rowMajor)
+{
+    const float* r = rowMajor.get();
+    for(int row = 0; row < 4; ++row)
+    {
+        m[row]      = r[row*4];
+        m[row + 4]  = r[row*4 + 1];
+        m[row + 8]  = r[row*4 + 2];
+        m[row + 12] = r[row*4 + 3];
+    }
+}
+
+
+
+inline const float* GLMatrix4::get() const
+{
+    return m;
+}
+
+
+
+inline Matrix4 GLMatrix4::toMatrix4() const
+{
+    return Matrix4(m[0], m[4], m[8],  m[12],
+                   m[1], m[5], m[9],  m[13],
+                   m[2], m[6], m[10], m[14],
+                   m[3], m[7], m[11], m[15]);
+}
+
+
+
+inline float GLMatrix4::at(int row, int col) const
+{
+    return m[col*4 + row];
+}
+
+
+
+inline GLMatrix4& GLMatrix4::identity()
+{
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+    m[1] = m[2] = m[3] = m[4] = m[6] = m[7] = m[8] = m[9] = m[11] = m[12] = m[13] = m[14] = 0.0f;
+    return *this;
+}
+
+
+
+inline Vector4 GLMatrix4::operator*(const Vector4& rhs) const
+{
+    return Vector4(m[0]*rhs.x + m[4]*rhs.y + m[8]*rhs.z  + m[12]*rhs.w,
+                   m[1]*rhs.x + m[5]*rhs.y + m[9]*rhs.z  + m[13]*rhs.w,
+                   m[2]*rhs.x + m[6]*rhs.y + m[10]*rhs.z + m[14]*rhs.w,
+                   m[3]*rhs.x + m[7]*rhs.y + m[11]*rhs.z + m[15]*rhs.w);
+}
+
+
+
+inline Vector3 GLMatrix4::operator*(const Vector3& rhs) const
+{
+    return Vector3(m[0]*rhs.x + m[4]*rhs.y + m[8]*rhs.z,
+                   m[1]*rhs.x + m[5]*rhs.y + m[9]*rhs.z,
+                   m[2]*rhs.x + m[6]*rhs.y + m[10]*rhs.z);
+}
+
+
+
+inline GLMatrix4 GLMatrix4::operator*(const GLMatrix4& rhs) const
+{
+    // column-major storage is the transpose, (A * B)^T = B^T * A^T
+    GLMatrix4 r;
+    multiplyMatrix4(rhs.m, m, r.m);
+    return r;
+}
+
+
+
+inline GLMatrix4& GLMatrix4::operator*=(const GLMatrix4& rhs)
+{
+    multiplyMatrix4(rhs.m, m, m);
+    return *this;
+}
+
+
+
+inline bool GLMatrix4::operator==(const GLMatrix4& rhs) const
+{
+    for(int i = 0; i < 16; ++i)
+    {
+        if(m[i] != rhs.m[i])
+            return false;
+    }
+    return true;
+}
+
+
+
+inline bool GLMatrix4::operator!=(const GLMatrix4& rhs) const
+{
+    return !(*this == rhs);
+}
+
+
+
+inline float GLMatrix4::operator[](int index) const
+{
+    return m[index];
+}
+
+
+
+inline float& GLMatrix4::operator[](int index)
+{
+    return m[index];
+}
+
+
+
+inline std::ostream& operator<<(std::ostream& os, const GLMatrix4& m)
+{
+    return os << m.toMatrix4();
+}
+// END OF GLMATRIX4 INLINE ////////////////////////////////////////////////////
 #endif
@@ -0,0 +1,916 @@
+///////////////////////////////////////////////////////////////////////////////
+// MeshCache.cpp
+// =============
+// Vertex cache optimization, the shape codec, the LZ frames and the cache
+// file of MeshCache.h.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MESH_CACHE_USE_SSE
+#endif
+// pshufb for the index varints, MSVC has no SSSE3 switch but /arch:AVX implies it
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define MESH_CACHE_USE_SSSE3
+#endif
+#include "MeshCache.h"
+
+using namespace std;
+
+const char MESH_CACHE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+const uint32_t MESH_CACHE_VERSION = 2;		// bumped when the stored LOD chains change
+const int MESH_CACHE_LZ_HASH_BITS = 14;
+const int MESH_CACHE_LZ_MIN_MATCH = 4;
+
+static double ElapsedMs(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// byte buffers
+///////////////////////////////////////////////////////////////////////////////
+struct ByteWriter
+{
+	vector<unsigned char>& out;
+	explicit ByteWriter(vector<unsigned char>& out) : out(out) {}
+	void bytes(const void* data, size_t size)
+	{
+		const unsigned char* p = (const unsigned char*)data;
+		out.insert(out.end(), p, p + size);
+	}
+	template<class T> void put(const T& value) { bytes(&value, sizeof(value)); }
+};
+
+struct ByteReader
+{
+	const unsigned char* p;
+	const unsigned char* end;
+	ByteReader(const unsigned char* data, size_t size) : p(data), end(data + size) {}
+	const unsigned char* take(size_t size)
+	{
+		if ((size_t)(end - p) < size)
+			return NULL;
+		const unsigned char* start = p;
+		p += size;
+		return start;
+	}
+	template<class T> bool get(T& value)
+	{
+		const unsigned char* data = take(sizeof(value));
+		if (data)
+			memcpy(&value, data, sizeof(value));
+		return data != NULL;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// vertex cache optimization, Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+///////////////////////////////////////////////////////////////////////////////
+static float VertexScore(int cache_position, unsigned int remaining)
+{
+	if (remaining == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if (cache_position >= 0) {
+		// the last triangle's vertices score the same, whichever order it was emitted in
+		if (cache_position < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (cache_position - 3) / (float)(MESH_CACHE_VERTEX_CACHE - 3), 1.5f);
+	}
+	// vertices with few triangles left are worth finishing
+	return score + 2.0f / sqrtf((float)remaining);
+}
+
+static void OptimizeVertexCache(vector<unsigned int>& indices, size_t vertex_count)
+{
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0)
+		return;
+
+	// triangles of every vertex, the first remaining[v] of them not emitted yet
+	vector<unsigned int> offsets(vertex_count + 1, 0), remaining(vertex_count, 0);
+	for (unsigned int v : indices)
+		remaining[v]++;
+	for (size_t v = 0; v < vertex_count; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	vector<unsigned int> adjacency(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	vector<int> cache_position(vertex_count, -1);
+	vector<float> vertex_score(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++)
+		vertex_score[v] = VertexScore(-1, remaining[v]);
+	vector<float> triangle_score(triangle_count);
+	vector<bool> emitted(triangle_count, false);
+	for (size_t t = 0; t < triangle_count; t++)
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+
+	auto rescore = [&](unsigned int v) {
+		float score = VertexScore(cache_position[v], remaining[v]);
+		float delta = score - vertex_score[v];
+		vertex_score[v] = score;
+		for (unsigned int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+			triangle_score[adjacency[a]] += delta;
+	};
+
+	vector<unsigned int> optimized;
+	optimized.reserve(indices.size());
+	vector<unsigned int> cache, next_cache;
+	size_t scan = 0;	// no triangle before this one is left
+	long long best = -1;
+	for (size_t done = 0; done < triangle_count; done++)
+	{
+		if (best < 0) {
+			// nothing in the cache has triangles left, continue with the next unused triangle
+			while (emitted[scan])
+				scan++;
+			best = (long long)scan;
+		}
+		const unsigned int* tri = &indices[best * 3];
+		optimized.insert(optimized.end(), tri, tri + 3);
+		emitted[best] = true;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = tri[k];
+			unsigned int first = offsets[v], last = offsets[v] + remaining[v] - 1;
+			for (unsigned int a = first; a <= last; a++)
+				if (adjacency[a] == (unsigned int)best) {
+					swap(adjacency[a], adjacency[last]);
+					break;
+				}
+			remaining[v]--;
+		}
+
+		// the triangle's vertices move to the front, the oldest ones fall out
+		next_cache.assign(tri, tri + 3);
+		for (unsigned int v : cache)
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				next_cache.push_back(v);
+		for (size_t i = MESH_CACHE_VERTEX_CACHE; i < next_cache.size(); i++)
+		{
+			cache_position[next_cache[i]] = -1;
+			rescore(next_cache[i]);
+		}
+		next_cache.resize(min(next_cache.size(), (size_t)MESH_CACHE_VERTEX_CACHE));
+		for (size_t i = 0; i < next_cache.size(); i++)
+		{
+			cache_position[next_cache[i]] = (int)i;
+			rescore(next_cache[i]);
+		}
+		cache.swap(next_cache);
+
+		best = -1;
+		float best_score = -1e30f;
+		for (unsigned int v : cache)
+			for (unsigned int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+				if (triangle_score[adjacency[a]] > best_score) {
+					best_score = triangle_score[adjacency[a]];
+					best = adjacency[a];
+				}
+	}
+	indices.swap(optimized);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LZ frames: LZ4-style sequences of a token (literal and match length nibbles),
+// the literals, a 16-bit offset and the match; the last sequence has no match
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t Read32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void PutLength(vector<unsigned char>& out, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		out.push_back(255);
+	out.push_back((unsigned char)length);
+}
+
+static void LZCompress(const unsigned char* src, size_t size, vector<unsigned char>& out)
+{
+	vector<uint32_t> table(1 << MESH_CACHE_LZ_HASH_BITS, 0);	// position + 1 of the last occurrence
+	size_t ip = 0, anchor = 0;
+	auto sequence = [&](size_t literals, size_t offset, size_t match) {
+		size_t match_code = match ? match - MESH_CACHE_LZ_MIN_MATCH : 0;
+		out.push_back((unsigned char)((min(literals, (size_t)15) << 4) | min(match_code, (size_t)15)));
+		if (literals >= 15)
+			PutLength(out, literals - 15);
+		out.insert(out.end(), src + anchor, src + anchor + literals);
+		if (!match)
+			return;
+		out.push_back((unsigned char)(offset & 0xFF));
+		out.push_back((unsigned char)(offset >> 8));
+		if (match_code >= 15)
+			PutLength(out, match_code - 15);
+	};
+	while (ip + MESH_CACHE_LZ_MIN_MATCH <= size)
+	{
+		uint32_t word = Read32(src + ip);
+		uint32_t h = (word * 2654435761u) >> (32 - MESH_CACHE_LZ_HASH_BITS);
+		size_t candidate = table[h];
+		table[h] = (uint32_t)(ip + 1);
+		if (candidate == 0 || ip - (candidate - 1) > 65535 || Read32(src + candidate - 1) != word) {
+			// skip faster through data that does not compress
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		size_t match_start = candidate - 1;
+		size_t length = MESH_CACHE_LZ_MIN_MATCH;
+		while (ip + length < size && src[match_start + length] == src[ip + length])
+			length++;
+		sequence(ip - anchor, ip - match_start, length);
+		ip += length;
+		anchor = ip;
+	}
+	sequence(size - anchor, 0, 0);
+}
+
+static bool GetLength(const unsigned char*& ip, const unsigned char* end, size_t& length)
+{
+	unsigned char b;
+	do {
+		if (ip >= end)
+			return false;
+		b = *ip++;
+		length += b;
+	} while (b == 255);
+	return true;
+}
+
+static bool LZDecompress(const unsigned char* ip, size_t size, unsigned char* out, size_t out_size)
+{
+	const unsigned char* end = ip + size;
+	unsigned char* op = out;
+	unsigned char* out_end = out + out_size;
+	while (ip < end)
+	{
+		unsigned char token = *ip++;
+		size_t literals = token >> 4;
+		if (literals == 15 && !GetLength(ip, end, literals))
+			return false;
+		if ((size_t)(end - ip) < literals || (size_t)(out_end - op) < literals)
+			return false;
+		memcpy(op, ip, literals);
+		ip += literals;
+		op += literals;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		size_t length = (token & 15);
+		if (length == 15 && !GetLength(ip, end, length))
+			return false;
+		length += MESH_CACHE_LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(op - out) || (size_t)(out_end - op) < length)
+			return false;
+		const unsigned char* match = op - offset;
+		if (offset == 1)
+			memset(op, *match, length);
+		else if (offset >= length)
+			memcpy(op, match, length);
+		else {
+			// overlapping, the repeated span doubles with every copy
+			for (size_t copied = 0; copied < length;)
+			{
+				size_t n = min((size_t)(op + copied - match), length - copied);
+				memcpy(op + copied, match, n);
+				copied += n;
+			}
+		}
+		op += length;
+	}
+	return op == out_end;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// shape codec
+///////////////////////////////////////////////////////////////////////////////
+struct ComponentRange
+{
+	float base;
+	float scale;		// 0 for a constant component
+};
+
+static inline uint16_t ZigZag16(uint16_t delta)
+{
+	int16_t s = (int16_t)delta;
+	return (uint16_t)((s << 1) ^ (s >> 15));
+}
+
+static inline uint32_t ZigZag32(int32_t delta)
+{
+	return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+static void EncodeShape(const MeshCacheShape& shape, bool lz, vector<unsigned char>& out, size_t& raw_bytes)
+{
+	size_t vertex_count = shape.mesh.vertexCount();
+	vector<vector<unsigned int>> lists(1 + shape.lods.size());
+	lists[0] = shape.mesh.indices;
+	for (size_t l = 0; l < shape.lods.size(); l++)
+		lists[1 + l] = shape.lods[l].indices;
+	for (vector<unsigned int>& list : lists)
+		OptimizeVertexCache(list, vertex_count);
+
+	// renumber in first-use order, so vertex deltas follow the mesh and index deltas stay small
+	vector<unsigned int> remap(vertex_count, ~0u);
+	unsigned int next = 0;
+	for (const vector<unsigned int>& list : lists)
+		for (unsigned int v : list)
+			if (remap[v] == ~0u)
+				remap[v] = next++;
+	for (size_t v = 0; v < vertex_count; v++)
+		if (remap[v] == ~0u)
+			remap[v] = next++;
+	vector<float> vertices(shape.mesh.vertices.size());
+	for (size_t v = 0; v < vertex_count; v++)
+		memcpy(&vertices[remap[v] * INDEXED_VERTEX_STRIDE], &shape.mesh.vertices[v * INDEXED_VERTEX_STRIDE], INDEXED_VERTEX_STRIDE * sizeof(float));
+	for (vector<unsigned int>& list : lists)
+		for (unsigned int& v : list)
+			v = remap[v];
+
+	// quantize, delta along the vertices, zigzag, then one plane per byte of every component
+	ComponentRange ranges[INDEXED_VERTEX_STRIDE];
+	vector<unsigned char> payload(vertex_count * INDEXED_VERTEX_STRIDE * 2);
+	for (int c = 0; c < INDEXED_VERTEX_STRIDE; c++)
+	{
+		float lo = 0.0f, hi = 0.0f;
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			float x = vertices[v * INDEXED_VERTEX_STRIDE + c];
+			lo = v == 0 ? x : min(lo, x);
+			hi = v == 0 ? x : max(hi, x);
+		}
+		ranges[c].base = lo;
+		ranges[c].scale = hi > lo ? (hi - lo) / 65535.0f : 0.0f;
+		unsigned char* low_plane = &payload[c * 2 * vertex_count];
+		unsigned char* high_plane = low_plane + vertex_count;
+		uint16_t previous = 0;
+		for (size_t v = 0; v < vertex_count; v++)
+		{
+			if (v % MESH_CACHE_BLOCK_VERTICES == 0)
+				previous = 0;
+			float x = vertices[v * INDEXED_VERTEX_STRIDE + c];
+			uint16_t q = hi > lo ? (uint16_t)min(65535.0, floor((x - lo) / (hi - lo) * 65535.0 + 0.5)) : 0;
+			uint16_t z = ZigZag16((uint16_t)(q - previous));
+			previous = q;
+			low_plane[v] = (unsigned char)(z & 0xFF);
+			high_plane[v] = (unsigned char)(z >> 8);
+		}
+	}
+
+	vector<uint32_t> list_bytes(lists.size());
+	for (size_t l = 0; l < lists.size(); l++)
+	{
+		size_t start = payload.size();
+		unsigned int previous = 0;
+		for (unsigned int v : lists[l])
+		{
+			uint32_t z = ZigZag32((int32_t)(v - previous));
+			previous = v;
+			for (; z >= 0x80; z >>= 7)
+				payload.push_back((unsigned char)(z | 0x80));
+			payload.push_back((unsigned char)z);
+		}
+		list_bytes[l] = (uint32_t)(payload.size() - start);
+	}
+
+	ByteWriter w(out);
+	w.put((int32_t)shape.material);
+	w.put((uint32_t)vertex_count);
+	w.put((uint32_t)lists.size());
+	for (size_t l = 0; l < lists.size(); l++)
+	{
+		w.put((uint32_t)lists[l].size());
+		w.put(list_bytes[l]);
+		w.put(l == 0 ? 0.0f : shape.lods[l - 1].error);
+	}
+	w.bytes(ranges, sizeof(ranges));
+	w.put((uint32_t)payload.size());
+	uint32_t frame_count = (uint32_t)((payload.size() + MESH_CACHE_LZ_FRAME - 1) / MESH_CACHE_LZ_FRAME);
+	w.put(frame_count);
+	vector<unsigned char> packed;
+	for (uint32_t f = 0; f < frame_count; f++)
+	{
+		size_t start = (size_t)f * MESH_CACHE_LZ_FRAME;
+		size_t size = min((size_t)MESH_CACHE_LZ_FRAME, payload.size() - start);
+		packed.clear();
+		if (lz)
+			LZCompress(&payload[start], size, packed);
+		// a frame that does not shrink is stored as it is, its stored size tells
+		bool stored = !lz || packed.size() >= size;
+		w.put((uint32_t)(stored ? size : packed.size()));
+		if (stored)
+			w.bytes(&payload[start], size);
+		else
+			w.bytes(packed.data(), packed.size());
+	}
+
+	raw_bytes += shape.mesh.vertices.size() * sizeof(float);
+	for (const vector<unsigned int>& list : lists)
+		raw_bytes += list.size() * sizeof(unsigned int);
+}
+
+// the layout of one shape in the file, what its decode jobs need
+struct ShapeLayout
+{
+	int material;
+	uint32_t vertex_count;
+	vector<uint32_t> list_counts, list_bytes;
+	vector<float> list_errors;
+	ComponentRange ranges[INDEXED_VERTEX_STRIDE];
+	vector<const unsigned char*> frames;
+	vector<uint32_t> frame_stored;
+	vector<unsigned char> payload;
+};
+
+static bool ParseShape(ByteReader& r, ShapeLayout& s)
+{
+	uint32_t list_count, payload_bytes, frame_count;
+	int32_t material;
+	if (!r.get(material) || !r.get(s.vertex_count) || !r.get(list_count) || list_count == 0)
+		return false;
+	s.material = material;
+	s.list_counts.resize(list_count);
+	s.list_bytes.resize(list_count);
+	s.list_errors.resize(list_count);
+	uint64_t index_bytes = 0;
+	for (uint32_t l = 0; l < list_count; l++)
+	{
+		if (!r.get(s.list_counts[l]) || !r.get(s.list_bytes[l]) || !r.get(s.list_errors[l]))
+			return false;
+		index_bytes += s.list_bytes[l];
+	}
+	const unsigned char* ranges = r.take(sizeof(s.ranges));
+	if (!ranges || !r.get(payload_bytes) || !r.get(frame_count))
+		return false;
+	memcpy(s.ranges, ranges, sizeof(s.ranges));
+	if ((uint64_t)s.vertex_count * INDEXED_VERTEX_STRIDE * 2 + index_bytes != payload_bytes ||
+		frame_count != (payload_bytes + MESH_CACHE_LZ_FRAME - 1) / MESH_CACHE_LZ_FRAME)
+		return false;
+	s.payload.resize(payload_bytes);
+	for (uint32_t f = 0; f < frame_count; f++)
+	{
+		uint32_t stored;
+		const unsigned char* data;
+		if (!r.get(stored) || !(data = r.take(stored)))
+			return false;
+		s.frames.push_back(data);
+		s.frame_stored.push_back(stored);
+	}
+	return true;
+}
+
+static bool DecodeFrame(ShapeLayout& s, int f)
+{
+	size_t start = (size_t)f * MESH_CACHE_LZ_FRAME;
+	size_t size = min((size_t)MESH_CACHE_LZ_FRAME, s.payload.size() - start);
+	if (s.frame_stored[f] == size) {
+		memcpy(&s.payload[start], s.frames[f], size);
+		return true;
+	}
+	return LZDecompress(s.frames[f], s.frame_stored[f], &s.payload[start], size);
+}
+
+// vertices [first, first + count) of every component, count at most MESH_CACHE_BLOCK_VERTICES
+static void DecodeVertexBlock(const ShapeLayout& s, size_t first, size_t count, float* vertices)
+{
+	alignas(16) float planar[INDEXED_VERTEX_STRIDE][MESH_CACHE_BLOCK_VERTICES];
+	for (int c = 0; c < INDEXED_VERTEX_STRIDE; c++)
+	{
+		const unsigned char* low_plane = &s.payload[c * 2 * (size_t)s.vertex_count + first];
+		const unsigned char* high_plane = low_plane + s.vertex_count;
+		float base = s.ranges[c].base, scale = s.ranges[c].scale;
+		float* out = planar[c];
+		size_t v = 0;
+		uint16_t previous = 0;
+#ifdef MESH_CACHE_USE_SSE
+		const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+		const __m128 base4 = _mm_set1_ps(base), scale4 = _mm_set1_ps(scale);
+		__m128i carry = zero;
+		for (; v + 8 <= count; v += 8)
+		{
+			// 8 zigzag deltas from the two byte planes
+			__m128i z = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(low_plane + v)), _mm_loadl_epi64((const __m128i*)(high_plane + v)));
+			__m128i d = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(zero, _mm_and_si128(z, one)));
+			// prefix sum across the lanes, plus the last value of the previous 8
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+			__m128i q = _mm_add_epi16(d, carry);
+			carry = _mm_shuffle_epi32(_mm_shufflehi_epi16(q, 0xFF), 0xFF);
+			__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, zero));
+			__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(q, zero));
+			_mm_store_ps(out + v, _mm_add_ps(_mm_mul_ps(lo, scale4), base4));
+			_mm_store_ps(out + v + 4, _mm_add_ps(_mm_mul_ps(hi, scale4), base4));
+		}
+		previous = (uint16_t)_mm_extract_epi16(carry, 0);
+#endif
+		for (; v < count; v++)
+		{
+			uint16_t z = (uint16_t)(low_plane[v] | (high_plane[v] << 8));
+			previous = (uint16_t)(previous + ((z >> 1) ^ (uint16_t)-(int)(z & 1)));
+			out[v] = (float)previous * scale + base;
+		}
+	}
+	float* dst = vertices + first * INDEXED_VERTEX_STRIDE;
+	size_t v = 0;
+#ifdef MESH_CACHE_USE_SSE
+	// a 4x4 transpose per 4 components of 4 vertices, the last 3 components store 3 lanes
+	static_assert(INDEXED_VERTEX_STRIDE % 4 == 3, "the interleave expects a 3 component tail");
+	for (; v + 4 <= count; v += 4, dst += 4 * INDEXED_VERTEX_STRIDE)
+	{
+		for (int c = 0; c < INDEXED_VERTEX_STRIDE; c += 4)
+		{
+			__m128 r0 = _mm_load_ps(planar[c] + v);
+			__m128 r1 = _mm_load_ps(planar[c + 1] + v);
+			__m128 r2 = _mm_load_ps(planar[c + 2] + v);
+			__m128 r3 = _mm_load_ps(planar[min(c + 3, INDEXED_VERTEX_STRIDE - 1)] + v);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			float* d = dst + c;
+			if (c + 4 <= INDEXED_VERTEX_STRIDE) {
+				_mm_storeu_ps(d, r0);
+				_mm_storeu_ps(d + INDEXED_VERTEX_STRIDE, r1);
+				_mm_storeu_ps(d + 2 * INDEXED_VERTEX_STRIDE, r2);
+				_mm_storeu_ps(d + 3 * INDEXED_VERTEX_STRIDE, r3);
+			}
+			else {
+				// the fourth lane would land in the next vertex, which may belong to another block
+				const __m128 rows[4] = { r0, r1, r2, r3 };
+				for (int k = 0; k < 4; k++, d += INDEXED_VERTEX_STRIDE)
+				{
+					_mm_storel_pi((__m64*)d, rows[k]);
+					_mm_store_ss(d + 2, _mm_movehl_ps(rows[k], rows[k]));
+				}
+			}
+		}
+	}
+#endif
+	for (; v < count; v++, dst += INDEXED_VERTEX_STRIDE)
+		for (int c = 0; c < INDEXED_VERTEX_STRIDE; c++)
+			dst[c] = planar[c][v];
+}
+
+#ifdef MESH_CACHE_USE_SSE
+// zigzag decodes 4 deltas, adds them up starting from the last index in carry and stores them;
+// in_range keeps the lanes whose index is below the vertex count
+static inline void AccumulateIndices(__m128i z, __m128i& carry, __m128i& in_range, __m128i limit, unsigned int* out)
+{
+	const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi32(1);
+	// unsigned compare through the signed one
+	const __m128i bias = _mm_set1_epi32(INT32_MIN);
+	__m128i d = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(zero, _mm_and_si128(z, one)));
+	d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+	d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+	__m128i x = _mm_add_epi32(d, carry);
+	carry = _mm_shuffle_epi32(x, 0xFF);
+	in_range = _mm_and_si128(in_range, _mm_cmplt_epi32(_mm_xor_si128(x, bias), limit));
+	_mm_storeu_si128((__m128i*)out, x);
+}
+#endif
+
+#ifdef MESH_CACHE_USE_SSSE3
+const int VARINT_WINDOW = 12;	// bytes whose continuation bits pick the table entry
+
+// how the whole 1 and 2 byte varints at the start of a window spread over 8 16-bit lanes
+struct VarintShuffle
+{
+	unsigned char shuffle[16];	// low byte and high byte of each lane, 0x80 for zero
+	unsigned char values;		// at most 8, 0 when the first varint is longer than 2 bytes
+	unsigned char bytes;
+};
+
+static const VarintShuffle* VarintShuffles()
+{
+	static const vector<VarintShuffle> table = [] {
+		vector<VarintShuffle> t(1 << VARINT_WINDOW);
+		for (int mask = 0; mask < (int)t.size(); mask++)
+		{
+			VarintShuffle& e = t[mask];
+			memset(e.shuffle, 0x80, sizeof(e.shuffle));
+			int pos = 0, n = 0;
+			while (n < 8 && pos < VARINT_WINDOW)
+			{
+				bool two = (mask >> pos) & 1;
+				if (two && (pos + 1 >= VARINT_WINDOW || ((mask >> (pos + 1)) & 1)))
+					break;
+				e.shuffle[2 * n] = (unsigned char)pos;
+				if (two)
+					e.shuffle[2 * n + 1] = (unsigned char)(pos + 1);
+				pos += two ? 2 : 1;
+				n++;
+			}
+			e.values = (unsigned char)n;
+			e.bytes = (unsigned char)pos;
+		}
+		return t;
+	}();
+	return table.data();
+}
+#endif
+
+static bool DecodeIndexList(const ShapeLayout& s, int l, vector<unsigned int>& indices)
+{
+	size_t offset = (size_t)s.vertex_count * INDEXED_VERTEX_STRIDE * 2;
+	for (int i = 0; i < l; i++)
+		offset += s.list_bytes[i];
+	const unsigned char* p = &s.payload[0] + offset;
+	const unsigned char* end = p + s.list_bytes[l];
+	indices.resize(s.list_counts[l]);
+	size_t i = 0, n = indices.size();
+	unsigned int previous = 0;
+#ifdef MESH_CACHE_USE_SSE
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i limit = _mm_xor_si128(_mm_set1_epi32((int)s.vertex_count), _mm_set1_epi32(INT32_MIN));
+#endif
+#ifdef MESH_CACHE_USE_SSSE3
+	const VarintShuffle* shuffles = VarintShuffles();
+	const __m128i low7 = _mm_set1_epi16(0x7F), high7 = _mm_set1_epi16(0x3F80);
+#endif
+	while (i < n)
+	{
+#if defined(MESH_CACHE_USE_SSSE3)
+		// up to 8 varints of 1 or 2 bytes at a time, the continuation bits pick the shuffle
+		// that moves each into a 16-bit lane; lanes past the last varint decode to a zero delta
+		if (n - i >= 8 && end - p >= 16) {
+			__m128i bytes = _mm_loadu_si128((const __m128i*)p);
+			const VarintShuffle& e = shuffles[_mm_movemask_epi8(bytes) & ((1 << VARINT_WINDOW) - 1)];
+			if (e.values > 0) {
+				__m128i lanes = _mm_shuffle_epi8(bytes, _mm_loadu_si128((const __m128i*)e.shuffle));
+				lanes = _mm_or_si128(_mm_and_si128(lanes, low7), _mm_and_si128(_mm_srli_epi16(lanes, 1), high7));
+				__m128i carry = _mm_set1_epi32((int)previous);
+				__m128i in_range = _mm_cmpeq_epi32(zero, zero);
+				AccumulateIndices(_mm_unpacklo_epi16(lanes, zero), carry, in_range, limit, &indices[i]);
+				AccumulateIndices(_mm_unpackhi_epi16(lanes, zero), carry, in_range, limit, &indices[i + 4]);
+				if (_mm_movemask_epi8(in_range) != 0xFFFF)
+					return false;
+				previous = (unsigned int)_mm_cvtsi128_si32(carry);
+				p += e.bytes;
+				i += e.values;
+				continue;
+			}
+		}
+#elif defined(MESH_CACHE_USE_SSE)
+		// 16 one-byte deltas at a time
+		if (n - i >= 16 && end - p >= 16) {
+			__m128i bytes = _mm_loadu_si128((const __m128i*)p);
+			if (_mm_movemask_epi8(bytes) == 0) {
+				__m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+				__m128i carry = _mm_set1_epi32((int)previous);
+				__m128i in_range = _mm_cmpeq_epi32(zero, zero);
+				AccumulateIndices(_mm_unpacklo_epi16(lo, zero), carry, in_range, limit, &indices[i]);
+				AccumulateIndices(_mm_unpackhi_epi16(lo, zero), carry, in_range, limit, &indices[i + 4]);
+				AccumulateIndices(_mm_unpacklo_epi16(hi, zero), carry, in_range, limit, &indices[i + 8]);
+				AccumulateIndices(_mm_unpackhi_epi16(hi, zero), carry, in_range, limit, &indices[i + 12]);
+				if (_mm_movemask_epi8(in_range) != 0xFFFF)
+					return false;
+				previous = (unsigned int)_mm_cvtsi128_si32(carry);
+				p += 16;
+				i += 16;
+				continue;
+			}
+		}
+#endif
+		uint32_t z;
+		if (p != end && *p < 0x80)
+			z = *p++;	// most deltas of an optimized order fit one byte
+		else {
+			z = 0;
+			for (int shift = 0;; shift += 7)
+			{
+				if (p == end || shift > 28)
+					return false;
+				unsigned char b = *p++;
+				z |= (uint32_t)(b & 0x7F) << shift;
+				if (b < 0x80)
+					break;
+			}
+		}
+		previous += (unsigned int)((z >> 1) ^ (0u - (z & 1)));
+		if (previous >= s.vertex_count)
+			return false;
+		indices[i++] = previous;
+	}
+	return p == end;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// cache files
+///////////////////////////////////////////////////////////////////////////////
+// FNV-1a over 8-byte words, enough to tell a damaged file from a good one
+static uint64_t Checksum(const unsigned char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	return hash;
+}
+
+bool MeshCacheKeyOf(const string& source_path, int lod_levels, float lod_reduction, MeshCacheKey& key)
+{
+	struct stat info;
+	if (stat(source_path.c_str(), &info) != 0)
+		return false;
+	key.source_bytes = (uint64_t)info.st_size;
+	key.source_time = (int64_t)info.st_mtime;
+	key.lod_levels = (uint32_t)lod_levels;
+	key.lod_reduction = lod_reduction;
+	return true;
+}
+
+string MeshCachePath(const string& dir, const string& source_path)
+{
+	// FNV-1a, models of the same name in different directories get their own cache
+	uint32_t hash = 2166136261u;
+	for (char c : source_path)
+		hash = (hash ^ (unsigned char)c) * 16777619u;
+	size_t slash = source_path.find_last_of("/\\");
+	string name = slash == string::npos ? source_path : source_path.substr(slash + 1);
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "_%08x", hash);
+	return dir + "/" + name + suffix + ".meshc";
+}
+
+bool WriteMeshCache(const string& path, const MeshCacheKey& key, const MeshCacheModel& model, bool lz, MeshCacheStats& stats)
+{
+	auto start = chrono::steady_clock::now();
+	vector<unsigned char> file;
+	ByteWriter w(file);
+	w.bytes(MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+	w.put(MESH_CACHE_VERSION);
+	w.put(key.source_bytes);
+	w.put(key.source_time);
+	w.put(key.lod_levels);
+	w.put(key.lod_reduction);
+	w.put((uint32_t)model.materials.size());
+	w.put((uint32_t)model.shapes.size());
+	size_t checksum_offset = file.size();
+	w.put((uint64_t)0);		// of everything after it, filled in below
+	for (const MeshCacheMaterial& m : model.materials)
+	{
+		w.bytes(m.ambient, sizeof(m.ambient));
+		w.bytes(m.diffuse, sizeof(m.diffuse));
+		w.bytes(m.specular, sizeof(m.specular));
+		w.put((uint32_t)m.diffuse_texname.size());
+		w.bytes(m.diffuse_texname.data(), m.diffuse_texname.size());
+	}
+	stats.raw_bytes = 0;
+	for (const MeshCacheShape& shape : model.shapes)
+		EncodeShape(shape, lz, file, stats.raw_bytes);
+	size_t body = checksum_offset + sizeof(uint64_t);
+	uint64_t checksum = Checksum(&file[body], file.size() - body);
+	memcpy(&file[checksum_offset], &checksum, sizeof(checksum));
+
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+	string temporary = path + suffix;
+	FILE* out = fopen(temporary.c_str(), "wb");
+	if (!out)
+		return false;
+	bool ok = fwrite(file.data(), 1, file.size(), out) == file.size();
+	ok = fclose(out) == 0 && ok;
+	// rename does not replace an existing file everywhere
+	remove(path.c_str());
+	ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+	if (!ok)
+		remove(temporary.c_str());
+	stats.file_bytes = file.size();
+	stats.encode_ms = ElapsedMs(start);
+	stats.read_ms = stats.verify_ms = stats.decode_ms = 0.0;
+	return ok;
+}
+
+bool ReadMeshCache(const string& path, const MeshCacheKey& key, MeshCacheModel& model, MeshCacheStats& stats, ThreadPool& pool)
+{
+	auto start = chrono::steady_clock::now();
+	FILE* in = fopen(path.c_str(), "rb");
+	if (!in)
+		return false;
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	vector<unsigned char> file(size > 0 ? (size_t)size : 0);
+	bool read = size > 0 && fread(file.data(), 1, file.size(), in) == file.size();
+	fclose(in);
+	if (!read)
+		return false;
+	stats.read_ms = ElapsedMs(start);
+	stats.file_bytes = file.size();
+	stats.encode_ms = 0.0;
+
+	start = chrono::steady_clock::now();
+	ByteReader r(file.data(), file.size());
+	const unsigned char* magic = r.take(sizeof(MESH_CACHE_MAGIC));
+	uint32_t version, material_count, shape_count;
+	MeshCacheKey stored;
+	uint64_t checksum;
+	if (!magic || memcmp(magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 || !r.get(version) || version != MESH_CACHE_VERSION)
+		return false;
+	if (!r.get(stored.source_bytes) || !r.get(stored.source_time) || !r.get(stored.lod_levels) || !r.get(stored.lod_reduction) ||
+		!r.get(material_count) || !r.get(shape_count) || !r.get(checksum))
+		return false;
+	if (stored.source_bytes != key.source_bytes || stored.source_time != key.source_time ||
+		stored.lod_levels != key.lod_levels || stored.lod_reduction != key.lod_reduction ||
+		Checksum(r.p, r.end - r.p) != checksum)
+		return false;
+	stats.verify_ms = ElapsedMs(start);
+
+	start = chrono::steady_clock::now();
+
+	model.materials.resize(material_count);
+	for (MeshCacheMaterial& m : model.materials)
+	{
+		uint32_t name_length;
+		const unsigned char* name;
+		if (!r.get(m.ambient) || !r.get(m.diffuse) || !r.get(m.specular) || !r.get(name_length) || !(name = r.take(name_length)))
+			return false;
+		m.diffuse_texname.assign((const char*)name, name_length);
+	}
+	vector<ShapeLayout> layouts(shape_count);
+	for (ShapeLayout& layout : layouts)
+		if (!ParseShape(r, layout))
+			return false;
+
+	// LZ frames of every shape, then the vertex blocks and index lists
+	vector<pair<int, int>> jobs;
+	for (int s = 0; s < (int)layouts.size(); s++)
+		for (int f = 0; f < (int)layouts[s].frames.size(); f++)
+			jobs.push_back(make_pair(s, f));
+	atomic<bool> ok(true);
+	pool.parallelFor((int)jobs.size(), [&](int j) {
+		if (!DecodeFrame(layouts[jobs[j].first], jobs[j].second))
+			ok.store(false);
+	});
+	if (!ok.load())
+		return false;
+
+	model.shapes.resize(shape_count);
+	jobs.clear();
+	stats.raw_bytes = 0;
+	for (int s = 0; s < (int)layouts.size(); s++)
+	{
+		const ShapeLayout& layout = layouts[s];
+		MeshCacheShape& shape = model.shapes[s];
+		shape.material = layout.material;
+		shape.mesh.vertices.resize((size_t)layout.vertex_count * INDEXED_VERTEX_STRIDE);
+		shape.lods.resize(layout.list_counts.size() - 1);
+		stats.raw_bytes += shape.mesh.vertices.size() * sizeof(float);
+		for (size_t l = 0; l < layout.list_counts.size(); l++)
+		{
+			stats.raw_bytes += layout.list_counts[l] * sizeof(unsigned int);
+			if (l > 0)
+				shape.lods[l - 1].error = layout.list_errors[l];
+		}
+		// jobs below the vertex count are vertex blocks, the rest index lists
+		int blocks = (int)((layout.vertex_count + MESH_CACHE_BLOCK_VERTICES - 1) / MESH_CACHE_BLOCK_VERTICES);
+		for (int b = 0; b < blocks + (int)layout.list_counts.size(); b++)
+			jobs.push_back(make_pair(s, b));
+	}
+	pool.parallelFor((int)jobs.size(), [&](int j) {
+		const ShapeLayout& layout = layouts[jobs[j].first];
+		MeshCacheShape& shape = model.shapes[jobs[j].first];
+		int blocks = (int)((layout.vertex_count + MESH_CACHE_BLOCK_VERTICES - 1) / MESH_CACHE_BLOCK_VERTICES);
+		int b = jobs[j].second;
+		if (b < blocks) {
+			size_t first = (size_t)b * MESH_CACHE_BLOCK_VERTICES;
+			DecodeVertexBlock(layout, first, min((size_t)MESH_CACHE_BLOCK_VERTICES, layout.vertex_count - first), &shape.mesh.vertices[0]);
+			return;
+		}
+		int l = b - blocks;
+		if (!DecodeIndexList(layout, l, l == 0 ? shape.mesh.indices : shape.lods[l - 1].indices))
+			ok.store(false);
+	});
+	stats.decode_ms = ElapsedMs(start);
+	return ok.load();
+}
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+// MeshCache.h
+// ===========
+// Compressed cache of what a model load ends up with: the welded mesh and
+// LOD chain of every shape, and the model's materials. Loading a model from
+// its cache skips the OBJ parse, the normalization, the welding and the QEM
+// simplification, and reads a fraction of the bytes of the float streams.
+//
+// Encoding of a shape:
+//   - every index list (full mesh and each LOD) is reordered for the
+//     post-transform vertex cache (Forsyth), then the vertices are renumbered
+//     in first-use order of the full mesh
+//   - indices: delta to the previous index, zigzag, varint bytes
+//   - each of the 11 vertex components is quantized to 16 bits over its own
+//     range, delta coded along the vertex order (restarting every
+//     MESH_CACHE_BLOCK_VERTICES vertices) and zigzagged, and the low and high
+//     bytes go to separate planes (byte transpose)
+//   - optionally an LZ stage over the result, in independent frames
+// Decoding runs the LZ frames, then the vertex blocks and index lists, as
+// parallel jobs. With SSE2 the vertex blocks are undone and interleaved with
+// 4x4 transposes, and runs of one-byte index varints 16 at a time; with SSSE3
+// (or AVX) a shuffle table takes up to 8 varints of 1 or 2 bytes per step.
+// A checksum over the file catches damaged caches, which load from the OBJ
+// again and get rewritten like stale ones.
+//
+// The quantization error is at most 1/131070 of a component's range, e.g.
+// 1.5e-5 for the normalized positions in [-1, 1].
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESH_CACHE_H_DEF
+#define MESH_CACHE_H_DEF
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "MeshSimplify.h"
+#include "ThreadPool.h"
+
+const int MESH_CACHE_BLOCK_VERTICES = 1024;		// vertices per independently decodable block
+const int MESH_CACHE_LZ_FRAME = 1 << 18;		// payload bytes per LZ frame
+const int MESH_CACHE_VERTEX_CACHE = 32;			// post-transform cache size the index order is tuned for
+
+// the part of a tinyobj material the loader uses
+struct MeshCacheMaterial
+{
+	float ambient[3];
+	float diffuse[3];
+	float specular[3];
+	std::string diffuse_texname;
+};
+
+// one shape of a model as SplitShapeByMaterial left it
+struct MeshCacheShape
+{
+	int material;				// index into the materials of the model
+	IndexedMesh mesh;			// mesh.indices is the full resolution level
+	std::vector<MeshLOD> lods;
+};
+
+struct MeshCacheModel
+{
+	std::vector<MeshCacheMaterial> materials;
+	std::vector<MeshCacheShape> shapes;
+};
+
+// a cache is only used for the source file and LOD settings it was written for
+struct MeshCacheKey
+{
+	uint64_t source_bytes;
+	int64_t source_time;
+	uint32_t lod_levels;
+	float lod_reduction;
+};
+
+struct MeshCacheStats
+{
+	size_t raw_bytes;		// float vertices and 32-bit indices of every level
+	size_t file_bytes;
+	double encode_ms;		// WriteMeshCache: optimization, encoding and the write
+	double read_ms;			// ReadMeshCache: the file read
+	double verify_ms;		// ReadMeshCache: the header and the checksum of the whole file
+	double decode_ms;		// ReadMeshCache: LZ frames, vertex blocks and index lists
+};
+
+// false when the source file cannot be read
+bool		MeshCacheKeyOf(const std::string& source_path, int lod_levels, float lod_reduction, MeshCacheKey& key);
+// <dir>/<file name>_<hash of the path>.meshc
+std::string	MeshCachePath(const std::string& dir, const std::string& source_path);
+
+// writes to a temporary file first, so processes loading the same model never see half a cache
+bool		WriteMeshCache(const std::string& path, const MeshCacheKey& key, const MeshCacheModel& model, bool lz, MeshCacheStats& stats);
+// false when there is no cache, it is stale or damaged
+bool		ReadMeshCache(const std::string& path, const MeshCacheKey& key, MeshCacheModel& model, MeshCacheStats& stats, ThreadPool& pool);
+
+#endif
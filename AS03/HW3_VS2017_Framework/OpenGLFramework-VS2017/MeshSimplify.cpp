@@ -0,0 +1,466 @@
+///////////////////////////////////////////////////////////////////////////////
+// MeshSimplify.cpp
+// ================
+// Quadric error metric simplification (Garland & Heckbert 1997) with
+// half-edge collapses, so every level reuses the welded vertex buffer.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include "MeshSimplify.h"
+
+using namespace std;
+
+const size_t LOD_MIN_TRIANGLES = 32;
+const double LOD_FLIP_LIMIT = 0.2;	// min cosine between a face normal before and after a collapse
+const int LOD_MAX_RETRIES = 8;		// times a rejected collapse goes back into the heap
+
+namespace
+{
+	struct VertexKey
+	{
+		float v[INDEXED_VERTEX_STRIDE];
+		int n;
+
+		bool operator==(const VertexKey& rhs) const { return n == rhs.n && memcmp(v, rhs.v, n * sizeof(float)) == 0; }
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const
+		{
+			// FNV-1a over the raw bits, exact matches only
+			const unsigned char* p = (const unsigned char*)key.v;
+			size_t h = 2166136261u;
+			for (size_t i = 0; i < key.n * sizeof(float); i++)
+				h = (h ^ p[i]) * 16777619u;
+			return h;
+		}
+	};
+
+	// symmetric 4x4 matrix stored as its upper triangle
+	struct Quadric
+	{
+		double a[10];
+
+		Quadric() { memset(a, 0, sizeof(a)); }
+
+		void addPlane(double nx, double ny, double nz, double d)
+		{
+			a[0] += nx * nx;  a[1] += nx * ny;  a[2] += nx * nz;  a[3] += nx * d;
+			a[4] += ny * ny;  a[5] += ny * nz;  a[6] += ny * d;
+			a[7] += nz * nz;  a[8] += nz * d;
+			a[9] += d * d;
+		}
+
+		void add(const Quadric& q)
+		{
+			for (int i = 0; i < 10; i++)
+				a[i] += q.a[i];
+		}
+
+		double evaluate(const float* p) const
+		{
+			double x = p[0], y = p[1], z = p[2];
+			return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+				 + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+				 + a[7] * z * z + 2 * a[8] * z
+				 + a[9];
+		}
+	};
+
+	struct Collapse
+	{
+		double cost;			// heap order, raised on every retry
+		double error;			// quadric error of the collapse
+		int from, to;
+		unsigned int from_version, to_version;
+		int retries;
+
+		bool operator<(const Collapse& rhs) const { return cost > rhs.cost; }	// min-heap
+	};
+
+	struct Simplifier
+	{
+		const IndexedMesh& mesh;
+		vector<int> group;					// position group of every vertex
+		vector<int> group_vertex;			// a representative vertex of every group
+		vector<char> locked;				// seam or border groups never move
+		vector<char> alive;
+		vector<unsigned int> version;
+		vector<Quadric> quadrics;
+		vector<vector<int> > group_tris;	// triangles touching every group
+		vector<unsigned int> tris;			// corners as vertex indices, rewritten by collapses
+		vector<char> tri_alive;
+		size_t live_tris;
+		priority_queue<Collapse> heap;
+
+		Simplifier(const IndexedMesh& m) : mesh(m), live_tris(0) {}
+
+		const float* position(int g) const { return &mesh.vertices[group_vertex[g] * INDEXED_VERTEX_STRIDE]; }
+		int cornerGroup(int t, int c) const { return group[tris[t * 3 + c]]; }
+
+		void setup();
+		void pushEdge(int a, int b);
+		bool canCollapse(int u, int v) const;
+		void collapse(int u, int v);
+		void snapshot(vector<unsigned int>& out) const;
+	};
+
+	void Simplifier::setup()
+	{
+		size_t vertex_count = mesh.vertexCount();
+
+		// group vertices sharing a position, a group with several vertices lies on a seam
+		unordered_map<VertexKey, int, VertexKeyHash> groups;
+		group.resize(vertex_count);
+		vector<int> group_size;
+		for (size_t i = 0; i < vertex_count; i++)
+		{
+			VertexKey key = {};
+			key.n = 3;
+			memcpy(key.v, &mesh.vertices[i * INDEXED_VERTEX_STRIDE], 3 * sizeof(float));
+			auto it = groups.find(key);
+			if (it == groups.end())
+			{
+				it = groups.insert(make_pair(key, (int)group_vertex.size())).first;
+				group_vertex.push_back((int)i);
+				group_size.push_back(0);
+			}
+			group[i] = it->second;
+			group_size[it->second]++;
+		}
+
+		size_t group_count = group_vertex.size();
+		locked.assign(group_count, 0);
+		alive.assign(group_count, 1);
+		version.assign(group_count, 0);
+		quadrics.assign(group_count, Quadric());
+		group_tris.assign(group_count, vector<int>());
+		for (size_t g = 0; g < group_count; g++)
+			locked[g] = group_size[g] > 1;
+
+		tris = mesh.indices;
+		size_t tri_count = tris.size() / 3;
+		tri_alive.assign(tri_count, 1);
+		live_tris = tri_count;
+
+		// edges used by a single triangle are borders, more than two is non-manifold
+		unordered_map<unsigned long long, int> edge_use;
+		for (size_t t = 0; t < tri_count; t++)
+		{
+			int g[3] = { cornerGroup((int)t, 0), cornerGroup((int)t, 1), cornerGroup((int)t, 2) };
+			if (g[0] == g[1] || g[1] == g[2] || g[0] == g[2])
+			{
+				tri_alive[t] = 0;
+				live_tris--;
+				continue;
+			}
+			for (int c = 0; c < 3; c++)
+			{
+				group_tris[g[c]].push_back((int)t);
+				unsigned long long lo = min(g[c], g[(c + 1) % 3]), hi = max(g[c], g[(c + 1) % 3]);
+				edge_use[(lo << 32) | hi]++;
+			}
+
+			const float* p0 = position(g[0]);
+			const float* p1 = position(g[1]);
+			const float* p2 = position(g[2]);
+			double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (len <= 0.0)
+				continue;
+			n[0] /= len;  n[1] /= len;  n[2] /= len;
+			double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+			for (int c = 0; c < 3; c++)
+				quadrics[g[c]].addPlane(n[0], n[1], n[2], d);
+		}
+		for (auto it = edge_use.begin(); it != edge_use.end(); ++it)
+		{
+			if (it->second != 2)
+			{
+				locked[(int)(it->first >> 32)] = 1;
+				locked[(int)(it->first & 0xffffffffu)] = 1;
+			}
+		}
+
+		for (auto it = edge_use.begin(); it != edge_use.end(); ++it)
+			pushEdge((int)(it->first >> 32), (int)(it->first & 0xffffffffu));
+	}
+
+	void Simplifier::pushEdge(int a, int b)
+	{
+		if (locked[a] && locked[b])
+			return;
+
+		Quadric q = quadrics[a];
+		q.add(quadrics[b]);
+		double cost_ab = locked[a] ? 1e300 : q.evaluate(position(b));
+		double cost_ba = locked[b] ? 1e300 : q.evaluate(position(a));
+
+		Collapse c;
+		if (cost_ab <= cost_ba)
+		{
+			c.cost = cost_ab;  c.from = a;  c.to = b;
+		}
+		else
+		{
+			c.cost = cost_ba;  c.from = b;  c.to = a;
+		}
+		c.cost = max(c.cost, 0.0);
+		c.error = c.cost;
+		c.retries = 0;
+		c.from_version = version[c.from];
+		c.to_version = version[c.to];
+		heap.push(c);
+	}
+
+	bool Simplifier::canCollapse(int u, int v) const
+	{
+		// u and v must still share exactly the two triangles of an interior edge,
+		// and only have the two opposite corners as common neighbours
+		int shared = 0;
+		vector<int> neighbours_u;
+		for (size_t i = 0; i < group_tris[u].size(); i++)
+		{
+			int t = group_tris[u][i];
+			if (!tri_alive[t])
+				continue;
+			bool has_v = false;
+			for (int c = 0; c < 3; c++)
+			{
+				int g = cornerGroup(t, c);
+				if (g == v)
+					has_v = true;
+				else if (g != u)
+					neighbours_u.push_back(g);
+			}
+			shared += has_v;
+		}
+		if (shared != 2)
+			return false;
+
+		sort(neighbours_u.begin(), neighbours_u.end());
+		neighbours_u.erase(unique(neighbours_u.begin(), neighbours_u.end()), neighbours_u.end());
+		int common = 0;
+		vector<int> seen;
+		for (size_t i = 0; i < group_tris[v].size(); i++)
+		{
+			int t = group_tris[v][i];
+			if (!tri_alive[t])
+				continue;
+			for (int c = 0; c < 3; c++)
+			{
+				int g = cornerGroup(t, c);
+				if (g == u || g == v || find(seen.begin(), seen.end(), g) != seen.end())
+					continue;
+				seen.push_back(g);
+				if (binary_search(neighbours_u.begin(), neighbours_u.end(), g))
+					common++;
+			}
+		}
+		if (common != 2)
+			return false;
+
+		// reject collapses that fold a remaining triangle over
+		const float* pv = position(v);
+		for (size_t i = 0; i < group_tris[u].size(); i++)
+		{
+			int t = group_tris[u][i];
+			if (!tri_alive[t])
+				continue;
+			const float* p[3];
+			bool has_v = false;
+			int corner_u = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int g = cornerGroup(t, c);
+				has_v |= g == v;
+				if (g == u)
+					corner_u = c;
+				p[c] = position(g);
+			}
+			if (has_v)
+				continue;
+
+			double n0[3], n1[3];
+			for (int pass = 0; pass < 2; pass++)
+			{
+				const float* a = p[0];
+				const float* b = p[1];
+				const float* c = p[2];
+				if (pass == 1)
+				{
+					if (corner_u == 0) a = pv;
+					if (corner_u == 1) b = pv;
+					if (corner_u == 2) c = pv;
+				}
+				double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+				double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+				double* n = pass == 0 ? n0 : n1;
+				n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+				n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+				n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+			}
+			double l0 = sqrt(n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]);
+			double l1 = sqrt(n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]);
+			if (l1 <= 1e-12 || (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2]) < LOD_FLIP_LIMIT * l0 * l1)
+				return false;
+		}
+		return true;
+	}
+
+	void Simplifier::collapse(int u, int v)
+	{
+		// u is not on a seam so all of its corners use one vertex; move them to the
+		// vertex v uses on the same side, taken from a triangle shared by both
+		unsigned int target = 0;
+		for (size_t i = 0; i < group_tris[u].size(); i++)
+		{
+			int t = group_tris[u][i];
+			if (!tri_alive[t])
+				continue;
+			for (int c = 0; c < 3; c++)
+			{
+				if (cornerGroup(t, c) == v)
+					target = tris[t * 3 + c];
+			}
+		}
+
+		for (size_t i = 0; i < group_tris[u].size(); i++)
+		{
+			int t = group_tris[u][i];
+			if (!tri_alive[t])
+				continue;
+			bool has_v = false;
+			for (int c = 0; c < 3; c++)
+				has_v |= cornerGroup(t, c) == v;
+			if (has_v)
+			{
+				tri_alive[t] = 0;
+				live_tris--;
+				continue;
+			}
+			for (int c = 0; c < 3; c++)
+			{
+				if (cornerGroup(t, c) == u)
+					tris[t * 3 + c] = target;
+			}
+			group_tris[v].push_back(t);
+		}
+
+		group_tris[u].clear();
+		alive[u] = 0;
+		quadrics[v].add(quadrics[u]);
+		version[v]++;
+
+		// drop dead triangles from v and queue its edges with the merged quadric
+		vector<int>& vt = group_tris[v];
+		vt.erase(remove_if(vt.begin(), vt.end(), [&](int t) { return !tri_alive[t]; }), vt.end());
+		vector<int> neighbours;
+		for (size_t i = 0; i < vt.size(); i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				int g = cornerGroup(vt[i], c);
+				if (g != v)
+					neighbours.push_back(g);
+			}
+		}
+		sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		for (size_t i = 0; i < neighbours.size(); i++)
+			pushEdge(v, neighbours[i]);
+	}
+
+	void Simplifier::snapshot(vector<unsigned int>& out) const
+	{
+		out.clear();
+		out.reserve(live_tris * 3);
+		for (size_t t = 0; t < tri_alive.size(); t++)
+		{
+			if (tri_alive[t])
+				out.insert(out.end(), &tris[t * 3], &tris[t * 3] + 3);
+		}
+	}
+}
+
+void WeldMesh(const float* positions, const float* colors, const float* normals, const float* texcoords,
+			  size_t corner_count, IndexedMesh& mesh)
+{
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.indices.reserve(corner_count);
+
+	unordered_map<VertexKey, unsigned int, VertexKeyHash> lookup;
+	lookup.reserve(corner_count);
+	for (size_t i = 0; i < corner_count; i++)
+	{
+		VertexKey key = {};
+		key.n = INDEXED_VERTEX_STRIDE;
+		memcpy(key.v + 0, positions + i * 3, 3 * sizeof(float));
+		memcpy(key.v + 3, colors + i * 3, 3 * sizeof(float));
+		memcpy(key.v + 6, normals + i * 3, 3 * sizeof(float));
+		memcpy(key.v + 9, texcoords + i * 2, 2 * sizeof(float));
+
+		auto it = lookup.find(key);
+		if (it == lookup.end())
+		{
+			it = lookup.insert(make_pair(key, (unsigned int)mesh.vertexCount())).first;
+			mesh.vertices.insert(mesh.vertices.end(), key.v, key.v + INDEXED_VERTEX_STRIDE);
+		}
+		mesh.indices.push_back(it->second);
+	}
+}
+
+void BuildLODChain(const IndexedMesh& mesh, int max_levels, float reduction, vector<MeshLOD>& lods)
+{
+	lods.clear();
+	if (mesh.indices.size() / 3 < LOD_MIN_TRIANGLES * 2)
+		return;
+
+	Simplifier s(mesh);
+	s.setup();
+
+	double max_cost = 0.0;
+	size_t target = s.live_tris;
+	for (int level = 0; level < max_levels; level++)
+	{
+		target = (size_t)(target * reduction);
+		if (target < LOD_MIN_TRIANGLES)
+			break;
+
+		while (s.live_tris > target && !s.heap.empty())
+		{
+			Collapse c = s.heap.top();
+			s.heap.pop();
+			if (!s.alive[c.from] || !s.alive[c.to] || c.from_version != s.version[c.from] || c.to_version != s.version[c.to])
+				continue;
+			if (!s.canCollapse(c.from, c.to)) {
+				// collapses around it can make it legal, retry it behind the next candidate
+				if (++c.retries <= LOD_MAX_RETRIES) {
+					c.cost = max(c.cost * 2.0, s.heap.empty() ? 0.0 : s.heap.top().cost);
+					s.heap.push(c);
+				}
+				continue;
+			}
+			max_cost = max(max_cost, c.error);
+			s.collapse(c.from, c.to);
+		}
+
+		// locked seams and borders can stop the reduction early, keep only real progress
+		size_t previous = lods.empty() ? mesh.indices.size() / 3 : lods.back().indices.size() / 3;
+		if (s.live_tris > previous * (1.0f + reduction) / 2.0f)
+			break;
+
+		MeshLOD lod;
+		s.snapshot(lod.indices);
+		lod.error = (float)sqrt(max_cost);
+		lods.push_back(lod);
+	}
+}
@@ -0,0 +1,41 @@
+///////////////////////////////////////////////////////////////////////////////
+// MeshSimplify.h
+// ==============
+// Quadric error metric simplification used to build per-shape LOD chains.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MESH_SIMPLIFY_H_DEF
+#define MESH_SIMPLIFY_H_DEF
+
+#include <vector>
+#include <cstddef>
+
+// interleaved vertex layout of an IndexedMesh: position(3) color(3) normal(3) texcoord(2)
+const int INDEXED_VERTEX_STRIDE = 11;
+
+struct IndexedMesh
+{
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+
+	size_t vertexCount() const { return vertices.size() / INDEXED_VERTEX_STRIDE; }
+};
+
+struct MeshLOD
+{
+	std::vector<unsigned int> indices;	// into the vertices of the source IndexedMesh
+	float error;						// object-space geometric error of this level
+};
+
+// merge the per-corner streams of the loader into shared vertices;
+// corners only merge when every attribute matches, so UV and normal seams stay split
+void WeldMesh(const float* positions, const float* colors, const float* normals, const float* texcoords,
+			  size_t corner_count, IndexedMesh& mesh);
+
+// build successively coarser levels, each with about `reduction` times the triangles of
+// the previous one. Vertices on UV/normal seams and on open borders (material boundaries
+// after the loader splits shapes by material) are never moved, and every collapse keeps an
+// existing vertex so all levels share the vertex buffer of `mesh`.
+void BuildLODChain(const IndexedMesh& mesh, int max_levels, float reduction, std::vector<MeshLOD>& lods);
+
+#endif
@@ -0,0 +1,260 @@
+///////////////////////////////////////////////////////////////////////////////
+// OcclusionCuller.cpp
+// ===================
+// CPU occlusion culling against a low resolution tiled depth buffer.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "OcclusionCuller.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_USE_SSE 1
+#endif
+
+using namespace std;
+
+const float OCCLUSION_NEAR_W = 1e-5f;		// triangles and boxes crossing w = 0 are not projected
+const float OCCLUSION_EDGE_BIAS = 1.0f / 64.0f;	// in pixels
+
+void OcclusionCuller::resize(int width, int height)
+{
+	tiles_x = max(1, (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH);
+	tiles_y = max(1, (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT);
+	buffer_width = tiles_x * OCCLUSION_TILE_WIDTH;
+	buffer_height = tiles_y * OCCLUSION_TILE_HEIGHT;
+	depth_buffer.assign(buffer_width * buffer_height, 1.0f);
+	tile_max_depth.assign(tiles_x * tiles_y, 1.0f);
+	bins.assign(tiles_x * tiles_y, vector<int>());
+}
+
+void OcclusionCuller::beginFrame(const Matrix4& vp)
+{
+	view_projection = vp;
+	triangles.clear();
+	for (size_t i = 0; i < bins.size(); i++)
+		bins[i].clear();
+	frame_stats = OcclusionStats();
+}
+
+void OcclusionCuller::addOccluder(const Matrix4& model_matrix, const float* positions, int vertex_count,
+								  const unsigned int* indices, int index_count)
+{
+	auto start = chrono::steady_clock::now();
+
+	Matrix4 mvp = view_projection * model_matrix;
+	clip.resize(vertex_count);
+	transformPoints(mvp, (const Vector3*)positions, &clip[0], vertex_count);
+
+	for (int i = 0; i + 2 < index_count; i += 3)
+	{
+		const Vector4* v[3] = { &clip[indices[i]], &clip[indices[i + 1]], &clip[indices[i + 2]] };
+		// dropping triangles that cross the near plane only makes the buffer less occluding
+		if (v[0]->w < OCCLUSION_NEAR_W || v[1]->w < OCCLUSION_NEAR_W || v[2]->w < OCCLUSION_NEAR_W)
+			continue;
+
+		ScreenTriangle tri;
+		for (int c = 0; c < 3; c++)
+		{
+			float inv_w = 1.0f / v[c]->w;
+			tri.x[c] = (v[c]->x * inv_w * 0.5f + 0.5f) * buffer_width;
+			tri.y[c] = (v[c]->y * inv_w * 0.5f + 0.5f) * buffer_height;
+			tri.z[c] = v[c]->z * inv_w * 0.5f + 0.5f;
+		}
+
+		float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+		if (fabsf(area) < 1e-6f)
+			continue;
+		if (area < 0)
+		{
+			// both windings occlude, store everything counter-clockwise
+			swap(tri.x[1], tri.x[2]);
+			swap(tri.y[1], tri.y[2]);
+			swap(tri.z[1], tri.z[2]);
+		}
+
+		float min_x = min(min(tri.x[0], tri.x[1]), tri.x[2]);
+		float max_x = max(max(tri.x[0], tri.x[1]), tri.x[2]);
+		float min_y = min(min(tri.y[0], tri.y[1]), tri.y[2]);
+		float max_y = max(max(tri.y[0], tri.y[1]), tri.y[2]);
+		if (max_x < 0 || max_y < 0 || min_x >= buffer_width || min_y >= buffer_height)
+			continue;
+		float min_z = min(min(tri.z[0], tri.z[1]), tri.z[2]);
+		if (min_z > 1.0f)
+			continue;
+
+		int tx0 = max(0, (int)min_x / OCCLUSION_TILE_WIDTH);
+		int tx1 = min(tiles_x - 1, (int)max_x / OCCLUSION_TILE_WIDTH);
+		int ty0 = max(0, (int)min_y / OCCLUSION_TILE_HEIGHT);
+		int ty1 = min(tiles_y - 1, (int)max_y / OCCLUSION_TILE_HEIGHT);
+		int index = (int)triangles.size();
+		triangles.push_back(tri);
+		for (int ty = ty0; ty <= ty1; ty++)
+			for (int tx = tx0; tx <= tx1; tx++)
+				bins[ty * tiles_x + tx].push_back(index);
+	}
+
+	frame_stats.occluders++;
+	frame_stats.raster_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionCuller::rasterize(ThreadPool& pool)
+{
+	auto start = chrono::steady_clock::now();
+
+	frame_stats.occluder_triangles = (int)triangles.size();
+	pool.parallelFor(tiles_x * tiles_y, [this](int tile) { rasterizeTile(tile); });
+
+	frame_stats.raster_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionCuller::rasterizeTile(int tile)
+{
+	int tile_x0 = (tile % tiles_x) * OCCLUSION_TILE_WIDTH;
+	int tile_y0 = (tile / tiles_x) * OCCLUSION_TILE_HEIGHT;
+	int tile_x1 = tile_x0 + OCCLUSION_TILE_WIDTH - 1;
+	int tile_y1 = tile_y0 + OCCLUSION_TILE_HEIGHT - 1;
+
+	for (int y = tile_y0; y <= tile_y1; y++)
+		fill(&depth_buffer[y * buffer_width + tile_x0], &depth_buffer[y * buffer_width + tile_x0] + OCCLUSION_TILE_WIDTH, 1.0f);
+
+	const vector<int>& bin = bins[tile];
+	for (size_t b = 0; b < bin.size(); b++)
+	{
+		const ScreenTriangle& t = triangles[bin[b]];
+
+		int x0 = max(tile_x0, (int)floorf(min(min(t.x[0], t.x[1]), t.x[2])));
+		int x1 = min(tile_x1, (int)ceilf(max(max(t.x[0], t.x[1]), t.x[2])));
+		int y0 = max(tile_y0, (int)floorf(min(min(t.y[0], t.y[1]), t.y[2])));
+		int y1 = min(tile_y1, (int)ceilf(max(max(t.y[0], t.y[1]), t.y[2])));
+		if (x0 > x1 || y0 > y1)
+			continue;
+		x0 &= ~3;	// 4-wide spans, tiles are multiples of 4 wide
+
+		// edge functions E_ab(p) = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x), positive inside
+		float ex[3], ey[3], ec[3];
+		for (int e = 0; e < 3; e++)
+		{
+			int a = e, c = (e + 1) % 3;
+			ex[e] = -(t.y[c] - t.y[a]);
+			ey[e] = t.x[c] - t.x[a];
+			ec[e] = -(ex[e] * t.x[a] + ey[e] * t.y[a]);
+		}
+		// depth plane from the barycentrics, E_12 weights z0, E_20 weights z1, E_01 weights z2
+		float inv_area = 1.0f / (ec[0] + ex[0] * t.x[2] + ey[0] * t.y[2]);
+		float zx = (ex[1] * t.z[0] + ex[2] * t.z[1] + ex[0] * t.z[2]) * inv_area;
+		float zy = (ey[1] * t.z[0] + ey[2] * t.z[1] + ey[0] * t.z[2]) * inv_area;
+		float zc = (ec[1] * t.z[0] + ec[2] * t.z[1] + ec[0] * t.z[2]) * inv_area;
+		// widen every edge by a fraction of a pixel so shared edges leave no cracks from rounding
+		for (int e = 0; e < 3; e++)
+			ec[e] += (fabsf(ex[e]) + fabsf(ey[e])) * OCCLUSION_EDGE_BIAS;
+
+		for (int y = y0; y <= y1; y++)
+		{
+			float py = y + 0.5f;
+			float* row = &depth_buffer[y * buffer_width];
+#ifdef OCCLUSION_USE_SSE
+			__m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			__m128 step = _mm_set1_ps(4.0f);
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x0), lane);
+			__m128 zero = _mm_setzero_ps();
+			__m128 ex0 = _mm_set1_ps(ex[0]), ex1 = _mm_set1_ps(ex[1]), ex2 = _mm_set1_ps(ex[2]);
+			__m128 row0 = _mm_set1_ps(ey[0] * py + ec[0]);
+			__m128 row1 = _mm_set1_ps(ey[1] * py + ec[1]);
+			__m128 row2 = _mm_set1_ps(ey[2] * py + ec[2]);
+			__m128 vzx = _mm_set1_ps(zx), rowz = _mm_set1_ps(zy * py + zc);
+			for (int x = x0; x <= x1; x += 4)
+			{
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(ex0, px), row0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(ex1, px), row1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(ex2, px), row2);
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside))
+				{
+					__m128 z = _mm_add_ps(_mm_mul_ps(vzx, px), rowz);
+					__m128 old = _mm_loadu_ps(row + x);
+					__m128 nearest = _mm_min_ps(old, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+				}
+				px = _mm_add_ps(px, step);
+			}
+#else
+			for (int x = x0; x <= x1; x++)
+			{
+				float px = x + 0.5f;
+				if (ex[0] * px + ey[0] * py + ec[0] >= 0 && ex[1] * px + ey[1] * py + ec[1] >= 0 && ex[2] * px + ey[2] * py + ec[2] >= 0)
+				{
+					float z = zx * px + zy * py + zc;
+					if (z < row[x])
+						row[x] = z;
+				}
+			}
+#endif
+		}
+	}
+
+	float farthest = 0.0f;
+	for (int y = tile_y0; y <= tile_y1; y++)
+		for (int x = tile_x0; x <= tile_x1; x++)
+			farthest = max(farthest, depth_buffer[y * buffer_width + x]);
+	tile_max_depth[tile] = farthest;
+}
+
+bool OcclusionCuller::isVisible(const AABB& box)
+{
+	auto start = chrono::steady_clock::now();
+	frame_stats.tested++;
+
+	bool visible = false;
+	float min_x = 1e30f, max_x = -1e30f, min_y = 1e30f, max_y = -1e30f, min_z = 1e30f;
+	for (int i = 0; i < 8 && !visible; i++)
+	{
+		Vector4 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+		Vector4 c = view_projection * corner;
+		if (c.w < OCCLUSION_NEAR_W)
+		{
+			visible = true;	// the box touches the camera plane
+			break;
+		}
+		float inv_w = 1.0f / c.w;
+		float x = (c.x * inv_w * 0.5f + 0.5f) * buffer_width;
+		float y = (c.y * inv_w * 0.5f + 0.5f) * buffer_height;
+		min_x = min(min_x, x);  max_x = max(max_x, x);
+		min_y = min(min_y, y);  max_y = max(max_y, y);
+		min_z = min(min_z, c.z * inv_w * 0.5f + 0.5f);
+	}
+
+	if (!visible)
+	{
+		int x0 = max(0, (int)floorf(min_x)), x1 = min(buffer_width - 1, (int)ceilf(max_x));
+		int y0 = max(0, (int)floorf(min_y)), y1 = min(buffer_height - 1, (int)ceilf(max_y));
+		if (x0 > x1 || y0 > y1)
+			visible = true;	// off the buffer, leave it to frustum culling
+
+		for (int ty = y0 / OCCLUSION_TILE_HEIGHT; !visible && ty <= y1 / OCCLUSION_TILE_HEIGHT; ty++)
+		{
+			for (int tx = x0 / OCCLUSION_TILE_WIDTH; !visible && tx <= x1 / OCCLUSION_TILE_WIDTH; tx++)
+			{
+				// the whole tile is nearer than the box, nothing to look at
+				if (min_z >= tile_max_depth[ty * tiles_x + tx])
+					continue;
+				int px0 = max(x0, tx * OCCLUSION_TILE_WIDTH), px1 = min(x1, tx * OCCLUSION_TILE_WIDTH + OCCLUSION_TILE_WIDTH - 1);
+				int py0 = max(y0, ty * OCCLUSION_TILE_HEIGHT), py1 = min(y1, ty * OCCLUSION_TILE_HEIGHT + OCCLUSION_TILE_HEIGHT - 1);
+				for (int y = py0; !visible && y <= py1; y++)
+					for (int x = px0; x <= px1; x++)
+						if (min_z < depth_buffer[y * buffer_width + x])
+						{
+							visible = true;
+							break;
+						}
+			}
+		}
+	}
+
+	if (!visible)
+		frame_stats.culled++;
+	frame_stats.test_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return visible;
+}
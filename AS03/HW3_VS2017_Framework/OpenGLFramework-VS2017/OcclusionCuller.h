@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////////
+// OcclusionCuller.h
+// =================
+// CPU occlusion culling: occluders are rasterized into a small tiled depth
+// buffer on the thread pool, then object bounds are tested against it.
+// Runs without a GL context.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef OCCLUSION_CULLER_H_DEF
+#define OCCLUSION_CULLER_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "SceneBVH.h"
+#include "ThreadPool.h"
+
+const int OCCLUSION_TILE_WIDTH = 32;
+const int OCCLUSION_TILE_HEIGHT = 16;
+
+struct OcclusionStats
+{
+	int occluders = 0;
+	int occluder_triangles = 0;
+	int tested = 0;
+	int culled = 0;
+	double raster_ms = 0.0;
+	double test_ms = 0.0;
+};
+
+class OcclusionCuller
+{
+public:
+	// the size is rounded up to whole tiles
+	void		resize(int width, int height);
+	void		beginFrame(const Matrix4& view_projection);
+	// positions are xyz triples, indices form a triangle list
+	void		addOccluder(const Matrix4& model_matrix, const float* positions, int vertex_count,
+							const unsigned int* indices, int index_count);
+	void		rasterize(ThreadPool& pool);
+	// conservative: true unless the whole box is behind rasterized occluders
+	bool		isVisible(const AABB& world_bounds);
+
+	const OcclusionStats& stats() const { return frame_stats; }
+	int			width() const { return buffer_width; }
+	int			height() const { return buffer_height; }
+	const float* depth() const { return depth_buffer.empty() ? NULL : &depth_buffer[0]; }
+
+private:
+	struct ScreenTriangle
+	{
+		float x[3], y[3], z[3];
+	};
+
+	void		rasterizeTile(int tile);
+
+	int			buffer_width = 0, buffer_height = 0;
+	int			tiles_x = 0, tiles_y = 0;
+	Matrix4		view_projection;
+	std::vector<float>	depth_buffer;		// window-space depth in [0, 1], 1 is empty
+	std::vector<float>	tile_max_depth;		// farthest depth inside every tile
+	std::vector<ScreenTriangle>	triangles;
+	std::vector<std::vector<int> > bins;	// triangles overlapping every tile
+	std::vector<Vector4>	clip;			// scratch for occluder vertices
+	OcclusionStats	frame_stats;
+};
+
+#endif
@@ -0,0 +1,269 @@
+///////////////////////////////////////////////////////////////////////////////
+// Profiler.cpp
+// ============
+// CPU/GPU scope timing, rolling percentiles and Chrome trace export.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <algorithm>
+#include "Profiler.h"
+
+using namespace std;
+
+Profiler& GetProfiler()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler() : epoch(chrono::steady_clock::now())
+{
+}
+
+void Profiler::ScopeHistory::add(float ms, int frame_calls)
+{
+	if (samples.size() < PROFILER_HISTORY)
+		samples.push_back(ms);
+	else
+		samples[next] = ms;
+	next = (next + 1) % PROFILER_HISTORY;
+	calls = frame_calls;
+}
+
+double Profiler::nowUs() const
+{
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::setEnabled(bool enable)
+{
+	if (enable == is_enabled)
+		return;
+	is_enabled = enable;
+	if (!enable) {
+		// results still in flight are dropped, their queries are reused when profiling resumes
+		for (int i = 0; i < PROFILER_FRAME_LATENCY; i++)
+		{
+			gpu_frames[i].scopes.clear();
+			gpu_frames[i].used = 0;
+			gpu_frames[i].pending = false;
+		}
+		cpu_stack.clear();
+		gpu_stack.clear();
+		cpu_frame_totals.clear();
+		in_frame = false;
+	}
+}
+
+void Profiler::beginFrame()
+{
+	if (!is_enabled)
+		return;
+
+	if (!gpu_clock_synced) {
+		GLint64 gpu_now = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+		gpu_to_cpu_offset_us = nowUs() - gpu_now / 1000.0;
+		gpu_clock_synced = true;
+	}
+
+	// the slot about to be reused was issued PROFILER_FRAME_LATENCY frames ago
+	GpuFrame& frame = gpu_frames[frame_index % PROFILER_FRAME_LATENCY];
+	if (frame.pending)
+		collectGpuFrame(frame);
+	frame.used = 0;
+	frame.scopes.clear();
+	frame.pending = false;
+
+	cpu_stack.clear();
+	gpu_stack.clear();
+	cpu_frame_totals.clear();
+	in_frame = true;
+}
+
+void Profiler::endFrame()
+{
+	if (!is_enabled || !in_frame)
+		return;
+	in_frame = false;
+
+	// close anything left open so a missing pop does not leak into the next frame
+	while (!gpu_stack.empty())
+		popGpu();
+	while (!cpu_stack.empty())
+		popCpu();
+
+	for (auto& total : cpu_frame_totals)
+		history["CPU " + total.first].add((float)total.second.ms, total.second.calls);
+
+	GpuFrame& frame = gpu_frames[frame_index % PROFILER_FRAME_LATENCY];
+	frame.pending = !frame.scopes.empty();
+	frame_index++;
+}
+
+bool Profiler::pushCpu(const char* name)
+{
+	if (!is_enabled || !in_frame || cpu_stack.size() >= PROFILER_MAX_DEPTH)
+		return false;
+	cpu_stack.push_back({ name, nowUs() });
+	return true;
+}
+
+void Profiler::popCpu()
+{
+	if (!is_enabled || cpu_stack.empty())
+		return;
+	CpuScope scope = cpu_stack.back();
+	cpu_stack.pop_back();
+	double duration = nowUs() - scope.start_us;
+
+	FrameTotal& total = cpu_frame_totals[scope.name];
+	total.ms += duration / 1000.0;
+	total.calls++;
+	addTraceEvent(scope.name, false, scope.start_us, duration);
+}
+
+GLuint Profiler::nextQuery(GpuFrame& frame, int& index)
+{
+	if (frame.used == (int)frame.queries.size()) {
+		// grow by a batch, the pool settles after the first few frames
+		size_t old_size = frame.queries.size();
+		frame.queries.resize(old_size + 32);
+		glGenQueries(32, &frame.queries[old_size]);
+	}
+	index = frame.used++;
+	return frame.queries[index];
+}
+
+bool Profiler::pushGpu(const char* name)
+{
+	if (!is_enabled || !in_frame || gpu_stack.size() >= PROFILER_MAX_DEPTH)
+		return false;
+	GpuFrame& frame = gpu_frames[frame_index % PROFILER_FRAME_LATENCY];
+	GpuScope scope;
+	scope.name = name;
+	glQueryCounter(nextQuery(frame, scope.begin_query), GL_TIMESTAMP);
+	scope.end_query = -1;
+	gpu_stack.push_back((int)frame.scopes.size());
+	frame.scopes.push_back(scope);
+	return true;
+}
+
+void Profiler::popGpu()
+{
+	if (!is_enabled || gpu_stack.empty())
+		return;
+	GpuFrame& frame = gpu_frames[frame_index % PROFILER_FRAME_LATENCY];
+	GpuScope& scope = frame.scopes[gpu_stack.back()];
+	gpu_stack.pop_back();
+	glQueryCounter(nextQuery(frame, scope.end_query), GL_TIMESTAMP);
+}
+
+void Profiler::collectGpuFrame(GpuFrame& frame)
+{
+	// queries complete in order, so the last one tells whether the whole frame is ready
+	GLuint last = frame.queries[frame.used - 1];
+	GLint available = 0;
+	glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		gpu_stalls++;	// the GPU is more than PROFILER_FRAME_LATENCY frames behind, this read blocks
+
+	map<string, FrameTotal> totals;
+	for (const GpuScope& scope : frame.scopes)
+	{
+		if (scope.end_query < 0)
+			continue;
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[scope.begin_query], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[scope.end_query], GL_QUERY_RESULT, &end);
+		double duration = end > begin ? (end - begin) / 1000.0 : 0.0;
+
+		FrameTotal& total = totals[scope.name];
+		total.ms += duration / 1000.0;
+		total.calls++;
+		addTraceEvent(scope.name, true, begin / 1000.0 + gpu_to_cpu_offset_us, duration);
+	}
+	for (auto& total : totals)
+		history["GPU " + total.first].add((float)total.second.ms, total.second.calls);
+}
+
+void Profiler::addTraceEvent(const char* name, bool gpu, double start_us, double duration_us)
+{
+	if (is_tracing && trace_events.size() < PROFILER_MAX_TRACE_EVENTS)
+		trace_events.push_back({ name, gpu, start_us, duration_us });
+}
+
+void Profiler::startTrace()
+{
+	trace_events.clear();
+	is_tracing = true;
+}
+
+bool Profiler::stopTrace(const char* path)
+{
+	// the last frames are still in flight, wait for them so the trace ends where it was stopped
+	for (int i = 0; i < PROFILER_FRAME_LATENCY; i++)
+	{
+		GpuFrame& frame = gpu_frames[(frame_index + i) % PROFILER_FRAME_LATENCY];
+		if (frame.pending && !in_frame) {
+			collectGpuFrame(frame);
+			frame.pending = false;
+		}
+	}
+	is_tracing = false;
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		trace_events.clear();
+		return false;
+	}
+
+	// trace event format, "X" complete events with microsecond timestamps
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+	for (const TraceEvent& e : trace_events)
+	{
+		fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			e.name, e.gpu ? "gpu" : "cpu", e.gpu ? 2 : 1, e.start_us, e.duration_us);
+	}
+	fprintf(file, "\n]}\n");
+	bool ok = !ferror(file);
+	fclose(file);
+
+	if (trace_events.size() >= PROFILER_MAX_TRACE_EVENTS)
+		printf("Profiler: trace truncated at %d events\n", (int)PROFILER_MAX_TRACE_EVENTS);
+	trace_events.clear();
+	return ok;
+}
+
+void Profiler::printSummary() const
+{
+	if (history.empty())
+		return;
+	printf("Profiler (ms per frame over the last %d frames, %d GPU stalls):\n", PROFILER_HISTORY, gpu_stalls);
+	printf("  %-28s %6s %8s %8s %8s\n", "scope", "calls", "p50", "p95", "p99");
+	for (const auto& entry : history)
+	{
+		vector<float> sorted = entry.second.samples;
+		sort(sorted.begin(), sorted.end());
+		auto percentile = [&](float p) { return sorted[min((size_t)(p * sorted.size()), sorted.size() - 1)]; };
+		printf("  %-28s %6d %8.3f %8.3f %8.3f\n", entry.first.c_str(), entry.second.calls,
+			percentile(0.50f), percentile(0.95f), percentile(0.99f));
+	}
+}
+
+ProfileScope::ProfileScope(const char* name, bool gpu)
+{
+	Profiler& profiler = GetProfiler();
+	cpu_active = profiler.pushCpu(name);
+	gpu_active = gpu && profiler.pushGpu(name);
+}
+
+ProfileScope::~ProfileScope()
+{
+	Profiler& profiler = GetProfiler();
+	if (gpu_active)
+		profiler.popGpu();
+	if (cpu_active)
+		profiler.popCpu();
+}
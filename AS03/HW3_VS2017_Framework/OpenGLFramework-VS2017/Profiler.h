@@ -0,0 +1,130 @@
+///////////////////////////////////////////////////////////////////////////////
+// Profiler.h
+// ==========
+// Frame profiler with nestable CPU and GPU scopes. GPU scopes are pairs of
+// GL_TIMESTAMP queries (GL_TIME_ELAPSED queries cannot be nested) kept in a
+// ring of PROFILER_FRAME_LATENCY frames, so results are read back frames later
+// without stalling. Keeps a rolling p50/p95/p99 per scope and can record a
+// Chrome trace (chrome://tracing, ui.perfetto.dev).
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROFILER_H_DEF
+#define PROFILER_H_DEF
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <glad/glad.h>
+
+const int PROFILER_FRAME_LATENCY = 4;		// frames between issuing a GPU query and reading it
+const int PROFILER_HISTORY = 240;			// frames kept per scope for the percentiles
+const int PROFILER_MAX_DEPTH = 32;
+const size_t PROFILER_MAX_TRACE_EVENTS = 1000000;
+
+class Profiler
+{
+public:
+	Profiler();
+
+	void		setEnabled(bool enable);
+	bool		enabled() const { return is_enabled; }
+
+	void		beginFrame();
+	void		endFrame();
+
+	// names must outlive the profiler, string literals in practice; a push that
+	// returns false (disabled, outside a frame, too deep) must not be popped
+	bool		pushCpu(const char* name);
+	void		popCpu();
+	bool		pushGpu(const char* name);
+	void		popGpu();
+
+	void		startTrace();
+	// writes everything recorded since startTrace, returns false when the file cannot be written
+	bool		stopTrace(const char* path);
+	bool		tracing() const { return is_tracing; }
+
+	// p50/p95/p99 of the per-frame time of every scope over the last PROFILER_HISTORY frames
+	void		printSummary() const;
+
+private:
+	struct ScopeHistory
+	{
+		std::vector<float> samples;		// ms per frame, ring buffer
+		int next = 0;
+		int calls = 0;					// calls in the last recorded frame
+		void add(float ms, int frame_calls);
+	};
+	struct FrameTotal
+	{
+		double ms = 0.0;
+		int calls = 0;
+	};
+	struct CpuScope
+	{
+		const char* name;
+		double start_us;
+	};
+	struct GpuScope
+	{
+		const char* name;
+		int begin_query, end_query;
+	};
+	struct GpuFrame
+	{
+		std::vector<GLuint> queries;
+		int used = 0;
+		std::vector<GpuScope> scopes;
+		bool pending = false;
+	};
+	struct TraceEvent
+	{
+		const char* name;
+		bool gpu;
+		double start_us, duration_us;
+	};
+
+	double		nowUs() const;
+	GLuint		nextQuery(GpuFrame& frame, int& index);
+	void		collectGpuFrame(GpuFrame& frame);
+	void		addTraceEvent(const char* name, bool gpu, double start_us, double duration_us);
+
+	bool		is_enabled = false;
+	bool		is_tracing = false;
+	bool		in_frame = false;
+	int			frame_index = 0;
+	std::chrono::steady_clock::time_point	epoch;
+
+	std::vector<CpuScope>	cpu_stack;
+	std::vector<int>		gpu_stack;			// open scopes in the current GpuFrame
+	std::map<std::string, FrameTotal>	cpu_frame_totals;
+	GpuFrame	gpu_frames[PROFILER_FRAME_LATENCY];
+
+	// GL_TIMESTAMP and the CPU clock are aligned once, so GPU events share the trace timeline
+	bool		gpu_clock_synced = false;
+	double		gpu_to_cpu_offset_us = 0.0;
+
+	std::map<std::string, ScopeHistory>	history;	// "CPU name" / "GPU name"
+	std::vector<TraceEvent>	trace_events;
+	int			gpu_stalls = 0;
+};
+
+Profiler& GetProfiler();
+
+// RAII helpers, a no-op while the profiler is disabled
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name, bool gpu);
+	~ProfileScope();
+private:
+	bool		cpu_active, gpu_active;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name, false)
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name, true)
+
+#endif
@@ -0,0 +1,137 @@
+///////////////////////////////////////////////////////////////////////////////
+// Quaternion.cpp
+// ==============
+// Quaternion products, interpolation, arcball and the fused TRS matrix.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <algorithm>
+#include "Quaternion.h"
+
+using namespace std;
+
+static_assert(sizeof(Quaternion) == 4 * sizeof(float), "Quaternion is loaded as one vector");
+
+Quaternion Quaternion::FromAxisAngle(const Vector3& axis, float angle)
+{
+	float s = sinf(angle * 0.5f);
+	return Quaternion(axis.x * s, axis.y * s, axis.z * s, cosf(angle * 0.5f));
+}
+
+Quaternion Quaternion::FromEuler(const Vector3& euler)
+{
+	return FromAxisAngle(Vector3(1, 0, 0), euler.x) * FromAxisAngle(Vector3(0, 1, 0), euler.y) * FromAxisAngle(Vector3(0, 0, 1), euler.z);
+}
+
+Quaternion Quaternion::operator*(const Quaternion& b) const
+{
+#if defined(MATRICES_SSE)
+	// every lane is a.w * b plus a.x, a.y, a.z times b reordered with signs
+	__m128 q = _mm_loadu_ps(&b.x);
+	__m128 rx = _mm_xor_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(0, 1, 2, 3)), _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f));
+	__m128 ry = _mm_xor_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(1, 0, 3, 2)), _mm_set_ps(-0.0f, -0.0f, 0.0f, 0.0f));
+	__m128 rz = _mm_xor_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(2, 3, 0, 1)), _mm_set_ps(-0.0f, 0.0f, 0.0f, -0.0f));
+	__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(w), q), _mm_mul_ps(_mm_set1_ps(x), rx)),
+						  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(y), ry), _mm_mul_ps(_mm_set1_ps(z), rz)));
+	Quaternion result;
+	_mm_storeu_ps(&result.x, r);
+	return result;
+#else
+	return Quaternion(w * b.x + x * b.w + y * b.z - z * b.y,
+					  w * b.y - x * b.z + y * b.w + z * b.x,
+					  w * b.z + x * b.y - y * b.x + z * b.w,
+					  w * b.w - x * b.x - y * b.y - z * b.z);
+#endif
+}
+
+float Quaternion::length() const
+{
+	return sqrtf(dot(*this));
+}
+
+Quaternion Quaternion::normalized() const
+{
+	float len = length();
+	if (len < 1e-12f)
+		return Quaternion();
+	float inv = 1.0f / len;
+	return Quaternion(x * inv, y * inv, z * inv, w * inv);
+}
+
+Vector3 Quaternion::rotate(const Vector3& v) const
+{
+	// v + 2w (u x v) + 2 u x (u x v), with u the vector part
+	Vector3 u(x, y, z);
+	Vector3 t = u.cross(v) * 2.0f;
+	return v + t * w + u.cross(t);
+}
+
+void Quaternion::toAxisAngle(Vector3& axis, float& angle) const
+{
+	Quaternion q = w < 0 ? Quaternion(-x, -y, -z, -w) : *this;
+	float s = sqrtf(max(0.0f, 1.0f - q.w * q.w));
+	angle = 2.0f * acosf(min(q.w, 1.0f));
+	axis = s < 1e-6f ? Vector3(1, 0, 0) : Vector3(q.x / s, q.y / s, q.z / s);
+}
+
+Matrix4 Quaternion::toMatrix() const
+{
+	return ComposeTRS(Vector3(0, 0, 0), *this, Vector3(1, 1, 1));
+}
+
+Quaternion Nlerp(const Quaternion& a, const Quaternion& b, float t)
+{
+	float sign = a.dot(b) < 0 ? -1.0f : 1.0f;
+	return Quaternion(a.x + (b.x * sign - a.x) * t, a.y + (b.y * sign - a.y) * t,
+					  a.z + (b.z * sign - a.z) * t, a.w + (b.w * sign - a.w) * t).normalized();
+}
+
+Quaternion Slerp(const Quaternion& a, const Quaternion& b, float t)
+{
+	float cosine = a.dot(b);
+	float sign = cosine < 0 ? -1.0f : 1.0f;
+	cosine *= sign;
+	// nearly parallel, the sine below would divide by ~0
+	if (cosine > 0.9995f)
+		return Nlerp(a, b, t);
+	float angle = acosf(cosine);
+	float inv_sin = 1.0f / sinf(angle);
+	float wa = sinf((1.0f - t) * angle) * inv_sin;
+	float wb = sinf(t * angle) * inv_sin * sign;
+	return Quaternion(a.x * wa + b.x * wb, a.y * wa + b.y * wb, a.z * wa + b.z * wb, a.w * wa + b.w * wb);
+}
+
+Vector3 ArcballPoint(float x, float y, float viewport_x, float viewport_y, float viewport_width, float viewport_height)
+{
+	// window y grows downwards, the ball's y up
+	float radius = 0.5f * min(viewport_width, viewport_height);
+	Vector3 p((x - viewport_x - 0.5f * viewport_width) / radius, (viewport_y + 0.5f * viewport_height - y) / radius, 0.0f);
+	float d2 = p.x * p.x + p.y * p.y;
+	if (d2 > 1.0f)
+		p *= 1.0f / sqrtf(d2);		// outside the ball, clamp to the rim
+	else
+		p.z = sqrtf(1.0f - d2);
+	return p;
+}
+
+Quaternion ArcballRotation(const Vector3& from, const Vector3& to)
+{
+	// about their common normal by the angle between them, so the point under the cursor follows it
+	Vector3 axis = from.cross(to);
+	float cosine = min(max(from.dot(to), -1.0f), 1.0f);
+	float len = axis.length();
+	if (len < 1e-7f)
+		return Quaternion();
+	return Quaternion::FromAxisAngle(axis * (1.0f / len), acosf(cosine));
+}
+
+Matrix4 ComposeTRS(const Vector3& t, const Quaternion& q, const Vector3& s)
+{
+	float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	return Matrix4((1 - 2 * (yy + zz)) * s.x, 2 * (xy - wz) * s.y,       2 * (xz + wy) * s.z,       t.x,
+				   2 * (xy + wz) * s.x,       (1 - 2 * (xx + zz)) * s.y, 2 * (yz - wx) * s.z,       t.y,
+				   2 * (xz - wy) * s.x,       2 * (yz + wx) * s.y,       (1 - 2 * (xx + yy)) * s.z, t.z,
+				   0, 0, 0, 1);
+}
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+// Quaternion.h
+// ============
+// Unit quaternion rotations for the model transforms: Hamilton product (SSE
+// when Matrices.h enables it), axis-angle and Euler conversion, nlerp/slerp,
+// arcball drags, and a fused translate * rotate * scale matrix build.
+//
+// Products compose like matrices: (a * b).toMatrix() == a.toMatrix() * b.toMatrix(),
+// so b is applied first.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef QUATERNION_H_DEF
+#define QUATERNION_H_DEF
+
+#include "Vectors.h"
+#include "Matrices.h"
+
+struct alignas(16) Quaternion
+{
+	float x, y, z, w;		// vector part, then scalar
+
+	Quaternion() : x(0), y(0), z(0), w(1) {}
+	Quaternion(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+	static Quaternion Identity() { return Quaternion(); }
+	// angle in radians about a unit axis
+	static Quaternion FromAxisAngle(const Vector3& axis, float angle);
+	// the rotation of rotateX(x) * rotateY(y) * rotateZ(z), radians
+	static Quaternion FromEuler(const Vector3& euler);
+
+	Quaternion	operator*(const Quaternion& rhs) const;
+	Quaternion&	operator*=(const Quaternion& rhs) { return *this = *this * rhs; }
+	Vector3		operator*(const Vector3& v) const { return rotate(v); }
+
+	float		dot(const Quaternion& rhs) const { return x * rhs.x + y * rhs.y + z * rhs.z + w * rhs.w; }
+	float		length() const;
+	Quaternion	conjugate() const { return Quaternion(-x, -y, -z, w); }
+	Quaternion	normalized() const;
+	Vector3		rotate(const Vector3& v) const;
+	void		toAxisAngle(Vector3& axis, float& angle) const;
+	Matrix4		toMatrix() const;
+};
+
+// interpolation along the shorter arc, t in [0, 1]
+Quaternion	Nlerp(const Quaternion& a, const Quaternion& b, float t);
+Quaternion	Slerp(const Quaternion& a, const Quaternion& b, float t);
+
+// point on the unit arcball for a cursor position, inside a viewport of the given size
+Vector3		ArcballPoint(float x, float y, float viewport_x, float viewport_y, float viewport_width, float viewport_height);
+// rotation taking one arcball point to the other
+Quaternion	ArcballRotation(const Vector3& from, const Vector3& to);
+
+// translate(t) * rotation * scaling(s) in one pass, no intermediate matrices
+Matrix4		ComposeTRS(const Vector3& translation, const Quaternion& rotation, const Vector3& scale);
+
+#endif
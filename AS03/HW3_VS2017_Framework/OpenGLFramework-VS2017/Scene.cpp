@@ -0,0 +1,406 @@
+///////////////////////////////////////////////////////////////////////////////
+// Scene.cpp
+// =========
+// Text and binary scene files, and the diff a reload is driven by.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "Logger.h"
+#include "Scene.h"
+
+using namespace std;
+
+const char SCENE_BINARY_MAGIC[4] = { 'S', 'C', 'N', 'B' };
+const uint32_t SCENE_BINARY_VERSION = 1;
+const float SCENE_DEG_TO_RAD = 3.14159265358979323846f / 180.0f;
+
+// the binary form copies these structs as they are, any new member has to bump SCENE_BINARY_VERSION
+static_assert(sizeof(camera) == 9 * sizeof(float), "camera is not float-only");
+static_assert(sizeof(project_setting) == 8 * sizeof(float), "project_setting is not float-only");
+static_assert(sizeof(DirectionalLight) == 16 * sizeof(float), "DirectionalLight is not float-only");
+static_assert(sizeof(PointLight) == 16 * sizeof(float), "PointLight is not float-only");
+static_assert(sizeof(SpotLight) == 21 * sizeof(float), "SpotLight is not float-only");
+
+// Binary layout: header, one record per model, then the path characters
+struct SceneBinaryHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t model_count;
+	uint32_t string_bytes;
+	int32_t light_source;
+	int32_t perspective;
+	camera main_camera;
+	project_setting proj;
+	DirectionalLight directional_light;
+	PointLight point_light;
+	SpotLight spot_light;
+};
+
+struct SceneBinaryModel
+{
+	uint32_t path_offset;	// into the path characters
+	uint32_t path_length;
+	float position[3];
+	float rotation[4];		// x, y, z, w
+	float scale[3];
+};
+
+static bool EndsWith(const string& s, const string& suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool ReadVector(istringstream& in, Vector3& v)
+{
+	return (bool)(in >> v.x >> v.y >> v.z);
+}
+
+static bool ParseLightName(const string& value, int& light)
+{
+	if (value == "directional")
+		light = 0;
+	else if (value == "point")
+		light = 1;
+	else if (value == "spot")
+		light = 2;
+	else
+		return false;
+	return true;
+}
+
+bool LoadScene(const string& path, Scene& scene)
+{
+	char magic[4] = { 0, 0, 0, 0 };
+	ifstream file(path, ios::binary);
+	if (!file) {
+		LOG_ERROR("Scene: cannot open %s", path);
+		return false;
+	}
+	file.read(magic, sizeof(magic));
+	file.close();
+	if (memcmp(magic, SCENE_BINARY_MAGIC, sizeof(magic)) == 0)
+		return LoadSceneBinary(path, scene);
+	return LoadSceneText(path, scene);
+}
+
+bool LoadSceneText(const string& path, Scene& scene)
+{
+	ifstream file(path);
+	if (!file) {
+		LOG_ERROR("Scene: cannot open %s", path);
+		return false;
+	}
+
+	scene = Scene();
+	enum { NoBlock, ModelBlock, LightBlock } block = NoBlock;
+	int light = 0;		// the light of a light block
+	string line;
+	int line_number = 0;
+	while (getline(file, line))
+	{
+		line_number++;
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.erase(comment);
+		istringstream in(line);
+		string key, value;
+		if (!(in >> key))
+			continue;
+
+		bool ok = true;
+		SceneModel* model = block == ModelBlock ? &scene.models.back() : NULL;
+		Vector3 v;
+		if (key == "model" || EndsWith(key, ".obj")) {
+			SceneModel m;
+			if (key == "model")
+				ok = (bool)(in >> m.path);
+			else
+				m.path = key;
+			if (ok) {
+				scene.models.push_back(m);
+				block = ModelBlock;
+			}
+		}
+		else if (key == "light") {
+			ok = (in >> value) && ParseLightName(value, light);
+			block = LightBlock;
+		}
+		else if (key == "active_light")
+			ok = (in >> value) && ParseLightName(value, scene.light_source);
+		else if (key == "camera") {
+			camera& c = scene.main_camera;
+			ok = ReadVector(in, c.position) && ReadVector(in, c.center);
+			if (ok && ReadVector(in, v))
+				c.up_vector = v;
+		}
+		else if (key == "projection") {
+			ok = (in >> value) && (value == "perspective" || value == "orthogonal");
+			scene.perspective = value == "perspective";
+		}
+		else if (key == "fovy")
+			ok = (bool)(in >> scene.proj.fovy);
+		else if (key == "clip")
+			ok = (bool)(in >> scene.proj.nearClip >> scene.proj.farClip);
+		else if (key == "ortho")
+			ok = (bool)(in >> scene.proj.left >> scene.proj.right >> scene.proj.bottom >> scene.proj.top);
+		else if (model && key == "position")
+			ok = ReadVector(in, model->position);
+		else if (model && key == "rotation") {
+			ok = ReadVector(in, v);
+			model->rotation = Quaternion::FromEuler(v * SCENE_DEG_TO_RAD);
+		}
+		else if (model && key == "scale")
+			ok = ReadVector(in, model->scale);
+		else if (block == LightBlock) {
+			DirectionalLight& d = scene.directional_light;
+			PointLight& p = scene.point_light;
+			SpotLight& s = scene.spot_light;
+			if (key == "position")
+				ok = ReadVector(in, light == 0 ? d.position : light == 1 ? p.position : s.position);
+			else if (key == "direction" && light != 1)
+				ok = ReadVector(in, light == 0 ? d.direction : s.direction);
+			else if (key == "ambient")
+				ok = ReadVector(in, light == 0 ? d.ambient_intensity : light == 1 ? p.ambient_intensity : s.ambient_intensity);
+			else if (key == "diffuse")
+				ok = ReadVector(in, light == 0 ? d.diffuse_intensity : light == 1 ? p.diffuse_intensity : s.diffuse_intensity);
+			else if (key == "specular")
+				ok = ReadVector(in, light == 0 ? d.specular_intensity : light == 1 ? p.specular_intensity : s.specular_intensity);
+			else if (key == "shininess")
+				ok = (bool)(in >> (light == 0 ? d.shininess : light == 1 ? p.shininess : s.shininess));
+			else if (key == "attenuation" && light == 1)
+				ok = (bool)(in >> p.constant >> p.linear >> p.quadratic);
+			else if (key == "attenuation" && light == 2)
+				ok = (bool)(in >> s.constant >> s.linear >> s.quadratic);
+			else if (key == "exponent" && light == 2)
+				ok = (bool)(in >> s.exponent);
+			else if (key == "cutoff" && light == 2)
+				ok = (bool)(in >> s.cutoff);
+			else
+				ok = false;
+		}
+		else
+			ok = false;
+
+		if (!ok) {
+			LOG_ERROR("Scene: %s:%d: cannot parse \"%s\"", path, line_number, line);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool LoadSceneBinary(const string& path, Scene& scene)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file) {
+		LOG_ERROR("Scene: cannot open %s", path);
+		return false;
+	}
+	vector<char> data((size_t)file.tellg());
+	file.seekg(0);
+	file.read(data.data(), data.size());
+
+	SceneBinaryHeader header;
+	if (data.size() < sizeof(header)) {
+		LOG_ERROR("Scene: %s is truncated", path);
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if (memcmp(header.magic, SCENE_BINARY_MAGIC, sizeof(header.magic)) != 0 || header.version != SCENE_BINARY_VERSION) {
+		LOG_ERROR("Scene: %s is not a version %d compiled scene, compile it again", path, (int)SCENE_BINARY_VERSION);
+		return false;
+	}
+	size_t records = sizeof(header) + (size_t)header.model_count * sizeof(SceneBinaryModel);
+	if (records > data.size() || data.size() - records != header.string_bytes) {
+		LOG_ERROR("Scene: %s is truncated", path);
+		return false;
+	}
+
+	scene = Scene();
+	scene.light_source = header.light_source;
+	scene.perspective = header.perspective != 0;
+	scene.main_camera = header.main_camera;
+	scene.proj = header.proj;
+	scene.directional_light = header.directional_light;
+	scene.point_light = header.point_light;
+	scene.spot_light = header.spot_light;
+	scene.models.resize(header.model_count);
+	const char* strings = data.data() + records;
+	for (uint32_t i = 0; i < header.model_count; i++)
+	{
+		SceneBinaryModel record;
+		memcpy(&record, data.data() + sizeof(header) + i * sizeof(record), sizeof(record));
+		if ((size_t)record.path_offset + record.path_length > header.string_bytes) {
+			LOG_ERROR("Scene: %s: model %d has a broken path", path, (int)i);
+			return false;
+		}
+		SceneModel& m = scene.models[i];
+		m.path.assign(strings + record.path_offset, record.path_length);
+		m.position = Vector3(record.position[0], record.position[1], record.position[2]);
+		m.rotation = Quaternion(record.rotation[0], record.rotation[1], record.rotation[2], record.rotation[3]);
+		m.scale = Vector3(record.scale[0], record.scale[1], record.scale[2]);
+	}
+	return true;
+}
+
+bool WriteSceneBinary(const string& path, const Scene& scene)
+{
+	SceneBinaryHeader header = SceneBinaryHeader();
+	memcpy(header.magic, SCENE_BINARY_MAGIC, sizeof(header.magic));
+	header.version = SCENE_BINARY_VERSION;
+	header.model_count = (uint32_t)scene.models.size();
+	header.light_source = scene.light_source;
+	header.perspective = scene.perspective ? 1 : 0;
+	header.main_camera = scene.main_camera;
+	header.proj = scene.proj;
+	header.directional_light = scene.directional_light;
+	header.point_light = scene.point_light;
+	header.spot_light = scene.spot_light;
+
+	vector<SceneBinaryModel> records(scene.models.size());
+	string strings;
+	for (size_t i = 0; i < scene.models.size(); i++)
+	{
+		const SceneModel& m = scene.models[i];
+		SceneBinaryModel& r = records[i];
+		r.path_offset = (uint32_t)strings.size();
+		r.path_length = (uint32_t)m.path.size();
+		strings += m.path;
+		memcpy(r.position, &m.position, sizeof(r.position));
+		r.rotation[0] = m.rotation.x;
+		r.rotation[1] = m.rotation.y;
+		r.rotation[2] = m.rotation.z;
+		r.rotation[3] = m.rotation.w;
+		memcpy(r.scale, &m.scale, sizeof(r.scale));
+	}
+	header.string_bytes = (uint32_t)strings.size();
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file) {
+		LOG_ERROR("Scene: cannot write %s", path);
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (!records.empty())
+		ok = ok && fwrite(records.data(), sizeof(SceneBinaryModel), records.size(), file) == records.size();
+	if (!strings.empty())
+		ok = ok && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+		LOG_ERROR("Scene: cannot write %s", path);
+	return ok;
+}
+
+// mean milliseconds of a load over runs, negative when one fails
+static double TimeSceneLoads(int runs, const function<bool()>& load)
+{
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < runs; i++)
+		if (!load())
+			return -1.0;
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / runs;
+}
+
+bool CompileScene(const string& text_path, const string& binary_path, int timing_runs)
+{
+	Scene scene;
+	if (!LoadSceneText(text_path, scene) || !WriteSceneBinary(binary_path, scene))
+		return false;
+
+	long long text_bytes = (long long)ifstream(text_path, ios::binary | ios::ate).tellg();
+	long long binary_bytes = (long long)ifstream(binary_path, ios::binary | ios::ate).tellg();
+	printf("Scene: %s -> %s, %d models, %lld -> %lld bytes\n", text_path.c_str(), binary_path.c_str(),
+		   (int)scene.models.size(), text_bytes, binary_bytes);
+	if (timing_runs <= 0)
+		return true;
+
+	Scene loaded;
+	double text_ms = TimeSceneLoads(timing_runs, [&] { return LoadSceneText(text_path, loaded); });
+	double binary_ms = TimeSceneLoads(timing_runs, [&] { return LoadSceneBinary(binary_path, loaded); });
+	if (text_ms < 0.0 || binary_ms < 0.0)
+		return false;
+	printf("Scene: load %.3f ms -> %.3f ms, mean of %d loads\n", text_ms, binary_ms, timing_runs);
+	return true;
+}
+
+void SetSceneModels(Scene& scene, const vector<string>& paths)
+{
+	scene.models.assign(paths.size(), SceneModel());
+	for (size_t i = 0; i < paths.size(); i++)
+		scene.models[i].path = paths[i];
+}
+
+static bool SameTransform(const SceneModel& a, const SceneModel& b)
+{
+	return a.position == b.position && a.scale == b.scale && a.rotation.x == b.rotation.x && a.rotation.y == b.rotation.y &&
+		   a.rotation.z == b.rotation.z && a.rotation.w == b.rotation.w;
+}
+
+bool SceneDiff::layoutChanged() const
+{
+	if (!removed.empty())
+		return true;
+	for (size_t i = 0; i < source.size(); i++)
+		if (source[i] != (int)i)
+			return true;
+	return false;
+}
+
+SceneDiff DiffScenes(const Scene& from, const Scene& to)
+{
+	SceneDiff diff;
+	diff.kept = diff.loaded = diff.moved_count = 0;
+	diff.source.assign(to.models.size(), -1);
+	diff.moved.assign(to.models.size(), false);
+	vector<bool> claimed(from.models.size(), false);
+	for (size_t i = 0; i < to.models.size(); i++)
+	{
+		// prefer the model at the same index, so duplicates of a path keep their order
+		int match = -1;
+		if (i < from.models.size() && from.models[i].path == to.models[i].path)
+			match = (int)i;
+		for (size_t j = 0; match < 0 && j < from.models.size(); j++)
+			if (!claimed[j] && from.models[j].path == to.models[i].path && (j >= to.models.size() || to.models[j].path != from.models[j].path))
+				match = (int)j;
+		if (match < 0) {
+			diff.loaded++;
+			continue;
+		}
+		claimed[match] = true;
+		diff.source[i] = match;
+		diff.kept++;
+		if (!SameTransform(from.models[match], to.models[i])) {
+			diff.moved[i] = true;
+			diff.moved_count++;
+		}
+	}
+	for (size_t j = 0; j < from.models.size(); j++)
+		if (!claimed[j])
+			diff.removed.push_back((int)j);
+
+	// float-only structs without padding, see the static_asserts above
+	diff.lights_changed = from.light_source != to.light_source ||
+		memcmp(&from.directional_light, &to.directional_light, sizeof(DirectionalLight)) != 0 ||
+		memcmp(&from.point_light, &to.point_light, sizeof(PointLight)) != 0 ||
+		memcmp(&from.spot_light, &to.spot_light, sizeof(SpotLight)) != 0;
+	diff.camera_changed = memcmp(&from.main_camera, &to.main_camera, sizeof(camera)) != 0;
+	diff.projection_changed = from.perspective != to.perspective || memcmp(&from.proj, &to.proj, sizeof(project_setting)) != 0;
+	return diff;
+}
+
+time_t FileModificationTime(const string& path)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return 0;
+	return info.st_mtime;
+}
@@ -0,0 +1,150 @@
+///////////////////////////////////////////////////////////////////////////////
+// Scene.h
+// =======
+// Scene description: the models with their transforms, the three lights, the
+// camera and the projection. Scenes are authored as text and can be compiled
+// into a binary form that loads with a few copies instead of parsing;
+// LoadScene tells the two apart by the first bytes of the file.
+//
+// Text format, one setting per line, # starts a comment. The settings below a
+// model or light line belong to it:
+//   model ../TextureModels/Mew.obj        (repeatable, drawn in this order)
+//     position 0 0 0
+//     rotation 0 90 0                     (Euler degrees, rotateX * rotateY * rotateZ)
+//     scale 1 1 1
+//   light directional | point | spot
+//     position x y z
+//     direction x y z                     (directional and spot)
+//     ambient r g b
+//     diffuse r g b
+//     specular r g b
+//     shininess 64
+//     attenuation constant linear quadratic   (point and spot)
+//     exponent 50                         (spot)
+//     cutoff 30                           (spot, degrees)
+//   active_light directional | point | spot
+//   camera eye_x eye_y eye_z center_x center_y center_z [up_x up_y up_z]
+//   projection perspective | orthogonal
+//   fovy 80
+//   clip near far
+//   ortho left right bottom top
+// A line holding only a .obj path is a model line as well, so config.txt reads
+// as a scene. Model paths are relative to the working directory.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCENE_H_DEF
+#define SCENE_H_DEF
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <glad/glad.h>
+#include "Vectors.h"
+#include "Quaternion.h"
+
+struct DirectionalLight
+{
+	Vector3 position = Vector3(1, 1, 1);
+	Vector3 direction = Vector3(0, 0, 0);
+	Vector3 diffuse_intensity = Vector3(1, 1, 1);
+	Vector3 ambient_intensity = Vector3(0.15, 0.15, 0.15);
+	Vector3 specular_intensity = Vector3(1, 1, 1);
+	GLfloat shininess = 64;
+};
+
+struct PointLight
+{
+	Vector3 position = Vector3(0, 2, 1);
+	Vector3 diffuse_intensity = Vector3(1, 1, 1);
+	Vector3 ambient_intensity = Vector3(0.15, 0.15, 0.15);
+	Vector3 specular_intensity = Vector3(1, 1, 1);
+	GLfloat shininess = 64;
+	// attenuation
+	GLfloat constant = 0.01;
+	GLfloat linear = 0.8;
+	GLfloat quadratic = 0.1;
+};
+
+struct SpotLight
+{
+	Vector3 position = Vector3(0, 0, 2);
+	Vector3 direction = Vector3(0, 0, -1);
+	GLfloat exponent = 50;
+	GLfloat cutoff = 30; // degree
+	Vector3 diffuse_intensity = Vector3(1, 1, 1);
+	Vector3 ambient_intensity = Vector3(0.15, 0.15, 0.15);
+	Vector3 specular_intensity = Vector3(1, 1, 1);
+	GLfloat shininess = 64;
+	// attenuation
+	GLfloat constant = 0.05;
+	GLfloat linear = 0.3;
+	GLfloat quadratic = 0.6;
+};
+
+struct camera
+{
+	Vector3 position = Vector3(0.0f, 0.0f, 2.0f);
+	Vector3 center = Vector3(0.0f, 0.0f, 0.0f);
+	Vector3 up_vector = Vector3(0.0f, 1.0f, 0.0f);
+};
+
+struct project_setting
+{
+	GLfloat nearClip = 0.001, farClip = 100.0;
+	GLfloat fovy = 80;
+	GLfloat aspect = 1;		// follows the window, not part of a scene file
+	GLfloat left = -1, right = 1, top = 1, bottom = -1;
+};
+
+struct SceneModel
+{
+	std::string path;
+	Vector3 position = Vector3(0, 0, 0);
+	Quaternion rotation;
+	Vector3 scale = Vector3(1, 1, 1);
+};
+
+struct Scene
+{
+	std::vector<SceneModel> models;
+	DirectionalLight directional_light;
+	PointLight point_light;
+	SpotLight spot_light;
+	int light_source = 0;		// DIRECTIONALLIGHT, POINTLIGHT or SPOTLIGHT
+	camera main_camera;
+	bool perspective = true;
+	project_setting proj;
+};
+
+// what a reload has to redo to get from one scene to the next
+struct SceneDiff
+{
+	std::vector<int> source;	// per new model, the old model it keeps (first unclaimed one with the same path), -1 to load it
+	std::vector<bool> moved;	// per new model, kept but with another transform
+	std::vector<int> removed;	// old models no new one keeps
+	int kept, loaded, moved_count;
+	bool lights_changed;		// any light or the active one
+	bool camera_changed;
+	bool projection_changed;
+
+	// models loaded, removed or reordered, i.e. the model indices change
+	bool layoutChanged() const;
+};
+
+// text or compiled, reports the offending line and returns false on a malformed file
+bool		LoadScene(const std::string& path, Scene& scene);
+bool		LoadSceneText(const std::string& path, Scene& scene);
+bool		LoadSceneBinary(const std::string& path, Scene& scene);
+bool		WriteSceneBinary(const std::string& path, const Scene& scene);
+// --compile-scene: text to binary, prints the sizes; with timing_runs > 0 also the mean load
+// time of both forms over that many loads (--time-loads N)
+bool		CompileScene(const std::string& text_path, const std::string& binary_path, int timing_runs);
+
+// untransformed models, e.g. the paths of --models or of a benchmark scenario
+void		SetSceneModels(Scene& scene, const std::vector<std::string>& paths);
+SceneDiff	DiffScenes(const Scene& from, const Scene& to);
+
+// last modification of a file, 0 when it cannot be read
+time_t		FileModificationTime(const std::string& path);
+
+#endif
@@ -0,0 +1,455 @@
+///////////////////////////////////////////////////////////////////////////////
+// SceneBVH.cpp
+// ============
+// Bounding volume hierarchy over placed model instances.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include "SceneBVH.h"
+
+using namespace std;
+
+const int BVH_BIN_COUNT = 12;
+const int BVH_MAX_LEAF_SIZE = 2;
+const float BVH_TRAVERSAL_COST = 1.0f;
+const float BVH_INTERSECT_COST = 1.0f;
+// below this depth only median splits, they halve the instances, so even 2^31 of
+// them stay within BVH_STACK_SIZE - 1 levels and the query stacks cannot overflow
+const int BVH_MAX_SAH_DEPTH = 24;
+const int BVH_STACK_SIZE = 64;
+
+void AABB::expand(const Vector3& p)
+{
+	min.x = std::min(min.x, p.x);  min.y = std::min(min.y, p.y);  min.z = std::min(min.z, p.z);
+	max.x = std::max(max.x, p.x);  max.y = std::max(max.y, p.y);  max.z = std::max(max.z, p.z);
+}
+
+void AABB::expand(const AABB& box)
+{
+	if (!box.valid())
+		return;
+	expand(box.min);
+	expand(box.max);
+}
+
+float AABB::surfaceArea() const
+{
+	if (!valid())
+		return 0.0f;
+	Vector3 e = extent();
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+float AABB::distanceSquared(const Vector3& p) const
+{
+	float dx = std::max(std::max(min.x - p.x, 0.0f), p.x - max.x);
+	float dy = std::max(std::max(min.y - p.y, 0.0f), p.y - max.y);
+	float dz = std::max(std::max(min.z - p.z, 0.0f), p.z - max.z);
+	return dx * dx + dy * dy + dz * dz;
+}
+
+AABB TransformAABB(const AABB& box, const Matrix4& m)
+{
+	AABB res;
+	if (!box.valid())
+		return res;
+
+	// start from the translation, then add the extreme contribution of every axis
+	res.min = res.max = Vector3(m[3], m[7], m[11]);
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			float a = m[row * 4 + col] * box.min[col];
+			float b = m[row * 4 + col] * box.max[col];
+			res.min[row] += std::min(a, b);
+			res.max[row] += std::max(a, b);
+		}
+	}
+	return res;
+}
+
+Frustum ExtractFrustum(const Matrix4& vp)
+{
+	// Gribb/Hartmann: clip = M * p, so every plane is row3 +/- row_i
+	Frustum f;
+	for (int i = 0; i < 3; i++)
+	{
+		f.planes[i * 2 + 0] = Vector4(vp[12] + vp[i * 4 + 0], vp[13] + vp[i * 4 + 1], vp[14] + vp[i * 4 + 2], vp[15] + vp[i * 4 + 3]);
+		f.planes[i * 2 + 1] = Vector4(vp[12] - vp[i * 4 + 0], vp[13] - vp[i * 4 + 1], vp[14] - vp[i * 4 + 2], vp[15] - vp[i * 4 + 3]);
+	}
+	normalizePlanes(f.planes, 6);
+	return f;
+}
+
+bool FrustumIntersectsAABB(const Frustum& frustum, const AABB& box)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const Vector4& p = frustum.planes[i];
+		// the box corner furthest along the plane normal
+		float x = p.x >= 0 ? box.max.x : box.min.x;
+		float y = p.y >= 0 ? box.max.y : box.min.y;
+		float z = p.z >= 0 ? box.max.z : box.min.z;
+		if (p.x * x + p.y * y + p.z * z + p.w < 0)
+			return false;
+	}
+	return true;
+}
+
+bool RayIntersectsAABB(const Vector3& origin, const Vector3& inv_dir, const AABB& box, float t_max, float* t_near)
+{
+	float t0 = 0.0f, t1 = t_max;
+	for (int i = 0; i < 3; i++)
+	{
+		float ta = (box.min[i] - origin[i]) * inv_dir[i];
+		float tb = (box.max[i] - origin[i]) * inv_dir[i];
+		if (ta > tb)
+			std::swap(ta, tb);
+		t0 = ta > t0 ? ta : t0;
+		t1 = tb < t1 ? tb : t1;
+		if (t0 > t1)
+			return false;
+	}
+	*t_near = t0;
+	return true;
+}
+
+void SceneBVH::clear()
+{
+	nodes.clear();
+	instance_ids.clear();
+	instance_bounds.clear();
+	leaf_of.clear();
+}
+
+void SceneBVH::build(const vector<AABB>& bounds)
+{
+	clear();
+	instance_bounds = bounds;
+	leaf_of.assign(bounds.size(), -1);
+	if (bounds.empty())
+		return;
+
+	instance_ids.resize(bounds.size());
+	for (int i = 0; i < (int)bounds.size(); i++)
+		instance_ids[i] = i;
+
+	nodes.reserve(bounds.size() * 2);
+	buildRecursive(instance_ids, 0, (int)instance_ids.size(), -1, 1);
+}
+
+int SceneBVH::buildRecursive(vector<int>& ids, int begin, int end, int parent, int depth)
+{
+	int index = (int)nodes.size();
+	nodes.push_back(Node());
+	nodes[index].parent = parent;
+
+	AABB bounds, centroids;
+	for (int i = begin; i < end; i++)
+	{
+		bounds.expand(instance_bounds[ids[i]]);
+		centroids.expand(instance_bounds[ids[i]].center());
+	}
+	nodes[index].bounds = bounds;
+
+	int count = end - begin;
+	int axis = 0;
+	Vector3 extent = centroids.extent();
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	int mid = -1;
+	if (count > BVH_MAX_LEAF_SIZE && extent[axis] > 0.0f && depth >= BVH_MAX_SAH_DEPTH)
+	{
+		// a skewed layout got the SAH this deep already, keep the rest of the subtree balanced
+		mid = begin + count / 2;
+		std::nth_element(&ids[begin], &ids[mid], &ids[begin] + count, [&](int a, int b) {
+			return instance_bounds[a].center()[axis] < instance_bounds[b].center()[axis];
+		});
+	}
+	else if (count > BVH_MAX_LEAF_SIZE && extent[axis] > 0.0f)
+	{
+		// binned SAH: bucket centroids along the widest axis and sweep the split planes
+		AABB bin_bounds[BVH_BIN_COUNT];
+		int bin_count[BVH_BIN_COUNT] = { 0 };
+		float scale = BVH_BIN_COUNT / extent[axis];
+		for (int i = begin; i < end; i++)
+		{
+			int b = (int)((instance_bounds[ids[i]].center()[axis] - centroids.min[axis]) * scale);
+			b = std::min(b, BVH_BIN_COUNT - 1);
+			bin_count[b]++;
+			bin_bounds[b].expand(instance_bounds[ids[i]]);
+		}
+
+		float right_area[BVH_BIN_COUNT];
+		int right_count[BVH_BIN_COUNT];
+		AABB acc;
+		int n = 0;
+		for (int b = BVH_BIN_COUNT - 1; b > 0; b--)
+		{
+			acc.expand(bin_bounds[b]);
+			n += bin_count[b];
+			right_area[b] = acc.surfaceArea();
+			right_count[b] = n;
+		}
+
+		float best_cost = BVH_INTERSECT_COST * count;	// cost of keeping a leaf
+		int best_split = -1;
+		float inv_area = 1.0f / std::max(bounds.surfaceArea(), 1e-12f);
+		acc = AABB();
+		n = 0;
+		for (int b = 0; b < BVH_BIN_COUNT - 1; b++)
+		{
+			acc.expand(bin_bounds[b]);
+			n += bin_count[b];
+			if (n == 0 || right_count[b + 1] == 0)
+				continue;
+			float cost = BVH_TRAVERSAL_COST + BVH_INTERSECT_COST * inv_area * (acc.surfaceArea() * n + right_area[b + 1] * right_count[b + 1]);
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_split = b;
+			}
+		}
+
+		if (best_split >= 0)
+		{
+			int* split = std::partition(&ids[begin], &ids[begin] + count, [&](int id) {
+				int b = (int)((instance_bounds[id].center()[axis] - centroids.min[axis]) * scale);
+				return std::min(b, BVH_BIN_COUNT - 1) <= best_split;
+			});
+			mid = (int)(split - &ids[0]);
+		}
+		else if (count > BVH_MAX_LEAF_SIZE * 4)
+		{
+			// SAH prefers a leaf but it would be too fat to traverse, fall back to a median split
+			mid = begin + count / 2;
+			std::nth_element(&ids[begin], &ids[mid], &ids[begin] + count, [&](int a, int b) {
+				return instance_bounds[a].center()[axis] < instance_bounds[b].center()[axis];
+			});
+		}
+	}
+
+	if (mid <= begin || mid >= end)
+	{
+		nodes[index].first = begin;
+		nodes[index].count = count;
+		for (int i = begin; i < end; i++)
+			leaf_of[ids[i]] = index;
+		return index;
+	}
+
+	int left = buildRecursive(ids, begin, mid, index, depth + 1);
+	int right = buildRecursive(ids, mid, end, index, depth + 1);
+	nodes[index].left = left;
+	nodes[index].right = right;
+	return index;
+}
+
+void SceneBVH::refit(int instance, const AABB& bounds)
+{
+	if (instance < 0 || instance >= (int)instance_bounds.size())
+		return;
+
+	instance_bounds[instance] = bounds;
+	int index = leaf_of[instance];
+	while (index >= 0)
+	{
+		Node& node = nodes[index];
+		AABB refitted;
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+				refitted.expand(instance_bounds[instance_ids[i]]);
+		}
+		else
+		{
+			refitted.expand(nodes[node.left].bounds);
+			refitted.expand(nodes[node.right].bounds);
+		}
+
+		// ancestors already enclose exactly these bounds, nothing left to propagate
+		if (refitted.min == node.bounds.min && refitted.max == node.bounds.max)
+			break;
+		node.bounds = refitted;
+		index = node.parent;
+	}
+}
+
+void SceneBVH::queryFrustum(const Frustum& frustum, vector<int>& out) const
+{
+	if (nodes.empty())
+		return;
+
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (!FrustumIntersectsAABB(frustum, node.bounds))
+			continue;
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				if (node.count == 1 || FrustumIntersectsAABB(frustum, instance_bounds[instance_ids[i]]))
+					out.push_back(instance_ids[i]);
+			}
+		}
+		else
+		{
+			assert(top + 2 <= BVH_STACK_SIZE);
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+}
+
+int SceneBVH::queryRay(const Vector3& origin, const Vector3& dir, float* t_hit) const
+{
+	if (nodes.empty())
+		return -1;
+
+	Vector3 inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+	float best_t = 1e30f;
+	int best = -1;
+
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		float t;
+		if (!RayIntersectsAABB(origin, inv_dir, node.bounds, best_t, &t))
+			continue;
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				if (RayIntersectsAABB(origin, inv_dir, instance_bounds[instance_ids[i]], best_t, &t) && t < best_t)
+				{
+					best_t = t;
+					best = instance_ids[i];
+				}
+			}
+		}
+		else
+		{
+			// visit the nearer child first so the far one is usually rejected by best_t
+			float tl = 1e30f, tr = 1e30f;
+			bool hl = RayIntersectsAABB(origin, inv_dir, nodes[node.left].bounds, best_t, &tl);
+			bool hr = RayIntersectsAABB(origin, inv_dir, nodes[node.right].bounds, best_t, &tr);
+			assert(top + 2 <= BVH_STACK_SIZE);
+			if (hl && hr)
+			{
+				stack[top++] = tl < tr ? node.right : node.left;
+				stack[top++] = tl < tr ? node.left : node.right;
+			}
+			else if (hl)
+				stack[top++] = node.left;
+			else if (hr)
+				stack[top++] = node.right;
+		}
+	}
+
+	if (t_hit != NULL)
+		*t_hit = best_t;
+	return best;
+}
+
+int SceneBVH::queryNearest(const Vector3& point, float* distance) const
+{
+	if (nodes.empty())
+		return -1;
+
+	float best_d2 = 1e30f;
+	int best = -1;
+
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (node.bounds.distanceSquared(point) >= best_d2)
+			continue;
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				float d2 = instance_bounds[instance_ids[i]].distanceSquared(point);
+				if (d2 < best_d2)
+				{
+					best_d2 = d2;
+					best = instance_ids[i];
+				}
+			}
+		}
+		else
+		{
+			float dl = nodes[node.left].bounds.distanceSquared(point);
+			float dr = nodes[node.right].bounds.distanceSquared(point);
+			assert(top + 2 <= BVH_STACK_SIZE);
+			stack[top++] = dl < dr ? node.right : node.left;
+			stack[top++] = dl < dr ? node.left : node.right;
+		}
+	}
+
+	if (distance != NULL)
+		*distance = sqrtf(best_d2);
+	return best;
+}
+
+void SceneBVH::queryRadius(const Vector3& point, float radius, vector<int>& out) const
+{
+	if (nodes.empty())
+		return;
+
+	float r2 = radius * radius;
+	int stack[BVH_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const Node& node = nodes[stack[--top]];
+		if (node.bounds.distanceSquared(point) > r2)
+			continue;
+		if (node.count > 0)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				if (instance_bounds[instance_ids[i]].distanceSquared(point) <= r2)
+					out.push_back(instance_ids[i]);
+			}
+		}
+		else
+		{
+			assert(top + 2 <= BVH_STACK_SIZE);
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+		}
+	}
+}
+
+const AABB& SceneBVH::sceneBounds() const
+{
+	static const AABB empty;
+	return nodes.empty() ? empty : nodes[0].bounds;
+}
+
+int SceneBVH::depth() const
+{
+	return nodes.empty() ? 0 : depthRecursive(0);
+}
+
+int SceneBVH::depthRecursive(int node) const
+{
+	if (nodes[node].count > 0)
+		return 1;
+	return 1 + std::max(depthRecursive(nodes[node].left), depthRecursive(nodes[node].right));
+}
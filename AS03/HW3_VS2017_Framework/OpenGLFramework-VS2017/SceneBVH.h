@@ -0,0 +1,83 @@
+///////////////////////////////////////////////////////////////////////////////
+// SceneBVH.h
+// ==========
+// Bounding volume hierarchy over placed model instances.
+// Built with a binned SAH sweep, refitted in place when an instance moves.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCENE_BVH_H_DEF
+#define SCENE_BVH_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+struct AABB
+{
+	Vector3 min = Vector3(1e30f, 1e30f, 1e30f);
+	Vector3 max = Vector3(-1e30f, -1e30f, -1e30f);
+
+	void		expand(const Vector3& p);
+	void		expand(const AABB& box);
+	bool		valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+	Vector3		center() const { return (min + max) * 0.5f; }
+	Vector3		extent() const { return max - min; }
+	float		surfaceArea() const;
+	float		distanceSquared(const Vector3& p) const;	// 0 when p is inside
+};
+
+// world-space bounds of a local box under an affine transform (Arvo's method)
+AABB TransformAABB(const AABB& box, const Matrix4& m);
+
+// planes are (a, b, c, d) with normals pointing inside: a*x + b*y + c*z + d >= 0
+struct Frustum
+{
+	Vector4 planes[6];
+};
+
+Frustum ExtractFrustum(const Matrix4& view_projection);	// row-major P * V
+bool FrustumIntersectsAABB(const Frustum& frustum, const AABB& box);
+bool RayIntersectsAABB(const Vector3& origin, const Vector3& inv_dir, const AABB& box, float t_max, float* t_near);
+
+class SceneBVH
+{
+public:
+	struct Node
+	{
+		AABB bounds;
+		int left = -1;		// children, only valid for inner nodes
+		int right = -1;
+		int parent = -1;
+		int first = 0;		// range into instance_ids, only valid for leaves
+		int count = 0;		// > 0 marks a leaf
+	};
+
+	void		build(const std::vector<AABB>& bounds);
+	void		refit(int instance, const AABB& bounds);	// O(depth) update after an instance moved
+	void		clear();
+
+	// instances whose bounds touch the frustum
+	void		queryFrustum(const Frustum& frustum, std::vector<int>& out) const;
+	// closest instance whose bounds are hit by the ray, -1 if none
+	int			queryRay(const Vector3& origin, const Vector3& dir, float* t_hit) const;
+	// closest instance to a point by bounds distance, -1 if the scene is empty
+	int			queryNearest(const Vector3& point, float* distance) const;
+	// instances whose bounds lie within radius of a point (light assignment)
+	void		queryRadius(const Vector3& point, float radius, std::vector<int>& out) const;
+
+	int			instanceCount() const { return (int)instance_bounds.size(); }
+	const AABB&	instanceBounds(int instance) const { return instance_bounds[instance]; }
+	const AABB&	sceneBounds() const;
+	int			depth() const;
+
+private:
+	int			buildRecursive(std::vector<int>& ids, int begin, int end, int parent, int depth);
+	int			depthRecursive(int node) const;
+
+	std::vector<Node>	nodes;
+	std::vector<int>	instance_ids;		// leaf-ordered instance ids
+	std::vector<AABB>	instance_bounds;	// indexed by instance id
+	std::vector<int>	leaf_of;			// leaf node holding each instance
+};
+
+#endif
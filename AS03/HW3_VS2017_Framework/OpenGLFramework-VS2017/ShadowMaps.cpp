@@ -0,0 +1,151 @@
+///////////////////////////////////////////////////////////////////////////////
+// ShadowMaps.cpp
+// ==============
+// Light matrices and cache bookkeeping for the spot and directional shadows.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <algorithm>
+#include "MathCore.h"
+#include "ShadowMaps.h"
+
+using namespace std;
+
+Matrix4 LookAtMatrix(const Vector3& eye, const Vector3& center, const Vector3& up)
+{
+	Vector3 f = eye - center;
+	f.normalize();
+	Vector3 u = up;
+	// fall back to another up vector when looking along it
+	if (fabsf(f.dot(u) / u.length()) > 0.99f)
+		u = fabsf(f.y) < 0.99f ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+	Vector3 r = u.cross(f);
+	r.normalize();
+	u = f.cross(r);
+
+	return Matrix4(r.x, r.y, r.z, -r.dot(eye),
+				   u.x, u.y, u.z, -u.dot(eye),
+				   f.x, f.y, f.z, -f.dot(eye),
+				   0, 0, 0, 1);
+}
+
+Matrix4 OrthoMatrix(float left, float right, float bottom, float top, float near_clip, float far_clip)
+{
+	return ToMatrix4(MakeOrthographic(left, right, bottom, top, near_clip, far_clip));
+}
+
+Matrix4 PerspectiveMatrix(float fovy, float aspect, float near_clip, float far_clip)
+{
+	float f = 1.0f / tanf(fovy / 2.0f / 180.0f * 3.14159265f);
+	return ToMatrix4(MakePerspective(f / aspect, f, near_clip, far_clip));
+}
+
+Matrix4 SpotShadowMatrix(const Vector3& position, const Vector3& direction, float cutoff, float range)
+{
+	Vector3 dir = direction;
+	dir.normalize();
+	float fovy = min(2.0f * cutoff + 2.0f, 170.0f);	// a little margin for the PCF taps on the rim
+	return PerspectiveMatrix(fovy, 1.0f, SHADOW_SPOT_NEAR, max(range, SHADOW_SPOT_NEAR * 2.0f))
+		* LookAtMatrix(position, position + dir, Vector3(0, 1, 0));
+}
+
+void FitShadowCascades(const Matrix4& view, const Matrix4& projection, float near_clip, float far_clip,
+					   const Vector3& light_direction, const AABB& scene_bounds, ShadowCascades& cascades)
+{
+	// no need to split beyond the farthest point of the scene
+	float scene_far = near_clip;
+	for (int i = 0; i < 8; i++)
+	{
+		Vector3 corner((i & 1) ? scene_bounds.max.x : scene_bounds.min.x, (i & 2) ? scene_bounds.max.y : scene_bounds.min.y,
+			(i & 4) ? scene_bounds.max.z : scene_bounds.min.z);
+		Vector4 p = view * Vector4(corner.x, corner.y, corner.z, 1.0f);
+		scene_far = max(scene_far, -p.z);
+	}
+	float split_near = max(near_clip, SHADOW_MIN_NEAR);
+	float split_far = max(min(far_clip, scene_far), split_near * 2.0f);
+
+	// the four frustum edges as lines in world space
+	Matrix4 inv_view_projection = projection * view;
+	inv_view_projection.invert();
+	Vector3 edge_near[4], edge_far[4];
+	for (int c = 0; c < 4; c++)
+	{
+		float x = (c & 1) ? 1.0f : -1.0f, y = (c & 2) ? 1.0f : -1.0f;
+		Vector4 a = inv_view_projection * Vector4(x, y, -1.0f, 1.0f);
+		Vector4 b = inv_view_projection * Vector4(x, y, 1.0f, 1.0f);
+		edge_near[c] = Vector3(a.x, a.y, a.z) / a.w;
+		edge_far[c] = Vector3(b.x, b.y, b.z) / b.w;
+	}
+	// view depth of a world point, to place a cut along the edges
+	Vector3 view_forward(-view[8], -view[9], -view[10]);
+	float forward_offset = -view[11];
+
+	Vector3 light_dir = light_direction;
+	light_dir.normalize();
+	Matrix4 light_view = LookAtMatrix(Vector3(0, 0, 0), light_dir, Vector3(0, 1, 0));
+
+	// depth range in light space always covers the whole scene
+	float light_min_z = 1e30f, light_max_z = -1e30f;
+	for (int i = 0; i < 8; i++)
+	{
+		Vector3 corner((i & 1) ? scene_bounds.max.x : scene_bounds.min.x, (i & 2) ? scene_bounds.max.y : scene_bounds.min.y,
+			(i & 4) ? scene_bounds.max.z : scene_bounds.min.z);
+		Vector4 p = light_view * Vector4(corner.x, corner.y, corner.z, 1.0f);
+		light_min_z = min(light_min_z, p.z);
+		light_max_z = max(light_max_z, p.z);
+	}
+
+	float prev_depth = split_near;
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		float t = (float)(i + 1) / SHADOW_CASCADE_COUNT;
+		float log_split = split_near * powf(split_far / split_near, t);
+		float uniform_split = split_near + (split_far - split_near) * t;
+		float depth = SHADOW_SPLIT_LAMBDA * log_split + (1.0f - SHADOW_SPLIT_LAMBDA) * uniform_split;
+
+		Vector3 corners[8];
+		for (int c = 0; c < 4; c++)
+		{
+			Vector3 d = edge_far[c] - edge_near[c];
+			float near_depth = view_forward.dot(edge_near[c]) + forward_offset;
+			float depth_step = view_forward.dot(d);
+			corners[c] = edge_near[c] + d * ((prev_depth - near_depth) / depth_step);
+			corners[c + 4] = edge_near[c] + d * ((depth - near_depth) / depth_step);
+		}
+
+		// a sphere does not change size when the camera turns
+		Vector3 center(0, 0, 0);
+		for (int c = 0; c < 8; c++)
+			center += corners[c];
+		center /= 8.0f;
+		float radius = 0.0f;
+		for (int c = 0; c < 8; c++)
+			radius = max(radius, (corners[c] - center).length());
+		radius = ceilf(radius * 16.0f) / 16.0f;
+
+		// snap the center to whole texels in light space
+		Vector4 light_center = light_view * Vector4(center.x, center.y, center.z, 1.0f);
+		float texel = 2.0f * radius / SHADOW_MAP_SIZE;
+		float cx = floorf(light_center.x / texel) * texel;
+		float cy = floorf(light_center.y / texel) * texel;
+
+		// light view looks down -z, so near and far are the negated z range, padded a little
+		float pad = 0.01f * (light_max_z - light_min_z) + 0.01f;
+		cascades.view_projection[i] = OrthoMatrix(cx - radius, cx + radius, cy - radius, cy + radius,
+			-light_max_z - pad, -light_min_z + pad) * light_view;
+		cascades.split_depth[i] = depth;
+		prev_depth = depth;
+	}
+}
+
+bool ShadowMapCache::update(const Matrix4& new_view_projection, const vector<int>& new_casters, const vector<unsigned int>& new_revisions)
+{
+	if (valid && view_projection == new_view_projection && casters == new_casters && caster_revisions == new_revisions)
+		return false;
+
+	valid = true;
+	view_projection = new_view_projection;
+	casters = new_casters;
+	caster_revisions = new_revisions;
+	return true;
+}
@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+// ShadowMaps.h
+// ============
+// Light matrices for shadow mapping: a perspective map for the spot light and
+// stabilized cascades for the directional light. Cascades are fitted to
+// bounding spheres and snapped to whole texels, so their matrices only change
+// when the cascade center crosses a texel, which is what lets the shadow cache
+// skip re-rendering them.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHADOW_MAPS_H_DEF
+#define SHADOW_MAPS_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "SceneBVH.h"
+
+const int SHADOW_CASCADE_COUNT = 3;
+const int SHADOW_MAP_SIZE = 1024;
+const float SHADOW_SPLIT_LAMBDA = 0.75f;	// blend of logarithmic and uniform splits
+const float SHADOW_MIN_NEAR = 0.05f;		// cascades start here even when the camera near clip is smaller
+const float SHADOW_SPOT_NEAR = 0.05f;
+
+struct ShadowCascades
+{
+	Matrix4 view_projection[SHADOW_CASCADE_COUNT];
+	float split_depth[SHADOW_CASCADE_COUNT];	// far view depth of every cascade
+};
+
+// view matrix looking from eye towards center, same convention as setViewingMatrix
+Matrix4 LookAtMatrix(const Vector3& eye, const Vector3& center, const Vector3& up);
+Matrix4 OrthoMatrix(float left, float right, float bottom, float top, float near_clip, float far_clip);
+Matrix4 PerspectiveMatrix(float fovy, float aspect, float near_clip, float far_clip);
+
+// cutoff is the half angle in degrees, range bounds the far plane
+Matrix4 SpotShadowMatrix(const Vector3& position, const Vector3& direction, float cutoff, float range);
+
+// split the camera frustum between its near clip and the far end of the scene, light_direction points
+// from the light into the scene; depth ranges cover scene_bounds so every caster up the light is included
+void FitShadowCascades(const Matrix4& view, const Matrix4& projection, float near_clip, float far_clip,
+					   const Vector3& light_direction, const AABB& scene_bounds, ShadowCascades& cascades);
+
+// what a shadow map was last rendered with, it stays valid while none of it changes
+struct ShadowMapCache
+{
+	bool valid = false;
+	Matrix4 view_projection;
+	std::vector<int> casters;
+	std::vector<unsigned int> caster_revisions;
+
+	// true when the map has to be re-rendered, the new state is recorded
+	bool update(const Matrix4& view_projection, const std::vector<int>& casters, const std::vector<unsigned int>& caster_revisions);
+	void invalidate() { valid = false; }
+};
+
+#endif
@@ -0,0 +1,554 @@
+///////////////////////////////////////////////////////////////////////////////
+// SoftRasterizer.cpp
+// ==================
+// Tiled CPU rasterizer for the Phong shaders, see SoftRasterizer.h.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include "SoftRasterizer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFT_RASTER_USE_SSE
+#endif
+
+using namespace std;
+
+#define PI 3.14159265358979323846
+
+const int SOFT_VERTEX_CHUNK = 1024;		// vertices shaded per job
+const int SOFT_SETUP_CHUNK = 1024;		// triangles set up per job
+const float SOFT_SUBPIXEL = 256.0f;		// vertices are snapped to 1/256 pixel
+
+// the lighting and light source values of the shaders
+enum { SoftDirectional = 0, SoftPoint = 1, SoftSpot = 2 };
+enum { SoftPerVertex = 0, SoftPerPixel = 1 };
+
+static double ElapsedMs(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+static Vector3 TransformPoint(const Matrix4& m, const Vector3& v)
+{
+	Vector4 r = m * Vector4(v.x, v.y, v.z, 1.0f);
+	return Vector3(r.x, r.y, r.z);
+}
+
+// DirectionSpaceTransform of the shaders
+static Vector3 TransformDirection(const Matrix4& m, const Vector3& v)
+{
+	Matrix4 normal_matrix = m;
+	normal_matrix.invert().transpose();
+	Vector4 r = normal_matrix * Vector4(v.x, v.y, v.z, 0.0f);
+	return Vector3(r.x, r.y, r.z);
+}
+
+static Vector3 Normalized(Vector3 v)
+{
+	float length = v.length();
+	return length > 0.0f ? v / length : v;
+}
+
+static float Clamp01(float v)
+{
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+void SoftTexture::set(int width, int height, const unsigned char* rgba)
+{
+	levels.clear();
+	Level base;
+	base.width = width;
+	base.height = height;
+	base.texels.assign(rgba, rgba + (size_t)width * height * 4);
+	levels.push_back(base);
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		const Level& src = levels.back();
+		Level dst;
+		dst.width = max(1, src.width / 2);
+		dst.height = max(1, src.height / 2);
+		dst.texels.resize((size_t)dst.width * dst.height * 4);
+		for (int y = 0; y < dst.height; y++)
+		{
+			int y0 = min(y * 2, src.height - 1), y1 = min(y * 2 + 1, src.height - 1);
+			for (int x = 0; x < dst.width; x++)
+			{
+				int x0 = min(x * 2, src.width - 1), x1 = min(x * 2 + 1, src.width - 1);
+				for (int c = 0; c < 4; c++)
+				{
+					int sum = src.texels[((size_t)y0 * src.width + x0) * 4 + c] + src.texels[((size_t)y0 * src.width + x1) * 4 + c]
+							+ src.texels[((size_t)y1 * src.width + x0) * 4 + c] + src.texels[((size_t)y1 * src.width + x1) * 4 + c];
+					dst.texels[((size_t)y * dst.width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+		levels.push_back(dst);
+	}
+}
+
+static void FetchTexel(const SoftTexture::Level& level, int x, int y, float out[4])
+{
+	// GL_REPEAT
+	x %= level.width;
+	y %= level.height;
+	if (x < 0) x += level.width;
+	if (y < 0) y += level.height;
+	const unsigned char* t = &level.texels[((size_t)y * level.width + x) * 4];
+	for (int c = 0; c < 4; c++)
+		out[c] = t[c] / 255.0f;
+}
+
+static void SampleLevel(const SoftTexture::Level& level, float u, float v, bool linear, float out[4])
+{
+	float x = u * level.width, y = v * level.height;
+	if (!linear) {
+		FetchTexel(level, (int)floorf(x), (int)floorf(y), out);
+		return;
+	}
+	x -= 0.5f;
+	y -= 0.5f;
+	float fx = floorf(x), fy = floorf(y);
+	float ax = x - fx, ay = y - fy;
+	int ix = (int)fx, iy = (int)fy;
+	float t00[4], t10[4], t01[4], t11[4];
+	FetchTexel(level, ix, iy, t00);
+	FetchTexel(level, ix + 1, iy, t10);
+	FetchTexel(level, ix, iy + 1, t01);
+	FetchTexel(level, ix + 1, iy + 1, t11);
+	for (int c = 0; c < 4; c++)
+	{
+		float bottom = t00[c] + (t10[c] - t00[c]) * ax;
+		float top = t01[c] + (t11[c] - t01[c]) * ax;
+		out[c] = bottom + (top - bottom) * ay;
+	}
+}
+
+// lod is log2 of the texels one pixel step covers, as GL picks between the magnification and minification filter
+static void SampleTexture(const SoftTexture* texture, float u, float v, float lod, SoftFilter mag, SoftFilter min, float out[4])
+{
+	if (!texture || texture->levels.empty()) {
+		out[0] = out[1] = out[2] = out[3] = 1.0f;
+		return;
+	}
+	if (lod <= 0.0f) {
+		SampleLevel(texture->levels[0], u, v, mag != SoftNearest, out);
+		return;
+	}
+	if (min != SoftLinearMipmapLinear) {
+		SampleLevel(texture->levels[0], u, v, min == SoftLinear, out);
+		return;
+	}
+	int last = (int)texture->levels.size() - 1;
+	lod = std::min(lod, (float)last);
+	int level = (int)floorf(lod);
+	float blend = lod - level;
+	SampleLevel(texture->levels[level], u, v, true, out);
+	if (blend > 0.0f && level < last) {
+		float next[4];
+		SampleLevel(texture->levels[level + 1], u, v, true, next);
+		for (int c = 0; c < 4; c++)
+			out[c] += (next[c] - out[c]) * blend;
+	}
+}
+
+void SoftRasterizer::resize(int width, int height)
+{
+	frame_width = max(width, 1);
+	frame_height = max(height, 1);
+	tiles_x = (frame_width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	tiles_y = (frame_height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+	color_buffer.assign((size_t)frame_width * frame_height * 4, 0);
+	depth_buffer.assign((size_t)frame_width * frame_height, 1.0f);
+	bins.assign(tiles_x * tiles_y, vector<int>());
+}
+
+void SoftRasterizer::clear(float r, float g, float b, float a)
+{
+	unsigned char rgba[4] = {
+		(unsigned char)(Clamp01(r) * 255.0f + 0.5f), (unsigned char)(Clamp01(g) * 255.0f + 0.5f),
+		(unsigned char)(Clamp01(b) * 255.0f + 0.5f), (unsigned char)(Clamp01(a) * 255.0f + 0.5f)
+	};
+	for (size_t i = 0; i < color_buffer.size(); i += 4)
+		memcpy(&color_buffer[i], rgba, 4);
+	fill(depth_buffer.begin(), depth_buffer.end(), 1.0f);
+}
+
+void SoftRasterizer::beginFrame(const SoftFrameState& frame_state)
+{
+	state = frame_state;
+	const SoftLight& light = state.lights[max(0, min(state.light_source, 2))];
+	constants.camera_position = TransformPoint(state.view, state.camera_position);
+	constants.light_position = TransformPoint(state.view, light.position);
+	if (state.light_source == SoftDirectional)
+		constants.light_direction = Normalized(TransformDirection(state.view, light.position));	// the shaders light from the position
+	else
+		constants.light_direction = Normalized(TransformDirection(state.view, light.direction));
+	constants.cos_cutoff = cosf(light.cutoff * (float)PI / 180.0f);
+
+	materials.clear();
+	triangles.clear();
+	for (size_t i = 0; i < bins.size(); i++)
+		bins[i].clear();
+	frame_stats = SoftRasterStats();
+}
+
+// DirectionalLight() / PointLight() / SpotLight() of the shaders, without shadows
+Vector3 SoftRasterizer::shade(const Material& material, const Vector3& position, const Vector3& normal) const
+{
+	if (state.light_source < SoftDirectional || state.light_source > SoftSpot)
+		return Vector3(0.0f, 0.0f, 0.0f);
+	const SoftLight& light = state.lights[state.light_source];
+
+	Vector3 N = Normalized(normal);
+	Vector3 L;
+	float attenuation = 1.0f, spot = 1.0f;
+	if (state.light_source == SoftDirectional)
+		L = constants.light_direction;
+	else {
+		Vector3 to_light = constants.light_position - position;
+		float dL = to_light.length();
+		L = Normalized(to_light);
+		attenuation = min(1.0f / (light.constant + light.linear * dL + light.quadratic * dL * dL), 1.0f);
+		if (state.light_source == SoftSpot) {
+			float cos_angle = Normalized(position - constants.light_position).dot(constants.light_direction);
+			spot = cos_angle < constants.cos_cutoff ? 0.0f : powf(max(cos_angle, 0.0f), light.exponent);
+		}
+	}
+	Vector3 R = N * (2.0f * N.dot(L)) - L;		// reflect(-L, N)
+	Vector3 V = Normalized(constants.camera_position - position);
+
+	Vector3 ambient = light.ambient_intensity * material.Ka;
+	Vector3 diffuse = light.diffuse_intensity * material.Kd * max(N.dot(L), 0.0f);
+	Vector3 specular = light.specular_intensity * material.Ks * powf(max(R.dot(V), 0.0f), light.shininess);
+	return (ambient + diffuse + specular) * (attenuation * spot);
+}
+
+void SoftRasterizer::draw(const SoftDrawCall& call)
+{
+	if (call.vertex_count < 3 || !call.positions)
+		return;
+	frame_stats.draws++;
+	int material_index = (int)materials.size();
+	Material material;
+	material.Ka = call.Ka;
+	material.Kd = call.Kd;
+	material.Ks = call.Ks;
+	material.offset[0] = call.offset[0];
+	material.offset[1] = call.offset[1];
+	material.texture = call.texture;
+	materials.push_back(material);
+
+	// vertex stage, the main() of shader.vs.glsl
+	auto start = chrono::steady_clock::now();
+	Matrix4 model_view = state.view * call.model;
+	Matrix4 mvp = state.projection * model_view;
+	Matrix4 normal_matrix = model_view;
+	normal_matrix.invert().transpose();
+	int count = call.vertex_count / 3 * 3;
+	shaded.resize(count);
+	bool per_vertex = state.lighting_mode == SoftPerVertex;
+	pool.parallelFor((count + SOFT_VERTEX_CHUNK - 1) / SOFT_VERTEX_CHUNK, [&](int chunk) {
+		int end = min(count, (chunk + 1) * SOFT_VERTEX_CHUNK);
+		for (int i = chunk * SOFT_VERTEX_CHUNK; i < end; i++)
+		{
+			const float* p = call.positions + i * 3;
+			ShadedVertex& out = shaded[i];
+			Vector4 position(p[0], p[1], p[2], 1.0f);
+			out.clip = mvp * position;
+			Vector4 view_position = model_view * position;
+			Vector3 normal(0.0f, 0.0f, 0.0f);
+			if (call.normals) {
+				const float* n = call.normals + i * 3;
+				Vector4 view_normal = normal_matrix * Vector4(n[0], n[1], n[2], 0.0f);
+				normal = Vector3(view_normal.x, view_normal.y, view_normal.z);
+			}
+			Vector3 color(0.0f, 0.0f, 0.0f);
+			Vector3 pos(view_position.x, view_position.y, view_position.z);
+			if (per_vertex)
+				color = shade(material, pos, normal);
+			else if (call.colors)
+				color = Vector3(call.colors[i * 3], call.colors[i * 3 + 1], call.colors[i * 3 + 2]);
+
+			float* v = out.varyings;
+			v[0] = pos.x; v[1] = pos.y; v[2] = pos.z;
+			v[3] = normal.x; v[4] = normal.y; v[5] = normal.z;
+			v[6] = color.x; v[7] = color.y; v[8] = color.z;
+			v[9] = call.texcoords ? call.texcoords[i * 2] : 0.0f;
+			v[10] = call.texcoords ? call.texcoords[i * 2 + 1] : 0.0f;
+		}
+	});
+	frame_stats.vertex_ms += ElapsedMs(start);
+
+	// clipping and setup per chunk, then binned in submission order so depth ties resolve as on the GPU
+	start = chrono::steady_clock::now();
+	int triangle_count = count / 3;
+	int chunks = (triangle_count + SOFT_SETUP_CHUNK - 1) / SOFT_SETUP_CHUNK;
+	vector<vector<Triangle> > setup(chunks);
+	pool.parallelFor(chunks, [&](int chunk) {
+		int end = min(triangle_count, (chunk + 1) * SOFT_SETUP_CHUNK);
+		for (int t = chunk * SOFT_SETUP_CHUNK; t < end; t++)
+		{
+			const ShadedVertex* v[3] = { &shaded[t * 3], &shaded[t * 3 + 1], &shaded[t * 3 + 2] };
+			setupTriangle(v, material_index, setup[chunk]);
+		}
+	});
+	for (int c = 0; c < chunks; c++)
+	{
+		for (size_t i = 0; i < setup[c].size(); i++)
+		{
+			const Triangle& tri = setup[c][i];
+			int index = (int)triangles.size();
+			triangles.push_back(tri);
+			float min_x = min(min(tri.x[0], tri.x[1]), tri.x[2]), max_x = max(max(tri.x[0], tri.x[1]), tri.x[2]);
+			float min_y = min(min(tri.y[0], tri.y[1]), tri.y[2]), max_y = max(max(tri.y[0], tri.y[1]), tri.y[2]);
+			int tx0 = max(0, (int)floorf(min_x) / SOFT_TILE_SIZE), tx1 = min(tiles_x - 1, (int)floorf(max_x) / SOFT_TILE_SIZE);
+			int ty0 = max(0, (int)floorf(min_y) / SOFT_TILE_SIZE), ty1 = min(tiles_y - 1, (int)floorf(max_y) / SOFT_TILE_SIZE);
+			for (int ty = ty0; ty <= ty1; ty++)
+				for (int tx = tx0; tx <= tx1; tx++)
+					bins[ty * tiles_x + tx].push_back(index);
+		}
+	}
+	frame_stats.triangles += triangle_count;
+	frame_stats.setup_ms += ElapsedMs(start);
+}
+
+static void LerpVertex(const Vector4& a_clip, const float* a, const Vector4& b_clip, const float* b, float t, Vector4& clip, float* out)
+{
+	clip = a_clip + (b_clip - a_clip) * t;
+	for (int i = 0; i < SOFT_VARYINGS; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+void SoftRasterizer::setupTriangle(const ShadedVertex* v[3], int material, vector<Triangle>& out) const
+{
+	// near plane, z >= -w; the other planes are left to the bounding box and the depth range
+	ShadedVertex polygon[4];
+	int n = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const ShadedVertex& a = *v[i];
+		const ShadedVertex& b = *v[(i + 1) % 3];
+		float da = a.clip.z + a.clip.w, db = b.clip.z + b.clip.w;
+		if (da >= 0.0f)
+			polygon[n++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f)) {
+			ShadedVertex& c = polygon[n++];
+			LerpVertex(a.clip, a.varyings, b.clip, b.varyings, da / (da - db), c.clip, c.varyings);
+		}
+	}
+	if (n < 3)
+		return;
+
+	// viewport transform of every clipped vertex
+	float sx[4], sy[4], sz[4], sw[4];
+	for (int i = 0; i < n; i++)
+	{
+		float inv_w = 1.0f / polygon[i].clip.w;
+		float x = (polygon[i].clip.x * inv_w * 0.5f + 0.5f) * frame_width;
+		float y = (polygon[i].clip.y * inv_w * 0.5f + 0.5f) * frame_height;
+		sx[i] = floorf(x * SOFT_SUBPIXEL + 0.5f) / SOFT_SUBPIXEL;
+		sy[i] = floorf(y * SOFT_SUBPIXEL + 0.5f) / SOFT_SUBPIXEL;
+		sz[i] = polygon[i].clip.z * inv_w * 0.5f + 0.5f;
+		sw[i] = inv_w;
+	}
+
+	// the clipped polygon is a fan
+	for (int k = 1; k + 1 < n; k++)
+	{
+		int idx[3] = { 0, k, k + 1 };
+		double area = ((double)sx[idx[1]] - sx[idx[0]]) * ((double)sy[idx[2]] - sy[idx[0]])
+					- ((double)sx[idx[2]] - sx[idx[0]]) * ((double)sy[idx[1]] - sy[idx[0]]);
+		if (area == 0.0)
+			continue;
+		// no face culling, clockwise triangles are rasterized with two vertices swapped
+		if (area < 0.0)
+			swap(idx[1], idx[2]);
+		float min_x = min(min(sx[idx[0]], sx[idx[1]]), sx[idx[2]]), max_x = max(max(sx[idx[0]], sx[idx[1]]), sx[idx[2]]);
+		float min_y = min(min(sy[idx[0]], sy[idx[1]]), sy[idx[2]]), max_y = max(max(sy[idx[0]], sy[idx[1]]), sy[idx[2]]);
+		if (max_x < 0.0f || max_y < 0.0f || min_x >= frame_width || min_y >= frame_height)
+			continue;
+
+		Triangle tri;
+		for (int j = 0; j < 3; j++)
+		{
+			int i = idx[j];
+			tri.x[j] = sx[i];
+			tri.y[j] = sy[i];
+			tri.z[j] = sz[i];
+			tri.inv_w[j] = sw[i];
+			for (int c = 0; c < SOFT_VARYINGS; c++)
+				tri.varyings[j][c] = polygon[i].varyings[c] * sw[i];
+		}
+		tri.material = material;
+		out.push_back(tri);
+	}
+}
+
+void SoftRasterizer::finish()
+{
+	auto start = chrono::steady_clock::now();
+	atomic<long long> fragments(0);
+	pool.parallelFor(tiles_x * tiles_y, [&](int tile) {
+		long long tile_fragments = 0;
+		rasterizeTile(tile, tile_fragments);
+		fragments += tile_fragments;
+	});
+	frame_stats.rasterized = (int)triangles.size();
+	frame_stats.fragments = fragments;
+	frame_stats.raster_ms += ElapsedMs(start);
+}
+
+// one worker owns the tile, so its depth and color pixels need no synchronization
+void SoftRasterizer::rasterizeTile(int tile, long long& fragments)
+{
+	const vector<int>& bin = bins[tile];
+	if (bin.empty())
+		return;
+	int tile_x = (tile % tiles_x) * SOFT_TILE_SIZE, tile_y = (tile / tiles_x) * SOFT_TILE_SIZE;
+	int tile_x1 = min(tile_x + SOFT_TILE_SIZE, frame_width), tile_y1 = min(tile_y + SOFT_TILE_SIZE, frame_height);
+	bool per_vertex = state.lighting_mode == SoftPerVertex;
+	// lanes of a quad: (0, 0) (1, 0) (0, 1) (1, 1)
+	static const float lane_x[4] = { 0.0f, 1.0f, 0.0f, 1.0f };
+	static const float lane_y[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+	for (size_t b = 0; b < bin.size(); b++)
+	{
+		const Triangle& tri = triangles[bin[b]];
+		const Material& material = materials[tri.material];
+
+		// edge k is opposite vertex k, positive inside: E_12 weights vertex 0, E_20 vertex 1, E_01 vertex 2
+		float ex[3], ey[3], ec[3];
+		bool top_left[3];
+		for (int k = 0; k < 3; k++)
+		{
+			int a = (k + 1) % 3, c = (k + 2) % 3;
+			double dx = (double)tri.x[c] - tri.x[a], dy = (double)tri.y[c] - tri.y[a];
+			ex[k] = (float)-dy;
+			ey[k] = (float)dx;
+			// relative to the center of the tile's first pixel, so the float values stay small
+			double origin_x = tile_x + 0.5 - tri.x[a], origin_y = tile_y + 0.5 - tri.y[a];
+			ec[k] = (float)(-dy * origin_x + dx * origin_y);
+			// counterclockwise in y-up window space: top edges run right to left, left edges downwards
+			top_left[k] = (dy < 0.0) || (dy == 0.0 && dx < 0.0);
+		}
+		// the edge functions sum to twice the area everywhere, so area normalized they are the barycentrics
+		double area = ((double)tri.x[1] - tri.x[0]) * ((double)tri.y[2] - tri.y[0]) - ((double)tri.x[2] - tri.x[0]) * ((double)tri.y[1] - tri.y[0]);
+		float inv_area = (float)(1.0 / area);
+
+		float min_x = min(min(tri.x[0], tri.x[1]), tri.x[2]), max_x = max(max(tri.x[0], tri.x[1]), tri.x[2]);
+		float min_y = min(min(tri.y[0], tri.y[1]), tri.y[2]), max_y = max(max(tri.y[0], tri.y[1]), tri.y[2]);
+		int x0 = max(tile_x, (int)floorf(min_x - 0.5f)) & ~1, x1 = min(tile_x1 - 1, (int)ceilf(max_x));
+		int y0 = max(tile_y, (int)floorf(min_y - 0.5f)) & ~1, y1 = min(tile_y1 - 1, (int)ceilf(max_y));
+
+		for (int qy = y0; qy <= y1; qy += 2)
+		{
+			for (int qx = x0; qx <= x1; qx += 2)
+			{
+				float rx = (float)(qx - tile_x), ry = (float)(qy - tile_y);
+				float e[3][4];
+				int mask = 0;
+#ifdef SOFT_RASTER_USE_SSE
+				__m128 lx = _mm_add_ps(_mm_set1_ps(rx), _mm_loadu_ps(lane_x));
+				__m128 ly = _mm_add_ps(_mm_set1_ps(ry), _mm_loadu_ps(lane_y));
+				__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (int k = 0; k < 3; k++)
+				{
+					__m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(ex[k]), lx), _mm_mul_ps(_mm_set1_ps(ey[k]), ly)), _mm_set1_ps(ec[k]));
+					_mm_storeu_ps(e[k], value);
+					__m128 zero = _mm_setzero_ps();
+					inside = _mm_and_ps(inside, top_left[k] ? _mm_cmpge_ps(value, zero) : _mm_cmpgt_ps(value, zero));
+				}
+				mask = _mm_movemask_ps(inside);
+#else
+				for (int l = 0; l < 4; l++)
+				{
+					bool in = true;
+					for (int k = 0; k < 3; k++)
+					{
+						e[k][l] = ex[k] * (rx + lane_x[l]) + ey[k] * (ry + lane_y[l]) + ec[k];
+						in = in && (top_left[k] ? e[k][l] >= 0.0f : e[k][l] > 0.0f);
+					}
+					if (in)
+						mask |= 1 << l;
+				}
+#endif
+				// lanes off the framebuffer still feed the derivatives, but are never written
+				if (qx + 1 >= frame_width)
+					mask &= ~0xA;
+				if (qy + 1 >= frame_height)
+					mask &= ~0xC;
+				if (!mask)
+					continue;
+
+				// depth test first, then the varyings of all four lanes for the texture derivatives
+				float depth[4];
+				int pass = 0;
+				for (int l = 0; l < 4; l++)
+				{
+					if (!(mask & (1 << l)))
+						continue;
+					depth[l] = (e[0][l] * tri.z[0] + e[1][l] * tri.z[1] + e[2][l] * tri.z[2]) * inv_area;
+					if (depth[l] < 0.0f || depth[l] > 1.0f)
+						continue;
+					size_t pixel = (size_t)(qy + (int)lane_y[l]) * frame_width + qx + (int)lane_x[l];
+					if (depth[l] < depth_buffer[pixel])
+						pass |= 1 << l;
+				}
+				if (!pass)
+					continue;
+
+				float vary[4][SOFT_VARYINGS];
+				for (int l = 0; l < 4; l++)
+				{
+					float b0 = e[0][l] * inv_area, b1 = e[1][l] * inv_area, b2 = e[2][l] * inv_area;
+					float w = b0 * tri.inv_w[0] + b1 * tri.inv_w[1] + b2 * tri.inv_w[2];
+					float inv = 1.0f / max(w, 1e-20f);
+					// only the texture coordinates are needed in lanes that are not shaded
+					int first = (pass & (1 << l)) ? 0 : 9;
+					for (int c = first; c < SOFT_VARYINGS; c++)
+						vary[l][c] = (b0 * tri.varyings[0][c] + b1 * tri.varyings[1][c] + b2 * tri.varyings[2][c]) * inv;
+				}
+
+				float lod = 0.0f;
+				if (material.texture && !material.texture->levels.empty()) {
+					const SoftTexture::Level& level = material.texture->levels[0];
+					float dudx = (vary[1][9] - vary[0][9]) * level.width, dvdx = (vary[1][10] - vary[0][10]) * level.height;
+					float dudy = (vary[2][9] - vary[0][9]) * level.width, dvdy = (vary[2][10] - vary[0][10]) * level.height;
+					float rho = max(sqrtf(dudx * dudx + dvdx * dvdx), sqrtf(dudy * dudy + dvdy * dvdy));
+					lod = rho > 0.0f ? log2f(rho) : 0.0f;
+				}
+
+				for (int l = 0; l < 4; l++)
+				{
+					if (!(pass & (1 << l)))
+						continue;
+					const float* v = vary[l];
+					Vector3 color;
+					if (per_vertex)
+						color = Vector3(v[6], v[7], v[8]);
+					else
+						color = shade(material, Vector3(v[0], v[1], v[2]), Vector3(v[3], v[4], v[5]));
+					float texel[4];
+					SampleTexture(material.texture, v[9] + material.offset[0], v[10] + material.offset[1], lod,
+								  state.mag_filter, state.min_filter, texel);
+
+					size_t pixel = (size_t)(qy + (int)lane_y[l]) * frame_width + qx + (int)lane_x[l];
+					depth_buffer[pixel] = depth[l];
+					unsigned char* out = &color_buffer[pixel * 4];
+					out[0] = (unsigned char)(Clamp01(texel[0] * color.x) * 255.0f + 0.5f);
+					out[1] = (unsigned char)(Clamp01(texel[1] * color.y) * 255.0f + 0.5f);
+					out[2] = (unsigned char)(Clamp01(texel[2] * color.z) * 255.0f + 0.5f);
+					out[3] = (unsigned char)(Clamp01(texel[3]) * 255.0f + 0.5f);
+					fragments++;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////////
+// SoftRasterizer.h
+// ================
+// CPU backend for the Phong pipeline of shader.vs.glsl / shader.fs.glsl, for
+// machines without a GPU. Draw calls take the same non-indexed Shape arrays
+// the VBOs are made of; vertices are shaded on the thread pool, triangles are
+// clipped against the near plane, set up with 8-bit subpixel precision and
+// binned into SOFT_TILE_SIZE tiles. Every tile is then rasterized by one
+// worker in 2x2 quads (SSE edge functions where available), with a GL_LESS
+// depth test and perspective-correct varyings; the quads give the texture
+// derivatives for mipmapping.
+//
+// Covered: directional/point/spot lights with attenuation and the spotlight
+// exponent/cutoff, per-vertex and per-pixel lighting, and nearest, linear and
+// linear-mipmap-linear sampling with repeat wrapping. The clustered light
+// field and shadow maps are GPU only. Runs without a GL context.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SOFT_RASTERIZER_H_DEF
+#define SOFT_RASTERIZER_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+#include "ThreadPool.h"
+
+const int SOFT_TILE_SIZE = 32;			// pixels, even so quads never straddle two tiles
+const int SOFT_VARYINGS = 11;			// view position, view normal, vertex color, texture coordinate
+
+enum SoftFilter { SoftNearest, SoftLinear, SoftLinearMipmapLinear };
+
+// RGBA8 texture with its mip chain, rows bottom first as stbi loads them flipped
+struct SoftTexture
+{
+	struct Level
+	{
+		int width, height;
+		std::vector<unsigned char> texels;
+	};
+	std::vector<Level> levels;
+
+	// level 0 is the image, the others are 2x2 box filtered down to 1x1 like glGenerateMipmap
+	void		set(int width, int height, const unsigned char* rgba);
+};
+
+// the uniforms of one light in the shaders, unused members are ignored
+struct SoftLight
+{
+	Vector3 position;
+	Vector3 direction;
+	Vector3 ambient_intensity;
+	Vector3 diffuse_intensity;
+	Vector3 specular_intensity;
+	float shininess = 64.0f;
+	float constant = 1.0f, linear = 0.0f, quadratic = 0.0f;	// point and spot
+	float exponent = 0.0f, cutoff = 180.0f;					// spot, cutoff in degrees
+};
+
+struct SoftFrameState
+{
+	Matrix4 view;
+	Matrix4 projection;
+	int light_source = 0;			// DIRECTIONALLIGHT, POINTLIGHT, SPOTLIGHT
+	int lighting_mode = 1;			// PERVERTEXLIGHTING, PERPIXELLIGHTING
+	SoftLight lights[3];			// indexed by light_source
+	Vector3 camera_position;
+	SoftFilter mag_filter = SoftNearest;
+	SoftFilter min_filter = SoftNearest;
+};
+
+struct SoftDrawCall
+{
+	Matrix4 model;
+	// xyz, rgb, xyz and uv per vertex, every three vertices a triangle
+	const float* positions = NULL;
+	const float* colors = NULL;
+	const float* normals = NULL;
+	const float* texcoords = NULL;
+	int vertex_count = 0;
+	Vector3 Ka, Kd, Ks;
+	float offset[2] = { 0.0f, 0.0f };	// eye texture coordinate offset
+	const SoftTexture* texture = NULL;	// NULL samples white
+};
+
+struct SoftRasterStats
+{
+	int draws = 0;
+	int triangles = 0;			// submitted
+	int rasterized = 0;			// after clipping and degenerate rejection
+	long long fragments = 0;	// shaded, after the depth test
+	double vertex_ms = 0.0;
+	double setup_ms = 0.0;
+	double raster_ms = 0.0;
+};
+
+class SoftRasterizer
+{
+public:
+	explicit SoftRasterizer(ThreadPool& pool) : pool(pool) {}
+
+	void		resize(int width, int height);
+	// clears color and depth, like glClear with depth 1
+	void		clear(float r, float g, float b, float a);
+
+	void		beginFrame(const SoftFrameState& state);
+	// shades the vertices and bins the triangles, the arrays are only read during the call
+	void		draw(const SoftDrawCall& call);
+	// rasterizes every tile, the image is complete afterwards
+	void		finish();
+
+	int			width() const { return frame_width; }
+	int			height() const { return frame_height; }
+	// RGBA8, bottom row first like glReadPixels
+	const unsigned char* colors() const { return color_buffer.empty() ? NULL : &color_buffer[0]; }
+	const SoftRasterStats& stats() const { return frame_stats; }
+	int			threadCount() const { return pool.threadCount(); }
+
+private:
+	// SoftFrameState brought into view space once per frame
+	struct FrameConstants
+	{
+		Vector3 light_position;		// point and spot
+		Vector3 light_direction;	// directional: towards the light, spot: along the cone, normalized
+		Vector3 camera_position;
+		float cos_cutoff;
+	};
+	struct Material
+	{
+		Vector3 Ka, Kd, Ks;
+		float offset[2];
+		const SoftTexture* texture;
+	};
+	struct ShadedVertex
+	{
+		Vector4 clip;
+		float varyings[SOFT_VARYINGS];
+	};
+	struct Triangle
+	{
+		float x[3], y[3], z[3];
+		float inv_w[3];
+		float varyings[3][SOFT_VARYINGS];	// premultiplied by inv_w
+		int material;
+	};
+
+	Vector3		shade(const Material& material, const Vector3& position, const Vector3& normal) const;
+	void		setupTriangle(const ShadedVertex* v[3], int material, std::vector<Triangle>& out) const;
+	void		rasterizeTile(int tile, long long& fragments);
+
+	ThreadPool&	pool;
+	int			frame_width = 0, frame_height = 0;
+	int			tiles_x = 0, tiles_y = 0;
+	std::vector<unsigned char> color_buffer;
+	std::vector<float>	depth_buffer;
+	SoftFrameState	state;
+	FrameConstants	constants;
+	std::vector<Material>	materials;		// one per draw call of the frame
+	std::vector<ShadedVertex> shaded;		// scratch for the draw call being set up
+	std::vector<Triangle>	triangles;
+	std::vector<std::vector<int> > bins;	// triangles overlapping every tile, in submission order
+	SoftRasterStats	frame_stats;
+};
+
+#endif
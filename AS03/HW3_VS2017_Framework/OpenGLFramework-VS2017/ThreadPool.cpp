@@ -0,0 +1,194 @@
+///////////////////////////////////////////////////////////////////////////////
+// ThreadPool.cpp
+// ==============
+// Persistent worker threads for data-parallel loops on the CPU.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int worker_count)
+	: job(NULL), job_count(0), generation(0), next_claim(0), finished(0), busy(false), quit(false), test_delay_us(0)
+{
+	for (int i = 0; i < worker_count; i++)
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void ThreadPool::runJobs(const function<void(int)>* fn, int count, unsigned int job_generation, int delay_us)
+{
+	for (;;)
+	{
+		// claim an index only while the job this thread was woken for is still the current one
+		unsigned long long claim = next_claim.load();
+		do {
+			if ((unsigned int)(claim >> 32) != job_generation || (int)(claim & 0xffffffffu) >= count)
+				return;
+		} while (!next_claim.compare_exchange_weak(claim, claim + 1));
+		if (delay_us > 0)
+			this_thread::sleep_for(chrono::microseconds(delay_us));
+
+		(*fn)((int)(claim & 0xffffffffu));
+		if (finished.fetch_add(1) + 1 == count)
+		{
+			lock_guard<std::mutex> lock(mutex);
+			done.notify_one();
+		}
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	unsigned int seen = 0;
+	for (;;)
+	{
+		const function<void(int)>* fn;
+		int count;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+			fn = job;
+			count = job_count;
+		}
+
+		// fn stays valid for as long as this generation can hand out indices, a late
+		// worker may hold an old or NULL one but never gets to call it
+		runJobs(fn, count, seen, test_delay_us);
+		if (test_delay_us > 0)
+			this_thread::sleep_for(chrono::microseconds(test_delay_us));
+	}
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& fn)
+{
+	if (count <= 0)
+		return;
+	// a second caller, or a job calling back in, would take over the one job slot
+	bool was_busy = busy.exchange(true);
+	assert(!was_busy && "parallelFor called concurrently or from inside a job");
+	(void)was_busy;
+	if (workers.empty() || count == 1)
+	{
+		for (int i = 0; i < count; i++)
+			fn(i);
+		busy = false;
+		return;
+	}
+
+	unsigned int job_generation;
+	{
+		lock_guard<std::mutex> lock(mutex);
+		job = &fn;
+		job_count = count;
+		job_generation = ++generation;
+		finished = 0;
+		next_claim = (unsigned long long)job_generation << 32;
+	}
+	wake.notify_all();
+
+	runJobs(&fn, count, job_generation, 0);
+
+	// every claimed index has run once finished reaches count, and nothing can claim another
+	unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return finished.load() == count; });
+	job = NULL;
+	busy = false;
+}
+
+ThreadPool& GetThreadPool()
+{
+	static ThreadPool pool(max(1, (int)thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+int RunThreadPoolTest(int argc, char** argv)
+{
+	int rounds = 1000;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--rounds") == 0)
+			rounds = max(1, atoi(argv[++i]));
+	}
+
+	// a pool that lost track of its jobs never returns from parallelFor, report that instead of hanging
+	atomic<int> progress(0);
+	atomic<bool> finished(false);
+	thread watchdog([&] {
+		int last = -1;
+		for (int idle = 0; !finished.load(); idle++)
+		{
+			this_thread::sleep_for(chrono::milliseconds(100));
+			int now = progress.load();
+			if (now != last)
+				idle = 0;
+			last = now;
+			if (idle == 50) {
+				printf("Thread pool test: FAILED, parallelFor has not returned for 5 s (round %d)\n", now);
+				fflush(stdout);
+				_Exit(1);
+			}
+		}
+	});
+
+	int failures = 0;
+	const int worker_counts[] = { 1, 3, 7 };
+	for (int workers : worker_counts)
+	{
+		ThreadPool pool(workers);
+		pool.setTestDelay(200);
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < rounds; r++)
+		{
+			// short rounds of quick jobs, often done before a worker wakes, alternate with long rounds
+			// of uneven jobs, so a late worker overlaps the start of a bigger call
+			bool small = r % 2 == 0;
+			int count = small ? 2 + r % 7 : 24 + r % 9;
+			vector<atomic<int>> runs(count);
+			for (int i = 0; i < count; i++)
+				runs[i] = 0;
+			pool.parallelFor(count, [&](int i) {
+				runs[i].fetch_add(1);
+				if (!small && (i + r) % 5 == 0)
+					this_thread::sleep_for(chrono::microseconds(50 + (r * 7 + i) % 150));
+			});
+			progress.fetch_add(1);
+			if (small)
+				this_thread::sleep_for(chrono::microseconds(300));
+			for (int i = 0; i < count; i++)
+			{
+				if (runs[i].load() != 1)
+				{
+					if (failures < 10)
+						printf("Thread pool test: %d workers, round %d, index %d of %d ran %d times\n", workers, r, i, count, runs[i].load());
+					failures++;
+				}
+			}
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		printf("Thread pool test: %d workers, %d rounds in %.0f ms\n", workers, rounds, ms);
+	}
+	finished = true;
+	watchdog.join();
+	printf("Thread pool test: %s\n", failures == 0 ? "passed" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
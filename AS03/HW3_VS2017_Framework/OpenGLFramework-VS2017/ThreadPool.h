@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+// ThreadPool.h
+// ============
+// Persistent worker threads for data-parallel loops on the CPU.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef THREAD_POOL_H_DEF
+#define THREAD_POOL_H_DEF
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int worker_count);
+	~ThreadPool();
+
+	// run job(0) .. job(count - 1) across the workers and the calling thread, returns when all are done;
+	// the pool has one job slot, so one thread at a time may call this and never from inside a job
+	// (asserted in debug builds), a job that needs its own parallel loop runs it serially
+	void		parallelFor(int count, const std::function<void(int index)>& job);
+	int			threadCount() const { return (int)workers.size() + 1; }
+	// --thread-pool-test: workers sleep this long between claiming an index and running it,
+	// and before waiting for the next job, widening windows the scheduler rarely hits
+	void		setTestDelay(int microseconds) { test_delay_us = microseconds; }
+
+private:
+	void		workerLoop();
+	void		runJobs(const std::function<void(int)>* fn, int count, unsigned int job_generation, int delay_us);
+
+	std::vector<std::thread>	workers;
+	std::mutex					mutex;
+	std::condition_variable		wake;
+	std::condition_variable		done;
+	// job, job_count and generation change under the mutex, workers copy them there
+	const std::function<void(int)>* job;
+	int							job_count;
+	unsigned int				generation;
+	// the generation in the high 32 bits and the next index in the low ones, so a worker
+	// still holding an older job can never claim an index of the current one
+	std::atomic<unsigned long long> next_claim;
+	std::atomic<int>			finished;
+	std::atomic<bool>			busy;		// a parallelFor is running, for the single caller assert
+	bool						quit;
+	int							test_delay_us;
+};
+
+// shared pool sized to the machine, one thread is left for the caller; its users (culling,
+// light clusters, mesh cache decode, regression compare) all call it from the main thread,
+// one loop at a time, see parallelFor
+ThreadPool& GetThreadPool();
+
+// --thread-pool-test: back-to-back parallelFor calls with uneven job lengths on pools of
+// several sizes, returns 0 when every index ran exactly once
+int RunThreadPoolTest(int argc, char** argv);
+
+#endif
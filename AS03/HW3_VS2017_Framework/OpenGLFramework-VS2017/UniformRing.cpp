@@ -0,0 +1,198 @@
+///////////////////////////////////////////////////////////////////////////////
+// UniformRing.cpp
+// ===============
+// Fenced ring of per-draw uniform blocks over a persistently mapped buffer.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include "UniformRing.h"
+
+using namespace std;
+
+// GL 4.4 / ARB_buffer_storage, beyond what glad was generated for
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_RING)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+const GLuint64 UNIFORM_RING_WAIT_NS = 1000000000;	// one glClientWaitSync, repeated until the fence signals
+
+static bool HasBufferStorage()
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 4))
+		return true;
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (name && strcmp(name, "GL_ARB_buffer_storage") == 0)
+			return true;
+	}
+	return false;
+}
+
+UniformRing::UniformRing()
+	: ring_buffer(0), spare_buffer(0), spare_size(0), region_size(0), alignment(1), mapped(NULL), region(0), used(0)
+{
+	for (int i = 0; i < UNIFORM_RING_REGIONS; i++)
+		fences[i] = 0;
+	resetStats();
+}
+
+bool UniformRing::init(void* (*get_proc)(const char* name), GLsizeiptr region_bytes)
+{
+	release();
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = max(alignment, 1);
+	// every region starts aligned, so offset 0 of a region is a valid binding
+	region_size = (region_bytes + alignment - 1) / alignment * alignment;
+	GLsizeiptr total = region_size * UNIFORM_RING_REGIONS;
+
+	glGenBuffers(1, &ring_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, ring_buffer);
+	PFNGLBUFFERSTORAGEPROC_RING buffer_storage = NULL;
+	if (get_proc && HasBufferStorage())
+		buffer_storage = (PFNGLBUFFERSTORAGEPROC_RING)get_proc("glBufferStorage");
+	if (buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		buffer_storage(GL_UNIFORM_BUFFER, total, NULL, flags);
+		mapped = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, total, flags);
+		if (!mapped) {
+			// immutable storage cannot be respecified, start over with a mutable buffer
+			glDeleteBuffers(1, &ring_buffer);
+			glGenBuffers(1, &ring_buffer);
+			glBindBuffer(GL_UNIFORM_BUFFER, ring_buffer);
+		}
+	}
+	if (!mapped)
+		glBufferData(GL_UNIFORM_BUFFER, total, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	region = 0;
+	used = 0;
+	return ring_buffer != 0;
+}
+
+void UniformRing::release()
+{
+	for (int i = 0; i < UNIFORM_RING_REGIONS; i++)
+	{
+		if (fences[i])
+			glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+	if (ring_buffer) {
+		if (mapped) {
+			glBindBuffer(GL_UNIFORM_BUFFER, ring_buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &ring_buffer);
+	}
+	ring_buffer = 0;
+	mapped = NULL;
+	if (spare_buffer)
+		glDeleteBuffers(1, &spare_buffer);
+	spare_buffer = 0;
+	spare_size = 0;
+}
+
+void UniformRing::nextRegion()
+{
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	region = (region + 1) % UNIFORM_RING_REGIONS;
+	used = 0;
+	ring_stats.regions_used++;
+
+	GLsync fence = fences[region];
+	if (!fence)
+		return;
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		// the GPU is UNIFORM_RING_REGIONS regions behind, this is the stall to look out for
+		auto start = chrono::steady_clock::now();
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UNIFORM_RING_WAIT_NS) == GL_TIMEOUT_EXPIRED)
+			;
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		ring_stats.fence_waits++;
+		ring_stats.wait_ms += ms;
+		ring_stats.max_wait_ms = max(ring_stats.max_wait_ms, ms);
+	}
+	glDeleteSync(fence);
+	fences[region] = 0;
+}
+
+GLintptr UniformRing::push(const void* data, GLsizeiptr bytes)
+{
+	if (!ring_buffer || bytes > region_size)
+		return -1;
+	GLsizeiptr start = (used + alignment - 1) / alignment * alignment;
+	if (start + bytes > region_size) {
+		ring_stats.overflows++;
+		nextRegion();
+		start = 0;
+	}
+
+	GLintptr offset = region * region_size + start;
+	if (mapped)
+		memcpy(mapped + offset, data, bytes);
+	else {
+		// the fences already keep the GPU off this range
+		glBindBuffer(GL_UNIFORM_BUFFER, ring_buffer);
+		void* p = glMapBufferRange(GL_UNIFORM_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (!p)
+			return -1;
+		memcpy(p, data, bytes);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+	used = start + bytes;
+	ring_stats.peak_bytes = max(ring_stats.peak_bytes, used);
+	ring_stats.blocks++;
+	return offset;
+}
+
+GLuint UniformRing::uploadSpare(const void* data, GLsizeiptr bytes)
+{
+	if (!spare_buffer)
+		glGenBuffers(1, &spare_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, spare_buffer);
+	if (bytes > spare_size) {
+		glBufferData(GL_UNIFORM_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+		spare_size = bytes;
+	}
+	// waits, or renames the storage, while an earlier draw still reads the block
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	ring_stats.spare_uploads++;
+	return spare_buffer;
+}
+
+void UniformRing::endFrame()
+{
+	// a frame without draws leaves nothing to fence
+	if (used > 0)
+		nextRegion();
+}
+
+void UniformRing::resetStats()
+{
+	memset(&ring_stats, 0, sizeof(ring_stats));
+}
+
+void UniformRing::printStats() const
+{
+	const UniformRingStats& s = ring_stats;
+	printf("Uniform ring (%s, %d x %.0f KB): %lld blocks, %d regions, %d overflows, %d fence waits (%.3f ms total, %.3f ms max), peak %.1f KB per region\n",
+		   persistent() ? "persistent" : "mapped per block", UNIFORM_RING_REGIONS, region_size / 1024.0,
+		   s.blocks, s.regions_used, s.overflows, s.fence_waits, s.wait_ms, s.max_wait_ms, s.peak_bytes / 1024.0);
+	if (s.spare_uploads > 0)
+		printf("Uniform ring: %lld blocks did not fit and went through glBufferSubData\n", s.spare_uploads);
+}
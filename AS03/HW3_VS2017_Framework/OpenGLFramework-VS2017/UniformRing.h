@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////////////////////////////////
+// UniformRing.h
+// =============
+// Ring allocator for per-draw uniform blocks. One buffer object is split into
+// UNIFORM_RING_REGIONS regions; blocks are copied into the current region one
+// after the other and bound with glBindBufferRange. When a frame ends (or the
+// region is full) the region is fenced and the next one is taken, waiting on
+// its fence only if the GPU is still reading it, so the CPU never writes
+// memory a draw in flight uses and no upload synchronizes implicitly.
+//
+// With glBufferStorage (GL 4.4 or ARB_buffer_storage) the buffer stays mapped
+// persistently and coherently; otherwise each block is written through an
+// unsynchronized glMapBufferRange, which the fences make just as safe.
+//
+// A block push cannot place (no ring, a block larger than a region, a failed
+// map) goes through uploadSpare instead: a glBufferSubData into a separate
+// buffer, which the driver synchronizes, slow but never dropping a draw.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef UNIFORM_RING_H_DEF
+#define UNIFORM_RING_H_DEF
+
+#include <glad/glad.h>
+
+const int UNIFORM_RING_REGIONS = 3;						// frames the GPU may lag behind
+const GLsizeiptr UNIFORM_RING_REGION_BYTES = 256 * 1024;
+
+struct UniformRingStats
+{
+	int regions_used;		// region switches, one per frame plus overflows
+	int overflows;			// switches because a frame did not fit its region
+	int fence_waits;		// switches that found the GPU still reading the next region
+	double wait_ms;			// CPU time blocked in those waits
+	double max_wait_ms;
+	GLsizeiptr peak_bytes;	// most bytes written into one region
+	long long blocks;
+	long long spare_uploads;	// blocks push could not place, uploaded by uploadSpare
+};
+
+class UniformRing
+{
+public:
+	UniformRing();
+
+	// get_proc resolves glBufferStorage, which the GL 4.2 loader does not
+	bool		init(void* (*get_proc)(const char* name), GLsizeiptr region_bytes);
+	void		release();
+	bool		persistent() const { return mapped != NULL; }
+
+	// copies a block into the current region and returns its offset in buffer(), -1 when it can never fit
+	GLintptr	push(const void* data, GLsizeiptr bytes);
+	GLuint		buffer() const { return ring_buffer; }
+	// for a block push refused: copies it to offset 0 of the spare buffer and returns that buffer
+	GLuint		uploadSpare(const void* data, GLsizeiptr bytes);
+
+	// fences what this frame wrote and moves on to the next region
+	void		endFrame();
+
+	const UniformRingStats& stats() const { return ring_stats; }
+	void		resetStats();
+	void		printStats() const;
+
+private:
+	void		nextRegion();
+
+	GLuint		ring_buffer;
+	GLuint		spare_buffer;	// created on the first uploadSpare
+	GLsizeiptr	spare_size;
+	GLsizeiptr	region_size;
+	GLint		alignment;		// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	char*		mapped;			// whole buffer, NULL without persistent mapping
+	GLsync		fences[UNIFORM_RING_REGIONS];
+	int			region;
+	GLsizeiptr	used;			// bytes written into the current region
+
+	UniformRingStats ring_stats;
+};
+
+#endif
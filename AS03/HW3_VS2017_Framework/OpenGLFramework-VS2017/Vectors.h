@@ -108,9 +108,9 @@ struct Vector3
 
 
 ///////////////////////////////////////////////////////////////////////////////
-// 4D vector
+// 4D vector, 16-byte aligned for the SIMD paths in Matrices.h
 ///////////////////////////////////////////////////////////////////////////////
-struct Vector4
+struct alignas(16) Vector4
 {
     float x;
     float y;
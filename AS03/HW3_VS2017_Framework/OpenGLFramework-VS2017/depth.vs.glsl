@@ -0,0 +1,17 @@
+#version 330
+
+// position-only stream for the depth pre-pass
+layout (location = 0) in vec3 aPos;
+
+/* matrix */
+uniform mat4 modelMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+
+// must match shader.vs.glsl bit for bit, the shading pass tests with GL_EQUAL
+invariant gl_Position;
+
+void main() 
+{
+	gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(aPos, 1.0);
+}
@@ -2,6 +2,13 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include<math.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -12,6 +19,32 @@
 
 #include "Vectors.h"
 #include "Matrices.h"
+#include "MathCore.h"
+#include "Quaternion.h"
+#include "SceneBVH.h"
+#include "MeshSimplify.h"
+#include "OcclusionCuller.h"
+#include "LightClusters.h"
+#include "ShadowMaps.h"
+#include "HeadlessContext.h"
+#include "ImageWriter.h"
+#include "Profiler.h"
+#include "Benchmark.h"
+#include "MathBenchmark.h"
+#include "LoadArena.h"
+#include "FramePacing.h"
+#include "Logger.h"
+#include "FrameQueue.h"
+#include "UniformRing.h"
+#include "SoftRasterizer.h"
+#include "ImageRegression.h"
+#include "FrameCapture.h"
+#include "Scene.h"
+#include "MeshCache.h"
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
@@ -56,12 +89,10 @@ int lightSource = DIRECTIONALLIGHT;
 struct Uniform
 {
 	GLuint iLocTex;
-	GLint iLocOffset;
 	
 	GLint iLocLightSource;	// directional light, point light, spot light
 	GLint iLocLightingMode; // per-vertex, per-pixel
 
-	GLint iLocModelMatrix;
 	GLint iLocViewMatrix;
 	GLint iLocProjectionMatrix;
 
@@ -93,55 +124,83 @@ struct Uniform
 	GLint iLocSpotLinear;
 	GLint iLocSpotQuadratic;
 
-	GLint iLocKa;
-	GLint iLocKd;
-	GLint iLocKs;
-
 	GLint iLocCameraPosition;	
+
+	GLint iLocClusteredLighting;
+	GLint iLocClusterLights;
+	GLint iLocClusterGrid;
+	GLint iLocClusterIndices;
+	GLint iLocClusterViewport;
+	GLint iLocClusterDims;
+	GLint iLocClusterDepthParams;
+	GLint iLocClusterLogDepth;
+
+	GLint iLocShadowsEnabled;
+	GLint iLocDirectionalShadowMap;
+	GLint iLocCascadeMatrices;
+	GLint iLocCascadeSplits;
+	GLint iLocSpotShadowMap;
+	GLint iLocSpotShadowMatrix;
 };
 Uniform uniform;
 
-struct DirectionalLight
+// std140 layout of DrawBlock in shader.vs.glsl / shader.fs.glsl, one per draw in the uniform ring
+struct DrawBlock
 {
-	Vector3 position = Vector3(1, 1, 1);
-	Vector3 direction = Vector3(0, 0, 0);
-	Vector3 diffuse_intensity = Vector3(1, 1, 1);
-	Vector3 ambient_intensity = Vector3(0.15, 0.15, 0.15);
-	Vector3 specular_intensity = Vector3(1, 1, 1);
-	GLfloat shininess = 64;
+	GLfloat model_matrix[16];	// column-major
+	GLfloat Ka[4];				// vec3 members take 16 bytes
+	GLfloat Kd[4];
+	GLfloat Ks[4];
+	GLfloat offset[2];
+	GLfloat padding[2];
 };
+const GLuint DRAW_BLOCK_BINDING = 0;
+UniformRing uniform_ring;
+
+// F2 and --capture record the window (or the benchmark frames) here, see FrameCapture.h
+FrameCapture frame_capture;
+string capture_file = "capture.y4m";
+void* (*gl_get_proc_address)(const char* name) = NULL;	// the loader glad was initialized with
+
+// the scene file sets these up, see Scene.h
 DirectionalLight directional_light;
+PointLight point_light;
+SpotLight spot_light;
 
-struct PointLight
-{
-	Vector3 position = Vector3(0, 2, 1);
-	Vector3 diffuse_intensity = Vector3(1, 1, 1);
-	Vector3 ambient_intensity = Vector3(0.15, 0.15, 0.15);
-	Vector3 specular_intensity = Vector3(1, 1, 1);
-	GLfloat shininess = 64;
-	// attenuation
-	GLfloat constant = 0.01;
-	GLfloat linear = 0.8;
-	GLfloat quadratic = 0.1;
+// light field shaded through the light clusters, on top of the light selected by lightSource
+const int LIGHT_FIELD_SIZES[] = { 0, 128, 512 };
+const int LIGHT_FIELD_SIZE_COUNT = sizeof(LIGHT_FIELD_SIZES) / sizeof(LIGHT_FIELD_SIZES[0]);
+const GLfloat LIGHT_FIELD_CONSTANT = 1.0f;	// short range attenuation so each light stays local
+const GLfloat LIGHT_FIELD_LINEAR = 2.0f;
+const GLfloat LIGHT_FIELD_QUADRATIC = 30.0f;
+const int CLUSTER_LIGHT_TEXELS = 5;			// RGBA32F texels per light, matches shader.fs.glsl
+int light_field_size_idx = 0;
+vector<PointLight> point_lights;
+vector<SpotLight> spot_lights;
+
+struct ClusterBuffers
+{
+	GLuint light_buffer, light_texture;
+	GLuint grid_buffer, grid_texture;
+	GLuint index_buffer, index_texture;
 };
-PointLight point_light;
+ClusterBuffers cluster_buffers;
+LightClusterGrid light_clusters;
 
-struct SpotLight
-{
-	Vector3 position = Vector3(0, 0, 2);
-	Vector3 direction = Vector3(0, 0, -1);
-	GLfloat exponent = 50;
-	GLfloat cutoff = 30; // degree
-	Vector3 diffuse_intensity = Vector3(1, 1, 1);
-	Vector3 ambient_intensity = Vector3(0.15, 0.15, 0.15);
-	Vector3 specular_intensity = Vector3(1, 1, 1);
-	GLfloat shininess = 64;
-	// attenuation
-	GLfloat constant = 0.05;
-	GLfloat linear = 0.3;
-	GLfloat quadratic = 0.6;
+// shadow maps of the spot and directional lights, only re-rendered when their cache is stale
+bool shadows_enabled = false;
+struct ShadowResources
+{
+	GLuint fbo;
+	GLuint cascade_texture;	// 2D array, one layer per cascade
+	GLuint spot_texture;
 };
-SpotLight spot_light;
+ShadowResources shadow_maps;
+ShadowCascades shadow_cascades;
+Matrix4 spot_shadow_matrix;
+ShadowMapCache cascade_caches[SHADOW_CASCADE_COUNT];
+ShadowMapCache spot_shadow_cache;
+int shadow_passes_rendered = 0, shadow_passes_skipped = 0;
 
 vector<string> filenames; // .obj filename list
 
@@ -168,6 +227,15 @@ typedef struct
 
 } PhongMaterial;
 
+typedef struct
+{
+	GLuint vao;		// shares the welded vertex buffer of its shape
+	GLuint ebo;
+	int indexCount;
+	float error;	// object-space geometric error of this level
+	GLuint depth_vao;	// positions only, for the depth pre-pass
+} ShapeLOD;
+
 typedef struct
 {
 	GLuint vao;
@@ -180,15 +248,38 @@ typedef struct
 	GLuint p_texCoord;
 	PhongMaterial material;
 	int indexCount;
+	GLuint depth_vao;	// only the position buffer above, for the depth pre-pass
+
+	// simplified levels, level 0 is the full resolution mesh above
+	GLuint lod_vbo;	// welded and interleaved, see INDEXED_VERTEX_STRIDE
+	GLuint lod_depth_vbo;	// welded positions only
+	vector<ShapeLOD> lods;
+	int cur_lod;
+
+	// CPU copy of the coarsest level for software occlusion culling
+	vector<GLfloat> occluder_positions;
+	vector<GLuint> occluder_indices;
+
+	// the vertex arrays of the buffers above, only kept for the software backend
+	vector<GLfloat> cpu_positions;
+	vector<GLfloat> cpu_colors;
+	vector<GLfloat> cpu_normals;
+	vector<GLfloat> cpu_texcoords;
 } Shape;
 
 struct model
 {
 	Vector3 position = Vector3(0, 0, 0);
 	Vector3 scale = Vector3(1, 1, 1);
-	Vector3 rotation = Vector3(0, 0, 0);	// Euler form
+	Quaternion rotation;	// unit quaternion, Euler angles gimbal-locked under the drag rotation
+	Vector3 placement = Vector3(0, 0, 0);	// grid offset, only applied when all models are shown
 
 	vector<Shape> shapes;
+	AABB local_bounds;	// object-space bounds after normalization
+	unsigned int revision = 0;	// bumped whenever the model matrix changes
+
+	GLMatrix4 gl_model_matrix;	// column-major copy for the uniforms, see GetGLModelMatrix
+	unsigned int gl_model_revision = ~0u;
 
 	bool hasEye;
 	GLint max_eye_offset = 7;
@@ -196,21 +287,16 @@ struct model
 };
 vector<model> models;
 
-struct camera
-{
-	Vector3 position;
-	Vector3 center;
-	Vector3 up_vector;
-};
-camera main_camera;
+// headless --backend software: models are loaded without GL and drawn by SoftRasterizer,
+// PhongMaterial::diffuseTexture then indexes soft_textures
+bool software_backend = false;
+vector<SoftTexture> soft_textures;
 
-struct project_setting
-{
-	GLfloat nearClip, farClip;
-	GLfloat fovy;
-	GLfloat aspect;
-	GLfloat left, right, top, bottom;
-};
+SceneBVH scene_bvh;	// one instance per entry of models
+bool show_all_models = false;
+vector<int> visible_models;
+
+camera main_camera;
 project_setting proj;
 
 enum ProjMode
@@ -223,16 +309,112 @@ TransMode cur_trans_mode = GeoTranslation;
 int mag_filtering_mode = 0;
 int min_filtering_mode = 0;
 
+const int STATS_REPORT_INTERVAL = 120;	// frames between two stats lines
+const int CAMERA_LOG_INTERVAL_MS = 100;	// camera edits print at most this often while dragging or scrolling
+const char* PROFILER_TRACE_FILE = "profile_trace.json";
+
+// draws issued in the current frame, reset by the benchmark
+int frame_draw_calls = 0;
+int frame_triangles = 0;
+
+// level of detail
+const int LOD_LEVEL_COUNT = 4;
+const float LOD_REDUCTION = 0.5f;		// triangle ratio between two levels
+const float LOD_PIXEL_ERROR = 1.0f;		// allowed projected error in pixels
+const float LOD_HYSTERESIS = 0.7f;		// a coarser level must beat the threshold by this factor
+bool lod_enabled = true;
+
+// --mesh-cache: models load from compressed caches in this directory, written on the first load
+string mesh_cache_dir;
+bool mesh_cache_lz = true;		// --mesh-lz off stores the payload without the LZ stage
+
+// software occlusion culling
+const int OCCLUSION_BUFFER_WIDTH = 320;		// the height follows the viewport aspect
+const int OCCLUSION_MAX_OCCLUDERS = 8;		// largest visible models on screen
+bool occlusion_enabled = true;
+OcclusionCuller occlusion_culler;
+
 Matrix4 view_matrix;
 Matrix4 project_matrix;
 
 Shape m_shpae;
 
 int cur_idx = 0; // represent which model should be rendered now
-vector<string> model_list{ "../TextureModels/Fushigidane.obj", "../TextureModels/Mew.obj","../TextureModels/Nyarth.obj","../TextureModels/Zenigame.obj", "../TextureModels/laurana500.obj", "../TextureModels/Nala.obj", "../TextureModels/Square.obj" };
+
+// models with their transforms, lights, camera and projection come from a scene file
+const char* DEFAULT_SCENE_FILE = "scene.txt";
+string scene_file = DEFAULT_SCENE_FILE;
+Scene scene;				// models[] holds its models in the same order, interactive: render thread only
+int scene_revision = 0;		// bumped by every reload that changes the model indices
 
 GLuint program;
 
+// depth pre-pass for the per-pixel view
+struct DepthUniform
+{
+	GLint iLocModelMatrix;
+	GLint iLocViewMatrix;
+	GLint iLocProjectionMatrix;
+};
+DepthUniform depth_uniform;
+GLuint depth_program;
+bool depth_prepass_enabled = false;
+GLuint shading_samples_query = 0;	// when set, counts the samples passing the shading pass of RenderScene
+const int DEPTH_PREPASS_BENCHMARK_FRAMES = 30;
+
+// interactive mode: the GLFW callbacks run on the main thread and only edit a
+// FrameSnapshot, the render thread owns the GL context and every global above
+struct ModelState
+{
+	Vector3 position;
+	Vector3 scale;
+	Quaternion rotation;
+	GLint max_eye_offset;
+	GLint cur_eye_offset_idx;
+};
+
+struct FrameSnapshot
+{
+	camera main_camera;
+	project_setting proj;
+	ProjMode cur_proj_mode;
+	DirectionalLight directional_light;
+	PointLight point_light;
+	SpotLight spot_light;
+	int lightSource;
+	int mag_filtering_mode, min_filtering_mode;
+	int cur_idx;
+	int light_field_size_idx;
+	bool lod_enabled, occlusion_enabled, depth_prepass_enabled, shadows_enabled, show_all_models;
+	int screenWidth, screenHeight;
+	vector<ModelState> models;
+	int scene_revision;		// models and cur_idx index the models of this scene revision
+};
+
+// one-off actions of the main thread that need the GL context
+struct RenderCommand
+{
+	enum Type { Pick, DepthPrepassBenchmark, ProfilerToggle, TraceToggle, RenderModeToggle, CaptureToggle };
+	Type type;
+	float x, y;			// Pick: cursor position
+	int width, height;	// Pick: window size
+};
+
+FrameSnapshot input;		// main thread only, the state the callbacks edit
+bool input_changed = false;	// input differs from the last snapshot published
+TripleBuffer<FrameSnapshot> frame_snapshots;
+SpscQueue<RenderCommand, 64> render_commands;
+atomic<int> picked_model(-1);	// render thread result of the last Pick, -1 when taken
+atomic<bool> render_quit(false);
+
+// F5 or a change of the scene file: the main thread parses the file and carries the
+// changes over to input, the render thread loads and releases the models
+Scene input_scene;			// main thread only, the scene input was last updated from
+time_t input_scene_time = 0;
+mutex pending_scene_mutex;
+Scene pending_scene;		// the newest scene waiting for the render thread
+int pending_scene_revision = -1;	// -1 when the render thread took it
+
 
 static GLvoid Normalize(GLfloat v[3])
 {
@@ -266,71 +448,82 @@ Matrix4 translate(Vector3 vec)
 	return mat;
 }
 
-Matrix4 scaling(Vector3 vec)
+Matrix4 GetModelMatrix(int idx)
 {
-	Matrix4 mat;
-
-	mat = Matrix4(
-		vec.x, 0.0f, 0.0f, 0.0f,
-		0.0f, vec.y, 0.0f, 0.0f,
-		0.0f, 0.0f, vec.z, 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
-
-	return mat;
+	Vector3 position = models[idx].position;
+	if (show_all_models)
+		position += models[idx].placement;
+	return ComposeTRS(position, models[idx].rotation, models[idx].scale);
 }
 
-Matrix4 rotateX(GLfloat val)
+// the model matrix as uploaded, transposed once per change instead of once per draw
+const GLMatrix4& GetGLModelMatrix(int idx)
 {
-	Matrix4 mat;
-
-	mat = Matrix4(
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, cosf(val), -sinf(val), 0.0f,
-		0.0f, sinf(val), cosf(val), 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
-
-	return mat;
+	model& m = models[idx];
+	if (m.gl_model_revision != m.revision) {
+		m.gl_model_matrix.set(GetModelMatrix(idx));
+		m.gl_model_revision = m.revision;
+	}
+	return m.gl_model_matrix;
 }
 
-Matrix4 rotateY(GLfloat val)
+// refit the scene BVH after the T/R/S of a model changed
+void UpdateModelBounds(int idx)
 {
-	Matrix4 mat;
-
-	mat = Matrix4(
-		cosf(val), 0.0f, sinf(val), 0.0f,
-		0.0f, 1.0f, 0.0f, 0.0f,
-		-sinf(val), 0.0f, cosf(val), 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
-
-	return mat;
+	models[idx].revision++;
+	scene_bvh.refit(idx, TransformAABB(models[idx].local_bounds, GetModelMatrix(idx)));
 }
 
-Matrix4 rotateZ(GLfloat val)
+void BuildSceneBVH()
 {
-	Matrix4 mat;
-
-	mat = Matrix4(
-		cosf(val), -sinf(val), 0.0f, 0.0f,
-		sinf(val), cosf(val), 0.0f, 0.0f,
-		0.0f, 0.0f, 1.0f, 0.0f,
-		0.0f, 0.0f, 0.0f, 1.0f
-	);
+	vector<AABB> bounds;
+	for (int i = 0; i < models.size(); i++)
+	{
+		// the layout may have moved every model
+		models[i].revision++;
+		bounds.push_back(TransformAABB(models[i].local_bounds, GetModelMatrix(i)));
+	}
+	scene_bvh.build(bounds);
+}
 
-	return mat;
+// place every model on a grid centered at the origin for the all models view
+void LayoutSceneModels()
+{
+	const float spacing = 2.5f;
+	int cols = (int)ceil(sqrt((double)models.size()));
+	int rows = ((int)models.size() + cols - 1) / cols;
+	for (int i = 0; i < models.size(); i++)
+	{
+		int r = i / cols, c = i % cols;
+		models[i].placement = Vector3((c - (cols - 1) / 2.0f) * spacing, ((rows - 1) / 2.0f - r) * spacing, 0.0f);
+	}
 }
 
-Matrix4 rotate(Vector3 vec)
+// cast a ray through the cursor, returns the closest model hit in the scene BVH or -1
+int PickModel(float xpos, float ypos, int width, int height)
 {
-	return rotateX(vec.x)*rotateY(vec.y)*rotateZ(vec.z);
+	// both halves show the same camera, so fold the cursor into one half
+	float half_width = width / 2.0f;
+	float local_x = xpos >= half_width ? xpos - half_width : xpos;
+	float ndc_x = 2.0f * local_x / half_width - 1.0f;
+	float ndc_y = 1.0f - 2.0f * ypos / height;
+
+	Matrix4 inv_vp = project_matrix * view_matrix;
+	inv_vp.invert();
+	Vector4 near_point = inv_vp * Vector4(ndc_x, ndc_y, -1.0f, 1.0f);
+	Vector4 far_point = inv_vp * Vector4(ndc_x, ndc_y, 1.0f, 1.0f);
+	Vector3 origin = Vector3(near_point.x, near_point.y, near_point.z) / near_point.w;
+	Vector3 dir = Vector3(far_point.x, far_point.y, far_point.z) / far_point.w - origin;
+	dir.normalize();
+
+	float t;
+	return scene_bvh.queryRay(origin, dir, &t);
 }
 
-void setViewingMatrix()
+Matrix4 ComputeViewMatrix(const camera& cam)
 {
-	float F[3] = { main_camera.position.x - main_camera.center.x, main_camera.position.y - main_camera.center.y, main_camera.position.z - main_camera.center.z };
-	float U[3] = { main_camera.up_vector.x, main_camera.up_vector.y, main_camera.up_vector.z };
+	float F[3] = { cam.position.x - cam.center.x, cam.position.y - cam.center.y, cam.position.z - cam.center.z };
+	float U[3] = { cam.up_vector.x, cam.up_vector.y, cam.up_vector.z };
 	float R[3];
 	Normalize(F);
 	Cross(U, F, R);
@@ -338,24 +531,30 @@ void setViewingMatrix()
 	Cross(F, R, U);
 	Normalize(U);
 
-	view_matrix[0] = R[0];
-	view_matrix[1] = R[1];
-	view_matrix[2] = R[2];
-	view_matrix[3] = 0;
-	view_matrix[4] = U[0];
-	view_matrix[5] = U[1];
-	view_matrix[6] = U[2];
-	view_matrix[7] = 0;
-	view_matrix[8] = F[0];
-	view_matrix[9] = F[1];
-	view_matrix[10] = F[2];
-	view_matrix[11] = 0;
-	view_matrix[12] = 0;
-	view_matrix[13] = 0;
-	view_matrix[14] = 0;
-	view_matrix[15] = 1;
-
-	view_matrix = view_matrix * translate(-main_camera.position);
+	Matrix4 view;
+	view[0] = R[0];
+	view[1] = R[1];
+	view[2] = R[2];
+	view[3] = 0;
+	view[4] = U[0];
+	view[5] = U[1];
+	view[6] = U[2];
+	view[7] = 0;
+	view[8] = F[0];
+	view[9] = F[1];
+	view[10] = F[2];
+	view[11] = 0;
+	view[12] = 0;
+	view[13] = 0;
+	view[14] = 0;
+	view[15] = 1;
+
+	return view * translate(-cam.position);
+}
+
+void setViewingMatrix()
+{
+	view_matrix = ComputeViewMatrix(main_camera);
 }
 
 void setOrthogonal()
@@ -364,22 +563,7 @@ void setOrthogonal()
 	// handle side by side view
 	float right = proj.right / 2;
 	float left = proj.left / 2;
-	project_matrix[0] = 2 / (right - left);
-	project_matrix[1] = 0;
-	project_matrix[2] = 0;
-	project_matrix[3] = -(right + left) / (right - left);
-	project_matrix[4] = 0;
-	project_matrix[5] = 2 / (proj.top - proj.bottom);
-	project_matrix[6] = 0;
-	project_matrix[7] = -(proj.top + proj.bottom) / (proj.top - proj.bottom);
-	project_matrix[8] = 0;
-	project_matrix[9] = 0;
-	project_matrix[10] = -2 / (proj.farClip - proj.nearClip);
-	project_matrix[11] = -(proj.farClip + proj.nearClip) / (proj.farClip - proj.nearClip);
-	project_matrix[12] = 0;
-	project_matrix[13] = 0;
-	project_matrix[14] = 0;
-	project_matrix[15] = 1;
+	project_matrix = ToMatrix4(MakeOrthographic(left, right, proj.bottom, proj.top, proj.nearClip, proj.farClip));
 }
 
 void setPerspective()
@@ -387,35 +571,23 @@ void setPerspective()
 	const float tanHalfFOV = tanf((proj.fovy / 2.0) / 180.0 * acosf(-1.0));
 	
 	cur_proj_mode = Perspective;
-	project_matrix[0] = 1.0f / (tanHalfFOV * proj.aspect);
-	project_matrix[1] = 0;
-	project_matrix[2] = 0;
-	project_matrix[3] = 0;
-	project_matrix[4] = 0;
-	project_matrix[5] = 1.0f / tanHalfFOV;
-	project_matrix[6] = 0;
-	project_matrix[7] = 0;
-	project_matrix[8] = 0;
-	project_matrix[9] = 0;
-	project_matrix[10] = -(proj.farClip + proj.nearClip) / (proj.farClip - proj.nearClip);
-	project_matrix[11] = -(2 * proj.farClip * proj.nearClip) / (proj.farClip - proj.nearClip);
-	project_matrix[12] = 0;
-	project_matrix[13] = 0;
-	project_matrix[14] = -1;
-	project_matrix[15] = 0;
+	project_matrix = ToMatrix4(MakePerspective(1.0f / (tanHalfFOV * proj.aspect), 1.0f / tanHalfFOV, proj.nearClip, proj.farClip));
 }
 
 // Call back function for window reshape
 void ChangeSize(GLFWwindow* window, int width, int height)
 {
 	// glViewport(0, 0, width, height);
-	proj.aspect = (float)(width / 2) / (float)height;
-	if (cur_proj_mode == Perspective) {
-		setPerspective();
-	}
+	input.proj.aspect = (float)(width / 2) / (float)height;
+	input.screenWidth = width;
+	input.screenHeight = height;
+	input_changed = true;
+}
 
-	screenWidth = width;
-	screenHeight = height;
+// the window was uncovered or restored and its contents are gone
+void WindowRefresh(GLFWwindow* window)
+{
+	input_changed = true;
 }
 
 void Vector3ToFloat4(Vector3 v, GLfloat res[4])
@@ -426,64 +598,75 @@ void Vector3ToFloat4(Vector3 v, GLfloat res[4])
 	res[3] = 1;
 }
 
-// Render function for display rendering
-void RenderScene(int per_vertex_or_per_pixel) {	
-	Matrix4 T, R, S;
-	T = translate(models[cur_idx].position);
-	R = rotate(models[cur_idx].rotation);
-	S = scaling(models[cur_idx].scale);
-
-	// render object
-	Matrix4 model_matrix = T * R * S;
-
-	glUniform1i(uniform.iLocLightSource, lightSource);
-	glUniform1i(uniform.iLocLightingMode, per_vertex_or_per_pixel);
-
-	glUniformMatrix4fv(uniform.iLocModelMatrix, 1, GL_FALSE, model_matrix.getTranspose());
-	glUniformMatrix4fv(uniform.iLocViewMatrix, 1, GL_FALSE, view_matrix.getTranspose());
-	glUniformMatrix4fv(uniform.iLocProjectionMatrix, 1, GL_FALSE, project_matrix.getTranspose());
-
-	glUniform3f(uniform.iLocDirectionalPosition, directional_light.position.x, directional_light.position.y, directional_light.position.z);
-	glUniform3f(uniform.iLocDirectionalDirection, directional_light.direction.x, directional_light.direction.y, directional_light.direction.z);
-	glUniform3f(uniform.iLocDirectionalAmbientIntensity, directional_light.ambient_intensity.x, directional_light.ambient_intensity.y, directional_light.ambient_intensity.z);
-	glUniform3f(uniform.iLocDirectionalDiffuseIntensity, directional_light.diffuse_intensity.x, directional_light.diffuse_intensity.y, directional_light.diffuse_intensity.z);
-	glUniform3f(uniform.iLocDirectionalSpecularIntensity, directional_light.specular_intensity.x, directional_light.specular_intensity.y, directional_light.specular_intensity.z);
-	glUniform1f(uniform.iLocDirectionalShininess, directional_light.shininess);
-
-	glUniform3f(uniform.iLocPointPosition, point_light.position.x, point_light.position.y, point_light.position.z);
-	glUniform3f(uniform.iLocPointAmbientIntensity, point_light.ambient_intensity.x, point_light.ambient_intensity.y, point_light.ambient_intensity.z);
-	glUniform3f(uniform.iLocPointDiffuseIntensity, point_light.diffuse_intensity.x, point_light.diffuse_intensity.y, point_light.diffuse_intensity.z);
-	glUniform3f(uniform.iLocPointSpecularIntensity, point_light.specular_intensity.x, point_light.specular_intensity.y, point_light.specular_intensity.z);
-	glUniform1f(uniform.iLocPointShininess, point_light.shininess);
-	glUniform1f(uniform.iLocPointConstant, point_light.constant);
-	glUniform1f(uniform.iLocPointLinear, point_light.linear);
-	glUniform1f(uniform.iLocPointQuadratic, point_light.quadratic);
-
-	glUniform3f(uniform.iLocSpotPosition, spot_light.position.x, spot_light.position.y, spot_light.position.z);
-	glUniform3f(uniform.iLocSpotDirection, spot_light.direction.x, spot_light.direction.y, spot_light.direction.z);
-	glUniform1f(uniform.iLocSpotExponent, spot_light.exponent);
-	glUniform1f(uniform.iLocSpotCutoff, spot_light.cutoff);
-	glUniform3f(uniform.iLocSpotAmbientIntensity, spot_light.ambient_intensity.x, spot_light.ambient_intensity.y, spot_light.ambient_intensity.z);
-	glUniform3f(uniform.iLocSpotDiffuseIntensity, spot_light.diffuse_intensity.x, spot_light.diffuse_intensity.y, spot_light.diffuse_intensity.z);
-	glUniform3f(uniform.iLocSpotSpecularIntensity, spot_light.specular_intensity.x, spot_light.specular_intensity.y, spot_light.specular_intensity.z);
-	glUniform1f(uniform.iLocSpotShininess, spot_light.shininess);
-	glUniform1f(uniform.iLocSpotConstant, spot_light.constant);
-	glUniform1f(uniform.iLocSpotLinear, spot_light.linear);
-	glUniform1f(uniform.iLocSpotQuadratic, spot_light.quadratic);
-
-	glUniform3f(uniform.iLocCameraPosition, main_camera.position.x, main_camera.position.y, main_camera.position.z);
-
-	for (int i = 0; i < models[cur_idx].shapes.size(); i++) 
-	{
-		glUniform3f(uniform.iLocKa, models[cur_idx].shapes[i].material.Ka.x, models[cur_idx].shapes[i].material.Ka.y, models[cur_idx].shapes[i].material.Ka.z);
-		glUniform3f(uniform.iLocKd, models[cur_idx].shapes[i].material.Kd.x, models[cur_idx].shapes[i].material.Kd.y, models[cur_idx].shapes[i].material.Kd.z);
-		glUniform3f(uniform.iLocKs, models[cur_idx].shapes[i].material.Ks.x, models[cur_idx].shapes[i].material.Ks.y, models[cur_idx].shapes[i].material.Ks.z);
-		glBindVertexArray(models[cur_idx].shapes[i].vao);
+// pick a level per shape from the error it would show on screen
+void SelectModelLOD(int idx)
+{
+	model& m = models[idx];
+	const AABB& bounds = scene_bvh.instanceBounds(idx);
+	float pixels_per_unit;
+	if (cur_proj_mode == Perspective) {
+		float radius = bounds.extent().length() * 0.5f;
+		float distance = max((bounds.center() - main_camera.position).length() - radius, proj.nearClip);
+		pixels_per_unit = screenHeight / (2.0f * distance * tanf(proj.fovy / 2.0f / 180.0f * (float)PI));
+	}
+	else {
+		pixels_per_unit = screenHeight / (proj.top - proj.bottom);
+	}
+	float scale = max(max(fabsf(m.scale.x), fabsf(m.scale.y)), fabsf(m.scale.z));
+
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		Shape& shape = m.shapes[i];
+		int level = 0;
+		if (lod_enabled) {
+			for (int l = (int)shape.lods.size(); l > 0; l--) {
+				if (shape.lods[l - 1].error * scale * pixels_per_unit <= LOD_PIXEL_ERROR) {
+					level = l;
+					break;
+				}
+			}
+			// only coarsen when the level is well under the threshold, so it does not pop back and forth
+			while (level > shape.cur_lod && shape.lods[level - 1].error * scale * pixels_per_unit > LOD_PIXEL_ERROR * LOD_HYSTERESIS)
+				level--;
+		}
+		shape.cur_lod = level;
+	}
+}
+
+void DrawModel(int idx)
+{
+	model& m = models[idx];
+	DrawBlock block;
+	memcpy(block.model_matrix, GetGLModelMatrix(idx).get(), sizeof(block.model_matrix));
+
+	for (int i = 0; i < m.shapes.size(); i++) 
+	{
+		const PhongMaterial& material = m.shapes[i].material;
+		Vector3ToFloat4(material.Ka, block.Ka);
+		Vector3ToFloat4(material.Kd, block.Kd);
+		Vector3ToFloat4(material.Ks, block.Ks);
+		if (material.isEye == 1) {
+			block.offset[0] = material.offsets[m.cur_eye_offset_idx].x;
+			block.offset[1] = material.offsets[m.cur_eye_offset_idx].y;
+		} else {
+			block.offset[0] = 0.0f;
+			block.offset[1] = 0.0f;
+		}
+		block.padding[0] = block.padding[1] = 0.0f;
+		GLintptr block_offset = uniform_ring.push(&block, sizeof(block));
+		if (block_offset >= 0)
+			glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING, uniform_ring.buffer(), block_offset, sizeof(block));
+		else {
+			// still draw the shape, just without the ring's synchronization-free upload
+			LOG_EVERY(LOG_LEVEL_WARN, 1000, "Uniform ring: no room for a draw block, falling back to glBufferSubData");
+			glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_BLOCK_BINDING, uniform_ring.uploadSpare(&block, sizeof(block)), 0, sizeof(block));
+		}
+		glBindVertexArray(m.shapes[i].vao);
 
 		// [TODO] Bind texture and modify texture filtering & wrapping mode
 		// Hint: glActiveTexture, glBindTexture, glTexParameteri
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, models[cur_idx].shapes[i].material.diffuseTexture);
+		glBindTexture(GL_TEXTURE_2D, m.shapes[i].material.diffuseTexture);
 
 		if (mag_filtering_mode == 0) {
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -496,738 +679,3090 @@ void RenderScene(int per_vertex_or_per_pixel) {
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		}
 
-		if (models[cur_idx].shapes[i].material.isEye == 1) {
-			glUniform2f(uniform.iLocOffset, models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].x, models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].y);
-		} else {
-			glUniform2f(uniform.iLocOffset, 0.0, 0.0);
-		}
-
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-		glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
+		if (m.shapes[i].cur_lod > 0) {
+			const ShapeLOD& lod = m.shapes[i].lods[m.shapes[i].cur_lod - 1];
+			glBindVertexArray(lod.vao);
+			glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, 0);
+			frame_triangles += lod.indexCount / 3;
+		}
+		else {
+			glDrawArrays(GL_TRIANGLES, 0, m.shapes[i].vertex_count);
+			frame_triangles += m.shapes[i].vertex_count / 3;
+		}
+		frame_draw_calls++;
 	}
 }
 
-// Call back function for keyboard
-void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+// rough projected size of a model, used to rank occluders
+float ScreenSizeOf(int idx)
 {
-	if (action == GLFW_PRESS) {
-		switch (key)
+	const AABB& bounds = scene_bvh.instanceBounds(idx);
+	float radius = bounds.extent().length() * 0.5f;
+	if (cur_proj_mode == Perspective)
+		return radius / max((bounds.center() - main_camera.position).length(), proj.nearClip);
+	return radius;
+}
+
+// drop the models hidden behind the largest ones on screen
+void CullOccludedModels(const Matrix4& view_projection)
+{
+	int view_width = max(screenWidth / 2, 1);
+	int buffer_height = max(OCCLUSION_BUFFER_WIDTH * screenHeight / view_width, 1);
+	buffer_height = (buffer_height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT * OCCLUSION_TILE_HEIGHT;
+	if (occlusion_culler.width() != OCCLUSION_BUFFER_WIDTH || occlusion_culler.height() != buffer_height)
+		occlusion_culler.resize(OCCLUSION_BUFFER_WIDTH, buffer_height);
+
+	vector<pair<float, int> > ranked;
+	for (int i = 0; i < visible_models.size(); i++)
+		ranked.push_back(make_pair(-ScreenSizeOf(visible_models[i]), visible_models[i]));
+	sort(ranked.begin(), ranked.end());
+	int occluder_count = min((int)ranked.size(), OCCLUSION_MAX_OCCLUDERS);
+
+	occlusion_culler.beginFrame(view_projection);
+	for (int i = 0; i < occluder_count; i++)
+	{
+		int idx = ranked[i].second;
+		Matrix4 model_matrix = GetModelMatrix(idx);
+		for (int s = 0; s < models[idx].shapes.size(); s++)
 		{
-		case GLFW_KEY_ESCAPE:
-			exit(0);
-			break;
-		case GLFW_KEY_Z:
-			cur_idx = (cur_idx + 1) % model_list.size();
-			break;
-		case GLFW_KEY_X:
-			cur_idx = (cur_idx - 1 + model_list.size()) % model_list.size();
-			break;
-		case GLFW_KEY_O:
-			if (cur_proj_mode == Perspective)
-			{
-				proj.farClip -= 3.0f;
-				setViewingMatrix();
-				setOrthogonal();
-			}
-			break;
-		case GLFW_KEY_P:
-			if (cur_proj_mode == Orthogonal)
-			{
-				proj.farClip += 3.0f;
-				setViewingMatrix();
-				setPerspective();
-			}
-			break;
-		case GLFW_KEY_T:
-			cur_trans_mode = GeoTranslation;
-			break;
-		case GLFW_KEY_S:
-			cur_trans_mode = GeoScaling;
-			break;
-		case GLFW_KEY_R:
-			cur_trans_mode = GeoRotation;
-			break;
-		case GLFW_KEY_E:
-			cur_trans_mode = ViewEye;
-			break;
-		case GLFW_KEY_C:
-			cur_trans_mode = ViewCenter;
-			break;
-		case GLFW_KEY_U:
-			cur_trans_mode = ViewUp;
-			break;
-		case GLFW_KEY_L:
-			lightSource += 1;
-			lightSource %= 3;
-			break;
-		case GLFW_KEY_K:
-			cur_trans_mode = LightEdit;
-			break;
-		case GLFW_KEY_J:
-			cur_trans_mode = ShininessEdit;
-			break;
-		case GLFW_KEY_G:
-			mag_filtering_mode = (mag_filtering_mode + 1) % 2;
-			break;
-		case GLFW_KEY_B:
-			min_filtering_mode = (min_filtering_mode + 1) % 2;
-			break;
-		case GLFW_KEY_RIGHT:
-			models[cur_idx].cur_eye_offset_idx += 1;
-			models[cur_idx].cur_eye_offset_idx %= models[cur_idx].max_eye_offset;
-			break;
-		case GLFW_KEY_LEFT:
-			models[cur_idx].cur_eye_offset_idx -= 1;
-			models[cur_idx].cur_eye_offset_idx += models[cur_idx].max_eye_offset;
-			models[cur_idx].cur_eye_offset_idx %= models[cur_idx].max_eye_offset;
-			break;
-		case GLFW_KEY_I:
-			cout << endl;
-			break;
-		case GLFW_KEY_H:
-			cout << "Z/X: switch the model" << endl;
-			cout << "O: switch to Orthogonal projection" << endl;
-			cout << "P: switch to NDC Perspective projection" << endl;
-			cout << "T: switch to translation mode" << endl;
-			cout << "S: switch to scale mode" << endl;
-			cout << "R: switch to rotation mode" << endl;
-			cout << "E: switch to translate eye position mode" << endl;
-			cout << "C: switch to translate viewing center position mode" << endl;
-			cout << "U: switch to translate camera up vector position mode" << endl;
-			cout << "L: switch between directional/point/spot light" << endl;
-			cout << "K: switch to light editing mode" << endl;
-			cout << "J: switch to shininess editing mode" << endl;
-			cout << "G: switch the magnification texture filtering mode between nearest / linear sampling" << endl;
-			cout << "B: switch the minification texture filtering mode between nearest / linear_mipmap_linear sampling" << endl;
-			cout << "->: change normal order (1-7)" << endl;
-			cout << "<-: change normal order (7-1)" << endl;
-			cout << endl;
-			break;
-		default:
-			break;
+			Shape& shape = models[idx].shapes[s];
+			if (shape.occluder_indices.empty())
+				continue;
+			occlusion_culler.addOccluder(model_matrix, &shape.occluder_positions[0], (int)shape.occluder_positions.size() / 3,
+				&shape.occluder_indices[0], (int)shape.occluder_indices.size());
 		}
 	}
+	occlusion_culler.rasterize(GetThreadPool());
+
+	// occluders are always drawn, everything else has to pass the depth test
+	visible_models.clear();
+	for (int i = 0; i < ranked.size(); i++)
+	{
+		int idx = ranked[i].second;
+		if (i < occluder_count || occlusion_culler.isVisible(scene_bvh.instanceBounds(idx)))
+			visible_models.push_back(idx);
+	}
+
+	static int frame = 0;
+	if (++frame % STATS_REPORT_INTERVAL == 0)
+	{
+		const OcclusionStats& stats = occlusion_culler.stats();
+		printf("Occlusion: %d occluders (%d triangles), culled %d / %d, raster %.3f ms, test %.3f ms\n",
+			stats.occluders, stats.occluder_triangles, stats.culled, stats.tested, stats.raster_ms, stats.test_ms);
+	}
 }
 
-void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+// fill visible_models once per frame, both views share the same camera
+void CullScene()
 {
-	// scroll up positive, otherwise it would be negtive
-	switch (cur_trans_mode)
+	// only the models whose bounds touch the view frustum are submitted
+	Matrix4 view_projection = project_matrix * view_matrix;
+	Frustum frustum = ExtractFrustum(view_projection);
+	visible_models.clear();
+	if (show_all_models) {
+		scene_bvh.queryFrustum(frustum, visible_models);
+	}
+	else if (FrustumIntersectsAABB(frustum, scene_bvh.instanceBounds(cur_idx))) {
+		visible_models.push_back(cur_idx);
+	}
+
+	if (occlusion_enabled && visible_models.size() >= 2)
+		CullOccludedModels(view_projection);
+
+	// both views and the depth pre-pass have to draw the same levels
+	for (int i = 0; i < visible_models.size(); i++)
+		SelectModelLOD(visible_models[i]);
+}
+
+void DrawModelDepth(int idx)
+{
+	model& m = models[idx];
+	glUniformMatrix4fv(depth_uniform.iLocModelMatrix, 1, GL_FALSE, GetGLModelMatrix(idx).get());
+
+	for (int i = 0; i < m.shapes.size(); i++)
 	{
-	case ViewEye:
-		main_camera.position.z -= 0.025 * (float)yoffset;
-		setViewingMatrix();
-		printf("Camera Position = ( %f , %f , %f )\n", main_camera.position.x, main_camera.position.y, main_camera.position.z);
-		break;
-	case ViewCenter:
-		main_camera.center.z += 0.1 * (float)yoffset;
-		setViewingMatrix();
-		printf("Camera Viewing Direction = ( %f , %f , %f )\n", main_camera.center.x, main_camera.center.y, main_camera.center.z);
-		break;
-	case ViewUp:
-		main_camera.up_vector.z += 0.33 * (float)yoffset;
-		setViewingMatrix();
-		printf("Camera Up Vector = ( %f , %f , %f )\n", main_camera.up_vector.x, main_camera.up_vector.y, main_camera.up_vector.z);
-		break;
-	case GeoTranslation:
-		models[cur_idx].position.z += 0.1 * (float)yoffset;
-		break;
-	case GeoScaling:
-		models[cur_idx].scale.z += 0.01 * (float)yoffset;
-		break;
-	case GeoRotation:
-		models[cur_idx].rotation.z += (acosf(-1.0f) / 180.0) * 5 * (float)yoffset;
-		break;
-	case LightEdit:
-		if (lightSource == DIRECTIONALLIGHT) {
-			directional_light.diffuse_intensity.x += (float)yoffset * 0.1;
-			directional_light.diffuse_intensity.y += (float)yoffset * 0.1;
-			directional_light.diffuse_intensity.z += (float)yoffset * 0.1;
+		// same level as DrawModel, otherwise GL_EQUAL would reject most fragments
+		if (m.shapes[i].cur_lod > 0) {
+			const ShapeLOD& lod = m.shapes[i].lods[m.shapes[i].cur_lod - 1];
+			glBindVertexArray(lod.depth_vao);
+			glDrawElements(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, 0);
+			frame_triangles += lod.indexCount / 3;
+		}
+		else {
+			glBindVertexArray(m.shapes[i].depth_vao);
+			glDrawArrays(GL_TRIANGLES, 0, m.shapes[i].vertex_count);
+			frame_triangles += m.shapes[i].vertex_count / 3;
 		}
-		else if (lightSource == POINTLIGHT) {
-			point_light.diffuse_intensity.x += (float)yoffset * 0.1;
-			point_light.diffuse_intensity.y += (float)yoffset * 0.1;
-			point_light.diffuse_intensity.z += (float)yoffset * 0.1;
+		frame_draw_calls++;
+	}
+}
+
+// scatter point and spot lights over the scene bounds, half of each kind
+void GenerateLightField(int count)
+{
+	point_lights.clear();
+	spot_lights.clear();
+
+	AABB bounds = scene_bvh.sceneBounds();
+	bounds.expand(bounds.min - Vector3(0.5f, 0.5f, 0.5f));
+	bounds.expand(bounds.max + Vector3(0.5f, 0.5f, 0.5f));
+	Vector3 extent = bounds.extent();
+
+	// fixed seed, the same field every time
+	unsigned int seed = 12345;
+	auto random = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / 16777216.0f;
+	};
+
+	for (int i = 0; i < count; i++)
+	{
+		Vector3 position(bounds.min.x + extent.x * random(), bounds.min.y + extent.y * random(), bounds.min.z + extent.z * random());
+		Vector3 color(random(), random(), random());
+		color /= max(max(color.x, color.y), max(color.z, 0.001f));
+		color *= 0.8f;
+
+		if (i % 2 == 0) {
+			PointLight light;
+			light.position = position;
+			light.diffuse_intensity = color;
+			light.specular_intensity = color;
+			light.ambient_intensity = Vector3(0, 0, 0);
+			light.constant = LIGHT_FIELD_CONSTANT;
+			light.linear = LIGHT_FIELD_LINEAR;
+			light.quadratic = LIGHT_FIELD_QUADRATIC;
+			point_lights.push_back(light);
 		}
-		else if (lightSource == SPOTLIGHT) {
-			spot_light.cutoff += (float)yoffset * 360 * 0.01;
+		else {
+			SpotLight light;
+			light.position = position;
+			light.direction = Vector3(random() - 0.5f, -1.0f, random() - 0.5f).normalize();
+			light.exponent = 10;
+			light.cutoff = 20 + 30 * random();
+			light.diffuse_intensity = color;
+			light.specular_intensity = color;
+			light.ambient_intensity = Vector3(0, 0, 0);
+			light.constant = LIGHT_FIELD_CONSTANT;
+			light.linear = LIGHT_FIELD_LINEAR;
+			light.quadratic = LIGHT_FIELD_QUADRATIC;
+			spot_lights.push_back(light);
 		}
-		break;
-	case ShininessEdit:
-		directional_light.shininess += (float)yoffset;
-		point_light.shininess += (float)yoffset;
-		spot_light.shininess += (float)yoffset;
-		break;
 	}
+	LOG_INFO("Clustered lights: %d point, %d spot, %dx%dx%d clusters", (int)point_lights.size(), (int)spot_lights.size(),
+		CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
 }
 
-void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+void InitLightClusters()
 {
-	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
-		mouse_pressed = true;
-	else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
-		mouse_pressed = false;
-		starting_press_x = -1;
-		starting_press_y = -1;
+	glGenBuffers(1, &cluster_buffers.light_buffer);
+	glGenBuffers(1, &cluster_buffers.grid_buffer);
+	glGenBuffers(1, &cluster_buffers.index_buffer);
+	glGenTextures(1, &cluster_buffers.light_texture);
+	glGenTextures(1, &cluster_buffers.grid_texture);
+	glGenTextures(1, &cluster_buffers.index_texture);
+
+	GLuint buffers[3] = { cluster_buffers.light_buffer, cluster_buffers.grid_buffer, cluster_buffers.index_buffer };
+	GLuint textures[3] = { cluster_buffers.light_texture, cluster_buffers.grid_texture, cluster_buffers.index_texture };
+	GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+	for (int i = 0; i < 3; i++)
+	{
+		// one dummy texel, so the samplers are complete before the first light is added
+		GLuint zero[4] = { 0, 0, 0, 0 };
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(zero), zero, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
 	}
-		
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// units 1-3 stay bound to the light clusters, unit 0 is the diffuse texture
+	for (int i = 0; i < 3; i++)
+	{
+		glActiveTexture(GL_TEXTURE1 + i);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
 }
 
-static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
+// move the lights to view space, assign them to clusters and upload the lists
+void UpdateLightClusters()
 {
-	if (mouse_pressed) {
-		if (starting_press_x < 0 || starting_press_y < 0) {
-			starting_press_x = (int)xpos;
-			starting_press_y = (int)ypos;
-		}
-		else {
-			float diff_x = starting_press_x - (int)xpos;
-			float diff_y = starting_press_y - (int)ypos;
-			starting_press_x = (int)xpos;
-			starting_press_y = (int)ypos;
-			switch (cur_trans_mode)
-			{
-			case ViewEye:
-				main_camera.position.x += diff_x * (1.0 / 400.0);
-				main_camera.position.y += diff_y * (1.0 / 400.0);
-				setViewingMatrix();
-				printf("Camera Position = ( %f , %f , %f )\n", main_camera.position.x, main_camera.position.y, main_camera.position.z);
-				break;
-			case ViewCenter:
-				main_camera.center.x += diff_x * (1.0 / 400.0);
-				main_camera.center.y -= diff_y * (1.0 / 400.0);
-				setViewingMatrix();
-				printf("Camera Viewing Direction = ( %f , %f , %f )\n", main_camera.center.x, main_camera.center.y, main_camera.center.z);
-				break;
-			case ViewUp:
-				main_camera.up_vector.x += diff_x * 0.1;
-				main_camera.up_vector.y += diff_y * 0.1;
-				setViewingMatrix();
-				printf("Camera Up Vector = ( %f , %f , %f )\n", main_camera.up_vector.x, main_camera.up_vector.y, main_camera.up_vector.z);
-				break;
-			case GeoTranslation:
-				models[cur_idx].position.x += -diff_x * (1.0 / 400.0);
-				models[cur_idx].position.y += diff_y * (1.0 / 400.0);
-				break;
-			case GeoScaling:
-				models[cur_idx].scale.x += diff_x * 0.001;
-				models[cur_idx].scale.y += diff_y * 0.001;
-				break;
-			case GeoRotation:
-				models[cur_idx].rotation.x += acosf(-1.0f) / 180.0*diff_y*(45.0 / 400.0);
-				models[cur_idx].rotation.y += acosf(-1.0f) / 180.0*diff_x*(45.0 / 400.0);
-				break;
-			case LightEdit:
-				if (lightSource == DIRECTIONALLIGHT) {
-					directional_light.position.x += (float)diff_x * (1.0 / 400.0);
-					directional_light.position.y += (float)-diff_y * (1.0 / 400.0);
-				}
-				else if (lightSource == POINTLIGHT) {
-					point_light.position.x += (float)diff_x * (1.0 / 400.0);
-					point_light.position.y += (float)-diff_y * (1.0 / 400.0);
-				}
-				else if (lightSource == SPOTLIGHT) {
-					spot_light.position.x += (float)diff_x * (1.0 / 400.0);
-					spot_light.position.y += (float)-diff_y * (1.0 / 400.0);
-				}
-				break;
-			}
-		}
-	}
-}
-
-void setShaders()
-{
-	GLuint v, f, p;
-	char *vs = NULL;
-	char *fs = NULL;
-
-	v = glCreateShader(GL_VERTEX_SHADER);
-	f = glCreateShader(GL_FRAGMENT_SHADER);
+	if (point_lights.empty() && spot_lights.empty())
+		return;
 
-	vs = textFileRead("shader.vs.glsl");
-	fs = textFileRead("shader.fs.glsl");
+	vector<LightSphere> spheres;
+	vector<GLfloat> data;
+	spheres.reserve(point_lights.size() + spot_lights.size());
+	data.reserve((point_lights.size() + spot_lights.size()) * CLUSTER_LIGHT_TEXELS * 4);
 
-	glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-	glShaderSource(f, 1, (const GLchar**)&fs, NULL);
-
-	free(vs);
-	free(fs);
-
-	GLint success;
-	char infoLog[1000];
-	// compile vertex shader
-	glCompileShader(v);
-	// check for shader compile errors
-	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
-	if (!success)
+	for (int i = 0; i < point_lights.size(); i++)
 	{
-		glGetShaderInfoLog(v, 1000, NULL, infoLog);
-		std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED\n" << infoLog << std::endl;
+		const PointLight& light = point_lights[i];
+		Vector4 p = view_matrix * Vector4(light.position.x, light.position.y, light.position.z, 1.0f);
+		float range = LightRange(light.diffuse_intensity + light.specular_intensity, light.constant, light.linear, light.quadratic, proj.farClip);
+		LightSphere sphere;
+		sphere.center = Vector3(p.x, p.y, p.z);
+		sphere.radius = range;
+		spheres.push_back(sphere);
+
+		GLfloat texels[CLUSTER_LIGHT_TEXELS * 4] = {
+			p.x, p.y, p.z, range,
+			0, 0, 0, -2,
+			light.constant, light.linear, light.quadratic, 0,
+			light.diffuse_intensity.x, light.diffuse_intensity.y, light.diffuse_intensity.z, light.shininess,
+			light.specular_intensity.x, light.specular_intensity.y, light.specular_intensity.z, 0,
+		};
+		data.insert(data.end(), texels, texels + CLUSTER_LIGHT_TEXELS * 4);
 	}
-
-	// compile fragment shader
-	glCompileShader(f);
-	// check for shader compile errors
-	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
-	if (!success)
+	for (int i = 0; i < spot_lights.size(); i++)
 	{
-		glGetShaderInfoLog(f, 1000, NULL, infoLog);
-		std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED\n" << infoLog << std::endl;
+		const SpotLight& light = spot_lights[i];
+		Vector4 p = view_matrix * Vector4(light.position.x, light.position.y, light.position.z, 1.0f);
+		Vector4 d = view_matrix * Vector4(light.direction.x, light.direction.y, light.direction.z, 0.0f);
+		Vector3 direction = Vector3(d.x, d.y, d.z).normalize();
+		float range = LightRange(light.diffuse_intensity + light.specular_intensity, light.constant, light.linear, light.quadratic, proj.farClip);
+		spheres.push_back(SpotLightBounds(Vector3(p.x, p.y, p.z), direction, range, light.cutoff));
+
+		GLfloat texels[CLUSTER_LIGHT_TEXELS * 4] = {
+			p.x, p.y, p.z, range,
+			direction.x, direction.y, direction.z, cosf(light.cutoff * (float)PI / 180.0f),
+			light.constant, light.linear, light.quadratic, light.exponent,
+			light.diffuse_intensity.x, light.diffuse_intensity.y, light.diffuse_intensity.z, light.shininess,
+			light.specular_intensity.x, light.specular_intensity.y, light.specular_intensity.z, 0,
+		};
+		data.insert(data.end(), texels, texels + CLUSTER_LIGHT_TEXELS * 4);
 	}
 
-	// create program object
-	p = glCreateProgram();
-
-	// attach shaders to program object
-	glAttachShader(p,f);
-	glAttachShader(p,v);
-
-	// link program
-	glLinkProgram(p);
-	// check for linking errors
-	glGetProgramiv(p, GL_LINK_STATUS, &success);
-	if (!success) {
-		glGetProgramInfoLog(p, 1000, NULL, infoLog);
-		std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n" << infoLog << std::endl;
+	light_clusters.setProjection(project_matrix, proj.nearClip, proj.farClip, cur_proj_mode == Perspective);
+	light_clusters.assign(spheres, GetThreadPool());
+
+	const vector<unsigned int>& grid = light_clusters.grid();
+	vector<unsigned int> indices = light_clusters.indices();
+	if (indices.empty())
+		indices.push_back(0);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_buffers.light_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, data.size() * sizeof(GLfloat), &data[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_buffers.grid_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, grid.size() * sizeof(GLuint), &grid[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, cluster_buffers.index_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	static int frame = 0;
+	if (++frame % STATS_REPORT_INTERVAL == 0)
+	{
+		const ClusterStats& stats = light_clusters.stats();
+		printf("Clusters: %d lights, %d / %d clusters lit, max %d per cluster, avg %.1f, assign %.3f ms\n",
+			stats.lights, stats.occupied_clusters, CLUSTER_COUNT, stats.max_lights_per_cluster,
+			stats.occupied_clusters ? (double)stats.index_count / stats.occupied_clusters : 0.0, stats.assign_ms);
 	}
+}
 
-	glDeleteShader(v);
-	glDeleteShader(f);
-
-	if (success)
-		glUseProgram(p);
-    else
-    {
-        system("pause");
-        exit(123);
-    }
-
-	program = p;
+void InitShadowMaps()
+{
+	const GLfloat border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };	// outside the map counts as lit
+
+	glGenTextures(1, &shadow_maps.cascade_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_maps.cascade_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	glGenTextures(1, &shadow_maps.spot_texture);
+	glBindTexture(GL_TEXTURE_2D, shadow_maps.spot_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+	glGenFramebuffers(1, &shadow_maps.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadow_maps.fbo);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// units 4 and 5 stay bound to the shadow maps
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_maps.cascade_texture);
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_2D, shadow_maps.spot_texture);
+	glActiveTexture(GL_TEXTURE0);
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, tinyobj::shape_t* shape)
+// models inside a light frustum, with the revisions the cache compares against
+void FindShadowCasters(const Matrix4& light_view_projection, vector<int>& casters, vector<unsigned int>& revisions)
 {
-	vector<float> xVector, yVector, zVector;
-	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+	Frustum frustum = ExtractFrustum(light_view_projection);
+	casters.clear();
+	revisions.clear();
+	if (show_all_models) {
+		scene_bvh.queryFrustum(frustum, casters);
+		sort(casters.begin(), casters.end());
+	}
+	else if (FrustumIntersectsAABB(frustum, scene_bvh.instanceBounds(cur_idx))) {
+		casters.push_back(cur_idx);
+	}
+	for (int i = 0; i < casters.size(); i++)
+		revisions.push_back(models[casters[i]].revision);
+}
 
-	// find out min and max value of X, Y and Z axis
-	for (int i = 0; i < attrib->vertices.size(); i++)
+// depth of the casters at full resolution, LOD levels follow the camera and would invalidate the cache
+void RenderShadowPass(Matrix4 light_view_projection, const vector<int>& casters)
+{
+	// row-major matrices computed once per pass go up with GL_TRUE, GL transposes them on upload
+	glUniformMatrix4fv(depth_uniform.iLocViewMatrix, 1, GL_TRUE, light_view_projection.get());
+	glUniformMatrix4fv(depth_uniform.iLocProjectionMatrix, 1, GL_FALSE, GLMatrix4().get());
+	glClear(GL_DEPTH_BUFFER_BIT);
+	for (int c = 0; c < casters.size(); c++)
 	{
-		//maxs = max(maxs, attrib->vertices.at(i));
-		if (i % 3 == 0)
+		model& m = models[casters[c]];
+		glUniformMatrix4fv(depth_uniform.iLocModelMatrix, 1, GL_FALSE, GetGLModelMatrix(casters[c]).get());
+		for (int i = 0; i < m.shapes.size(); i++)
 		{
+			glBindVertexArray(m.shapes[i].depth_vao);
+			glDrawArrays(GL_TRIANGLES, 0, m.shapes[i].vertex_count);
+			frame_triangles += m.shapes[i].vertex_count / 3;
+			frame_draw_calls++;
+		}
+	}
+}
 
-			xVector.push_back(attrib->vertices.at(i));
-
-			if (attrib->vertices.at(i) < minX)
-			{
-				minX = attrib->vertices.at(i);
-			}
+// re-render only the shadow maps whose light, casters or cascade fit changed
+void UpdateShadowMaps()
+{
+	if (!shadows_enabled)
+		return;
+
+	vector<int> casters;
+	vector<unsigned int> revisions;
+	bool bound = false;
+	auto begin_pass = [&bound]() {
+		if (bound)
+			return;
+		glBindFramebuffer(GL_FRAMEBUFFER, shadow_maps.fbo);
+		glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+		glUseProgram(depth_program);
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(2.0f, 4.0f);
+		bound = true;
+	};
 
-			if (attrib->vertices.at(i) > maxX)
-			{
-				maxX = attrib->vertices.at(i);
+	if (lightSource == DIRECTIONALLIGHT && directional_light.position.length() > 0.0f) {
+		FitShadowCascades(view_matrix, project_matrix, proj.nearClip, proj.farClip, -directional_light.position, scene_bvh.sceneBounds(), shadow_cascades);
+		for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			FindShadowCasters(shadow_cascades.view_projection[i], casters, revisions);
+			if (!cascade_caches[i].update(shadow_cascades.view_projection[i], casters, revisions)) {
+				shadow_passes_skipped++;
+				continue;
 			}
+			begin_pass();
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_maps.cascade_texture, 0, i);
+			RenderShadowPass(shadow_cascades.view_projection[i], casters);
+			shadow_passes_rendered++;
 		}
-		else if (i % 3 == 1)
-		{
-			yVector.push_back(attrib->vertices.at(i));
+	}
+	else if (lightSource == SPOTLIGHT) {
+		float range = LightRange(spot_light.diffuse_intensity + spot_light.specular_intensity, spot_light.constant, spot_light.linear, spot_light.quadratic, proj.farClip);
+		spot_shadow_matrix = SpotShadowMatrix(spot_light.position, spot_light.direction, spot_light.cutoff, range);
+		FindShadowCasters(spot_shadow_matrix, casters, revisions);
+		if (!spot_shadow_cache.update(spot_shadow_matrix, casters, revisions)) {
+			shadow_passes_skipped++;
+		}
+		else {
+			begin_pass();
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_maps.spot_texture, 0);
+			RenderShadowPass(spot_shadow_matrix, casters);
+			shadow_passes_rendered++;
+		}
+	}
 
-			if (attrib->vertices.at(i) < minY)
-			{
-				minY = attrib->vertices.at(i);
-			}
+	if (bound) {
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glUseProgram(program);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
 
-			if (attrib->vertices.at(i) > maxY)
-			{
-				maxY = attrib->vertices.at(i);
-			}
-		}
-		else if (i % 3 == 2)
-		{
-			zVector.push_back(attrib->vertices.at(i));
+	static int frame = 0;
+	if (++frame % STATS_REPORT_INTERVAL == 0 && shadow_passes_rendered + shadow_passes_skipped > 0)
+	{
+		printf("Shadows: %d passes rendered, %d skipped (%.1f%% cached)\n", shadow_passes_rendered, shadow_passes_skipped,
+			100.0 * shadow_passes_skipped / (shadow_passes_rendered + shadow_passes_skipped));
+		shadow_passes_rendered = 0;
+		shadow_passes_skipped = 0;
+	}
+}
 
-			if (attrib->vertices.at(i) < minZ)
-			{
-				minZ = attrib->vertices.at(i);
-			}
+// lay down the depth of the visible models so the shading pass only runs the final fragments
+void RenderDepthPrepass()
+{
+	glUseProgram(depth_program);
+	glUniformMatrix4fv(depth_uniform.iLocViewMatrix, 1, GL_TRUE, view_matrix.get());
+	glUniformMatrix4fv(depth_uniform.iLocProjectionMatrix, 1, GL_TRUE, project_matrix.get());
 
-			if (attrib->vertices.at(i) > maxZ)
-			{
-				maxZ = attrib->vertices.at(i);
-			}
-		}
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	for (int i = 0; i < visible_models.size(); i++)
+	{
+		DrawModelDepth(visible_models[i]);
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	glUseProgram(program);
+}
+
+// Render function for display rendering
+void RenderScene(int per_vertex_or_per_pixel) {	
+	bool prepass = depth_prepass_enabled && per_vertex_or_per_pixel == PERPIXELLIGHTING;
+	if (prepass) {
+		PROFILE_GPU_SCOPE("Depth pre-pass");
+		RenderDepthPrepass();
 	}
-	
-	float offsetX = (maxX + minX) / 2;
-	float offsetY = (maxY + minY) / 2;
-	float offsetZ = (maxZ + minZ) / 2;
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
 	{
-		if (offsetX != 0 && i % 3 == 0)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
-		}
-		else if (offsetY != 0 && i % 3 == 1)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+		PROFILE_GPU_SCOPE("Upload uniforms");
+		glUniform1i(uniform.iLocLightSource, lightSource);
+		glUniform1i(uniform.iLocLightingMode, per_vertex_or_per_pixel);
+
+		glUniformMatrix4fv(uniform.iLocViewMatrix, 1, GL_TRUE, view_matrix.get());
+		glUniformMatrix4fv(uniform.iLocProjectionMatrix, 1, GL_TRUE, project_matrix.get());
+
+		glUniform3f(uniform.iLocDirectionalPosition, directional_light.position.x, directional_light.position.y, directional_light.position.z);
+		glUniform3f(uniform.iLocDirectionalDirection, directional_light.direction.x, directional_light.direction.y, directional_light.direction.z);
+		glUniform3f(uniform.iLocDirectionalAmbientIntensity, directional_light.ambient_intensity.x, directional_light.ambient_intensity.y, directional_light.ambient_intensity.z);
+		glUniform3f(uniform.iLocDirectionalDiffuseIntensity, directional_light.diffuse_intensity.x, directional_light.diffuse_intensity.y, directional_light.diffuse_intensity.z);
+		glUniform3f(uniform.iLocDirectionalSpecularIntensity, directional_light.specular_intensity.x, directional_light.specular_intensity.y, directional_light.specular_intensity.z);
+		glUniform1f(uniform.iLocDirectionalShininess, directional_light.shininess);
+
+		glUniform3f(uniform.iLocPointPosition, point_light.position.x, point_light.position.y, point_light.position.z);
+		glUniform3f(uniform.iLocPointAmbientIntensity, point_light.ambient_intensity.x, point_light.ambient_intensity.y, point_light.ambient_intensity.z);
+		glUniform3f(uniform.iLocPointDiffuseIntensity, point_light.diffuse_intensity.x, point_light.diffuse_intensity.y, point_light.diffuse_intensity.z);
+		glUniform3f(uniform.iLocPointSpecularIntensity, point_light.specular_intensity.x, point_light.specular_intensity.y, point_light.specular_intensity.z);
+		glUniform1f(uniform.iLocPointShininess, point_light.shininess);
+		glUniform1f(uniform.iLocPointConstant, point_light.constant);
+		glUniform1f(uniform.iLocPointLinear, point_light.linear);
+		glUniform1f(uniform.iLocPointQuadratic, point_light.quadratic);
+
+		glUniform3f(uniform.iLocSpotPosition, spot_light.position.x, spot_light.position.y, spot_light.position.z);
+		glUniform3f(uniform.iLocSpotDirection, spot_light.direction.x, spot_light.direction.y, spot_light.direction.z);
+		glUniform1f(uniform.iLocSpotExponent, spot_light.exponent);
+		glUniform1f(uniform.iLocSpotCutoff, spot_light.cutoff);
+		glUniform3f(uniform.iLocSpotAmbientIntensity, spot_light.ambient_intensity.x, spot_light.ambient_intensity.y, spot_light.ambient_intensity.z);
+		glUniform3f(uniform.iLocSpotDiffuseIntensity, spot_light.diffuse_intensity.x, spot_light.diffuse_intensity.y, spot_light.diffuse_intensity.z);
+		glUniform3f(uniform.iLocSpotSpecularIntensity, spot_light.specular_intensity.x, spot_light.specular_intensity.y, spot_light.specular_intensity.z);
+		glUniform1f(uniform.iLocSpotShininess, spot_light.shininess);
+		glUniform1f(uniform.iLocSpotConstant, spot_light.constant);
+		glUniform1f(uniform.iLocSpotLinear, spot_light.linear);
+		glUniform1f(uniform.iLocSpotQuadratic, spot_light.quadratic);
+
+		glUniform3f(uniform.iLocCameraPosition, main_camera.position.x, main_camera.position.y, main_camera.position.z);
+
+		bool clustered = !point_lights.empty() || !spot_lights.empty();
+		glUniform1i(uniform.iLocClusteredLighting, clustered ? 1 : 0);
+
+		bool shadowed = shadows_enabled && ((lightSource == DIRECTIONALLIGHT && cascade_caches[0].valid) || (lightSource == SPOTLIGHT && spot_shadow_cache.valid));
+		glUniform1i(uniform.iLocShadowsEnabled, shadowed ? 1 : 0);
+		if (shadowed) {
+			GLfloat cascade_matrices[SHADOW_CASCADE_COUNT * 16];
+			for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+				memcpy(&cascade_matrices[i * 16], shadow_cascades.view_projection[i].get(), 16 * sizeof(GLfloat));
+			glUniformMatrix4fv(uniform.iLocCascadeMatrices, SHADOW_CASCADE_COUNT, GL_TRUE, cascade_matrices);
+			glUniform3f(uniform.iLocCascadeSplits, shadow_cascades.split_depth[0], shadow_cascades.split_depth[1], shadow_cascades.split_depth[2]);
+			glUniformMatrix4fv(uniform.iLocSpotShadowMatrix, 1, GL_TRUE, spot_shadow_matrix.get());
 		}
-		else if (offsetZ != 0 && i % 3 == 2)
-		{
-			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+		if (clustered) {
+			GLint viewport[4];
+			glGetIntegerv(GL_VIEWPORT, viewport);
+			glUniform4f(uniform.iLocClusterViewport, (GLfloat)viewport[0], (GLfloat)viewport[1], (GLfloat)viewport[2], (GLfloat)viewport[3]);
+			glUniform3i(uniform.iLocClusterDims, CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES);
+			glUniform2f(uniform.iLocClusterDepthParams, light_clusters.depthScale(), light_clusters.depthBias());
+			glUniform1i(uniform.iLocClusterLogDepth, light_clusters.logDepth() ? 1 : 0);
 		}
 	}
 
-	float greatestAxis = maxX - minX;
-	float distanceOfYAxis = maxY - minY;
-	float distanceOfZAxis = maxZ - minZ;
+	if (prepass) {
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+	if (shading_samples_query)
+		glBeginQuery(GL_SAMPLES_PASSED, shading_samples_query);
 
-	if (distanceOfYAxis > greatestAxis)
+	for (int i = 0; i < visible_models.size(); i++)
 	{
-		greatestAxis = distanceOfYAxis;
+		PROFILE_GPU_SCOPE("Draw model");
+		DrawModel(visible_models[i]);
 	}
 
-	if (distanceOfZAxis > greatestAxis)
-	{
-		greatestAxis = distanceOfZAxis;
+	if (shading_samples_query)
+		glEndQuery(GL_SAMPLES_PASSED);
+	if (prepass) {
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
 	}
+}
 
-	float scale = greatestAxis / 2;
+// draw the per-pixel view with and without the depth pre-pass and compare the shaded fragments
+void BenchmarkDepthPrepass()
+{
+	GLuint queries[2];
+	glGenQueries(2, queries);
+	bool saved_prepass = depth_prepass_enabled;
+	GLuint64 samples[2] = { 0, 0 }, nanoseconds[2] = { 0, 0 };
 
-	for (int i = 0; i < attrib->vertices.size(); i++)
+	glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+	for (int mode = 0; mode < 2; mode++)
 	{
-		//std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
-		attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
+		depth_prepass_enabled = mode == 1;
+		for (int f = 0; f < DEPTH_PREPASS_BENCHMARK_FRAMES; f++)
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+			shading_samples_query = queries[0];
+			RenderScene(PERPIXELLIGHTING);
+			shading_samples_query = 0;
+			uniform_ring.endFrame();
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 value;
+			glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &value);
+			samples[mode] += value;
+			glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &value);
+			nanoseconds[mode] += value;
+		}
 	}
-	size_t index_offset = 0;
-	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
-		int fv = shape->mesh.num_face_vertices[f];
+	depth_prepass_enabled = saved_prepass;
+	glDeleteQueries(2, queries);
 
-		// Loop over vertices in the face.
-		for (size_t v = 0; v < fv; v++) {
-			// access to vertex
-			tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
-			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
-			// Optional: vertex colors
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
-			colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
-			// Optional: vertex normals
-			normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
-			normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
-			normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
-			// Optional: texture coordinate
-			textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 0]);
-			textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 1]);
-			// The material of this vertex
-			material_id.push_back(shape->mesh.material_ids[f]);
-		}
-		index_offset += fv;
+	printf("Depth pre-pass benchmark, %d frames of the per-pixel view:\n", DEPTH_PREPASS_BENCHMARK_FRAMES);
+	for (int mode = 0; mode < 2; mode++)
+	{
+		printf("  pre-pass %-3s: %10.0f fragments shaded, %.3f ms GPU per frame\n", mode ? "on" : "off",
+			(double)samples[mode] / DEPTH_PREPASS_BENCHMARK_FRAMES, nanoseconds[mode] / 1e6 / DEPTH_PREPASS_BENCHMARK_FRAMES);
 	}
+	if (samples[0] > 0 && samples[1] > 0)
+		printf("  shaded fragments -%.1f%%, depth complexity %.2f\n", 100.0 * (1.0 - (double)samples[1] / samples[0]), (double)samples[0] / samples[1]);
 }
 
-static string GetBaseDir(const string& filepath) {
-	if (filepath.find_last_of("/\\") != std::string::npos)
-		return filepath.substr(0, filepath.find_last_of("/\\"));
-	return "";
+// the render-side state the callbacks start editing from, once setupRC is done
+void CaptureSnapshot(FrameSnapshot& s)
+{
+	s.main_camera = main_camera;
+	s.proj = proj;
+	s.cur_proj_mode = cur_proj_mode;
+	s.directional_light = directional_light;
+	s.point_light = point_light;
+	s.spot_light = spot_light;
+	s.lightSource = lightSource;
+	s.mag_filtering_mode = mag_filtering_mode;
+	s.min_filtering_mode = min_filtering_mode;
+	s.cur_idx = cur_idx;
+	s.light_field_size_idx = light_field_size_idx;
+	s.lod_enabled = lod_enabled;
+	s.occlusion_enabled = occlusion_enabled;
+	s.depth_prepass_enabled = depth_prepass_enabled;
+	s.shadows_enabled = shadows_enabled;
+	s.show_all_models = show_all_models;
+	s.screenWidth = screenWidth;
+	s.screenHeight = screenHeight;
+	s.scene_revision = scene_revision;
+	s.models.resize(models.size());
+	for (int i = 0; i < models.size(); i++)
+	{
+		s.models[i].position = models[i].position;
+		s.models[i].scale = models[i].scale;
+		s.models[i].rotation = models[i].rotation;
+		s.models[i].max_eye_offset = models[i].max_eye_offset;
+		s.models[i].cur_eye_offset_idx = models[i].cur_eye_offset_idx;
+	}
 }
 
-GLuint LoadTextureImage(string image_path)
+// render thread: bring the globals up to a snapshot, redoing only the derived state that changed
+void ApplySnapshot(const FrameSnapshot& s)
 {
-	int channel, width, height;
-	int require_channel = 4;
-	stbi_set_flip_vertically_on_load(true);
-	stbi_uc *data = stbi_load(image_path.c_str(), &width, &height, &channel, require_channel);
-	if (data != NULL)
+	main_camera = s.main_camera;
+	proj = s.proj;
+	setViewingMatrix();
+	if (s.cur_proj_mode == Perspective)
+		setPerspective();
+	else
+		setOrthogonal();
+	directional_light = s.directional_light;
+	point_light = s.point_light;
+	spot_light = s.spot_light;
+	lightSource = s.lightSource;
+	mag_filtering_mode = s.mag_filtering_mode;
+	min_filtering_mode = s.min_filtering_mode;
+	lod_enabled = s.lod_enabled;
+	occlusion_enabled = s.occlusion_enabled;
+	depth_prepass_enabled = s.depth_prepass_enabled;
+	shadows_enabled = s.shadows_enabled;
+	screenWidth = s.screenWidth;
+	screenHeight = s.screenHeight;
+
+	// a snapshot published for a scene reload the render thread has not run yet, the models keep their state until it has
+	bool same_scene = s.scene_revision == scene_revision;
+	if (same_scene)
+		cur_idx = s.cur_idx;
+	bool layout_changed = s.show_all_models != show_all_models;
+	for (int i = 0; same_scene && i < models.size() && i < s.models.size(); i++)
 	{
-		GLuint tex = 0;
+		const ModelState& src = s.models[i];
+		model& m = models[i];
+		m.cur_eye_offset_idx = src.cur_eye_offset_idx;
+		if (m.position == src.position && m.scale == src.scale && memcmp(&m.rotation, &src.rotation, sizeof(Quaternion)) == 0)
+			continue;
+		m.position = src.position;
+		m.scale = src.scale;
+		m.rotation = src.rotation;
+		// a new layout rebuilds the whole BVH below
+		if (!layout_changed)
+			UpdateModelBounds(i);
+	}
+	if (layout_changed) {
+		show_all_models = s.show_all_models;
+		if (show_all_models)
+			LayoutSceneModels();
+		BuildSceneBVH();
+		LOG_INFO("Show all models: %s (BVH depth %d)", show_all_models ? "on" : "off", scene_bvh.depth());
+	}
+	if (s.light_field_size_idx != light_field_size_idx || (layout_changed && LIGHT_FIELD_SIZES[s.light_field_size_idx] > 0)) {
+		light_field_size_idx = s.light_field_size_idx;
+		GenerateLightField(LIGHT_FIELD_SIZES[light_field_size_idx]);
+	}
+}
 
-		// [TODO] Bind the image to texture
-		// Hint: glGenTextures, glBindTexture, glTexImage2D, glGenerateMipmap
-		glGenTextures(1, &tex);
-		glBindTexture(GL_TEXTURE_2D, tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+// main thread: hand the edited input over to the render thread
+void PublishInput()
+{
+	frame_snapshots.writeBuffer() = input;
+	frame_snapshots.publish();
+	input_changed = false;
+	GetFramePacer().requestRedraw();
+}
 
-		// free the image from memory after binding to texture
-		stbi_image_free(data);
-		return tex;
-	}
-	else
-	{
-		cout << "LoadTextureImage: Cannot load image from " << image_path << endl;
-		return -1;
+void PushRenderCommand(RenderCommand::Type type, float x = 0.0f, float y = 0.0f, int width = 0, int height = 0)
+{
+	RenderCommand command;
+	command.type = type;
+	command.x = x;
+	command.y = y;
+	command.width = width;
+	command.height = height;
+	if (!render_commands.push(command)) {
+		LOG_WARN("Render command queue full, command %d dropped", (int)type);
+		return;
 	}
+	GetFramePacer().requestRedraw();
 }
 
-vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<PhongMaterial>& materials)
+// render thread, returns whether there was any command
+bool RunRenderCommands()
 {
-	vector<Shape> res;
-	for (int m = 0; m < materials.size(); m++)
+	RenderCommand command;
+	bool any = false;
+	while (render_commands.pop(command))
 	{
-		vector<GLfloat> m_vertices, m_colors, m_normals, m_textureCoords;
-		for (int v = 0; v < material_id.size(); v++) 
+		any = true;
+		switch (command.type)
 		{
-			// extract all vertices with same material id and create a new shape for it.
-			if (material_id[v] == m)
-			{
-				m_vertices.push_back(vertices[v * 3 + 0]);
-				m_vertices.push_back(vertices[v * 3 + 1]);
-				m_vertices.push_back(vertices[v * 3 + 2]);
-
-				m_colors.push_back(colors[v * 3 + 0]);
-				m_colors.push_back(colors[v * 3 + 1]);
-				m_colors.push_back(colors[v * 3 + 2]);
-
-				m_normals.push_back(normals[v * 3 + 0]);
-				m_normals.push_back(normals[v * 3 + 1]);
-				m_normals.push_back(normals[v * 3 + 2]);
-
-				m_textureCoords.push_back(textureCoords[v * 2 + 0]);
-				m_textureCoords.push_back(textureCoords[v * 2 + 1]);
+		case RenderCommand::Pick:
+		{
+			int hit = PickModel(command.x, command.y, command.width, command.height);
+			if (hit >= 0) {
+				// the main thread owns the selection, wake it to take the result
+				picked_model.store(hit);
+				glfwPostEmptyEvent();
 			}
+			break;
 		}
+		case RenderCommand::DepthPrepassBenchmark:
+			BenchmarkDepthPrepass();
+			break;
+		case RenderCommand::ProfilerToggle:
+			GetProfiler().setEnabled(!GetProfiler().enabled());
+			LOG_INFO("Profiler: %s", GetProfiler().enabled() ? "on" : "off");
+			break;
+		case RenderCommand::TraceToggle:
+			if (!GetProfiler().tracing()) {
+				GetProfiler().setEnabled(true);
+				GetProfiler().startTrace();
+				LOG_INFO("Profiler: recording a trace, press W again to stop");
+			}
+			else if (GetProfiler().stopTrace(PROFILER_TRACE_FILE))
+				LOG_INFO("Profiler: trace written to %s", PROFILER_TRACE_FILE);
+			else
+				LOG_INFO("Profiler: cannot write %s", PROFILER_TRACE_FILE);
+			break;
+		case RenderCommand::RenderModeToggle:
+			GetFramePacer().setMode(GetFramePacer().mode() == OnDemandRendering ? ContinuousRendering : OnDemandRendering);
+			LOG_INFO("Rendering: %s", GetFramePacer().mode() == OnDemandRendering ? "on demand" : "continuous");
+			break;
+		case RenderCommand::CaptureToggle:
+			if (frame_capture.active())
+				frame_capture.stop();
+			else
+				frame_capture.start(capture_file, screenWidth, screenHeight);
+			break;
+		}
+	}
+	return any;
+}
+
+// main thread: read the scene file again and carry what changed over to input, the models only go
+// to the render thread when one was added, removed or reordered; edits made in the window survive
+// unless the file changed the same thing
+void ReloadScene()
+{
+	Scene next;
+	if (!LoadScene(scene_file, next)) {
+		LOG_WARN("Scene: keeping the current scene");
+		return;
+	}
+	if (next.models.empty()) {
+		LOG_ERROR("Scene: %s has no models, keeping the current scene", scene_file);
+		return;
+	}
+	// LoadTexturedModels gives up on the whole process, not just the model
+	for (const SceneModel& m : next.models)
+	{
+		if (!ifstream(m.path)) {
+			LOG_ERROR("Scene: cannot open %s, keeping the current scene", m.path);
+			return;
+		}
+	}
+	SceneDiff diff = DiffScenes(input_scene, next);
+
+	vector<ModelState> states(next.models.size());
+	model defaults;
+	int next_idx = 0;
+	for (int i = 0; i < next.models.size(); i++)
+	{
+		ModelState& state = states[i];
+		int source = diff.source[i];
+		if (source >= 0) {
+			state = input.models[source];
+			if (source == input.cur_idx)
+				next_idx = i;
+		}
+		else {
+			state.max_eye_offset = defaults.max_eye_offset;
+			state.cur_eye_offset_idx = defaults.cur_eye_offset_idx;
+		}
+		if (source < 0 || diff.moved[i]) {
+			state.position = next.models[i].position;
+			state.rotation = next.models[i].rotation;
+			state.scale = next.models[i].scale;
+		}
+	}
+	input.models.swap(states);
+	input.cur_idx = next_idx;
+
+	if (diff.lights_changed) {
+		input.directional_light = next.directional_light;
+		input.point_light = next.point_light;
+		input.spot_light = next.spot_light;
+		input.lightSource = next.light_source;
+	}
+	if (diff.camera_changed)
+		input.main_camera = next.main_camera;
+	if (diff.projection_changed) {
+		GLfloat aspect = input.proj.aspect;
+		input.proj = next.proj;
+		input.proj.aspect = aspect;
+		input.cur_proj_mode = next.perspective ? Perspective : Orthogonal;
+	}
+	if (diff.layoutChanged()) {
+		input.scene_revision++;
+		lock_guard<mutex> lock(pending_scene_mutex);
+		pending_scene = next;
+		pending_scene_revision = input.scene_revision;
+	}
+	input_scene = next;
+	input_changed = true;
+	LOG_INFO("Scene: reloaded %s, %d models kept (%d moved), %d loaded, %d removed%s%s%s", scene_file, diff.kept, diff.moved_count,
+		diff.loaded, (int)diff.removed.size(), diff.lights_changed ? ", lights changed" : "",
+		diff.camera_changed ? ", camera changed" : "", diff.projection_changed ? ", projection changed" : "");
+}
+
+// Call back function for keyboard
+void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	if (action == GLFW_PRESS) {
+		input_changed = true;
+		switch (key)
+		{
+		case GLFW_KEY_ESCAPE:
+			// the render thread has to be joined before the process goes away
+			glfwSetWindowShouldClose(window, GLFW_TRUE);
+			break;
+		case GLFW_KEY_Z:
+			input.cur_idx = (input.cur_idx + 1) % input.models.size();
+			break;
+		case GLFW_KEY_X:
+			input.cur_idx = (input.cur_idx - 1 + input.models.size()) % input.models.size();
+			break;
+		case GLFW_KEY_O:
+			if (input.cur_proj_mode == Perspective)
+			{
+				input.proj.farClip -= 3.0f;
+				input.cur_proj_mode = Orthogonal;
+			}
+			break;
+		case GLFW_KEY_P:
+			if (input.cur_proj_mode == Orthogonal)
+			{
+				input.proj.farClip += 3.0f;
+				input.cur_proj_mode = Perspective;
+			}
+			break;
+		case GLFW_KEY_T:
+			cur_trans_mode = GeoTranslation;
+			break;
+		case GLFW_KEY_S:
+			cur_trans_mode = GeoScaling;
+			break;
+		case GLFW_KEY_R:
+			cur_trans_mode = GeoRotation;
+			break;
+		case GLFW_KEY_E:
+			cur_trans_mode = ViewEye;
+			break;
+		case GLFW_KEY_C:
+			cur_trans_mode = ViewCenter;
+			break;
+		case GLFW_KEY_U:
+			cur_trans_mode = ViewUp;
+			break;
+		case GLFW_KEY_L:
+			input.lightSource += 1;
+			input.lightSource %= 3;
+			break;
+		case GLFW_KEY_K:
+			cur_trans_mode = LightEdit;
+			break;
+		case GLFW_KEY_J:
+			cur_trans_mode = ShininessEdit;
+			break;
+		case GLFW_KEY_G:
+			input.mag_filtering_mode = (input.mag_filtering_mode + 1) % 2;
+			break;
+		case GLFW_KEY_B:
+			input.min_filtering_mode = (input.min_filtering_mode + 1) % 2;
+			break;
+		case GLFW_KEY_Q:
+			input.lod_enabled = !input.lod_enabled;
+			LOG_INFO("Level of detail: %s", input.lod_enabled ? "on" : "off");
+			break;
+		case GLFW_KEY_V:
+			input.occlusion_enabled = !input.occlusion_enabled;
+			LOG_INFO("Occlusion culling: %s", input.occlusion_enabled ? "on" : "off");
+			break;
+		case GLFW_KEY_A:
+			PushRenderCommand(RenderCommand::ProfilerToggle);
+			break;
+		case GLFW_KEY_W:
+			PushRenderCommand(RenderCommand::TraceToggle);
+			break;
+		case GLFW_KEY_D:
+			input.depth_prepass_enabled = !input.depth_prepass_enabled;
+			LOG_INFO("Depth pre-pass: %s", input.depth_prepass_enabled ? "on" : "off");
+			break;
+		case GLFW_KEY_Y:
+			PushRenderCommand(RenderCommand::DepthPrepassBenchmark);
+			break;
+		case GLFW_KEY_F:
+			input.shadows_enabled = !input.shadows_enabled;
+			LOG_INFO("Shadows: %s", input.shadows_enabled ? "on" : "off");
+			break;
+		case GLFW_KEY_N:
+			input.light_field_size_idx = (input.light_field_size_idx + 1) % LIGHT_FIELD_SIZE_COUNT;
+			break;
+		case GLFW_KEY_M:
+			input.show_all_models = !input.show_all_models;
+			break;
+		case GLFW_KEY_F1:
+			PushRenderCommand(RenderCommand::RenderModeToggle);
+			break;
+		case GLFW_KEY_F2:
+			PushRenderCommand(RenderCommand::CaptureToggle);
+			break;
+		case GLFW_KEY_F5:
+			ReloadScene();
+			break;
+		case GLFW_KEY_RIGHT:
+			input.models[input.cur_idx].cur_eye_offset_idx += 1;
+			input.models[input.cur_idx].cur_eye_offset_idx %= input.models[input.cur_idx].max_eye_offset;
+			break;
+		case GLFW_KEY_LEFT:
+			input.models[input.cur_idx].cur_eye_offset_idx -= 1;
+			input.models[input.cur_idx].cur_eye_offset_idx += input.models[input.cur_idx].max_eye_offset;
+			input.models[input.cur_idx].cur_eye_offset_idx %= input.models[input.cur_idx].max_eye_offset;
+			break;
+		case GLFW_KEY_I:
+			LOG_INFO("");
+			break;
+		case GLFW_KEY_H:
+			LOG_INFO("Z/X: switch the model");
+			LOG_INFO("O: switch to Orthogonal projection");
+			LOG_INFO("P: switch to NDC Perspective projection");
+			LOG_INFO("T: switch to translation mode");
+			LOG_INFO("S: switch to scale mode");
+			LOG_INFO("R: switch to rotation mode (drag turns an arcball, scroll spins about z)");
+			LOG_INFO("E: switch to translate eye position mode");
+			LOG_INFO("C: switch to translate viewing center position mode");
+			LOG_INFO("U: switch to translate camera up vector position mode");
+			LOG_INFO("L: switch between directional/point/spot light");
+			LOG_INFO("K: switch to light editing mode");
+			LOG_INFO("J: switch to shininess editing mode");
+			LOG_INFO("G: switch the magnification texture filtering mode between nearest / linear sampling");
+			LOG_INFO("B: switch the minification texture filtering mode between nearest / linear_mipmap_linear sampling");
+			LOG_INFO("Q: toggle automatic level of detail");
+			LOG_INFO("M: show all models in a grid, culled through the scene BVH");
+			LOG_INFO("V: toggle software occlusion culling of the models shown");
+			LOG_INFO("D: toggle the depth pre-pass of the per-pixel lighting view");
+			LOG_INFO("Y: benchmark the per-pixel lighting view with and without the depth pre-pass");
+			LOG_INFO("F: toggle cached shadow maps of the directional (cascaded) and spot light");
+			LOG_INFO("N: cycle the number of clustered point/spot lights in the per-pixel view (0, 128, 512)");
+			LOG_INFO("A: toggle the CPU/GPU frame profiler, p50/p95/p99 per scope are printed periodically");
+			LOG_INFO("W: start/stop recording a Chrome trace (chrome://tracing) of the profiled scopes");
+			LOG_INFO("F1: switch between continuous and on-demand rendering (redraw only on changes, CPU usage is reported)");
+			LOG_INFO("F2: start/stop recording the window to %s (.y4m stream, otherwise a PNG sequence)", capture_file);
+			LOG_INFO("F5: reload %s, only models that were added are loaded (saving the file reloads it too)", scene_file);
+			LOG_INFO("Right click: pick the model under the cursor when all models are shown");
+			LOG_INFO("->: change normal order (1-7)");
+			LOG_INFO("<-: change normal order (7-1)");
+			LOG_INFO("");
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+	input_changed = true;
+	// scroll up positive, otherwise it would be negtive
+	switch (cur_trans_mode)
+	{
+	case ViewEye:
+		input.main_camera.position.z -= 0.025 * (float)yoffset;
+		LOG_EVERY(LOG_LEVEL_INFO, CAMERA_LOG_INTERVAL_MS, "Camera Position = ( %f , %f , %f )", input.main_camera.position.x, input.main_camera.position.y, input.main_camera.position.z);
+		break;
+	case ViewCenter:
+		input.main_camera.center.z += 0.1 * (float)yoffset;
+		LOG_EVERY(LOG_LEVEL_INFO, CAMERA_LOG_INTERVAL_MS, "Camera Viewing Direction = ( %f , %f , %f )", input.main_camera.center.x, input.main_camera.center.y, input.main_camera.center.z);
+		break;
+	case ViewUp:
+		input.main_camera.up_vector.z += 0.33 * (float)yoffset;
+		LOG_EVERY(LOG_LEVEL_INFO, CAMERA_LOG_INTERVAL_MS, "Camera Up Vector = ( %f , %f , %f )", input.main_camera.up_vector.x, input.main_camera.up_vector.y, input.main_camera.up_vector.z);
+		break;
+	case GeoTranslation:
+		input.models[input.cur_idx].position.z += 0.1 * (float)yoffset;
+		break;
+	case GeoScaling:
+		input.models[input.cur_idx].scale.z += 0.01 * (float)yoffset;
+		break;
+	case GeoRotation:
+		// spin about the model's own z axis, 5 degrees per notch
+		input.models[input.cur_idx].rotation = (input.models[input.cur_idx].rotation * Quaternion::FromAxisAngle(Vector3(0, 0, 1), (acosf(-1.0f) / 180.0f) * 5 * (float)yoffset)).normalized();
+		break;
+	case LightEdit:
+		if (input.lightSource == DIRECTIONALLIGHT) {
+			input.directional_light.diffuse_intensity.x += (float)yoffset * 0.1;
+			input.directional_light.diffuse_intensity.y += (float)yoffset * 0.1;
+			input.directional_light.diffuse_intensity.z += (float)yoffset * 0.1;
+		}
+		else if (input.lightSource == POINTLIGHT) {
+			input.point_light.diffuse_intensity.x += (float)yoffset * 0.1;
+			input.point_light.diffuse_intensity.y += (float)yoffset * 0.1;
+			input.point_light.diffuse_intensity.z += (float)yoffset * 0.1;
+		}
+		else if (input.lightSource == SPOTLIGHT) {
+			input.spot_light.cutoff += (float)yoffset * 360 * 0.01;
+		}
+		break;
+	case ShininessEdit:
+		input.directional_light.shininess += (float)yoffset;
+		input.point_light.shininess += (float)yoffset;
+		input.spot_light.shininess += (float)yoffset;
+		break;
+	}
+}
+
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	input_changed = true;
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+		mouse_pressed = true;
+	else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
+		mouse_pressed = false;
+		starting_press_x = -1;
+		starting_press_y = -1;
+	}
+	else if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && input.show_all_models) {
+		// the ray needs the view and projection the render thread last drew with
+		double xpos, ypos;
+		int width, height;
+		glfwGetCursorPos(window, &xpos, &ypos);
+		glfwGetWindowSize(window, &width, &height);
+		PushRenderCommand(RenderCommand::Pick, (float)xpos, (float)ypos, width, height);
+	}
+		
+}
+
+// turn the current model with an arcball over the half of the window the cursor is in
+static void DragArcball(GLFWwindow* window, float from_x, float from_y, float to_x, float to_y)
+{
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	float half = width / 2.0f;
+	float viewport_x = to_x < half ? 0.0f : half;
+	Vector3 from = ArcballPoint(from_x, from_y, viewport_x, 0.0f, half, (float)height);
+	Vector3 to = ArcballPoint(to_x, to_y, viewport_x, 0.0f, half, (float)height);
+	// the ball lives in view space, v * view takes its points back to world space
+	Matrix4 view = ComputeViewMatrix(input.main_camera);
+	Vector3 world_from = from * view, world_to = to * view;
+	world_from.normalize();
+	world_to.normalize();
+	ModelState& m = input.models[input.cur_idx];
+	m.rotation = (ArcballRotation(world_from, world_to) * m.rotation).normalized();
+}
+
+static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
+{
+	if (mouse_pressed) {
+		input_changed = true;
+		if (starting_press_x < 0 || starting_press_y < 0) {
+			starting_press_x = (int)xpos;
+			starting_press_y = (int)ypos;
+		}
+		else {
+			float diff_x = starting_press_x - (int)xpos;
+			float diff_y = starting_press_y - (int)ypos;
+			starting_press_x = (int)xpos;
+			starting_press_y = (int)ypos;
+			switch (cur_trans_mode)
+			{
+			case ViewEye:
+				input.main_camera.position.x += diff_x * (1.0 / 400.0);
+				input.main_camera.position.y += diff_y * (1.0 / 400.0);
+				LOG_EVERY(LOG_LEVEL_INFO, CAMERA_LOG_INTERVAL_MS, "Camera Position = ( %f , %f , %f )", input.main_camera.position.x, input.main_camera.position.y, input.main_camera.position.z);
+				break;
+			case ViewCenter:
+				input.main_camera.center.x += diff_x * (1.0 / 400.0);
+				input.main_camera.center.y -= diff_y * (1.0 / 400.0);
+				LOG_EVERY(LOG_LEVEL_INFO, CAMERA_LOG_INTERVAL_MS, "Camera Viewing Direction = ( %f , %f , %f )", input.main_camera.center.x, input.main_camera.center.y, input.main_camera.center.z);
+				break;
+			case ViewUp:
+				input.main_camera.up_vector.x += diff_x * 0.1;
+				input.main_camera.up_vector.y += diff_y * 0.1;
+				LOG_EVERY(LOG_LEVEL_INFO, CAMERA_LOG_INTERVAL_MS, "Camera Up Vector = ( %f , %f , %f )", input.main_camera.up_vector.x, input.main_camera.up_vector.y, input.main_camera.up_vector.z);
+				break;
+			case GeoTranslation:
+				input.models[input.cur_idx].position.x += -diff_x * (1.0 / 400.0);
+				input.models[input.cur_idx].position.y += diff_y * (1.0 / 400.0);
+				break;
+			case GeoScaling:
+				input.models[input.cur_idx].scale.x += diff_x * 0.001;
+				input.models[input.cur_idx].scale.y += diff_y * 0.001;
+				break;
+			case GeoRotation:
+				DragArcball(window, (float)xpos + diff_x, (float)ypos + diff_y, (float)xpos, (float)ypos);
+				break;
+			case LightEdit:
+				if (input.lightSource == DIRECTIONALLIGHT) {
+					input.directional_light.position.x += (float)diff_x * (1.0 / 400.0);
+					input.directional_light.position.y += (float)-diff_y * (1.0 / 400.0);
+				}
+				else if (input.lightSource == POINTLIGHT) {
+					input.point_light.position.x += (float)diff_x * (1.0 / 400.0);
+					input.point_light.position.y += (float)-diff_y * (1.0 / 400.0);
+				}
+				else if (input.lightSource == SPOTLIGHT) {
+					input.spot_light.position.x += (float)diff_x * (1.0 / 400.0);
+					input.spot_light.position.y += (float)-diff_y * (1.0 / 400.0);
+				}
+				break;
+			}
+		}
+	}
+}
+
+// a GL info log one line per message, they are longer than a log message can hold
+static void LogInfoLog(const char* title, const char* info_log)
+{
+	LOG_ERROR("%s", title);
+	while (*info_log)
+	{
+		const char* end = strchr(info_log, '\n');
+		size_t length = end ? end - info_log : strlen(info_log);
+		LOG_ERROR("%s", string(info_log, length));
+		info_log += end ? length + 1 : length;
+	}
+}
+
+GLuint LoadShaderProgram(const char* vs_path, const char* fs_path)
+{
+	GLuint v, f, p;
+	char *vs = NULL;
+	char *fs = NULL;
+
+	v = glCreateShader(GL_VERTEX_SHADER);
+	f = glCreateShader(GL_FRAGMENT_SHADER);
+
+	vs = textFileRead(vs_path);
+	fs = textFileRead(fs_path);
+
+	glShaderSource(v, 1, (const GLchar**)&vs, NULL);
+	glShaderSource(f, 1, (const GLchar**)&fs, NULL);
+
+	free(vs);
+	free(fs);
+
+	GLint success;
+	char infoLog[1000];
+	// compile vertex shader
+	glCompileShader(v);
+	// check for shader compile errors
+	glGetShaderiv(v, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(v, 1000, NULL, infoLog);
+		LogInfoLog("ERROR: VERTEX SHADER COMPILATION FAILED", infoLog);
+	}
+
+	// compile fragment shader
+	glCompileShader(f);
+	// check for shader compile errors
+	glGetShaderiv(f, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(f, 1000, NULL, infoLog);
+		LogInfoLog("ERROR: FRAGMENT SHADER COMPILATION FAILED", infoLog);
+	}
+
+	// create program object
+	p = glCreateProgram();
+
+	// attach shaders to program object
+	glAttachShader(p,f);
+	glAttachShader(p,v);
+
+	// link program
+	glLinkProgram(p);
+	// check for linking errors
+	glGetProgramiv(p, GL_LINK_STATUS, &success);
+	if (!success) {
+		glGetProgramInfoLog(p, 1000, NULL, infoLog);
+		LogInfoLog("ERROR: SHADER PROGRAM LINKING FAILED", infoLog);
+	}
+
+	glDeleteShader(v);
+	glDeleteShader(f);
+
+	if (!success)
+    {
+        LogFlush();
+        system("pause");
+        exit(123);
+    }
+
+	return p;
+}
+
+void setShaders()
+{
+	program = LoadShaderProgram("shader.vs.glsl", "shader.fs.glsl");
+
+	depth_program = LoadShaderProgram("depth.vs.glsl", "depth.fs.glsl");
+	depth_uniform.iLocModelMatrix = glGetUniformLocation(depth_program, "modelMatrix");
+	depth_uniform.iLocViewMatrix = glGetUniformLocation(depth_program, "viewMatrix");
+	depth_uniform.iLocProjectionMatrix = glGetUniformLocation(depth_program, "projectionMatrix");
+
+	glUseProgram(program);
+}
+
+void normalization(tinyobj::attrib_t* attrib, ArenaVector<GLfloat>& vertices, ArenaVector<GLfloat>& colors, ArenaVector<GLfloat>& normals, ArenaVector<GLfloat>& textureCoords, ArenaVector<int>& material_id, tinyobj::shape_t* shape)
+{
+	float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
+
+	// find out min and max value of X, Y and Z axis
+	for (int i = 0; i < attrib->vertices.size(); i++)
+	{
+		//maxs = max(maxs, attrib->vertices.at(i));
+		if (i % 3 == 0)
+		{
+
+			if (attrib->vertices.at(i) < minX)
+			{
+				minX = attrib->vertices.at(i);
+			}
+
+			if (attrib->vertices.at(i) > maxX)
+			{
+				maxX = attrib->vertices.at(i);
+			}
+		}
+		else if (i % 3 == 1)
+		{
+
+			if (attrib->vertices.at(i) < minY)
+			{
+				minY = attrib->vertices.at(i);
+			}
+
+			if (attrib->vertices.at(i) > maxY)
+			{
+				maxY = attrib->vertices.at(i);
+			}
+		}
+		else if (i % 3 == 2)
+		{
+
+			if (attrib->vertices.at(i) < minZ)
+			{
+				minZ = attrib->vertices.at(i);
+			}
+
+			if (attrib->vertices.at(i) > maxZ)
+			{
+				maxZ = attrib->vertices.at(i);
+			}
+		}
+	}
+	
+	float offsetX = (maxX + minX) / 2;
+	float offsetY = (maxY + minY) / 2;
+	float offsetZ = (maxZ + minZ) / 2;
+
+	for (int i = 0; i < attrib->vertices.size(); i++)
+	{
+		if (offsetX != 0 && i % 3 == 0)
+		{
+			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetX;
+		}
+		else if (offsetY != 0 && i % 3 == 1)
+		{
+			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetY;
+		}
+		else if (offsetZ != 0 && i % 3 == 2)
+		{
+			attrib->vertices.at(i) = attrib->vertices.at(i) - offsetZ;
+		}
+	}
+
+	float greatestAxis = maxX - minX;
+	float distanceOfYAxis = maxY - minY;
+	float distanceOfZAxis = maxZ - minZ;
+
+	if (distanceOfYAxis > greatestAxis)
+	{
+		greatestAxis = distanceOfYAxis;
+	}
+
+	if (distanceOfZAxis > greatestAxis)
+	{
+		greatestAxis = distanceOfZAxis;
+	}
+
+	float scale = greatestAxis / 2;
+
+	for (int i = 0; i < attrib->vertices.size(); i++)
+	{
+		//std::cout << i << " = " << (double)(attrib.vertices.at(i) / greatestAxis) << std::endl;
+		attrib->vertices.at(i) = attrib->vertices.at(i)/ scale;
+	}
+	// OBJs without normals get smooth ones: the face normals around each
+	// position summed unnormalized, so larger faces weigh more
+	ArenaVector<Vector3> smoothNormals(vertices.get_allocator());
+	bool missingNormals = false;
+	for (size_t i = 0; i < shape->mesh.indices.size(); i++)
+		missingNormals |= shape->mesh.indices[i].normal_index < 0;
+	if (missingNormals)
+	{
+		const Vector3* positions = (const Vector3*)&attrib->vertices[0];
+		smoothNormals.assign(attrib->vertices.size() / 3, Vector3(0, 0, 0));
+		size_t offset = 0;
+		for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++)
+		{
+			int fv = shape->mesh.num_face_vertices[f];
+			int i0 = shape->mesh.indices[offset].vertex_index;
+			for (int v = 1; v + 1 < fv; v++)
+			{
+				int i1 = shape->mesh.indices[offset + v].vertex_index;
+				int i2 = shape->mesh.indices[offset + v + 1].vertex_index;
+				Vector3 n = (positions[i1] - positions[i0]).cross(positions[i2] - positions[i0]);
+				smoothNormals[i0] += n;
+				smoothNormals[i1] += n;
+				smoothNormals[i2] += n;
+			}
+			offset += fv;
+		}
+		normalizeVectors(&smoothNormals[0], (int)smoothNormals.size());
+	}
+
+	// one entry per face corner
+	size_t corners = shape->mesh.indices.size();
+	vertices.reserve(corners * 3);
+	colors.reserve(corners * 3);
+	normals.reserve(corners * 3);
+	textureCoords.reserve(corners * 2);
+	material_id.reserve(corners);
+
+	size_t index_offset = 0;
+	for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
+		int fv = shape->mesh.num_face_vertices[f];
+
+		// Loop over vertices in the face.
+		for (size_t v = 0; v < fv; v++) {
+			// access to vertex
+			tinyobj::index_t idx = shape->mesh.indices[index_offset + v];
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 0]);
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 1]);
+			vertices.push_back(attrib->vertices[3 * idx.vertex_index + 2]);
+			// Optional: vertex colors
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
+			colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
+			// Optional: vertex normals
+			if (idx.normal_index >= 0) {
+				normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
+				normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
+				normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
+			}
+			else {
+				const Vector3& n = smoothNormals[idx.vertex_index];
+				normals.push_back(n.x);
+				normals.push_back(n.y);
+				normals.push_back(n.z);
+			}
+			// Optional: texture coordinate
+			textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 0]);
+			textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 1]);
+			// The material of this vertex
+			material_id.push_back(shape->mesh.material_ids[f]);
+		}
+		index_offset += fv;
+	}
+}
+
+static string GetBaseDir(const string& filepath) {
+	if (filepath.find_last_of("/\\") != std::string::npos)
+		return filepath.substr(0, filepath.find_last_of("/\\"));
+	return "";
+}
+
+// 1x1 white texture for materials without a diffuse map
+GLuint WhiteTexture()
+{
+	static GLuint tex = 0;
+	static bool created = false;
+	if (!created)
+	{
+		const unsigned char white[4] = { 255, 255, 255, 255 };
+		created = true;
+		if (software_backend) {
+			tex = (GLuint)soft_textures.size();
+			soft_textures.push_back(SoftTexture());
+			soft_textures.back().set(1, 1, white);
+			return tex;
+		}
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	return tex;
+}
+
+GLuint LoadTextureImage(string image_path)
+{
+	int channel, width, height;
+	int require_channel = 4;
+	stbi_set_flip_vertically_on_load(true);
+	stbi_uc *data = stbi_load(image_path.c_str(), &width, &height, &channel, require_channel);
+	if (data != NULL && software_backend)
+	{
+		GLuint tex = (GLuint)soft_textures.size();
+		soft_textures.push_back(SoftTexture());
+		soft_textures.back().set(width, height, data);
+		stbi_image_free(data);
+		return tex;
+	}
+	else if (data != NULL)
+	{
+		GLuint tex = 0;
+
+		// [TODO] Bind the image to texture
+		// Hint: glGenTextures, glBindTexture, glTexImage2D, glGenerateMipmap
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		// free the image from memory after binding to texture
+		stbi_image_free(data);
+		return tex;
+	}
+	else
+	{
+		LOG_ERROR("LoadTextureImage: Cannot load image from %s", image_path);
+		return -1;
+	}
+}
+
+// one index buffer per level of the welded mesh
+void UploadShapeLODs(Shape& shape, const IndexedMesh& mesh, const vector<MeshLOD>& lods)
+{
+	shape.occluder_positions.resize(mesh.vertexCount() * 3);
+	for (int v = 0; v < mesh.vertexCount(); v++)
+	{
+		shape.occluder_positions[v * 3 + 0] = mesh.vertices[v * INDEXED_VERTEX_STRIDE + 0];
+		shape.occluder_positions[v * 3 + 1] = mesh.vertices[v * INDEXED_VERTEX_STRIDE + 1];
+		shape.occluder_positions[v * 3 + 2] = mesh.vertices[v * INDEXED_VERTEX_STRIDE + 2];
+	}
+	shape.occluder_indices = lods.empty() ? mesh.indices : lods.back().indices;
+
+	shape.lods.clear();
+	shape.cur_lod = 0;
+	// the software backend draws the full resolution mesh, the levels only feed the occluders
+	if (lods.empty() || software_backend)
+		return;
+
+	glGenBuffers(1, &shape.lod_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, shape.lod_vbo);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(GLfloat), &mesh.vertices.at(0), GL_STATIC_DRAW);
+	glGenBuffers(1, &shape.lod_depth_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, shape.lod_depth_vbo);
+	glBufferData(GL_ARRAY_BUFFER, shape.occluder_positions.size() * sizeof(GLfloat), &shape.occluder_positions.at(0), GL_STATIC_DRAW);
+
+	string chain = to_string(shape.vertex_count / 3);
+	for (int l = 0; l < lods.size(); l++)
+	{
+		ShapeLOD lod;
+		glGenVertexArrays(1, &lod.vao);
+		glBindVertexArray(lod.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.lod_vbo);
+		const GLsizei stride = INDEXED_VERTEX_STRIDE * sizeof(GLfloat);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)(0 * sizeof(GLfloat)));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(GLfloat)));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(GLfloat)));
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void*)(9 * sizeof(GLfloat)));
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glEnableVertexAttribArray(3);
+
+		glGenBuffers(1, &lod.ebo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod.ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, lods[l].indices.size() * sizeof(GLuint), &lods[l].indices.at(0), GL_STATIC_DRAW);
+		lod.indexCount = (int)lods[l].indices.size();
+		lod.error = lods[l].error;
+
+		glGenVertexArrays(1, &lod.depth_vao);
+		glBindVertexArray(lod.depth_vao);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.lod_depth_vbo);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod.ebo);
+		shape.lods.push_back(lod);
+		chain += " -> " + to_string(lod.indexCount / 3);
+	}
+	LOG_INFO("LOD chain: %s triangles", chain);
+	glBindVertexArray(0);
+}
+
+// a shape from its per-corner streams and its welded mesh with the LOD chain
+Shape CreateShape(const ArenaVector<GLfloat>& vertices, const ArenaVector<GLfloat>& colors, const ArenaVector<GLfloat>& normals, const ArenaVector<GLfloat>& textureCoords,
+	const PhongMaterial& material, const IndexedMesh& mesh, const vector<MeshLOD>& lods)
+{
+	Shape shape;
+	shape.vertex_count = vertices.size() / 3;
+	if (software_backend)
+	{
+		shape.cpu_positions.assign(vertices.begin(), vertices.end());
+		shape.cpu_colors.assign(colors.begin(), colors.end());
+		shape.cpu_normals.assign(normals.begin(), normals.end());
+		shape.cpu_texcoords.assign(textureCoords.begin(), textureCoords.end());
+	}
+	else
+	{
+		glGenVertexArrays(1, &shape.vao);
+		glBindVertexArray(shape.vao);
+
+		glGenBuffers(1, &shape.vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GL_FLOAT), &vertices.at(0), GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glGenBuffers(1, &shape.p_color);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.p_color);
+		glBufferData(GL_ARRAY_BUFFER, colors.size() * sizeof(GL_FLOAT), &colors.at(0), GL_STATIC_DRAW);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glGenBuffers(1, &shape.p_normal);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.p_normal);
+		glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(GL_FLOAT), &normals.at(0), GL_STATIC_DRAW);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glGenBuffers(1, &shape.p_texCoord);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.p_texCoord);
+		glBufferData(GL_ARRAY_BUFFER, textureCoords.size() * sizeof(GL_FLOAT), &textureCoords.at(0), GL_STATIC_DRAW);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glEnableVertexAttribArray(3);
+
+		glGenVertexArrays(1, &shape.depth_vao);
+		glBindVertexArray(shape.depth_vao);
+		glBindBuffer(GL_ARRAY_BUFFER, shape.vbo);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+		glEnableVertexAttribArray(0);
+	}
+	shape.material = material;
+	UploadShapeLODs(shape, mesh, lods);
+	return shape;
+}
+
+// cached receives the welded mesh and LOD chain of every shape when the model goes to the mesh cache
+vector<Shape> SplitShapeByMaterial(ArenaVector<GLfloat>& vertices, ArenaVector<GLfloat>& colors, ArenaVector<GLfloat>& normals, ArenaVector<GLfloat>& textureCoords, ArenaVector<int>& material_id, vector<PhongMaterial>& materials,
+	vector<MeshCacheShape>* cached = NULL)
+{
+	vector<Shape> res;
+	LoadArena& arena = *vertices.get_allocator().arena;
+	ArenaVector<int> material_counts(materials.size(), 0, ArenaAllocator<int>(arena));
+	for (int v = 0; v < material_id.size(); v++)
+	{
+		if (material_id[v] >= 0 && material_id[v] < materials.size())
+			material_counts[material_id[v]]++;
+	}
+
+	for (int m = 0; m < materials.size(); m++)
+	{
+		// the split copies only live until their upload
+		LoadArena::Scope scope(arena);
+		ArenaVector<GLfloat> m_vertices(vertices.get_allocator()), m_colors(vertices.get_allocator());
+		ArenaVector<GLfloat> m_normals(vertices.get_allocator()), m_textureCoords(vertices.get_allocator());
+		m_vertices.reserve(material_counts[m] * 3);
+		m_colors.reserve(material_counts[m] * 3);
+		m_normals.reserve(material_counts[m] * 3);
+		m_textureCoords.reserve(material_counts[m] * 2);
+		for (int v = 0; v < material_id.size(); v++) 
+		{
+			// extract all vertices with same material id and create a new shape for it.
+			if (material_id[v] == m)
+			{
+				m_vertices.push_back(vertices[v * 3 + 0]);
+				m_vertices.push_back(vertices[v * 3 + 1]);
+				m_vertices.push_back(vertices[v * 3 + 2]);
+
+				m_colors.push_back(colors[v * 3 + 0]);
+				m_colors.push_back(colors[v * 3 + 1]);
+				m_colors.push_back(colors[v * 3 + 2]);
+
+				m_normals.push_back(normals[v * 3 + 0]);
+				m_normals.push_back(normals[v * 3 + 1]);
+				m_normals.push_back(normals[v * 3 + 2]);
+
+				m_textureCoords.push_back(textureCoords[v * 2 + 0]);
+				m_textureCoords.push_back(textureCoords[v * 2 + 1]);
+			}
+		}
+		if (m_vertices.empty())
+			continue;
+
+		// simplify the shape with quadric error metrics
+		MeshCacheShape shape;
+		shape.material = m;
+		WeldMesh(&m_vertices.at(0), &m_colors.at(0), &m_normals.at(0), &m_textureCoords.at(0), m_vertices.size() / 3, shape.mesh);
+		BuildLODChain(shape.mesh, LOD_LEVEL_COUNT, LOD_REDUCTION, shape.lods);
+		res.push_back(CreateShape(m_vertices, m_colors, m_normals, m_textureCoords, materials[m], shape.mesh, shape.lods));
+		if (cached)
+			cached->push_back(shape);
+	}
+
+	return res;
+}
+
+// models without a .mtl, e.g. the ones in config.txt, get a plain white material
+vector<PhongMaterial> LoadMaterials(const vector<MeshCacheMaterial>& materials, const string& base_dir)
+{
+	vector<PhongMaterial> allMaterial;
+	for (int i = 0; i < materials.size(); i++)
+	{
+		PhongMaterial material;
+		material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
+		material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
+		material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
+
+		material.diffuseTexture = LoadTextureImage(base_dir + materials[i].diffuse_texname);
+		if (material.diffuseTexture == -1)
+		{
+			LOG_ERROR("LoadTexturedModels: Fail to load model's material %d", i);
+			LogFlush();
+			system("pause");
+			
+		}
+
+		if (materials[i].diffuse_texname.find("Eye") != string::npos) {
+			material.isEye = 1;
+			material.offsets = {
+				Offset(0.0, 0.0), Offset(0.0, -0.25), Offset(0.0, -0.5), Offset(0.0, -0.75),
+				Offset(0.5, 0.0), Offset(0.5, -0.25), Offset(0.5, -0.5)
+			};
+		} else {
+			material.isEye = 0;
+		}
+		
+		allMaterial.push_back(material);
+	}
+	if (allMaterial.empty())
+	{
+		PhongMaterial material;
+		material.Ka = Vector3(0.2f, 0.2f, 0.2f);
+		material.Kd = Vector3(0.8f, 0.8f, 0.8f);
+		material.Ks = Vector3(0.5f, 0.5f, 0.5f);
+		material.diffuseTexture = WhiteTexture();
+		material.isEye = 0;
+		allMaterial.push_back(material);
+	}
+	return allMaterial;
+}
+
+// --mesh-cache: the model from its cache file, false to load the OBJ
+bool LoadCachedModel(const string& model_path, const string& base_dir)
+{
+	MeshCacheKey key;
+	MeshCacheModel cached;
+	MeshCacheStats stats;
+	if (mesh_cache_dir.empty() || !MeshCacheKeyOf(model_path, LOD_LEVEL_COUNT, LOD_REDUCTION, key) ||
+		!ReadMeshCache(MeshCachePath(mesh_cache_dir, model_path), key, cached, stats, GetThreadPool()))
+		return false;
+	for (const MeshCacheShape& s : cached.shapes)
+		if (s.material < 0 || s.material >= max((int)cached.materials.size(), 1) || s.mesh.indices.empty())
+			return false;
+
+	LoadArena arena;
+	model tmp_model;
+	vector<PhongMaterial> allMaterial = LoadMaterials(cached.materials, base_dir);
+	for (const MeshCacheShape& s : cached.shapes)
+	{
+		// back to the per-corner streams the full resolution draw uses
+		LoadArena::Scope scope(arena);
+		ArenaAllocator<GLfloat> alloc(arena);
+		ArenaVector<GLfloat> vertices(alloc), colors(alloc), normals(alloc), textureCoords(alloc);
+		size_t corners = s.mesh.indices.size();
+		vertices.reserve(corners * 3);
+		colors.reserve(corners * 3);
+		normals.reserve(corners * 3);
+		textureCoords.reserve(corners * 2);
+		for (unsigned int index : s.mesh.indices)
+		{
+			const float* v = &s.mesh.vertices[index * INDEXED_VERTEX_STRIDE];
+			vertices.insert(vertices.end(), v, v + 3);
+			colors.insert(colors.end(), v + 3, v + 6);
+			normals.insert(normals.end(), v + 6, v + 9);
+			textureCoords.insert(textureCoords.end(), v + 9, v + 11);
+			tmp_model.local_bounds.expand(Vector3(v[0], v[1], v[2]));
+		}
+		tmp_model.shapes.push_back(CreateShape(vertices, colors, normals, textureCoords, allMaterial[s.material], s.mesh, s.lods));
+	}
+	models.push_back(tmp_model);
+	LOG_INFO("Mesh cache: %s, %.2f MB for %.2f MB of mesh (%.1fx), read %.2f ms, verify %.2f ms, decode %.2f ms (%.2f GB/s)",
+		model_path, stats.file_bytes / 1048576.0, stats.raw_bytes / 1048576.0, stats.raw_bytes / (double)max(stats.file_bytes, (size_t)1),
+		stats.read_ms, stats.verify_ms, stats.decode_ms, stats.raw_bytes / max(stats.decode_ms * 1e6, 1e-9));
+	return true;
+}
+
+void LoadTexturedModels(string model_path)
+{
+	vector<tinyobj::shape_t> shapes;
+	vector<tinyobj::material_t> materials;
+	tinyobj::attrib_t attrib;
+	// the per-shape buffers, released together once the model is on the GPU
+	LoadArena arena;
+	HeapStats heap_start = GetHeapStats();
+	ResetHeapPeak();
+
+	string err;
+	string warn;
+
+	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+
+#ifdef _WIN32
+	base_dir += "\\";
+#else
+	base_dir += "/";
+#endif
+
+	if (LoadCachedModel(model_path, base_dir))
+		return;
+
+	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+
+	if (!warn.empty()) {
+		LOG_WARN("%s", warn);
+	}
+
+	if (!err.empty()) {
+		LOG_ERROR("%s", err);
+	}
+
+	if (!ret) {
+		LogFlush();
+		exit(1);
+	}
+
+	LOG_INFO("Load Models Success ! Shapes size %d Material size %d", shapes.size(), materials.size());
+	model tmp_model;
+
+	MeshCacheModel cached;
+	for (int i = 0; i < materials.size(); i++)
+	{
+		MeshCacheMaterial material;
+		for (int c = 0; c < 3; c++)
+		{
+			material.ambient[c] = materials[i].ambient[c];
+			material.diffuse[c] = materials[i].diffuse[c];
+			material.specular[c] = materials[i].specular[c];
+		}
+		material.diffuse_texname = materials[i].diffuse_texname;
+		cached.materials.push_back(material);
+	}
+	vector<PhongMaterial> allMaterial = LoadMaterials(cached.materials, base_dir);
+	bool default_material = materials.empty();
+	
+	for (int i = 0; i < shapes.size(); i++)
+	{
+		LoadArena::Scope scope(arena);
+		ArenaAllocator<GLfloat> alloc(arena);
+		ArenaVector<GLfloat> vertices(alloc), colors(alloc), normals(alloc), textureCoords(alloc);
+		ArenaVector<int> material_id(alloc);
+
+		normalization(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
+		if (default_material)
+			material_id.assign(material_id.size(), 0);
+		// printf("Vertices size: %d", vertices.size() / 3);
+		for (int v = 0; v + 2 < vertices.size(); v += 3)
+		{
+			tmp_model.local_bounds.expand(Vector3(vertices[v], vertices[v + 1], vertices[v + 2]));
+		}
+
+		// split current shape into multiple shapes base on material_id.
+		vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, allMaterial,
+			mesh_cache_dir.empty() ? NULL : &cached.shapes);
+
+		// concatenate splited shape to model's shape list
+		tmp_model.shapes.insert(tmp_model.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
+	}
+	shapes.clear();
+	materials.clear();
+	models.push_back(tmp_model);
+
+	HeapStats heap_end = GetHeapStats();
+	if (HEAP_STATS_COUNTED)
+		LOG_INFO("Load stats: %d heap allocations, heap peak +%.2f MB; arena %d buffers in %d blocks, peak %.2f MB",
+			(int)(heap_end.allocations - heap_start.allocations), (heap_end.peak_bytes - heap_start.live_bytes) / 1048576.0,
+			(int)arena.allocationCount(), (int)arena.blockCount(), arena.peakBytes() / 1048576.0);
+	else
+		LOG_INFO("Load stats: arena %d buffers in %d blocks, peak %.2f MB (heap not counted, build with LOAD_ARENA_COUNT_HEAP)",
+			(int)arena.allocationCount(), (int)arena.blockCount(), arena.peakBytes() / 1048576.0);
+
+	MeshCacheKey key;
+	MeshCacheStats stats;
+	if (mesh_cache_dir.empty() || !MeshCacheKeyOf(model_path, LOD_LEVEL_COUNT, LOD_REDUCTION, key))
+		return;
+	if (!WriteMeshCache(MeshCachePath(mesh_cache_dir, model_path), key, cached, mesh_cache_lz, stats)) {
+		LOG_WARN("Mesh cache: cannot write %s", MeshCachePath(mesh_cache_dir, model_path));
+		return;
+	}
+	LOG_INFO("Mesh cache: wrote %s, %.2f MB for %.2f MB of mesh (%.1fx) in %.1f ms",
+		MeshCachePath(mesh_cache_dir, model_path), stats.file_bytes / 1048576.0, stats.raw_bytes / 1048576.0,
+		stats.raw_bytes / (double)max(stats.file_bytes, (size_t)1), stats.encode_ms);
+}
+
+// camera, projection and lights of the scene
+void initParameter()
+{
+	proj = scene.proj;
+	proj.aspect = (float)(WINDOW_WIDTH / 2) / (float)WINDOW_HEIGHT; // adjust width for side by side view
+	main_camera = scene.main_camera;
+
+	directional_light = scene.directional_light;
+	point_light = scene.point_light;
+	spot_light = scene.spot_light;
+	lightSource = scene.light_source;
+
+	setViewingMatrix();
+	if (scene.perspective)
+		setPerspective();
+	else
+		setOrthogonal();
+}
+
+void ApplySceneTransform(model& m, const SceneModel& placement)
+{
+	m.position = placement.position;
+	m.rotation = placement.rotation;
+	m.scale = placement.scale;
+	m.revision++;
+}
+
+// the models of the scene with their transforms, in scene order
+void LoadSceneModels()
+{
+	for (int i = 0; i < scene.models.size(); i++)
+	{
+		LoadTexturedModels(scene.models[i].path);
+		ApplySceneTransform(models.back(), scene.models[i]);
+	}
+}
+
+void setUniformVariables()
+{
+	uniform.iLocLightSource = glGetUniformLocation(program, "lightSource");
+	uniform.iLocLightingMode = glGetUniformLocation(program, "lightingMode");
+
+	uniform.iLocViewMatrix = glGetUniformLocation(program, "viewMatrix");
+	uniform.iLocProjectionMatrix = glGetUniformLocation(program, "projectionMatrix");
+
+	uniform.iLocDirectionalPosition = glGetUniformLocation(program, "directionalLight_position");
+	uniform.iLocDirectionalDirection = glGetUniformLocation(program, "directionalLight_direction");
+	uniform.iLocDirectionalAmbientIntensity = glGetUniformLocation(program, "directionalLight_ambientIntensity");
+	uniform.iLocDirectionalDiffuseIntensity = glGetUniformLocation(program, "directionalLight_diffuseIntensity");
+	uniform.iLocDirectionalSpecularIntensity = glGetUniformLocation(program, "directionalLight_specularIntensity");
+	uniform.iLocDirectionalShininess = glGetUniformLocation(program, "directionalLight_shininess");
+
+	uniform.iLocPointPosition = glGetUniformLocation(program, "pointLight_position");
+	uniform.iLocPointAmbientIntensity = glGetUniformLocation(program, "pointLight_ambientIntensity");
+	uniform.iLocPointDiffuseIntensity = glGetUniformLocation(program, "pointLight_diffuseIntensity");
+	uniform.iLocPointSpecularIntensity = glGetUniformLocation(program, "pointLight_specularIntensity");
+	uniform.iLocPointShininess = glGetUniformLocation(program, "pointLight_shininess");
+	uniform.iLocPointConstant = glGetUniformLocation(program, "pointLight_constant");
+	uniform.iLocPointLinear = glGetUniformLocation(program, "pointLight_linear");
+	uniform.iLocPointQuadratic = glGetUniformLocation(program, "pointLight_quadratic");
+
+	uniform.iLocSpotPosition = glGetUniformLocation(program, "spotLight_position");
+	uniform.iLocSpotDirection = glGetUniformLocation(program, "spotLight_direction");
+	uniform.iLocSpotExponent = glGetUniformLocation(program, "spotLight_exponent");
+	uniform.iLocSpotCutoff = glGetUniformLocation(program, "spotLight_cutoff");
+	uniform.iLocSpotAmbientIntensity = glGetUniformLocation(program, "spotLight_ambientIntensity");
+	uniform.iLocSpotDiffuseIntensity = glGetUniformLocation(program, "spotLight_diffuseIntensity");
+	uniform.iLocSpotSpecularIntensity = glGetUniformLocation(program, "spotLight_specularIntensity");
+	uniform.iLocSpotShininess = glGetUniformLocation(program, "spotLight_shininess");
+	uniform.iLocSpotConstant = glGetUniformLocation(program, "spotLight_constant");
+	uniform.iLocSpotLinear = glGetUniformLocation(program, "spotLight_linear");
+	uniform.iLocSpotQuadratic = glGetUniformLocation(program, "spotLight_quadratic");
+
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "DrawBlock"), DRAW_BLOCK_BINDING);
+
+	uniform.iLocCameraPosition = glGetUniformLocation(program, "camera_position");
+
+	uniform.iLocClusteredLighting = glGetUniformLocation(program, "clusteredLighting");
+	uniform.iLocClusterLights = glGetUniformLocation(program, "clusterLights");
+	uniform.iLocClusterGrid = glGetUniformLocation(program, "clusterGrid");
+	uniform.iLocClusterIndices = glGetUniformLocation(program, "clusterIndices");
+	uniform.iLocClusterViewport = glGetUniformLocation(program, "clusterViewport");
+	uniform.iLocClusterDims = glGetUniformLocation(program, "clusterDims");
+	uniform.iLocClusterDepthParams = glGetUniformLocation(program, "clusterDepthParams");
+	uniform.iLocClusterLogDepth = glGetUniformLocation(program, "clusterLogDepth");
+	glUniform1i(uniform.iLocClusterLights, 1);
+	glUniform1i(uniform.iLocClusterGrid, 2);
+	glUniform1i(uniform.iLocClusterIndices, 3);
+
+	uniform.iLocShadowsEnabled = glGetUniformLocation(program, "shadowsEnabled");
+	uniform.iLocDirectionalShadowMap = glGetUniformLocation(program, "directionalShadowMap");
+	uniform.iLocCascadeMatrices = glGetUniformLocation(program, "cascadeMatrices");
+	uniform.iLocCascadeSplits = glGetUniformLocation(program, "cascadeSplits");
+	uniform.iLocSpotShadowMap = glGetUniformLocation(program, "spotShadowMap");
+	uniform.iLocSpotShadowMatrix = glGetUniformLocation(program, "spotShadowMatrix");
+	glUniform1i(uniform.iLocDirectionalShadowMap, 4);
+	glUniform1i(uniform.iLocSpotShadowMap, 5);
+
+	// [TODO] Get uniform location of texture
+	uniform.iLocTex = glGetUniformLocation(program, "tex");
+	glUniform1i(uniform.iLocTex, 0);
+}
+
+void setupRC()
+{
+	// setup shaders
+	setShaders();
+	initParameter();
+	setUniformVariables();
+
+	// OpenGL States and Values
+	glClearColor(0.2, 0.2, 0.2, 1.0);
+
+	LoadSceneModels();
+	BuildSceneBVH();
+	InitLightClusters();
+	InitShadowMaps();
+	if (!uniform_ring.init(gl_get_proc_address, UNIFORM_RING_REGION_BYTES))
+		LOG_ERROR("Failed to create the uniform ring");
+	else if (!uniform_ring.persistent())
+		LOG_INFO("Uniform ring: glBufferStorage not available, mapping each draw block unsynchronized");
+	// whatever setup logged comes before the first frame's output
+	LogFlush();
+}
+
+// GL objects of a model that left the scene, the white texture is shared by every model
+void ReleaseModel(model& m)
+{
+	vector<GLuint> textures;
+	GLuint white = WhiteTexture();
+	for (Shape& shape : m.shapes)
+	{
+		GLuint vertex_arrays[2] = { shape.vao, shape.depth_vao };
+		GLuint buffers[4] = { shape.vbo, shape.p_color, shape.p_normal, shape.p_texCoord };
+		glDeleteVertexArrays(2, vertex_arrays);
+		glDeleteBuffers(4, buffers);
+		// the welded buffers only exist when the mesh got a LOD chain
+		if (!shape.lods.empty()) {
+			glDeleteBuffers(1, &shape.lod_vbo);
+			glDeleteBuffers(1, &shape.lod_depth_vbo);
+		}
+		for (ShapeLOD& lod : shape.lods)
+		{
+			glDeleteVertexArrays(1, &lod.vao);
+			glDeleteVertexArrays(1, &lod.depth_vao);
+			glDeleteBuffers(1, &lod.ebo);
+		}
+		GLuint tex = shape.material.diffuseTexture;
+		if (tex != white && tex != (GLuint)-1 && find(textures.begin(), textures.end(), tex) == textures.end())
+			textures.push_back(tex);
+	}
+	if (!textures.empty())
+		glDeleteTextures((GLsizei)textures.size(), &textures[0]);
+	m.shapes.clear();
+}
+
+// render thread: bring models in line with the next scene, models whose path stays keep their
+// buffers and state, only new paths are loaded and uploaded
+void ReloadSceneModels(const Scene& next)
+{
+	auto start = chrono::steady_clock::now();
+	SceneDiff diff = DiffScenes(scene, next);
+	for (int i : diff.removed)
+		ReleaseModel(models[i]);
+
+	vector<model> old_models;
+	old_models.swap(models);
+	vector<model> next_models(next.models.size());
+	for (int i = 0; i < next.models.size(); i++)
+	{
+		if (diff.source[i] >= 0) {
+			next_models[i] = move(old_models[diff.source[i]]);
+			if (diff.moved[i])
+				ApplySceneTransform(next_models[i], next.models[i]);
+			continue;
+		}
+		// LoadTexturedModels appends to models, which only holds the new model meanwhile
+		LoadTexturedModels(next.models[i].path);
+		next_models[i] = move(models.back());
+		models.clear();
+		ApplySceneTransform(next_models[i], next.models[i]);
+	}
+	models.swap(next_models);
+	scene = next;
+
+	cur_idx = min(cur_idx, (int)models.size() - 1);
+	if (show_all_models)
+		LayoutSceneModels();
+	BuildSceneBVH();
+	if (show_all_models && LIGHT_FIELD_SIZES[light_field_size_idx] > 0)
+		GenerateLightField(LIGHT_FIELD_SIZES[light_field_size_idx]);
+	LOG_INFO("Scene: %d models kept, %d loaded, %d released in %.1f ms", diff.kept, diff.loaded, (int)diff.removed.size(),
+		chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+}
+
+// render thread, returns whether the main thread handed a new scene over
+bool TakePendingScene()
+{
+	Scene next;
+	int revision;
+	{
+		lock_guard<mutex> lock(pending_scene_mutex);
+		if (pending_scene_revision < 0)
+			return false;
+		next = move(pending_scene);
+		revision = pending_scene_revision;
+		pending_scene_revision = -1;
+	}
+	ReloadSceneModels(next);
+	scene_revision = revision;
+	// the snapshot of the reload may have come first, its model states apply from now on
+	ApplySnapshot(frame_snapshots.readBuffer());
+	return true;
+}
+
+void glPrintContextInfo(bool printExtension)
+{
+	LOG_INFO("GL_VENDOR = %s", (const char*)glGetString(GL_VENDOR));
+	LOG_INFO("GL_RENDERER = %s", (const char*)glGetString(GL_RENDERER));
+	LOG_INFO("GL_VERSION = %s", (const char*)glGetString(GL_VERSION));
+	LOG_INFO("GL_SHADING_LANGUAGE_VERSION = %s", (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
+	if (printExtension)
+	{
+		GLint numExt;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &numExt);
+		LOG_INFO("GL_EXTENSIONS =");
+		for (GLint i = 0; i < numExt; i++)
+		{
+			LOG_INFO("\t%s", (const char*)glGetStringi(GL_EXTENSIONS, i));
+		}
+	}
+}
+
+// --scene FILE, otherwise scene.txt when there is one, otherwise the models have to come from --models or a benchmark
+bool LoadStartupScene(const string& path)
+{
+	if (!path.empty())
+		scene_file = path;
+	else if (!ifstream(scene_file))
+		return true;
+	bool ok = LoadScene(scene_file, scene);
+	LogFlush();
+	return ok;
+}
+
+// batch rendering without a window, see RunHeadless
+struct HeadlessOptions
+{
+	string output_dir = ".";
+	int width = 512;
+	int height = 512;
+	int pose_count = 8;
+	string pose_file;
+	string model_file;
+	int jobs = 0;		// 0: one per core for --regression, otherwise 1
+	int lighting = PERPIXELLIGHTING;
+	string trace_file;
+	string benchmark_file;
+	string results_file = "benchmark_results.json";
+	bool software = false;
+	int threads = 0;	// software rasterizer threads, 0 for one per core
+	string capture_file;
+	string scene_file;
+	string mesh_cache_dir;
+	bool mesh_lz = true;
+	string golden_dir;
+	bool update_goldens = false;
+	double psnr_threshold = REGRESSION_DEFAULT_PSNR;
+};
+
+void PrintUsage()
+{
+	cout << "options of the interactive window:" << endl;
+	cout << "  --scene FILE       models, transforms and lights (see Scene.h, text or compiled) instead of scene.txt" << endl;
+	cout << "  --on-demand        redraw only on changes" << endl;
+	cout << "  --mesh-cache DIR   load models from compressed caches in DIR (see MeshCache.h), writing the missing ones" << endl;
+	cout << "  --mesh-lz on|off   LZ stage of the caches written (default on)" << endl;
+	cout << "  --benchmark FILE   run a benchmark scenario (see Benchmark.h) in the window and exit" << endl;
+	cout << "  --results FILE     benchmark results (default benchmark_results.json)" << endl;
+	cout << "  --capture FILE     record the benchmark frames, FILE.y4m as a Y4M stream, otherwise FILE_00000.png ..." << endl;
+	cout << "  --log-level NAME   debug, info (default), warn or error" << endl;
+	cout << "other modes: --headless [options] (see below), --math-benchmark, --thread-pool-test, --compile-scene IN OUT [--time-loads N]" << endl;
+}
+
+void PrintHeadlessUsage()
+{
+	cout << "--headless [options]: render every model from scripted camera poses into PNG files" << endl;
+	cout << "  --out DIR          existing output directory (default .)" << endl;
+	cout << "  --size WxH         image size (default 512x512)" << endl;
+	cout << "  --poses N          orbit poses around each model (default 8)" << endl;
+	cout << "  --pose-file FILE   poses instead of the orbit, one \"eye_x eye_y eye_z center_x center_y center_z\" per line" << endl;
+	cout << "  --scene FILE       models, transforms and lights (see Scene.h, text or compiled) instead of scene.txt" << endl;
+	cout << "  --models FILE      model paths, one per line like config.txt, instead of the models of the scene" << endl;
+	cout << "  --mesh-cache DIR   load models from compressed caches in DIR (see MeshCache.h), writing the missing ones" << endl;
+	cout << "  --mesh-lz on|off   LZ stage of the caches written (default on)" << endl;
+	cout << "  --jobs N           render in N processes, each with its own context (default 1, one per core for --regression)" << endl;
+	cout << "  --per-vertex       per-vertex instead of per-pixel lighting" << endl;
+	cout << "  --trace FILE       profile every image, write a Chrome trace and print the per-scope summary" << endl;
+	cout << "  --benchmark FILE   run a benchmark scenario (see Benchmark.h) instead of writing images" << endl;
+	cout << "  --results FILE     benchmark results (default benchmark_results.json)" << endl;
+	cout << "  --capture FILE     record the benchmark frames, FILE.y4m as a Y4M stream, otherwise FILE_00000.png ..." << endl;
+	cout << "  --backend NAME     gl (default) or software, the CPU rasterizer that needs no GPU (see SoftRasterizer.h)" << endl;
+	cout << "  --threads N        software rasterizer threads (default one per core)" << endl;
+	cout << "  --regression DIR   render the settings matrix (see ImageRegression.h) and compare with the golden images in DIR" << endl;
+	cout << "  --update-goldens   with --regression, write the renders into DIR instead of comparing" << endl;
+	cout << "  --threshold DB     lowest PSNR that passes --regression (default " << REGRESSION_DEFAULT_PSNR << ")" << endl;
+	cout << "  --log-level NAME   debug, info (default), warn or error" << endl;
+}
+
+bool ParseHeadlessOptions(int argc, char** argv, HeadlessOptions& opt)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		LogLevel level;
+		if (arg == "--headless")
+			continue;
+		else if (arg == "--log-level" && has_value && ParseLogLevel(argv[i + 1], level))
+			i++;	// already applied by main
+		else if (arg == "--out" && has_value)
+			opt.output_dir = argv[++i];
+		else if (arg == "--size" && has_value && sscanf(argv[i + 1], "%dx%d", &opt.width, &opt.height) == 2)
+			i++;
+		else if (arg == "--poses" && has_value)
+			opt.pose_count = atoi(argv[++i]);
+		else if (arg == "--pose-file" && has_value)
+			opt.pose_file = argv[++i];
+		else if (arg == "--scene" && has_value)
+			opt.scene_file = argv[++i];
+		else if (arg == "--models" && has_value)
+			opt.model_file = argv[++i];
+		else if (arg == "--mesh-cache" && has_value)
+			opt.mesh_cache_dir = argv[++i];
+		else if (arg == "--mesh-lz" && has_value && (string(argv[i + 1]) == "on" || string(argv[i + 1]) == "off"))
+			opt.mesh_lz = string(argv[++i]) == "on";
+		else if (arg == "--jobs" && has_value)
+			opt.jobs = atoi(argv[++i]);
+		else if (arg == "--per-vertex")
+			opt.lighting = PERVERTEXLIGHTING;
+		else if (arg == "--trace" && has_value)
+			opt.trace_file = argv[++i];
+		else if (arg == "--benchmark" && has_value)
+			opt.benchmark_file = argv[++i];
+		else if (arg == "--results" && has_value)
+			opt.results_file = argv[++i];
+		else if (arg == "--capture" && has_value)
+			opt.capture_file = argv[++i];
+		else if (arg == "--backend" && has_value && (string(argv[i + 1]) == "gl" || string(argv[i + 1]) == "software"))
+			opt.software = string(argv[++i]) == "software";
+		else if (arg == "--threads" && has_value)
+			opt.threads = atoi(argv[++i]);
+		else if (arg == "--regression" && has_value)
+			opt.golden_dir = argv[++i];
+		else if (arg == "--update-goldens")
+			opt.update_goldens = true;
+		else if (arg == "--threshold" && has_value)
+			opt.psnr_threshold = atof(argv[++i]);
+		else {
+			cout << "Unknown option " << arg << endl;
+			PrintHeadlessUsage();
+			return false;
+		}
+	}
+	if (opt.width <= 0 || opt.height <= 0 || opt.pose_count <= 0 || opt.jobs < 0 || opt.threads < 0) {
+		PrintHeadlessUsage();
+		return false;
+	}
+	if (opt.software && (!opt.trace_file.empty() || !opt.benchmark_file.empty())) {
+		cout << "--trace and --benchmark time GPU work, they need --backend gl" << endl;
+		return false;
+	}
+	if (opt.update_goldens && opt.golden_dir.empty()) {
+		cout << "--update-goldens needs --regression DIR" << endl;
+		return false;
+	}
+	return true;
+}
+
+// lines of a text file, skipping empty ones and # comments
+vector<string> ReadListFile(const string& path)
+{
+	vector<string> lines;
+	ifstream file(path);
+	string line;
+	while (getline(file, line))
+	{
+		while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+			line.pop_back();
+		if (!line.empty() && line[0] != '#')
+			lines.push_back(line);
+	}
+	return lines;
+}
+
+vector<CameraPose> LoadCameraPoses(const HeadlessOptions& opt)
+{
+	vector<CameraPose> poses;
+	if (!opt.pose_file.empty()) {
+		vector<string> lines = ReadListFile(opt.pose_file);
+		for (int i = 0; i < lines.size(); i++)
+		{
+			CameraPose pose;
+			if (sscanf(lines[i].c_str(), "%f %f %f %f %f %f", &pose.eye.x, &pose.eye.y, &pose.eye.z,
+				&pose.center.x, &pose.center.y, &pose.center.z) == 6)
+				poses.push_back(pose);
+		}
+		return poses;
+	}
+
+	// orbit at the default camera distance, slightly from above
+	const float radius = 2.0f, elevation = 20.0f / 180.0f * (float)PI;
+	for (int i = 0; i < opt.pose_count; i++)
+	{
+		float angle = 2.0f * (float)PI * i / opt.pose_count;
+		CameraPose pose;
+		pose.eye = Vector3(radius * cosf(elevation) * sinf(angle), radius * sinf(elevation), radius * cosf(elevation) * cosf(angle));
+		pose.center = Vector3(0, 0, 0);
+		poses.push_back(pose);
+	}
+	return poses;
+}
+
+string ModelName(const string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	string name = slash == string::npos ? path : path.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	return dot == string::npos ? name : name.substr(0, dot);
+}
 
-		if (!m_vertices.empty())
-		{
-			Shape tmp_shape;
-			glGenVertexArrays(1, &tmp_shape.vao);
-			glBindVertexArray(tmp_shape.vao);
-
-			glGenBuffers(1, &tmp_shape.vbo);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
-			glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(GL_FLOAT), &m_vertices.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-			tmp_shape.vertex_count = m_vertices.size() / 3;
-
-			glGenBuffers(1, &tmp_shape.p_color);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_color);
-			glBufferData(GL_ARRAY_BUFFER, m_colors.size() * sizeof(GL_FLOAT), &m_colors.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+// render the models of the scene in its own context, list_index numbers them in the output names,
+// returns the number of images written or -1
+// context, GL functions and models for rendering opt.width x opt.height images without a window
+bool StartHeadlessRenderer(const HeadlessOptions& opt, bool print_info)
+{
+	if (!CreateHeadlessContext(3, 3))
+		return false;
+	gl_get_proc_address = HeadlessGetProcAddress;
+	if (!gladLoadGLLoader((GLADloadproc)HeadlessGetProcAddress))
+	{
+		LOG_ERROR("Failed to initialize GLAD");
+		return false;
+	}
+	if (print_info)
+		glPrintContextInfo(false);
 
-			glGenBuffers(1, &tmp_shape.p_normal);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_normal);
-			glBufferData(GL_ARRAY_BUFFER, m_normals.size() * sizeof(GL_FLOAT), &m_normals.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	// the renderer thinks in side by side views, make one of them the image size
+	screenWidth = opt.width * 2;
+	screenHeight = opt.height;
+	glEnable(GL_DEPTH_TEST);
+	setupRC();
+	proj.aspect = (float)opt.width / (float)opt.height;
+	if (cur_proj_mode == Perspective)
+		setPerspective();
+	return true;
+}
 
-			glGenBuffers(1, &tmp_shape.p_texCoord);
-			glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_texCoord);
-			glBufferData(GL_ARRAY_BUFFER, m_textureCoords.size() * sizeof(GL_FLOAT), &m_textureCoords.at(0), GL_STATIC_DRAW);
-			glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
+// RGBA8 + depth target, renderbuffers receives the color and depth buffer, returns 0 on failure
+GLuint CreateHeadlessFramebuffer(int width, int height, GLuint renderbuffers[2])
+{
+	GLuint fbo;
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cout << "Headless: framebuffer incomplete" << endl;
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(2, renderbuffers);
+		return 0;
+	}
+	return fbo;
+}
 
-			glEnableVertexAttribArray(0);
-			glEnableVertexAttribArray(1);
-			glEnableVertexAttribArray(2);
-			glEnableVertexAttribArray(3);
+// the uniforms RenderScene would upload, for the software rasterizer
+SoftFrameState SoftwareFrameState(int per_vertex_or_per_pixel)
+{
+	SoftFrameState state;
+	state.view = view_matrix;
+	state.projection = project_matrix;
+	state.light_source = lightSource;
+	state.lighting_mode = per_vertex_or_per_pixel;
+	state.camera_position = main_camera.position;
+
+	SoftLight& directional = state.lights[DIRECTIONALLIGHT];
+	directional.position = directional_light.position;
+	directional.direction = directional_light.direction;
+	directional.ambient_intensity = directional_light.ambient_intensity;
+	directional.diffuse_intensity = directional_light.diffuse_intensity;
+	directional.specular_intensity = directional_light.specular_intensity;
+	directional.shininess = directional_light.shininess;
+
+	SoftLight& point = state.lights[POINTLIGHT];
+	point.position = point_light.position;
+	point.ambient_intensity = point_light.ambient_intensity;
+	point.diffuse_intensity = point_light.diffuse_intensity;
+	point.specular_intensity = point_light.specular_intensity;
+	point.shininess = point_light.shininess;
+	point.constant = point_light.constant;
+	point.linear = point_light.linear;
+	point.quadratic = point_light.quadratic;
+
+	SoftLight& spot = state.lights[SPOTLIGHT];
+	spot.position = spot_light.position;
+	spot.direction = spot_light.direction;
+	spot.ambient_intensity = spot_light.ambient_intensity;
+	spot.diffuse_intensity = spot_light.diffuse_intensity;
+	spot.specular_intensity = spot_light.specular_intensity;
+	spot.shininess = spot_light.shininess;
+	spot.constant = spot_light.constant;
+	spot.linear = spot_light.linear;
+	spot.quadratic = spot_light.quadratic;
+	spot.exponent = spot_light.exponent;
+	spot.cutoff = spot_light.cutoff;
+
+	state.mag_filter = mag_filtering_mode == 0 ? SoftNearest : SoftLinear;
+	state.min_filter = min_filtering_mode == 0 ? SoftNearest : SoftLinearMipmapLinear;
+	return state;
+}
 
-			tmp_shape.material = materials[m];
-			res.push_back(tmp_shape);
+// DrawModel for the software rasterizer
+void DrawModelSoftware(SoftRasterizer& raster, int idx)
+{
+	model& m = models[idx];
+	Matrix4 model_matrix = GetModelMatrix(idx);
+	for (int i = 0; i < m.shapes.size(); i++)
+	{
+		const Shape& shape = m.shapes[i];
+		const PhongMaterial& material = shape.material;
+		SoftDrawCall call;
+		call.model = model_matrix;
+		call.positions = &shape.cpu_positions[0];
+		call.colors = &shape.cpu_colors[0];
+		call.normals = &shape.cpu_normals[0];
+		call.texcoords = &shape.cpu_texcoords[0];
+		call.vertex_count = shape.vertex_count;
+		call.Ka = material.Ka;
+		call.Kd = material.Kd;
+		call.Ks = material.Ks;
+		if (material.isEye == 1) {
+			call.offset[0] = material.offsets[m.cur_eye_offset_idx].x;
+			call.offset[1] = material.offsets[m.cur_eye_offset_idx].y;
 		}
+		if (material.diffuseTexture < soft_textures.size())
+			call.texture = &soft_textures[material.diffuseTexture];
+		raster.draw(call);
+		frame_triangles += shape.vertex_count / 3;
+		frame_draw_calls++;
 	}
-
-	return res;
 }
 
-void LoadTexturedModels(string model_path)
+// StartHeadlessRenderer without GL, the models keep CPU copies of their arrays
+void StartSoftwareRenderer(const HeadlessOptions& opt)
 {
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	tinyobj::attrib_t attrib;
-	vector<GLfloat> vertices;
-	vector<GLfloat> colors;
-	vector<GLfloat> normals;
-	vector<GLfloat> textureCoords;
-	vector<int> material_id;
-
-	string err;
-	string warn;
-
-	string base_dir = GetBaseDir(model_path); // handle .mtl with relative path
+	screenWidth = opt.width * 2;
+	screenHeight = opt.height;
+	initParameter();
+	LoadSceneModels();
+	BuildSceneBVH();
+	LogFlush();
+	proj.aspect = (float)opt.width / (float)opt.height;
+	if (cur_proj_mode == Perspective)
+		setPerspective();
+}
 
-#ifdef _WIN32
-	base_dir += "\\";
-#else
-	base_dir += "/";
-#endif
+// workers of the rasterizer's pool, the calling thread is the last one
+int SoftwareWorkerCount(const HeadlessOptions& opt)
+{
+	return opt.threads > 0 ? opt.threads - 1 : (int)max(thread::hardware_concurrency(), 1u) - 1;
+}
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, model_path.c_str(), base_dir.c_str());
+// RenderHeadlessImage for the software rasterizer, the image is left in raster.colors()
+void RenderSoftwareImage(SoftRasterizer& raster, int per_vertex_or_per_pixel)
+{
+	CullScene();
+	raster.clear(0.2f, 0.2f, 0.2f, 1.0f);
+	raster.beginFrame(SoftwareFrameState(per_vertex_or_per_pixel));
+	for (int i = 0; i < visible_models.size(); i++)
+		DrawModelSoftware(raster, visible_models[i]);
+	raster.finish();
+}
 
-	if (!warn.empty()) {
-		cout << warn << std::endl;
+// RenderHeadlessBatch on the CPU: the same poses and file names, no GL context
+int RenderSoftwareBatch(const HeadlessOptions& opt, const vector<CameraPose>& poses, const vector<int>& list_index, int worker)
+{
+	StartSoftwareRenderer(opt);
+	ThreadPool pool(SoftwareWorkerCount(opt));
+	SoftRasterizer raster(pool);
+	raster.resize(opt.width, opt.height);
+
+	int written = 0;
+	long long triangles = 0, fragments = 0;
+	double vertex_ms = 0.0, setup_ms = 0.0, raster_ms = 0.0, render_seconds = 0.0;
+	auto start = chrono::steady_clock::now();
+	for (int m = 0; m < models.size(); m++)
+	{
+		cur_idx = m;
+		for (int p = 0; p < poses.size(); p++)
+		{
+			main_camera.position = poses[p].eye;
+			main_camera.center = poses[p].center;
+			main_camera.up_vector = Vector3(0, 1, 0);
+			setViewingMatrix();
+
+			auto frame_start = chrono::steady_clock::now();
+			RenderSoftwareImage(raster, opt.lighting);
+			render_seconds += chrono::duration<double>(chrono::steady_clock::now() - frame_start).count();
+
+			const SoftRasterStats& stats = raster.stats();
+			triangles += stats.triangles;
+			fragments += stats.fragments;
+			vertex_ms += stats.vertex_ms;
+			setup_ms += stats.setup_ms;
+			raster_ms += stats.raster_ms;
+
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%02d_%s_%03d.png", opt.output_dir.c_str(), list_index[m], ModelName(scene.models[m].path).c_str(), p);
+			if (WritePNG(path, opt.width, opt.height, 4, raster.colors(), true))
+				written++;
+		}
 	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("Headless worker %d: %d images in %.2f s (%.2f images/s)\n", worker, written, seconds, written / max(seconds, 1e-9));
+	int frames = max(written, 1);
+	printf("Software rasterizer (%d thread(s)): %.2f Mtriangles/s, %.1f Mfragments/s; per image %.2f ms vertex, %.2f ms setup, %.2f ms raster\n",
+		   raster.threadCount(), triangles / max(render_seconds, 1e-9) / 1e6, fragments / max(render_seconds, 1e-9) / 1e6,
+		   vertex_ms / frames, setup_ms / frames, raster_ms / frames);
+	return written;
+}
 
-	if (!err.empty()) {
-		cerr << err << std::endl;
+// draw the current camera into fbo and read it back, bottom row first
+void RenderHeadlessImage(const HeadlessOptions& opt, GLuint fbo, int per_vertex_or_per_pixel, unsigned char* pixels)
+{
+	{
+		PROFILE_SCOPE("Cull scene");
+		CullScene();
+	}
+	{
+		PROFILE_GPU_SCOPE("Light clusters");
+		UpdateLightClusters();
+	}
+	{
+		PROFILE_GPU_SCOPE("Shadow maps");
+		UpdateShadowMaps();
 	}
 
-	if (!ret) {
-		exit(1);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, opt.width, opt.height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	{
+		PROFILE_GPU_SCOPE("View");
+		RenderScene(per_vertex_or_per_pixel);
 	}
+	{
+		PROFILE_GPU_SCOPE("Read pixels");
+		glReadPixels(0, 0, opt.width, opt.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	uniform_ring.endFrame();
+}
 
-	printf("Load Models Success ! Shapes size %d Material size %d\n", shapes.size(), materials.size());
-	model tmp_model;
+int RenderHeadlessBatch(const HeadlessOptions& opt, const vector<CameraPose>& poses, const vector<int>& list_index, int worker)
+{
+	if (software_backend)
+		return RenderSoftwareBatch(opt, poses, list_index, worker);
+	if (!StartHeadlessRenderer(opt, worker == 0))
+		return -1;
+	GLuint renderbuffers[2];
+	GLuint fbo = CreateHeadlessFramebuffer(opt.width, opt.height, renderbuffers);
+	if (!fbo)
+		return -1;
 
-	vector<PhongMaterial> allMaterial;
-	for (int i = 0; i < materials.size(); i++)
+	vector<unsigned char> pixels(opt.width * opt.height * 4);
+	int written = 0;
+	Profiler& profiler = GetProfiler();
+	if (!opt.trace_file.empty()) {
+		profiler.setEnabled(true);
+		profiler.startTrace();
+	}
+	auto start = chrono::steady_clock::now();
+	for (int m = 0; m < models.size(); m++)
 	{
-		PhongMaterial material;
-		material.Ka = Vector3(materials[i].ambient[0], materials[i].ambient[1], materials[i].ambient[2]);
-		material.Kd = Vector3(materials[i].diffuse[0], materials[i].diffuse[1], materials[i].diffuse[2]);
-		material.Ks = Vector3(materials[i].specular[0], materials[i].specular[1], materials[i].specular[2]);
-
-		material.diffuseTexture = LoadTextureImage(base_dir + string(materials[i].diffuse_texname));
-		if (material.diffuseTexture == -1)
+		cur_idx = m;
+		for (int p = 0; p < poses.size(); p++)
 		{
-			cout << "LoadTexturedModels: Fail to load model's material " << i << endl;
-			system("pause");
-			
-		}
-
-		if (materials[i].diffuse_texname.find("Eye") != string::npos) {
-			material.isEye = 1;
-			material.offsets = {
-				Offset(0.0, 0.0), Offset(0.0, -0.25), Offset(0.0, -0.5), Offset(0.0, -0.75),
-				Offset(0.5, 0.0), Offset(0.5, -0.25), Offset(0.5, -0.5)
-			};
-		} else {
-			material.isEye = 0;
+			main_camera.position = poses[p].eye;
+			main_camera.center = poses[p].center;
+			main_camera.up_vector = Vector3(0, 1, 0);
+			setViewingMatrix();
+
+			profiler.beginFrame();
+			RenderHeadlessImage(opt, fbo, opt.lighting, &pixels[0]);
+			profiler.endFrame();
+
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%02d_%s_%03d.png", opt.output_dir.c_str(), list_index[m], ModelName(scene.models[m].path).c_str(), p);
+			if (WritePNG(path, opt.width, opt.height, 4, &pixels[0], true))
+				written++;
 		}
-		
-		allMaterial.push_back(material);
 	}
-	
-	for (int i = 0; i < shapes.size(); i++)
-	{
-		vertices.clear();
-		colors.clear();
-		normals.clear();
-		textureCoords.clear();
-		material_id.clear();
-
-		normalization(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
-		// printf("Vertices size: %d", vertices.size() / 3);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("Headless worker %d: %d images in %.2f s (%.2f images/s)\n", worker, written, seconds, written / max(seconds, 1e-9));
+	if (worker == 0)
+		uniform_ring.printStats();
+	if (profiler.enabled()) {
+		// every worker writes its own trace next to the requested one
+		string trace_path = opt.jobs > 1 ? opt.trace_file + "." + to_string(worker) : opt.trace_file;
+		profiler.printSummary();
+		if (!profiler.stopTrace(trace_path.c_str()))
+			cout << "Headless: cannot write " << trace_path << endl;
+		profiler.setEnabled(false);
+	}
 
-		// split current shape into multiple shapes base on material_id.
-		vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, allMaterial);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(2, renderbuffers);
+	DestroyHeadlessContext();
+	return written;
+}
 
-		// concatenate splited shape to model's shape list
-		tmp_model.shapes.insert(tmp_model.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
+// settings of a benchmark scenario, once setupRC loaded its models
+void ApplyBenchmarkScenario(const BenchmarkScenario& scenario)
+{
+	cur_idx = 0;
+	if (scenario.perspective)
+		setPerspective();
+	else
+		setOrthogonal();
+	lightSource = scenario.light_source;
+	mag_filtering_mode = scenario.mag_filter;
+	min_filtering_mode = scenario.min_filter;
+	shadows_enabled = scenario.shadows;
+	depth_prepass_enabled = scenario.prepass;
+	if (scenario.show_all) {
+		show_all_models = true;
+		LayoutSceneModels();
+		BuildSceneBVH();
 	}
-	shapes.clear();
-	materials.clear();
-	models.push_back(tmp_model);
+	if (scenario.light_field > 0)
+		GenerateLightField(scenario.light_field);
 }
 
-void initParameter()
+// warm up, then time every frame of the scenario, draw_frame renders (and presents) one frame;
+// the GPU time of a frame is read PROFILER_FRAME_LATENCY frames later, so frames stay pipelined
+vector<BenchmarkFrame> RunBenchmarkFrames(const BenchmarkScenario& scenario, const function<void()>& draw_frame, double& total_seconds)
 {
-	proj.left = -1;
-	proj.right = 1;
-	proj.top = 1;
-	proj.bottom = -1;
-	proj.nearClip = 0.001;
-	proj.farClip = 100.0;
-	proj.fovy = 80;
-	proj.aspect = (float)(WINDOW_WIDTH / 2) / (float)WINDOW_HEIGHT; // adjust width for side by side view
+	GLuint queries[PROFILER_FRAME_LATENCY];
+	int query_frame[PROFILER_FRAME_LATENCY];	// index into frames per query in flight, -1 for none or a warmup frame
+	bool query_pending[PROFILER_FRAME_LATENCY] = { false };
+	glGenQueries(PROFILER_FRAME_LATENCY, queries);
+	int stalls = 0;
+	vector<BenchmarkFrame> frames;
+	frames.reserve(max(scenario.frames, 0));
+	auto collect = [&](int slot) {
+		if (!query_pending[slot])
+			return;
+		GLint available = 0;
+		glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			stalls++;	// the GPU is more than PROFILER_FRAME_LATENCY frames behind, this read blocks
+		GLuint64 gpu_ns = 0;
+		glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &gpu_ns);
+		if (query_frame[slot] >= 0)
+			frames[query_frame[slot]].gpu_ms = gpu_ns / 1e6;
+		query_pending[slot] = false;
+	};
 
-	main_camera.position = Vector3(0.0f, 0.0f, 2.0f);
-	main_camera.center = Vector3(0.0f, 0.0f, 0.0f);
-	main_camera.up_vector = Vector3(0.0f, 1.0f, 0.0f);
+	auto start = chrono::steady_clock::now();
+	for (int f = -scenario.warmup; f < scenario.frames; f++)
+	{
+		// the camera follows the frame number, never the clock
+		float t = scenario.frames > 1 ? (float)max(f, 0) / (scenario.frames - 1) : 0.0f;
+		CameraPose pose = CameraSplinePose(scenario.camera, t);
+		main_camera.position = pose.eye;
+		main_camera.center = pose.center;
+		main_camera.up_vector = Vector3(0, 1, 0);
+		setViewingMatrix();
 
-	setViewingMatrix();
-	setPerspective();	//set default projection matrix as perspective matrix
+		if (f == 0)
+			start = chrono::steady_clock::now();
+		auto frame_start = chrono::steady_clock::now();
+		int slot = (f + scenario.warmup) % PROFILER_FRAME_LATENCY;
+		collect(slot);
+		frame_draw_calls = 0;
+		frame_triangles = 0;
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		CullScene();
+		UpdateLightClusters();
+		UpdateShadowMaps();
+		draw_frame();
+		uniform_ring.endFrame();
+		glEndQuery(GL_TIME_ELAPSED);
+		query_pending[slot] = true;
+		query_frame[slot] = f >= 0 ? (int)frames.size() : -1;
+
+		if (f >= 0) {
+			BenchmarkFrame frame;
+			frame.frame_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - frame_start).count();
+			frame.gpu_ms = 0.0;
+			frame.draw_calls = frame_draw_calls;
+			frame.triangles = frame_triangles;
+			frames.push_back(frame);
+		}
+	}
+	// the last frames' GPU times, the wait for them counts toward the total but not to any frame
+	for (int slot = 0; slot < PROFILER_FRAME_LATENCY; slot++)
+		collect(slot);
+	total_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	glDeleteQueries(PROFILER_FRAME_LATENCY, queries);
+	if (stalls > 0)
+		LOG_INFO("Benchmark: %d of %d GPU time reads waited for the GPU", stalls, scenario.warmup + scenario.frames);
+	uniform_ring.printStats();
+	return frames;
 }
 
-void setUniformVariables()
+int FinishBenchmark(const BenchmarkScenario& scenario, const string& results_file, int width, int height,
+					double total_seconds, const vector<BenchmarkFrame>& frames)
 {
-	uniform.iLocLightSource = glGetUniformLocation(program, "lightSource");
-	uniform.iLocLightingMode = glGetUniformLocation(program, "lightingMode");
+	string renderer = string((const char*)glGetString(GL_RENDERER)) + " / " + (const char*)glGetString(GL_VERSION);
+	printf("Benchmark %s: %d frames in %.2f s (%.1f fps)\n", scenario.name.c_str(), (int)frames.size(), total_seconds,
+		frames.size() / max(total_seconds, 1e-9));
+	if (!WriteBenchmarkResults(results_file, scenario, renderer, width, height, total_seconds, frames)) {
+		cout << "Benchmark: cannot write " << results_file << endl;
+		return 1;
+	}
+	cout << "Benchmark results written to " << results_file << endl;
+	return 0;
+}
 
-	uniform.iLocModelMatrix = glGetUniformLocation(program, "modelMatrix");
-	uniform.iLocViewMatrix = glGetUniformLocation(program, "viewMatrix");
-	uniform.iLocProjectionMatrix = glGetUniformLocation(program, "projectionMatrix");
+int RunHeadlessBenchmark(const HeadlessOptions& opt)
+{
+	BenchmarkScenario scenario;
+	if (!LoadBenchmarkScenario(opt.benchmark_file, scenario))
+		return 1;
+	if (!scenario.models.empty())
+		SetSceneModels(scene, scenario.models);
+	if (!StartHeadlessRenderer(opt, true))
+		return 1;
+	GLuint renderbuffers[2];
+	GLuint fbo = CreateHeadlessFramebuffer(opt.width, opt.height, renderbuffers);
+	if (!fbo)
+		return 1;
+	ApplyBenchmarkScenario(scenario);
+	if (!opt.capture_file.empty())
+		frame_capture.start(opt.capture_file, opt.width, opt.height);
+
+	double total_seconds = 0.0;
+	vector<BenchmarkFrame> frames = RunBenchmarkFrames(scenario, [&]() {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, opt.width, opt.height);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		RenderScene(scenario.per_pixel ? PERPIXELLIGHTING : PERVERTEXLIGHTING);
+		frame_capture.capture(fbo, 0, 0, opt.width, opt.height);
+	}, total_seconds);
+	frame_capture.stop();
+	LogFlush();
+	int result = FinishBenchmark(scenario, opt.results_file, opt.width, opt.height, total_seconds, frames);
+
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteRenderbuffers(2, renderbuffers);
+	DestroyHeadlessContext();
+	return result;
+}
 
-	uniform.iLocDirectionalPosition = glGetUniformLocation(program, "directionalLight_position");
-	uniform.iLocDirectionalDirection = glGetUniformLocation(program, "directionalLight_direction");
-	uniform.iLocDirectionalAmbientIntensity = glGetUniformLocation(program, "directionalLight_ambientIntensity");
-	uniform.iLocDirectionalDiffuseIntensity = glGetUniformLocation(program, "directionalLight_diffuseIntensity");
-	uniform.iLocDirectionalSpecularIntensity = glGetUniformLocation(program, "directionalLight_specularIntensity");
-	uniform.iLocDirectionalShininess = glGetUniformLocation(program, "directionalLight_shininess");
+#ifndef _WIN32
+// run work(0) .. work(jobs - 1) in forked processes, the result tells which of them returned true
+vector<bool> ForkWorkers(int jobs, const function<bool(int worker)>& work)
+{
+	vector<bool> ok(jobs, false);
+	vector<pid_t> children(jobs, -1);
+	LogFlush();
+	fflush(stdout);
+	for (int w = 0; w < jobs; w++)
+	{
+		pid_t pid = fork();
+		if (pid == 0) {
+			bool result = work(w);
+			LogFlush();
+			fflush(stdout);
+			_exit(result ? 0 : 1);
+		}
+		if (pid < 0) {
+			cout << "Headless: fork failed" << endl;
+			break;
+		}
+		children[w] = pid;
+	}
+	for (int w = 0; w < jobs; w++)
+	{
+		if (children[w] < 0)
+			continue;
+		int status = 0;
+		waitpid(children[w], &status, 0);
+		ok[w] = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	return ok;
+}
+#endif
 
-	uniform.iLocPointPosition = glGetUniformLocation(program, "pointLight_position");
-	uniform.iLocPointAmbientIntensity = glGetUniformLocation(program, "pointLight_ambientIntensity");
-	uniform.iLocPointDiffuseIntensity = glGetUniformLocation(program, "pointLight_diffuseIntensity");
-	uniform.iLocPointSpecularIntensity = glGetUniformLocation(program, "pointLight_specularIntensity");
-	uniform.iLocPointShininess = glGetUniformLocation(program, "pointLight_shininess");
-	uniform.iLocPointConstant = glGetUniformLocation(program, "pointLight_constant");
-	uniform.iLocPointLinear = glGetUniformLocation(program, "pointLight_linear");
-	uniform.iLocPointQuadratic = glGetUniformLocation(program, "pointLight_quadratic");
+void ApplyRegressionCase(const RegressionCase& c)
+{
+	if (c.perspective)
+		setPerspective();
+	else
+		setOrthogonal();
+	lightSource = c.light_source;
+	mag_filtering_mode = c.mag_filter;
+	min_filtering_mode = c.min_filter;
+}
 
-	uniform.iLocSpotPosition = glGetUniformLocation(program, "spotLight_position");
-	uniform.iLocSpotDirection = glGetUniformLocation(program, "spotLight_direction");
-	uniform.iLocSpotExponent = glGetUniformLocation(program, "spotLight_exponent");
-	uniform.iLocSpotCutoff = glGetUniformLocation(program, "spotLight_cutoff");
-	uniform.iLocSpotAmbientIntensity = glGetUniformLocation(program, "spotLight_ambientIntensity");
-	uniform.iLocSpotDiffuseIntensity = glGetUniformLocation(program, "spotLight_diffuseIntensity");
-	uniform.iLocSpotSpecularIntensity = glGetUniformLocation(program, "spotLight_specularIntensity");
-	uniform.iLocSpotShininess = glGetUniformLocation(program, "spotLight_shininess");
-	uniform.iLocSpotConstant = glGetUniformLocation(program, "spotLight_constant");
-	uniform.iLocSpotLinear = glGetUniformLocation(program, "spotLight_linear");
-	uniform.iLocSpotQuadratic = glGetUniformLocation(program, "spotLight_quadratic");
+string RegressionImageName(int list_index, const string& model_path, const RegressionCase& c, int pose)
+{
+	char name[512];
+	snprintf(name, sizeof(name), "%02d_%s_%s_%03d.png", list_index, ModelName(model_path).c_str(), RegressionCaseName(c).c_str(), pose);
+	return name;
+}
 
-	uniform.iLocKa = glGetUniformLocation(program, "Ka");
-	uniform.iLocKd = glGetUniformLocation(program, "Kd");
-	uniform.iLocKs = glGetUniformLocation(program, "Ks");
+// render the matrix entries in cases for every model and pose into dir, returns false if any image is missing
+bool RenderRegressionBatch(const HeadlessOptions& opt, const vector<CameraPose>& poses, const vector<int>& cases, const string& dir)
+{
+	GLuint fbo = 0, renderbuffers[2];
+	if (software_backend)
+		StartSoftwareRenderer(opt);
+	else if (!StartHeadlessRenderer(opt, false) || !(fbo = CreateHeadlessFramebuffer(opt.width, opt.height, renderbuffers)))
+		return false;
+	ThreadPool pool(software_backend ? SoftwareWorkerCount(opt) : 0);
+	SoftRasterizer raster(pool);
+	raster.resize(opt.width, opt.height);
+
+	vector<RegressionCase> matrix = RegressionMatrix();
+	vector<unsigned char> pixels(opt.width * opt.height * 4);
+	bool ok = true;
+	for (int i = 0; i < cases.size(); i++)
+	{
+		const RegressionCase& c = matrix[cases[i]];
+		ApplyRegressionCase(c);
+		int lighting = c.per_pixel ? PERPIXELLIGHTING : PERVERTEXLIGHTING;
+		for (int m = 0; m < models.size(); m++)
+		{
+			cur_idx = m;
+			for (int p = 0; p < poses.size(); p++)
+			{
+				main_camera.position = poses[p].eye;
+				main_camera.center = poses[p].center;
+				main_camera.up_vector = Vector3(0, 1, 0);
+				setViewingMatrix();
 
-	uniform.iLocCameraPosition = glGetUniformLocation(program, "camera_position");
+				const unsigned char* image = &pixels[0];
+				if (software_backend) {
+					RenderSoftwareImage(raster, lighting);
+					image = raster.colors();
+				}
+				else
+					RenderHeadlessImage(opt, fbo, lighting, &pixels[0]);
+				string path = dir + "/" + RegressionImageName(m, scene.models[m].path, c, p);
+				if (!WritePNG(path.c_str(), opt.width, opt.height, 4, image, true)) {
+					cout << "Regression: cannot write " << path << endl;
+					ok = false;
+				}
+			}
+		}
+	}
 
-	// [TODO] Get uniform location of texture
-	uniform.iLocTex = glGetUniformLocation(program, "tex");
-	glUniform1i(uniform.iLocTex, 0);
-	uniform.iLocOffset = glGetUniformLocation(program, "offset");
+	if (!software_backend) {
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(2, renderbuffers);
+		DestroyHeadlessContext();
+	}
+	return ok;
 }
 
-void setupRC()
+// --regression: render the whole matrix in parallel processes, then compare with the goldens on the thread pool
+int RunRegression(const HeadlessOptions& opt, const vector<CameraPose>& poses)
 {
-	// setup shaders
-	setShaders();
-	initParameter();
-	setUniformVariables();
+	vector<RegressionCase> matrix = RegressionMatrix();
+	string dir = opt.update_goldens ? opt.golden_dir : opt.output_dir;
+	vector<string> images;
+	for (int m = 0; m < scene.models.size(); m++)
+		for (int c = 0; c < matrix.size(); c++)
+			for (int p = 0; p < poses.size(); p++)
+				images.push_back(RegressionImageName(m, scene.models[m].path, matrix[c], p));
+
+	int jobs = opt.jobs > 0 ? opt.jobs : (int)max(thread::hardware_concurrency(), 1u);
+	jobs = min(jobs, (int)matrix.size());
+#ifdef _WIN32
+	if (jobs > 1)
+		cout << "Regression: --jobs needs fork(), rendering in this process" << endl;
+	jobs = 1;
+#endif
+	// the processes already fill the cores
+	HeadlessOptions worker_opt = opt;
+	if (software_backend && opt.threads == 0 && jobs > 1)
+		worker_opt.threads = 1;
+	printf("Regression (%s): %d models x %d settings x %d poses at %dx%d in %d process(es)\n",
+		   software_backend ? "software" : HeadlessBackendName(), (int)scene.models.size(), (int)matrix.size(), (int)poses.size(),
+		   opt.width, opt.height, jobs);
+
+	auto start = chrono::steady_clock::now();
+	bool rendered = true;
+	if (jobs <= 1) {
+		vector<int> cases;
+		for (int c = 0; c < matrix.size(); c++)
+			cases.push_back(c);
+		rendered = RenderRegressionBatch(worker_opt, poses, cases, dir);
+	}
+#ifndef _WIN32
+	else {
+		// every process takes every jobs-th setting, each needs all the models
+		vector<bool> ok = ForkWorkers(jobs, [&](int w) {
+			vector<int> cases;
+			for (int c = w; c < matrix.size(); c += jobs)
+				cases.push_back(c);
+			return RenderRegressionBatch(worker_opt, poses, cases, dir);
+		});
+		for (int w = 0; w < jobs; w++)
+			rendered = rendered && ok[w];
+	}
+#endif
+	double render_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (!rendered)
+		cout << "Regression: some images were not rendered" << endl;
+	if (opt.update_goldens) {
+		printf("Regression: %d golden images written to %s in %.2f s\n", (int)images.size(), dir.c_str(), render_seconds);
+		return rendered ? 0 : 1;
+	}
 
-	// OpenGL States and Values
-	glClearColor(0.2, 0.2, 0.2, 1.0);
+	start = chrono::steady_clock::now();
+	vector<RegressionResult> results = CompareWithGoldens(images, dir, opt.golden_dir, opt.psnr_threshold, GetThreadPool());
+	int failed = PrintRegressionReport(results, opt.psnr_threshold);
+	double compare_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("Regression: rendered in %.2f s, compared in %.2f s\n", render_seconds, compare_seconds);
+	return failed == 0 && rendered ? 0 : 1;
+}
+
+int RunHeadless(int argc, char** argv)
+{
+	HeadlessOptions opt;
+	if (!ParseHeadlessOptions(argc, argv, opt) || !LoadStartupScene(opt.scene_file))
+		return 1;
+	mesh_cache_dir = opt.mesh_cache_dir;
+	mesh_cache_lz = opt.mesh_lz;
+	if (!opt.benchmark_file.empty())
+		return RunHeadlessBenchmark(opt);
+	software_backend = opt.software;
+	if (!opt.model_file.empty())
+		SetSceneModels(scene, ReadListFile(opt.model_file));
+	vector<CameraPose> poses = LoadCameraPoses(opt);
+	if (scene.models.empty() || poses.empty()) {
+		cout << "Headless: nothing to render" << endl;
+		return 1;
+	}
+	if (!opt.golden_dir.empty())
+		return RunRegression(opt, poses);
 
-	for (string model_path : model_list){
-		LoadTexturedModels(model_path);
+	int jobs = min(max(opt.jobs, 1), (int)scene.models.size());
+#ifdef _WIN32
+	if (jobs > 1)
+		cout << "Headless: --jobs needs fork(), rendering in this process" << endl;
+	jobs = 1;
+#endif
+	printf("Headless (%s): %d models x %d poses at %dx%d in %d process(es)\n", software_backend ? "software" : HeadlessBackendName(),
+		(int)scene.models.size(), (int)poses.size(), opt.width, opt.height, jobs);
+
+	auto start = chrono::steady_clock::now();
+	int written = 0;
+	bool failed = false;
+	if (jobs <= 1) {
+		vector<int> list_index;
+		for (int m = 0; m < scene.models.size(); m++)
+			list_index.push_back(m);
+		written = RenderHeadlessBatch(opt, poses, list_index, 0);
+		failed = written < 0;
+	}
+#ifndef _WIN32
+	else {
+		// every process loads and renders its share of the models with its own context
+		vector<SceneModel> all_models = scene.models;
+		vector<bool> ok = ForkWorkers(jobs, [&](int w) {
+			vector<SceneModel> share;
+			vector<int> list_index;
+			for (int m = w; m < all_models.size(); m += jobs)
+			{
+				share.push_back(all_models[m]);
+				list_index.push_back(m);
+			}
+			scene.models = share;
+			return RenderHeadlessBatch(opt, poses, list_index, w) == (int)(share.size() * poses.size());
+		});
+		for (int w = 0; w < jobs; w++)
+		{
+			int share = ((int)all_models.size() - w + jobs - 1) / jobs;
+			if (ok[w])
+				written += share * (int)poses.size();
+			else
+				failed = true;
+		}
 	}
+#endif
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("Headless: %d images in %.2f s, %.2f images/s overall\n", max(written, 0), seconds, max(written, 0) / max(seconds, 1e-9));
+	return failed ? 1 : 0;
 }
 
-void glPrintContextInfo(bool printExtension)
+// interactive mode: owns the GL context, draws the newest snapshot the main thread published
+void RenderThreadMain(GLFWwindow* window)
 {
-	cout << "GL_VENDOR = " << (const char*)glGetString(GL_VENDOR) << endl;
-	cout << "GL_RENDERER = " << (const char*)glGetString(GL_RENDERER) << endl;
-	cout << "GL_VERSION = " << (const char*)glGetString(GL_VERSION) << endl;
-	cout << "GL_SHADING_LANGUAGE_VERSION = " << (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
-	if (printExtension)
+	glfwMakeContextCurrent(window);
+	Profiler& profiler = GetProfiler();
+	FramePacer& pacer = GetFramePacer();
+	while (!render_quit.load())
 	{
-		GLint numExt;
-		glGetIntegerv(GL_NUM_EXTENSIONS, &numExt);
-		cout << "GL_EXTENSIONS =" << endl;
-		for (GLint i = 0; i < numExt; i++)
+		// applied before the commands, so a pick sees the camera it was clicked with
+		bool changed = false;
+		if (frame_snapshots.update()) {
+			ApplySnapshot(frame_snapshots.readBuffer());
+			changed = true;
+		}
+		changed |= TakePendingScene();
+		changed |= RunRenderCommands();
+		// the profiler's rolling percentiles need a steady stream of frames
+		pacer.setAnimating(profiler.enabled());
+		pacer.update();
+		// a request made while the last frame was drawn may have been taken by it already
+		if (!pacer.beginFrame() && !changed) {
+			// nothing changed since the last frame, sleep until the main thread publishes something
+			pacer.waitForRedraw(ON_DEMAND_WAIT_SECONDS);
+			continue;
+		}
+
+		profiler.beginFrame();
 		{
-			cout << "\t" << (const char*)glGetStringi(GL_EXTENSIONS, i) << endl;
+			PROFILE_SCOPE("Frame");
+			{
+				PROFILE_SCOPE("Cull scene");
+				CullScene();
+			}
+			{
+				PROFILE_GPU_SCOPE("Light clusters");
+				UpdateLightClusters();
+			}
+			{
+				PROFILE_GPU_SCOPE("Shadow maps");
+				UpdateShadowMaps();
+			}
+
+			// render
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			// render left view
+			{
+				PROFILE_GPU_SCOPE("Left view");
+				glViewport(0, 0, screenWidth / 2, screenHeight);
+				RenderScene(PERVERTEXLIGHTING);
+			}
+			// render right view
+			{
+				PROFILE_GPU_SCOPE("Right view");
+				glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+				RenderScene(PERPIXELLIGHTING);
+			}
+
+			if (frame_capture.active()) {
+				PROFILE_SCOPE("Capture");
+				frame_capture.capture(0, 0, 0, screenWidth, screenHeight);
+			}
+			// swap buffer from back to front
+			{
+				PROFILE_SCOPE("Swap buffers");
+				glfwSwapBuffers(window);
+			}
+			uniform_ring.endFrame();
+		}
+		profiler.endFrame();
+		pacer.frameRendered();
+		static int profiled_frames = 0;
+		if (profiler.enabled() && ++profiled_frames % STATS_REPORT_INTERVAL == 0) {
+			profiler.printSummary();
+			uniform_ring.printStats();
+			uniform_ring.resetStats();
 		}
 	}
+	frame_capture.stop();
+	glfwMakeContextCurrent(NULL);
 }
 
-
 int main(int argc, char **argv)
 {
+	BenchmarkScenario scenario;
+	bool benchmark = false;
+	bool capture = false;
+	string results_file = "benchmark_results.json";
+	string startup_scene;
+	// global flags first, so they apply to every mode
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "--log-level") == 0) {
+			LogLevel level;
+			if (!ParseLogLevel(argv[++i], level)) {
+				cout << "--log-level takes debug, info, warn or error" << endl;
+				return 1;
+			}
+			SetLogLevel(level);
+		}
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			return RunHeadless(argc, argv);
+		if (strcmp(argv[i], "--math-benchmark") == 0)
+			return RunMathBenchmark(argc, argv);
+		if (strcmp(argv[i], "--thread-pool-test") == 0)
+			return RunThreadPoolTest(argc, argv);
+		if (strcmp(argv[i], "--compile-scene") == 0 && i + 2 < argc) {
+			// loads are only timed on request, compiling stays a single parse
+			int timing_runs = 0;
+			for (int j = i + 3; j + 1 < argc; j++)
+				if (strcmp(argv[j], "--time-loads") == 0)
+					timing_runs = atoi(argv[++j]);
+			bool ok = CompileScene(argv[i + 1], argv[i + 2], timing_runs);
+			LogFlush();
+			return ok ? 0 : 1;
+		}
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--on-demand")
+			GetFramePacer().setMode(OnDemandRendering);
+		else if (arg == "--log-level" && has_value)
+			i++;	// already applied
+		else if (arg == "--benchmark" && has_value) {
+			if (!LoadBenchmarkScenario(argv[++i], scenario))
+				return 1;
+			benchmark = true;
+		}
+		else if (arg == "--results" && has_value)
+			results_file = argv[++i];
+		else if (arg == "--capture" && has_value) {
+			capture_file = argv[++i];
+			capture = true;
+		}
+		else if (arg == "--scene" && has_value)
+			startup_scene = argv[++i];
+		else if (arg == "--mesh-cache" && has_value)
+			mesh_cache_dir = argv[++i];
+		else if (arg == "--mesh-lz" && has_value && (string(argv[i + 1]) == "on" || string(argv[i + 1]) == "off"))
+			mesh_cache_lz = string(argv[++i]) == "on";
+		else {
+			cout << "Unknown option " << arg << endl;
+			PrintUsage();
+			PrintHeadlessUsage();
+			return 1;
+		}
+	}
+	if (!LoadStartupScene(startup_scene))
+		return 1;
+	if (benchmark && !scenario.models.empty())
+		SetSceneModels(scene, scenario.models);
+	if (scene.models.empty()) {
+		LOG_ERROR("No models, %s or --scene FILE has to list some", scene_file);
+		LogFlush();
+		return 1;
+	}
 
     // initial glfw
     glfwInit();
@@ -1244,7 +3779,7 @@ int main(int argc, char **argv)
 	GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "109062134_HW3", NULL, NULL);
     if (window == NULL)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
+        LOG_ERROR("Failed to create GLFW window");
         glfwTerminate();
         return -1;
     }
@@ -1252,14 +3787,24 @@ int main(int argc, char **argv)
     
     
     // load OpenGL function pointer
+    gl_get_proc_address = (void* (*)(const char*))glfwGetProcAddress;
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
+        LOG_ERROR("Failed to initialize GLAD");
         return -1;
     }
 
 	glPrintContextInfo(false);
     
+	glEnable(GL_DEPTH_TEST);
+	// Setup render context
+	setupRC();
+	// the callbacks edit input, starting from the state setupRC left
+	CaptureSnapshot(input);
+	PublishInput();
+	input_scene = scene;
+	input_scene_time = FileModificationTime(scene_file);
+
 	// register glfw callback functions
     glfwSetKeyCallback(window, KeyCallback);
 	glfwSetScrollCallback(window, scroll_callback);
@@ -1267,29 +3812,59 @@ int main(int argc, char **argv)
 	glfwSetCursorPosCallback(window, cursor_pos_callback);
 
     glfwSetFramebufferSizeCallback(window, ChangeSize);
-	glEnable(GL_DEPTH_TEST);
-	// Setup render context
-	setupRC();
+	glfwSetWindowRefreshCallback(window, WindowRefresh);
+
+	if (benchmark) {
+		// vsync would clamp every frame to the refresh rate
+		glfwSwapInterval(0);
+		ApplyBenchmarkScenario(scenario);
+		if (capture)
+			frame_capture.start(capture_file, screenWidth, screenHeight);
+		double total_seconds = 0.0;
+		vector<BenchmarkFrame> frames = RunBenchmarkFrames(scenario, [&]() {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			glViewport(0, 0, screenWidth / 2, screenHeight);
+			RenderScene(PERVERTEXLIGHTING);
+			glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
+			RenderScene(PERPIXELLIGHTING);
+			frame_capture.capture(0, 0, 0, screenWidth, screenHeight);
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}, total_seconds);
+		frame_capture.stop();
+		int result = FinishBenchmark(scenario, results_file, screenWidth, screenHeight, total_seconds, frames);
+		glfwTerminate();
+		return result;
+	}
 
-	// main loop
-    while (!glfwWindowShouldClose(window))
-    {
-        // render
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		// render left view
-		glViewport(0, 0, screenWidth / 2, screenHeight);
-        RenderScene(PERVERTEXLIGHTING);
-		// render right view
-		glViewport(screenWidth / 2, 0, screenWidth / 2, screenHeight);
-		RenderScene(PERPIXELLIGHTING);
-        
-        // swap buffer from back to front
-        glfwSwapBuffers(window);
-        
-        // Poll input event
-        glfwPollEvents();
-    }
-	
-	// just for compatibiliy purposes
+	if (capture)
+		PushRenderCommand(RenderCommand::CaptureToggle);
+	// the render thread takes the context over, this thread only handles events from here on
+	glfwMakeContextCurrent(NULL);
+	thread render_thread(RenderThreadMain, window);
+	while (!glfwWindowShouldClose(window))
+	{
+		glfwWaitEventsTimeout(ON_DEMAND_WAIT_SECONDS);
+		int hit = picked_model.exchange(-1);
+		// a pick made before a reload reached the render thread indexes the old models
+		if (hit >= 0 && hit < input.models.size()) {
+			input.cur_idx = hit;
+			input_changed = true;
+			LOG_INFO("Picked model %d (%s)", hit, input_scene.models[hit].path);
+		}
+		// saving the scene file reloads it
+		time_t scene_time = FileModificationTime(scene_file);
+		if (scene_time != input_scene_time) {
+			input_scene_time = scene_time;
+			ReloadScene();
+		}
+		if (input_changed)
+			PublishInput();
+	}
+	render_quit.store(true);
+	GetFramePacer().requestRedraw();
+	render_thread.join();
+	LogFlush();
+	glfwTerminate();
 	return 0;
 }
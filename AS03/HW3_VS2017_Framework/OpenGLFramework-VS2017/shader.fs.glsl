@@ -6,6 +6,7 @@ out vec4 FragColor;
 in vec3 vertex_pos;
 in vec3 vertex_color;
 in vec3 vertex_normal;
+in vec3 world_pos;
 
 #define PI 3.14159265358979323846
 /* light source */ 
@@ -18,7 +19,6 @@ uniform int lightingMode;
 #define PERVERTEXLIGHTING 0
 #define PERPIXELLIGHTING 1
 /* matrix */
-uniform mat4 modelMatrix;
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
 /* directional light */ 
@@ -49,12 +49,36 @@ uniform float spotLight_shininess;
 uniform float spotLight_constant;
 uniform float spotLight_linear;
 uniform float spotLight_quadratic;
-/* material */
-uniform vec3 Ka;
-uniform vec3 Kd;
-uniform vec3 Ks;
+/* per-draw model matrix and material, written by the uniform ring (UniformRing.h) */
+layout (std140) uniform DrawBlock
+{
+	mat4 modelMatrix;
+	vec3 Ka;
+	vec3 Kd;
+	vec3 Ks;
+	vec2 offset;	// eye texture coordinate offset
+};
 /* camera */
 uniform vec3 camera_position;
+/* clustered lights, see LightClusters.h */
+uniform int clusteredLighting;
+uniform samplerBuffer clusterLights;	// CLUSTER_LIGHT_TEXELS texels per light, view space
+uniform usamplerBuffer clusterGrid;		// light index offset and count per cluster
+uniform usamplerBuffer clusterIndices;
+uniform vec4 clusterViewport;			// x, y, width, height in pixels
+uniform ivec3 clusterDims;				// tiles x, tiles y, depth slices
+uniform vec2 clusterDepthParams;		// slice scale and bias
+uniform int clusterLogDepth;
+#define CLUSTER_LIGHT_TEXELS 5
+/* shadows, see ShadowMaps.h */
+uniform int shadowsEnabled;
+uniform sampler2DArrayShadow directionalShadowMap;	// one layer per cascade
+uniform mat4 cascadeMatrices[3];
+uniform vec3 cascadeSplits;						// far view depth of every cascade
+uniform sampler2DShadow spotShadowMap;
+uniform mat4 spotShadowMatrix;
+#define SHADOW_CASCADE_COUNT 3
+#define SHADOW_BIAS 0.0005
 
 vec3 PositionSpaceTransform(vec3 v, mat4 trans) {
 	return (trans * vec4(v, 1.0)).xyz;
@@ -115,6 +139,51 @@ float SpotlightEffect() {
 	return value;
 }
 
+// 3x3 PCF, every tap is a bilinear depth comparison
+float DirectionalShadow() {
+	if (shadowsEnabled == 0)
+		return 1.0;
+
+	float depth = -vertex_pos.z;
+	int cascade = 0;
+	while (cascade < SHADOW_CASCADE_COUNT && depth > cascadeSplits[cascade])
+		cascade++;
+	if (cascade == SHADOW_CASCADE_COUNT)
+		return 1.0;
+
+	vec4 coord = cascadeMatrices[cascade] * vec4(world_pos, 1.0);
+	coord.xyz = coord.xyz / coord.w * 0.5 + 0.5;
+	vec2 texel = 1.0 / vec2(textureSize(directionalShadowMap, 0).xy);
+	float lit = 0.0;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(directionalShadowMap, vec4(coord.xy + vec2(x, y) * texel, cascade, coord.z - SHADOW_BIAS));
+		}
+	}
+	return lit / 9.0;
+}
+
+float SpotShadow() {
+	if (shadowsEnabled == 0)
+		return 1.0;
+
+	vec4 coord = spotShadowMatrix * vec4(world_pos, 1.0);
+	if (coord.w <= 0.0)
+		return 1.0;
+	coord.xyz = coord.xyz / coord.w * 0.5 + 0.5;
+	if (any(lessThan(coord.xyz, vec3(0.0))) || any(greaterThan(coord.xyz, vec3(1.0))))
+		return 1.0;
+
+	vec2 texel = 1.0 / vec2(textureSize(spotShadowMap, 0));
+	float lit = 0.0;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(spotShadowMap, vec3(coord.xy + vec2(x, y) * texel, coord.z - SHADOW_BIAS));
+		}
+	}
+	return lit / 9.0;
+}
+
 vec3 Ambient(vec3 Ia) {
 	return Ia * Ka;
 }
@@ -135,7 +204,7 @@ vec3 DirectionalLight() {
 	vec3 Is = directionalLight_specularIntensity;
 	float shininess = directionalLight_shininess;
 
-	return Attenuation() * SpotlightEffect() * (Ambient(Ia) + Diffuse(N, L, Id) + Specular(R, V, shininess, Is));
+	return Attenuation() * SpotlightEffect() * (Ambient(Ia) + DirectionalShadow() * (Diffuse(N, L, Id) + Specular(R, V, shininess, Is)));
 } 
 
 vec3 PointLight() {
@@ -161,13 +230,52 @@ vec3 SpotLight() {
 	vec3 Is = spotLight_specularIntensity;
 	float shininess = spotLight_shininess;
 
-	return Attenuation() * SpotlightEffect() * (Ambient(Ia) + Diffuse(N, L, Id) + Specular(R, V, shininess, Is));
+	return Attenuation() * SpotlightEffect() * (Ambient(Ia) + SpotShadow() * (Diffuse(N, L, Id) + Specular(R, V, shininess, Is)));
+}
+
+// point and spot lights of the cluster this fragment falls in, diffuse and specular only
+vec3 ClusteredLights() {
+	vec3 N = normalize(vertex_normal);
+	vec3 V = normalize(PositionSpaceTransform(camera_position, viewMatrix) - vertex_pos);
+
+	ivec2 tile = ivec2((gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw * vec2(clusterDims.xy));
+	tile = clamp(tile, ivec2(0), clusterDims.xy - 1);
+	float depth = -vertex_pos.z;
+	float slice_value = (clusterLogDepth == 1 ? log(max(depth, 1e-6)) : depth) * clusterDepthParams.x + clusterDepthParams.y;
+	int slice = clamp(int(slice_value), 0, clusterDims.z - 1);
+	int cluster = (slice * clusterDims.y + tile.y) * clusterDims.x + tile.x;
+	uvec2 range = texelFetch(clusterGrid, cluster).xy;
+
+	vec3 color = vec3(0.0);
+	for (uint i = 0u; i < range.y; i++) {
+		int light = int(texelFetch(clusterIndices, int(range.x + i)).r) * CLUSTER_LIGHT_TEXELS;
+		vec4 position_range = texelFetch(clusterLights, light + 0);
+		vec4 direction_cutoff = texelFetch(clusterLights, light + 1);	// cos cutoff is -2 for point lights
+		vec4 attenuation = texelFetch(clusterLights, light + 2);		// constant, linear, quadratic, spot exponent
+		vec4 diffuse_shininess = texelFetch(clusterLights, light + 3);
+		vec3 specular = texelFetch(clusterLights, light + 4).rgb;
+
+		vec3 to_light = position_range.xyz - vertex_pos;
+		float dL = length(to_light);
+		if (dL > position_range.w)
+			continue;
+		vec3 L = to_light / dL;
+		float value = min(1.0 / (attenuation.x + attenuation.y * dL + attenuation.z * dL * dL), 1.0);
+		if (direction_cutoff.w > -1.5) {
+			float cos_angle = dot(-L, direction_cutoff.xyz);
+			if (cos_angle < direction_cutoff.w)
+				continue;
+			value *= pow(max(cos_angle, 0.0), attenuation.w);
+		}
+		vec3 R = reflect(-L, N);
+		color += value * (Diffuse(N, L, diffuse_shininess.rgb) + Specular(R, V, diffuse_shininess.w, specular));
+	}
+	return color;
 }
 
 // [TODO] passing texture from main.cpp
 // Hint: sampler2D
 uniform sampler2D tex;
-uniform vec2 offset;
 
 void main() {
 
@@ -189,6 +297,9 @@ void main() {
 				FragColor = vec4(0.0, 0.0, 0.0, 1.0);
 				break;
 		}
+		if (clusteredLighting == 1) {
+			FragColor.rgb += ClusteredLights();
+		}
 	}
 	// [TODO] sampleing from texture
 	// Hint: texture
@@ -9,6 +9,10 @@ out vec2 texCoord;
 out vec3 vertex_pos;
 out vec3 vertex_color;
 out vec3 vertex_normal;
+out vec3 world_pos;		// for the shadow map lookups
+
+// same transform as depth.vs.glsl, so the depth pre-pass can be tested with GL_EQUAL
+invariant gl_Position;
 
 #define PI 3.14159265358979323846
 /* light source */ 
@@ -21,7 +25,6 @@ uniform int lightingMode;
 #define PERVERTEXLIGHTING 0
 #define PERPIXELLIGHTING 1
 /* matrix */
-uniform mat4 modelMatrix;
 uniform mat4 viewMatrix;
 uniform mat4 projectionMatrix;
 /* directional light */ 
@@ -52,10 +55,15 @@ uniform float spotLight_shininess;
 uniform float spotLight_constant;
 uniform float spotLight_linear;
 uniform float spotLight_quadratic;
-/* material */
-uniform vec3 Ka;
-uniform vec3 Kd;
-uniform vec3 Ks;
+/* per-draw model matrix and material, written by the uniform ring (UniformRing.h) */
+layout (std140) uniform DrawBlock
+{
+	mat4 modelMatrix;
+	vec3 Ka;
+	vec3 Kd;
+	vec3 Ks;
+	vec2 offset;	// eye texture coordinate offset
+};
 /* camera */
 uniform vec3 camera_position;
 
@@ -175,6 +183,7 @@ void main()
 
 	vertex_normal = DirectionSpaceTransform(aNormal, viewMatrix * modelMatrix);
 	vertex_pos = PositionSpaceTransform(aPos, viewMatrix * modelMatrix);
+	world_pos = PositionSpaceTransform(aPos, modelMatrix);
 
 	if (lightingMode == PERVERTEXLIGHTING) {
 		switch (lightSource) {